@@ -1,26 +1,34 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstddef>
 #include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <string_view>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 /**
  * @class ArenaAllocator
  * @brief A simple arena allocator for memory allocation.
  *
- * This class provides a basic arena allocator that allocates a fixed amount of memory upfront
+ * This class provides a basic arena allocator that allocates a block of memory upfront
  * and then doles out memory blocks as requested. It is useful in scenarios where many small
  * allocations and deallocations are needed, as it avoids the overhead of frequent allocations
- * from the heap.
+ * from the heap. When a block is full another one is chained on, so large inputs do not run out.
+ * Everything allocated after a mark can be released at once by rewinding to it.
  */
 class ArenaAllocator final
 {
 public:
     /**
-     * @brief Constructs the arena allocator with a specified size.
+     * @brief Constructs the arena allocator with a specified block size.
      *
-     * @param max_num_bytes The size of the memory buffer to allocate.
+     * @param max_num_bytes The size of each memory block to allocate.
      */
     explicit ArenaAllocator(const std::size_t max_num_bytes)
         : m_size{max_num_bytes}, m_buffer{new std::byte[max_num_bytes]}, m_offset{m_buffer}
@@ -52,7 +60,7 @@ public:
      * @param other The allocator to move from.
      */
     ArenaAllocator(ArenaAllocator &&other) noexcept
-        : m_size{std::exchange(other.m_size, 0)}, m_buffer{std::exchange(other.m_buffer, nullptr)}, m_offset{std::exchange(other.m_offset, nullptr)}
+        : m_size{std::exchange(other.m_size, 0)}, m_buffer{std::exchange(other.m_buffer, nullptr)}, m_offset{std::exchange(other.m_offset, nullptr)}, m_full_blocks{std::move(other.m_full_blocks)}, m_full_bytes{std::exchange(other.m_full_bytes, 0)}
     {
         // Exchange the resources from the source allocator to this allocator.
     }
@@ -72,6 +80,8 @@ public:
         std::swap(m_size, other.m_size);
         std::swap(m_buffer, other.m_buffer);
         std::swap(m_offset, other.m_offset);
+        std::swap(m_full_blocks, other.m_full_blocks);
+        std::swap(m_full_bytes, other.m_full_bytes);
         return *this;
     }
 
@@ -83,27 +93,26 @@ public:
      *
      * @tparam T The type of the object to allocate memory for.
      * @return A pointer to the allocated memory for the object of type T.
-     * @throws std::bad_alloc if there is not enough memory left in the buffer.
+     * @throws std::bad_alloc if a new block cannot be allocated.
      */
     template <typename T>
     [[nodiscard]] T *alloc()
     {
-        // Calculate the remaining number of bytes in the buffer.
-        std::size_t remaining_num_bytes = m_size - static_cast<std::size_t>(m_offset - m_buffer);
-
-        // Attempt to align the memory for the type T.
-        auto pointer = static_cast<void *>(m_offset);
-        const auto aligned_address = std::align(alignof(T), sizeof(T), pointer, remaining_num_bytes);
-
-        // If alignment fails, throw an exception.
-        if (aligned_address == nullptr)
-        {
-            throw std::bad_alloc{};
-        }
+        return static_cast<T *>(alloc_bytes(sizeof(T), alignof(T)));
+    }
 
-        // Move the offset forward by the size of T.
-        m_offset = static_cast<std::byte *>(aligned_address) + sizeof(T);
-        return static_cast<T *>(aligned_address);
+    /**
+     * @brief Allocates memory for a contiguous array of objects of type T.
+     *
+     * @tparam T The type of the array elements.
+     * @param count The number of elements.
+     * @return A pointer to the first element of the allocated array.
+     * @throws std::bad_alloc if a new block cannot be allocated.
+     */
+    template <typename T>
+    [[nodiscard]] T *alloc_array(const std::size_t count)
+    {
+        return static_cast<T *>(alloc_bytes(sizeof(T) * count, alignof(T)));
     }
 
     /**
@@ -116,11 +125,13 @@ public:
      * @tparam Args The types of the arguments to pass to the constructor of T.
      * @param args The arguments to pass to the constructor of T.
      * @return A pointer to the constructed object of type T.
-     * @throws std::bad_alloc if there is not enough memory left in the buffer.
+     * @throws std::bad_alloc if a new block cannot be allocated.
      */
     template <typename T, typename... Args>
     [[nodiscard]] T *emplace(Args &&...args)
     {
+        static_assert(std::is_trivially_destructible_v<T>, "Objects in the arena are released without being destroyed");
+
         // Allocate memory for the object.
         const auto allocated_memory = alloc<T>();
 
@@ -128,20 +139,305 @@ public:
         return new (allocated_memory) T{std::forward<Args>(args)...};
     }
 
+    /**
+     * @brief Copies a string into the arena.
+     *
+     * @param str The string to copy.
+     * @return A view of the copy.
+     * @throws std::bad_alloc if a new block cannot be allocated.
+     */
+    [[nodiscard]] std::string_view alloc_string(const std::string_view str)
+    {
+        char *const data = alloc_array<char>(str.size());
+        std::memcpy(data, str.data(), str.size());
+        return {data, str.size()};
+    }
+
+    /// @brief Position in the arena to rewind to.
+    struct Mark
+    {
+        std::size_t full_block_count; // Number of full blocks.
+        std::byte *buffer;            // The current memory block.
+        std::size_t size;             // The size of the current memory block.
+        std::byte *offset;            // The current offset within the buffer.
+    };
+
+    /// @brief Marks the current position, to release everything allocated after it later.
+    /// @return The mark.
+    [[nodiscard]] Mark mark() const
+    {
+        return {.full_block_count = m_full_blocks.size(), .buffer = m_buffer, .size = m_size, .offset = m_offset};
+    }
+
+    /**
+     * @brief Releases everything allocated after a mark, freeing the blocks chained on since.
+     *
+     * @param mark A mark of this arena that no later rewind went past.
+     */
+    void rewind(const Mark &mark)
+    {
+        if (m_buffer != mark.buffer)
+        {
+            delete[] m_buffer;
+            for (std::size_t i = mark.full_block_count + 1; i < m_full_blocks.size(); i++)
+            {
+                delete[] m_full_blocks[i].data;
+            }
+            m_full_blocks.resize(mark.full_block_count);
+            m_full_bytes = 0;
+            for (const Block &block : m_full_blocks)
+            {
+                m_full_bytes += block.size;
+            }
+            m_buffer = mark.buffer;
+            m_size = mark.size;
+        }
+        m_offset = mark.offset;
+    }
+
+    /// @brief Number of bytes taken from the heap by the blocks in use, up to the current offset.
+    std::size_t used_bytes() const
+    {
+        return m_full_bytes + static_cast<std::size_t>(m_offset - m_buffer);
+    }
+
     /**
      * @brief Destructor for the ArenaAllocator.
      *
-     * The destructor releases the allocated memory buffer. Note that no destructors are called
+     * The destructor releases the allocated memory blocks. Note that no destructors are called
      * for objects allocated in the buffer, which may lead to memory leaks if objects with non-trivial
      * destructors (e.g., std::vector) are used. This is a trade-off for performance and simplicity.
      */
     ~ArenaAllocator()
     {
-        delete[] m_buffer; // Release the allocated memory buffer.
+        delete[] m_buffer; // Release the current memory block.
+        for (const Block &block : m_full_blocks)
+        {
+            delete[] block.data; // Release the blocks filled before it.
+        }
     }
 
 private:
-    std::size_t m_size;  // The size of the memory buffer.
-    std::byte *m_buffer; // The allocated memory buffer.
-    std::byte *m_offset; // The current offset within the buffer, indicating the next free memory location.
+    /**
+     * @brief Allocates aligned memory, chaining on a new block if the current one is full.
+     *
+     * @param num_bytes The number of bytes to allocate.
+     * @param alignment The alignment of the allocation.
+     * @return A pointer to the allocated memory.
+     */
+    void *alloc_bytes(const std::size_t num_bytes, const std::size_t alignment)
+    {
+        // Calculate the remaining number of bytes in the buffer.
+        std::size_t remaining_num_bytes = m_size - static_cast<std::size_t>(m_offset - m_buffer);
+
+        // Attempt to align the memory in the current block.
+        auto pointer = static_cast<void *>(m_offset);
+        auto aligned_address = std::align(alignment, num_bytes, pointer, remaining_num_bytes);
+
+        // If the current block is full, start a new one big enough for the allocation.
+        if (aligned_address == nullptr)
+        {
+            m_full_blocks.push_back({.data = m_buffer, .size = m_size});
+            m_full_bytes += m_size;
+            m_size = std::max(m_size, num_bytes + alignment);
+            m_buffer = new std::byte[m_size];
+            m_offset = m_buffer;
+
+            remaining_num_bytes = m_size;
+            pointer = static_cast<void *>(m_offset);
+            aligned_address = std::align(alignment, num_bytes, pointer, remaining_num_bytes);
+        }
+
+        // Move the offset forward by the size of the allocation.
+        m_offset = static_cast<std::byte *>(aligned_address) + num_bytes;
+        return aligned_address;
+    }
+
+    /// @brief A memory block filled before the current one.
+    struct Block
+    {
+        std::byte *data;  // The memory block.
+        std::size_t size; // The size of the memory block.
+    };
+
+    std::size_t m_size;                // The size of the current memory block.
+    std::byte *m_buffer;               // The current memory block.
+    std::byte *m_offset;               // The current offset within the buffer, indicating the next free memory location.
+    std::vector<Block> m_full_blocks;  // Memory blocks filled before the current one.
+    std::size_t m_full_bytes = 0;      // Total size of the full blocks.
+};
+
+/**
+ * @class PoolAllocator
+ * @brief An arena allocator whose objects can also be freed one at a time, for parse trees edited in place.
+ *
+ * Freed memory is kept on an intrusive free list per size class and handed out again by the next allocation of that
+ * class. Small sizes get a class every 8 bytes, so nodes of the same type share one; larger sizes get a class per
+ * power of two. When a class has nothing free, memory is bumped off the arena, so allocation stays about as fast as
+ * with the plain arena. Memory is only returned to the heap when the pool is rewound or destroyed.
+ */
+class PoolAllocator final
+{
+public:
+    using Mark = ArenaAllocator::Mark;
+
+    /**
+     * @brief Constructs the pool allocator with a specified block size.
+     *
+     * @param max_num_bytes The size of each memory block of the arena.
+     */
+    explicit PoolAllocator(const std::size_t max_num_bytes)
+        : m_arena(max_num_bytes)
+    {
+    }
+
+    /**
+     * @brief Constructs an object of type T in place, reusing freed memory of its size class if there is any.
+     *
+     * @tparam T The type of the object to construct.
+     * @tparam Args The types of the arguments to pass to the constructor of T.
+     * @param args The arguments to pass to the constructor of T.
+     * @return A pointer to the constructed object of type T.
+     * @throws std::bad_alloc if a new block cannot be allocated.
+     */
+    template <typename T, typename... Args>
+    [[nodiscard]] T *emplace(Args &&...args)
+    {
+        static_assert(std::is_trivially_destructible_v<T>, "Objects in the pool are freed without being destroyed");
+        static_assert(alignof(T) <= alignof(FreeSlot), "Freed memory is only aligned for pointers");
+        return new (alloc_bytes(sizeof(T))) T{std::forward<Args>(args)...};
+    }
+
+    /**
+     * @brief Allocates memory for a contiguous array of objects of type T.
+     *
+     * @tparam T The type of the array elements.
+     * @param count The number of elements.
+     * @return A pointer to the first element of the allocated array.
+     * @throws std::bad_alloc if a new block cannot be allocated.
+     */
+    template <typename T>
+    [[nodiscard]] T *alloc_array(const std::size_t count)
+    {
+        static_assert(alignof(T) <= alignof(FreeSlot), "Freed memory is only aligned for pointers");
+        return static_cast<T *>(alloc_bytes(sizeof(T) * count));
+    }
+
+    /**
+     * @brief Copies a string into the arena. Strings are interned by their users and never freed.
+     *
+     * @param str The string to copy.
+     * @return A view of the copy.
+     */
+    [[nodiscard]] std::string_view alloc_string(const std::string_view str)
+    {
+        return m_arena.alloc_string(str);
+    }
+
+    /// @brief Frees an object allocated by `emplace`, which must no longer be used.
+    template <typename T>
+    void free(T *object)
+    {
+        free_bytes(object, sizeof(T));
+    }
+
+    /// @brief Frees an array allocated by `alloc_array` with the same count, which must no longer be used.
+    template <typename T>
+    void free_array(T *array, const std::size_t count)
+    {
+        free_bytes(array, sizeof(T) * count);
+    }
+
+    /// @brief Marks the current position, to release everything allocated after it later.
+    [[nodiscard]] Mark mark() const
+    {
+        return m_arena.mark();
+    }
+
+    /**
+     * @brief Releases everything allocated after a mark. Freed memory may lie past the mark, so it is forgotten.
+     *
+     * @param mark A mark of this pool that no later rewind went past.
+     */
+    void rewind(const Mark &mark)
+    {
+        m_free.fill(nullptr);
+        m_arena.rewind(mark);
+    }
+
+    /// @brief Number of bytes taken from the heap by the blocks in use, including freed memory.
+    std::size_t used_bytes() const
+    {
+        return m_arena.used_bytes();
+    }
+
+private:
+    /// @brief Freed memory, linking to the next freed memory of its size class.
+    struct FreeSlot
+    {
+        FreeSlot *next;
+    };
+
+    static constexpr std::size_t small_class_count = 32;                             // Classes every 8 bytes.
+    static constexpr std::size_t small_bytes = small_class_count * sizeof(FreeSlot); // Size of the largest of them.
+    static constexpr std::size_t class_count = small_class_count + 64;               // Then one per power of two.
+    static constexpr int small_width = std::bit_width(small_bytes);                  // Bits of the power of two classes below.
+
+    /// @brief Smallest class whose freed memory always fits an allocation.
+    static constexpr std::size_t fitting_class(const std::size_t num_bytes)
+    {
+        return num_bytes <= small_bytes ? (num_bytes + sizeof(FreeSlot) - 1) / sizeof(FreeSlot) - 1
+                                        : small_class_count + std::bit_width(num_bytes - 1) - small_width;
+    }
+
+    /// @brief Largest class whose allocations always fit in freed memory.
+    static constexpr std::size_t covered_class(const std::size_t num_bytes)
+    {
+        return num_bytes <= small_bytes ? num_bytes / sizeof(FreeSlot) - 1
+                                        : small_class_count + std::bit_width(num_bytes) - 1 - small_width;
+    }
+
+    /**
+     * @brief Allocates memory, taking it from the free list of its class if it has any.
+     *
+     * Memory bumped off the arena is not rounded up to its class, so trees that are never freed take no more memory
+     * than in a plain arena. It is freed into the largest class it covers instead.
+     *
+     * @param num_bytes The number of bytes to allocate.
+     * @return A pointer to the allocated memory.
+     */
+    void *alloc_bytes(const std::size_t num_bytes)
+    {
+        if (num_bytes != 0)
+        {
+            const std::size_t size_class = fitting_class(num_bytes);
+            if (FreeSlot *const slot = m_free[size_class])
+            {
+                m_free[size_class] = slot->next;
+                return slot;
+            }
+        }
+        return m_arena.alloc_array<FreeSlot>((num_bytes + sizeof(FreeSlot) - 1) / sizeof(FreeSlot));
+    }
+
+    /**
+     * @brief Pushes memory on the free list of the largest class it covers.
+     *
+     * @param data The memory.
+     * @param num_bytes The number of bytes it was allocated with.
+     */
+    void free_bytes(void *data, std::size_t num_bytes)
+    {
+        // Allocations are whole slots, even when bumped off the arena.
+        num_bytes = (num_bytes + sizeof(FreeSlot) - 1) / sizeof(FreeSlot) * sizeof(FreeSlot);
+        if (num_bytes == 0)
+        {
+            return;
+        }
+        const std::size_t size_class = covered_class(num_bytes);
+        m_free[size_class] = new (data) FreeSlot{.next = m_free[size_class]};
+    }
+
+    ArenaAllocator m_arena;                       // Memory the classes are bumped off.
+    std::array<FreeSlot *, class_count> m_free{}; // Head of the free list of every class.
 };
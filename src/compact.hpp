@@ -0,0 +1,513 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include "parser.hpp"
+
+/// @brief Kind of a node in the compact parse tree, stored in a single byte.
+enum class AstKind : uint8_t
+{
+    int_lit, // Integer literal, followed by its index in the literal table.
+    ident,   // Identifier, followed by the stack slot of its variable.
+    add,     // Addition, followed by its lhs and rhs.
+    sub,     // Subtraction, followed by its lhs and rhs.
+    mul,     // Multiplication, followed by its lhs and rhs.
+    div,     // Division, followed by its lhs and rhs.
+    exit,    // 'exit' statement, followed by its expression.
+    let,     // 'let' statement, followed by its expression.
+    assign,  // Reassignment, followed by the stack slot of its variable and its expression.
+    scope,   // Scope, followed by the number of statements and the statements.
+    if_,     // 'if' without 'else', followed by the number of arms and the condition and scope of every arm.
+    if_else, // 'if' with 'else', laid out like `if_` followed by the 'else' scope.
+    print,   // 'print' statement, followed by its expression.
+    arg,     // 'arg' term, followed by its expression.
+    read,    // 'read' term.
+    alloc,   // 'alloc' term, followed by its expression.
+    index,   // Element of an array, followed by the stack slot of the array's variable and the index.
+    store,   // Assignment to an element, followed by the stack slot of the array's variable, the index and the value.
+    reset,   // 'reset' statement, followed by its expression.
+    map,     // 'map' term, followed by its expression.
+    size,    // 'size' term, followed by its expression.
+    byte,    // 'byte' term, followed by the file and the index.
+    word,    // 'word' term, followed by the file and the index.
+    for_,    // 'parallel for', followed by the number of variables copied, the bounds, the chunk size and the body.
+    for_sum  // 'parallel for' with a sum, laid out like `for_` with the sum variable before the body.
+};
+
+/// @brief Kind of a binary expression.
+/// @param bin_expr The binary expression node.
+/// @return The kind of the expression.
+AstKind kind_of(const NodeBinExpr *bin_expr)
+{
+    struct BinExprVisitor
+    {
+        AstKind operator()(const NodeBinExprAdd *) const { return AstKind::add; }
+        AstKind operator()(const NodeBinExprSub *) const { return AstKind::sub; }
+        AstKind operator()(const NodeBinExprMulti *) const { return AstKind::mul; }
+        AstKind operator()(const NodeBinExprDiv *) const { return AstKind::div; }
+    };
+    return std::visit(BinExprVisitor{}, bin_expr->var);
+}
+
+/**
+ * @class CompactAst
+ * @brief A resolved parse tree encoded in a flat byte array, for programs too large to keep the parse tree of.
+ *
+ * Nodes are laid out in pre-order: a kind byte, then its operands as LEB128 varints, then its children. Every child
+ * but the last one of a node is preceded by its size in bytes, the delta to its next sibling, so the generator can
+ * find every child without decoding the ones before it. Names are already resolved to stack slots, parentheses are
+ * dropped and integer literals are kept once each in a side table, so a typical node takes two or three bytes instead
+ * of the dozens the parse tree takes with its pointers and variants.
+ */
+class CompactAst
+{
+public:
+    /**
+     * @brief Encodes a resolved parse tree.
+     *
+     * @param prog The root of the parse tree, which is not referenced afterwards.
+     */
+    explicit CompactAst(const NodeProg &prog)
+    {
+        for (const NodeStmt *stmt : prog.stmts)
+        {
+            append_statement(stmt);
+        }
+        m_code.shrink_to_fit();
+        m_literals.shrink_to_fit();
+        m_literal_ids = {};
+        m_scratch = {};
+    }
+
+    /**
+     * @brief Encodes a top-level statement after the ones before it.
+     *
+     * Every top-level statement is preceded by its size, like the children of a node.
+     *
+     * @param stmt The statement node to encode.
+     */
+    void append_statement(const NodeStmt *stmt)
+    {
+        // The statement is encoded back to front, so the size of every child is known before its prefix is written.
+        m_scratch.clear();
+        m_tasks.emplace_back(StmtTask{.stmt = stmt});
+        run_tasks();
+        write_varint(m_code, m_scratch.size());
+        m_code.insert(m_code.end(), m_scratch.rbegin(), m_scratch.rend());
+    }
+
+    /// @brief Offset of the end of the top-level statements.
+    size_t end() const
+    {
+        return m_code.size();
+    }
+
+    /// @brief Kind of the node at an offset.
+    AstKind kind(const size_t pos) const
+    {
+        return static_cast<AstKind>(m_code[pos]);
+    }
+
+    /**
+     * @brief Reads a varint, such as an operand or the size of a child.
+     *
+     * @param pos Offset of the varint, moved past it.
+     * @return The value of the varint.
+     */
+    uint64_t read_varint(size_t &pos) const
+    {
+        uint64_t value = 0;
+        for (unsigned shift = 0;; shift += 7)
+        {
+            const uint8_t byte = m_code[pos++];
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return value;
+            }
+        }
+    }
+
+    /// @brief Value of an integer literal.
+    /// @param id Index of the literal in the literal table.
+    uint64_t literal(const size_t id) const
+    {
+        return m_literals[id];
+    }
+
+    /// @brief Bytes of memory taken by the encoded tree and its literal table.
+    size_t size_bytes() const
+    {
+        return m_code.capacity() + m_literals.capacity() * sizeof(uint64_t);
+    }
+
+private:
+    // The parse tree is walked with an explicit worklist like in the generator. Every node pushes a task to write its
+    // header, then tasks for its children in reverse; each child but the last is surrounded by a task that records
+    // where it begins and one that writes its size once it is complete.
+
+    /// @brief Encode an expression.
+    struct ExprTask
+    {
+        const NodeExpr *expr;
+    };
+
+    /// @brief Encode a statement.
+    struct StmtTask
+    {
+        const NodeStmt *stmt;
+    };
+
+    /// @brief Encode a scope.
+    struct ScopeTask
+    {
+        const NodeScope *scope;
+    };
+
+    /// @brief Record where the next child begins.
+    struct BeginTask
+    {
+    };
+
+    /// @brief Write the size of the child that began at the last recorded position.
+    struct SizeTask
+    {
+    };
+
+    /// @brief Write the kind and operand of a node once its children are written.
+    struct HeaderTask
+    {
+        AstKind kind;
+        std::optional<uint64_t> operand; // Slot, count or literal index, if the node has one.
+    };
+
+    using Task = std::variant<ExprTask, StmtTask, ScopeTask, BeginTask, SizeTask, HeaderTask>;
+
+    /// @brief Runs tasks until the worklist is empty.
+    void run_tasks()
+    {
+        struct TaskVisitor
+        {
+            CompactAst &ast;
+
+            void operator()(const ExprTask &task) const
+            {
+                ast.expand_expression(task.expr);
+            }
+
+            void operator()(const StmtTask &task) const
+            {
+                ast.expand_statement(task.stmt);
+            }
+
+            void operator()(const ScopeTask &task) const
+            {
+                std::vector<Task> children;
+                children.reserve(task.scope->stmts.size());
+                for (const NodeStmt *stmt : task.scope->stmts)
+                {
+                    children.emplace_back(StmtTask{.stmt = stmt});
+                }
+                ast.push_node(AstKind::scope, task.scope->stmts.size(), children);
+            }
+
+            void operator()(const BeginTask &) const
+            {
+                ast.m_begins.push_back(ast.m_scratch.size());
+            }
+
+            void operator()(const SizeTask &) const
+            {
+                write_varint_reversed(ast.m_scratch, ast.m_scratch.size() - ast.m_begins.back());
+                ast.m_begins.pop_back();
+            }
+
+            void operator()(const HeaderTask &task) const
+            {
+                ast.write_header(task.kind, task.operand);
+            }
+        };
+
+        TaskVisitor visitor{.ast = *this};
+        while (!m_tasks.empty())
+        {
+            const Task task = m_tasks.back();
+            m_tasks.pop_back();
+            std::visit(visitor, task);
+        }
+    }
+
+    /**
+     * @brief Encodes a leaf or pushes the tasks for an expression.
+     *
+     * @param expr The expression node to encode.
+     */
+    void expand_expression(const NodeExpr *expr)
+    {
+        struct ExprVisitor
+        {
+            CompactAst &ast;
+
+            void operator()(const NodeTerm *term) const
+            {
+                if (const auto int_lit = std::get_if<NodeTermIntLit *>(&term->var))
+                {
+                    ast.write_header(AstKind::int_lit, ast.literal_id((*int_lit)->int_lit.value));
+                }
+                else if (const auto ident = std::get_if<NodeTermIdent *>(&term->var))
+                {
+                    ast.write_header(AstKind::ident, (*ident)->slot);
+                }
+                else if (const auto arg = std::get_if<NodeTermArg *>(&term->var))
+                {
+                    ast.push_node(AstKind::arg, std::nullopt, ExprTask{.expr = (*arg)->expr});
+                }
+                else if (std::holds_alternative<NodeTermRead *>(term->var))
+                {
+                    ast.write_header(AstKind::read, std::nullopt);
+                }
+                else if (const auto alloc = std::get_if<NodeTermAlloc *>(&term->var))
+                {
+                    ast.push_node(AstKind::alloc, std::nullopt, ExprTask{.expr = (*alloc)->expr});
+                }
+                else if (const auto index = std::get_if<NodeTermIndex *>(&term->var))
+                {
+                    ast.push_node(AstKind::index, (*index)->array.slot, ExprTask{.expr = (*index)->index});
+                }
+                else if (const auto map = std::get_if<NodeTermMap *>(&term->var))
+                {
+                    ast.push_node(AstKind::map, std::nullopt, ExprTask{.expr = (*map)->expr});
+                }
+                else if (const auto size = std::get_if<NodeTermSize *>(&term->var))
+                {
+                    ast.push_node(AstKind::size, std::nullopt, ExprTask{.expr = (*size)->expr});
+                }
+                else if (const auto load = std::get_if<NodeTermLoad *>(&term->var))
+                {
+                    const std::array<Task, 2> children{ExprTask{.expr = (*load)->file}, ExprTask{.expr = (*load)->index}};
+                    ast.push_node((*load)->word ? AstKind::word : AstKind::byte, std::nullopt, children);
+                }
+                else
+                {
+                    // Parentheses only group, which the tree already does.
+                    ast.m_tasks.emplace_back(ExprTask{.expr = std::get<NodeTermParen *>(term->var)->expr});
+                }
+            }
+
+            void operator()(const NodeBinExpr *bin_expr) const
+            {
+                const auto [lhs, rhs] = std::visit([](const auto *bin) { return std::pair<const NodeExpr *, const NodeExpr *>(bin->lhs, bin->rhs); }, bin_expr->var);
+                const std::array<Task, 2> children{ExprTask{.expr = lhs}, ExprTask{.expr = rhs}};
+                ast.push_node(kind_of(bin_expr), std::nullopt, children);
+            }
+        };
+
+        ExprVisitor visitor{.ast = *this};
+        std::visit(visitor, expr->var);
+    }
+
+    /**
+     * @brief Pushes the tasks for a statement.
+     *
+     * @param stmt The statement node to encode.
+     */
+    void expand_statement(const NodeStmt *stmt)
+    {
+        struct StmtVisitor
+        {
+            CompactAst &ast;
+
+            void operator()(const NodeStmtExit *stmt_exit) const
+            {
+                ast.push_node(AstKind::exit, std::nullopt, ExprTask{.expr = stmt_exit->expr});
+            }
+
+            void operator()(const NodeStmtPrint *stmt_print) const
+            {
+                ast.push_node(AstKind::print, std::nullopt, ExprTask{.expr = stmt_print->expr});
+            }
+
+            void operator()(const NodeStmtLet *stmt_let) const
+            {
+                ast.push_node(AstKind::let, std::nullopt, ExprTask{.expr = stmt_let->expr});
+            }
+
+            void operator()(const NodeStmtAssign *stmt_assign) const
+            {
+                ast.push_node(AstKind::assign, stmt_assign->slot, ExprTask{.expr = stmt_assign->expr});
+            }
+
+            void operator()(const NodeStmtStore *stmt_store) const
+            {
+                const std::array<Task, 2> children{ExprTask{.expr = stmt_store->index}, ExprTask{.expr = stmt_store->expr}};
+                ast.push_node(AstKind::store, stmt_store->array.slot, children);
+            }
+
+            void operator()(const NodeStmtReset *stmt_reset) const
+            {
+                ast.push_node(AstKind::reset, std::nullopt, ExprTask{.expr = stmt_reset->expr});
+            }
+
+            void operator()(const NodeScope *stmt_scope) const
+            {
+                ast.m_tasks.emplace_back(ScopeTask{.scope = stmt_scope});
+            }
+
+            void operator()(const NodeStmtParallel *stmt_parallel) const
+            {
+                // Loops without a chunk size get a chunk size of 0, which splits the range evenly too.
+                std::vector<Task> children{ExprTask{.expr = stmt_parallel->lo}, ExprTask{.expr = stmt_parallel->hi}};
+                if (stmt_parallel->chunk != nullptr)
+                {
+                    children.emplace_back(ExprTask{.expr = stmt_parallel->chunk});
+                }
+                else
+                {
+                    children.emplace_back(HeaderTask{.kind = AstKind::int_lit, .operand = ast.literal_id("0")});
+                }
+                if (stmt_parallel->sum.has_value())
+                {
+                    children.emplace_back(HeaderTask{.kind = AstKind::ident, .operand = stmt_parallel->sum->slot});
+                }
+                children.emplace_back(ScopeTask{.scope = stmt_parallel->scope});
+                const AstKind kind = stmt_parallel->sum.has_value() ? AstKind::for_sum : AstKind::for_;
+                ast.push_node(kind, stmt_parallel->copied, children);
+            }
+
+            void operator()(const NodeStmtIf *stmt_if) const
+            {
+                std::vector<Task> children;
+                children.reserve(stmt_if->arms.size() * 2 + 1);
+                for (const NodeIfArm &arm : stmt_if->arms)
+                {
+                    children.emplace_back(ExprTask{.expr = arm.expr});
+                    children.emplace_back(ScopeTask{.scope = arm.scope});
+                }
+                if (stmt_if->else_scope.has_value())
+                {
+                    children.emplace_back(ScopeTask{.scope = stmt_if->else_scope.value()});
+                }
+                const AstKind kind = stmt_if->else_scope.has_value() ? AstKind::if_else : AstKind::if_;
+                ast.push_node(kind, stmt_if->arms.size(), children);
+            }
+        };
+
+        StmtVisitor visitor{.ast = *this};
+        std::visit(visitor, stmt->var);
+    }
+
+    /**
+     * @brief Pushes the tasks for a node with children, its header is written after them as the code is reversed.
+     *
+     * @param kind The kind of the node.
+     * @param operand The operand of the node, if it has one.
+     * @param children Tasks encoding the children, in order.
+     */
+    void push_node(const AstKind kind, const std::optional<uint64_t> operand, const std::span<const Task> children)
+    {
+        m_tasks.emplace_back(HeaderTask{.kind = kind, .operand = operand});
+        for (size_t i = 0; i < children.size(); i++)
+        {
+            if (i + 1 == children.size())
+            {
+                m_tasks.push_back(children[i]);
+                break;
+            }
+            m_tasks.emplace_back(SizeTask{});
+            m_tasks.push_back(children[i]);
+            m_tasks.emplace_back(BeginTask{});
+        }
+    }
+
+    /**
+     * @brief Pushes the tasks for a node with a single child, which needs no size.
+     *
+     * @param kind The kind of the node.
+     * @param operand The operand of the node, if it has one.
+     * @param child Task encoding the child.
+     */
+    void push_node(const AstKind kind, const std::optional<uint64_t> operand, const Task &child)
+    {
+        m_tasks.emplace_back(HeaderTask{.kind = kind, .operand = operand});
+        m_tasks.push_back(child);
+    }
+
+    /**
+     * @brief Writes the kind and operand of a node to the reversed code.
+     *
+     * @param kind The kind of the node.
+     * @param operand The operand of the node, if it has one.
+     */
+    void write_header(const AstKind kind, const std::optional<uint64_t> operand)
+    {
+        if (operand.has_value())
+        {
+            write_varint_reversed(m_scratch, operand.value());
+        }
+        m_scratch.push_back(static_cast<uint8_t>(kind));
+    }
+
+    /**
+     * @brief Finds or adds an integer literal in the literal table.
+     *
+     * @param lit Text of the literal.
+     * @return Index of the literal.
+     */
+    size_t literal_id(const std::string_view lit)
+    {
+        uint64_t value = 0;
+        if (std::from_chars(lit.data(), lit.data() + lit.size(), value).ec != std::errc{})
+        {
+            std::cerr << "Integer literal out of range: " << lit << "\n";
+            exit(EXIT_FAILURE);
+        }
+        const auto [it, inserted] = m_literal_ids.try_emplace(value, m_literals.size());
+        if (inserted)
+        {
+            m_literals.push_back(value);
+        }
+        return it->second;
+    }
+
+    /**
+     * @brief Appends a value as a LEB128 varint.
+     *
+     * @param code The code to append to.
+     * @param value The value.
+     */
+    static void write_varint(std::vector<uint8_t> &code, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            code.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        code.push_back(static_cast<uint8_t>(value));
+    }
+
+    /**
+     * @brief Appends a value as a LEB128 varint to reversed code.
+     *
+     * @param code The reversed code to append to.
+     * @param value The value.
+     */
+    static void write_varint_reversed(std::vector<uint8_t> &code, const uint64_t value)
+    {
+        const size_t begin = code.size();
+        write_varint(code, value);
+        std::reverse(code.begin() + static_cast<std::ptrdiff_t>(begin), code.end());
+    }
+
+    std::vector<uint8_t> m_code{};                        // The encoded top-level statements.
+    std::vector<uint64_t> m_literals{};                   // Values of the integer literals, each stored once.
+    std::unordered_map<uint64_t, size_t> m_literal_ids{}; // Index of every literal value, only used while encoding.
+    std::vector<uint8_t> m_scratch{};                     // The statement being encoded, back to front.
+    std::vector<size_t> m_begins{};                       // Offsets in the scratch code where open children begin.
+    std::vector<Task> m_tasks{};                          // Worklist of encoding tasks.
+};
@@ -0,0 +1,541 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include "machine.hpp"
+
+/// @brief A call to a runtime routine in encoded machine code, whose displacement a linker fills in.
+struct Relocation
+{
+    size_t offset;        // Offset of the 32-bit displacement in the code, the call ends right after it.
+    RuntimeSymbol symbol; // The routine called.
+};
+
+/// @brief Class to encode machine instructions into x86-64 machine code.
+class Encoder
+{
+public:
+    /**
+     * @brief Constructs the encoder with the labels of the program.
+     *
+     * @param labels The label table, label offsets are recorded into it.
+     */
+    explicit Encoder(LabelTable &labels)
+        : m_labels(labels)
+    {
+    }
+
+    /**
+     * @brief Chooses the displacement size of every jump and lays out the labels.
+     *
+     * Every jump starts out short and is only made near once its target is out of reach. Jumps only ever grow, so
+     * the layout settles after a few passes.
+     *
+     * @param instrs The instructions to relax, their `disp_size` is updated in place.
+     */
+    void relax(std::vector<MachineInstr> &instrs)
+    {
+        std::vector<size_t> sizes(instrs.size());
+        for (size_t i = 0; i < instrs.size(); i++)
+        {
+            if (LabelTable::is_jump(instrs[i].op))
+            {
+                instrs[i].disp_size = 1;
+            }
+            sizes[i] = size(instrs[i]);
+        }
+
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            layout_labels(instrs, sizes);
+            size_t offset = 0;
+            for (size_t i = 0; i < instrs.size(); i++)
+            {
+                offset += sizes[i];
+                if (instrs[i].disp_size != 1)
+                {
+                    continue;
+                }
+                const int64_t disp = static_cast<int64_t>(m_labels.offset(instrs[i].dst.value)) - static_cast<int64_t>(offset);
+                if (disp < INT8_MIN || disp > INT8_MAX)
+                {
+                    instrs[i].disp_size = 4;
+                    sizes[i] = size(instrs[i]);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Encodes relaxed instructions into machine code.
+     *
+     * @param instrs The instructions to encode, relaxed by `relax`.
+     * @return The machine code.
+     */
+    std::vector<uint8_t> encode(const std::vector<MachineInstr> &instrs)
+    {
+        std::vector<uint8_t> code;
+        m_relocations.clear();
+        for (const MachineInstr &instr : instrs)
+        {
+            m_offset = code.size();
+            encode_instr(instr, code);
+            if (instr.op == Opcode::call && instr.dst.kind == OperandKind::symbol &&
+                !m_symbols[instr.dst.value].has_value())
+            {
+                m_relocations.push_back({.offset = code.size() - 4, .symbol = static_cast<RuntimeSymbol>(instr.dst.value)});
+            }
+        }
+        return code;
+    }
+
+    /// @brief Calls in the code last encoded to runtime routines it does not define, for a linker to fill in.
+    const std::vector<Relocation> &relocations() const
+    {
+        return m_relocations;
+    }
+
+    /// @brief Offset of a runtime routine in the code, valid after relaxation.
+    /// @param symbol The routine.
+    /// @return The offset, or an empty optional if the code does not define the routine.
+    std::optional<size_t> symbol_offset(const RuntimeSymbol symbol) const
+    {
+        return m_symbols[static_cast<size_t>(symbol)];
+    }
+
+    /**
+     * @brief Size of an instruction in bytes.
+     *
+     * @param instr The instruction, jumps are sized by their `disp_size`.
+     * @return Size of the encoded instruction.
+     */
+    size_t size(const MachineInstr &instr)
+    {
+        m_scratch.clear();
+        encode_instr(instr, m_scratch);
+        return m_scratch.size();
+    }
+
+private:
+    /**
+     * @brief Records the offset of every label for the current instruction sizes.
+     *
+     * @param instrs The instructions.
+     * @param sizes Size of every instruction.
+     */
+    void layout_labels(const std::vector<MachineInstr> &instrs, const std::vector<size_t> &sizes)
+    {
+        size_t offset = 0;
+        for (size_t i = 0; i < instrs.size(); i++)
+        {
+            if (instrs[i].op == Opcode::label && instrs[i].dst.kind == OperandKind::symbol)
+            {
+                m_symbols[instrs[i].dst.value] = offset;
+            }
+            else if (instrs[i].op == Opcode::label)
+            {
+                m_labels.set_offset(instrs[i].dst.value, offset);
+            }
+            offset += sizes[i];
+        }
+    }
+
+    /// @brief Encoding number of a register.
+    static uint8_t reg_num(const Reg reg)
+    {
+        return static_cast<uint8_t>(reg);
+    }
+
+    /// @brief Checks whether a value fits in a sign-extended byte.
+    static bool fits_int8(const int64_t value)
+    {
+        return value >= INT8_MIN && value <= INT8_MAX;
+    }
+
+    /// @brief Checks whether a value fits in a sign-extended dword.
+    static bool fits_int32(const int64_t value)
+    {
+        return value >= INT32_MIN && value <= INT32_MAX;
+    }
+
+    /// @brief Appends a little-endian value of the given size.
+    static void append_le(std::vector<uint8_t> &code, const uint64_t value, const size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            code.push_back(static_cast<uint8_t>(value >> (i * 8)));
+        }
+    }
+
+    /**
+     * @brief Appends a REX prefix, the opcode bytes and a ModRM (with SIB and displacement) for an instruction.
+     *
+     * @param code The output.
+     * @param rex_w Whether the instruction operates on 64 bits.
+     * @param opcode Opcode bytes.
+     * @param reg Contents of the ModRM reg field, a register number or an opcode extension.
+     * @param rm The register or memory operand.
+     */
+    static void append_modrm(
+        std::vector<uint8_t> &code,
+        const bool rex_w,
+        std::initializer_list<uint8_t> opcode,
+        const uint8_t reg,
+        const Operand &rm)
+    {
+        const uint8_t base = reg_num(rm.base);
+        const uint8_t index = rm.scale != 0 ? reg_num(rm.index) : 0;
+        const uint8_t rex = 0x40 | (rex_w ? 0x08 : 0) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+        if (rex != 0x40)
+        {
+            code.push_back(rex);
+        }
+        code.insert(code.end(), opcode);
+
+        if (rm.kind == OperandKind::reg)
+        {
+            code.push_back(0xC0 | ((reg & 7) << 3) | (base & 7));
+            return;
+        }
+
+        // rbp and r13 as base have no displacement-free form, rsp and r12 as base always need a SIB byte.
+        const uint8_t mod = rm.value == 0 && (base & 7) != 5 ? 0x00 : fits_int8(rm.value) ? 0x40 : 0x80;
+        if (rm.scale != 0 || (base & 7) == 4)
+        {
+            const uint8_t scale_bits = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+            const uint8_t sib_index = rm.scale != 0 ? (index & 7) : 4;
+            code.push_back(mod | ((reg & 7) << 3) | 4);
+            code.push_back((scale_bits << 6) | (sib_index << 3) | (base & 7));
+        }
+        else
+        {
+            code.push_back(mod | ((reg & 7) << 3) | (base & 7));
+        }
+        if (mod == 0x40)
+        {
+            append_le(code, static_cast<uint64_t>(rm.value), 1);
+        }
+        else if (mod == 0x80)
+        {
+            append_le(code, static_cast<uint64_t>(rm.value), 4);
+        }
+    }
+
+    /**
+     * @brief Appends an ALU instruction in its register, imm8 or imm32 form.
+     *
+     * @param code The output.
+     * @param op_rm_reg Opcode of the `op r/m64, r64` form.
+     * @param ext Opcode extension of the `op r/m64, imm` forms.
+     * @param instr The instruction.
+     */
+    static void append_alu(std::vector<uint8_t> &code, const uint8_t op_rm_reg, const uint8_t ext, const MachineInstr &instr)
+    {
+        if (instr.src.kind == OperandKind::imm)
+        {
+            const bool short_imm = fits_int8(instr.src.value);
+            append_modrm(code, true, {static_cast<uint8_t>(short_imm ? 0x83 : 0x81)}, ext, instr.dst);
+            append_le(code, static_cast<uint64_t>(instr.src.value), short_imm ? 1 : 4);
+            return;
+        }
+        append_modrm(code, true, {op_rm_reg}, reg_num(instr.src.base), instr.dst);
+    }
+
+    /**
+     * @brief Appends a shift by an immediate count or by cl.
+     *
+     * @param code The output.
+     * @param ext Opcode extension of the shift.
+     * @param instr The instruction.
+     */
+    static void append_shift(std::vector<uint8_t> &code, const uint8_t ext, const MachineInstr &instr)
+    {
+        if (instr.src.kind == OperandKind::reg)
+        {
+            append_modrm(code, true, {0xD3}, ext, instr.dst);
+        }
+        else if (instr.src.value == 1)
+        {
+            append_modrm(code, true, {0xD1}, ext, instr.dst);
+        }
+        else
+        {
+            append_modrm(code, true, {0xC1}, ext, instr.dst);
+            append_le(code, static_cast<uint64_t>(instr.src.value), 1);
+        }
+    }
+
+    /**
+     * @brief Appends the machine code of a single instruction.
+     *
+     * @param instr The instruction to encode.
+     * @param code The output.
+     */
+    void encode_instr(const MachineInstr &instr, std::vector<uint8_t> &code) const
+    {
+        switch (instr.op)
+        {
+        case Opcode::mov:
+            if (instr.src.kind == OperandKind::imm && instr.dst.kind == OperandKind::mem)
+            {
+                append_modrm(code, true, {0xC7}, 0, instr.dst);
+                append_le(code, static_cast<uint64_t>(instr.src.value), 4);
+            }
+            else if (instr.src.kind == OperandKind::imm)
+            {
+                const uint8_t reg = reg_num(instr.dst.base);
+                const auto value = static_cast<uint64_t>(instr.src.value);
+                if (value <= UINT32_MAX)
+                {
+                    // Writing the 32-bit register zero-extends into the full one.
+                    if (reg >= 8)
+                    {
+                        code.push_back(0x41);
+                    }
+                    code.push_back(0xB8 | (reg & 7));
+                    append_le(code, value, 4);
+                }
+                else if (fits_int32(instr.src.value))
+                {
+                    append_modrm(code, true, {0xC7}, 0, instr.dst);
+                    append_le(code, value, 4);
+                }
+                else
+                {
+                    code.push_back(0x48 | ((reg & 8) >> 3));
+                    code.push_back(0xB8 | (reg & 7));
+                    append_le(code, value, 8);
+                }
+            }
+            else if (instr.src.kind == OperandKind::mem)
+            {
+                append_modrm(code, true, {0x8B}, reg_num(instr.dst.base), instr.src);
+            }
+            else
+            {
+                append_modrm(code, true, {0x89}, reg_num(instr.src.base), instr.dst);
+            }
+            break;
+        case Opcode::movzx:
+            append_modrm(code, true, {0x0F, 0xB6}, reg_num(instr.dst.base), instr.src);
+            break;
+        case Opcode::push:
+            if (instr.dst.kind == OperandKind::mem)
+            {
+                append_modrm(code, false, {0xFF}, 6, instr.dst);
+            }
+            else
+            {
+                if (reg_num(instr.dst.base) >= 8)
+                {
+                    code.push_back(0x41);
+                }
+                code.push_back(0x50 | (reg_num(instr.dst.base) & 7));
+            }
+            break;
+        case Opcode::pop:
+            if (reg_num(instr.dst.base) >= 8)
+            {
+                code.push_back(0x41);
+            }
+            code.push_back(0x58 | (reg_num(instr.dst.base) & 7));
+            break;
+        case Opcode::add:
+            append_alu(code, 0x01, 0, instr);
+            break;
+        case Opcode::sub:
+            append_alu(code, 0x29, 5, instr);
+            break;
+        case Opcode::xor_:
+            append_alu(code, 0x31, 6, instr);
+            break;
+        case Opcode::and_:
+            append_alu(code, 0x21, 4, instr);
+            break;
+        case Opcode::or_:
+            append_alu(code, 0x09, 1, instr);
+            break;
+        case Opcode::mul:
+            append_modrm(code, true, {0xF7}, 4, instr.dst);
+            break;
+        case Opcode::div:
+            append_modrm(code, true, {0xF7}, 6, instr.dst);
+            break;
+        case Opcode::neg:
+            append_modrm(code, true, {0xF7}, 3, instr.dst);
+            break;
+        case Opcode::imul:
+            if (instr.src2.kind == OperandKind::imm)
+            {
+                const bool short_imm = fits_int8(instr.src2.value);
+                append_modrm(code, true, {static_cast<uint8_t>(short_imm ? 0x6B : 0x69)}, reg_num(instr.dst.base), instr.src);
+                append_le(code, static_cast<uint64_t>(instr.src2.value), short_imm ? 1 : 4);
+            }
+            else
+            {
+                append_modrm(code, true, {0x0F, 0xAF}, reg_num(instr.dst.base), instr.src);
+            }
+            break;
+        case Opcode::lea:
+            if (instr.src.kind == OperandKind::label)
+            {
+                encode_lea_label(instr, code);
+                break;
+            }
+            append_modrm(code, true, {0x8D}, reg_num(instr.dst.base), instr.src);
+            break;
+        case Opcode::shl:
+            append_shift(code, 4, instr);
+            break;
+        case Opcode::shr:
+            append_shift(code, 5, instr);
+            break;
+        case Opcode::bsf:
+            append_modrm(code, true, {0x0F, 0xBC}, reg_num(instr.dst.base), instr.src);
+            break;
+        case Opcode::test:
+            append_modrm(code, true, {0x85}, reg_num(instr.src.base), instr.dst);
+            break;
+        case Opcode::cmp:
+            append_alu(code, 0x39, 7, instr);
+            break;
+        case Opcode::jz:
+        case Opcode::jnz:
+        case Opcode::jb:
+        case Opcode::jae:
+        case Opcode::jbe:
+        case Opcode::jmp:
+            encode_jump(instr, code);
+            break;
+        case Opcode::call:
+            encode_call(instr, code);
+            break;
+        case Opcode::syscall:
+            code.insert(code.end(), {0x0F, 0x05});
+            break;
+        case Opcode::ret:
+            code.push_back(0xC3);
+            break;
+        case Opcode::std:
+            code.push_back(0xFD);
+            break;
+        case Opcode::cld:
+            code.push_back(0xFC);
+            break;
+        case Opcode::stosb:
+            code.push_back(0xAA);
+            break;
+        case Opcode::movsb:
+            code.insert(code.end(), {0xF3, 0xA4});
+            break;
+        case Opcode::label:
+        case Opcode::comment:
+            break;
+        }
+    }
+
+    /**
+     * @brief Appends the machine code of a jump, using the label offsets of the current layout.
+     *
+     * @param instr The jump to encode.
+     * @param code The output.
+     */
+    void encode_jump(const MachineInstr &instr, std::vector<uint8_t> &code) const
+    {
+        const bool is_short = instr.disp_size == 1;
+        const size_t begin = code.size();
+        if (instr.op == Opcode::jmp)
+        {
+            code.push_back(is_short ? 0xEB : 0xE9);
+        }
+        else
+        {
+            const uint8_t cond = condition_code(instr.op);
+            if (is_short)
+            {
+                code.push_back(0x70 | cond);
+            }
+            else
+            {
+                code.insert(code.end(), {0x0F, static_cast<uint8_t>(0x80 | cond)});
+            }
+        }
+
+        // Displacements are relative to the end of the jump, which is only known while encoding, not while sizing.
+        const size_t disp_size = is_short ? 1 : 4;
+        const size_t end = m_offset + (code.size() - begin) + disp_size;
+        const int64_t disp = static_cast<int64_t>(m_labels.offset(instr.dst.value)) - static_cast<int64_t>(end);
+        append_le(code, static_cast<uint64_t>(disp), disp_size);
+    }
+
+    /**
+     * @brief Appends the machine code of a `lea` of the address of a label, relative to the instruction pointer so the
+     * code stays position independent.
+     *
+     * @param instr The instruction to encode.
+     * @param code The output.
+     */
+    void encode_lea_label(const MachineInstr &instr, std::vector<uint8_t> &code) const
+    {
+        const uint8_t reg = reg_num(instr.dst.base);
+        // A ModRM with mod 00 and rm 101 addresses a 32-bit displacement from the end of the instruction.
+        code.push_back(0x48 | ((reg & 8) >> 1));
+        code.push_back(0x8D);
+        code.push_back(((reg & 7) << 3) | 5);
+        const int64_t disp =
+            static_cast<int64_t>(m_labels.offset(instr.src.value)) - static_cast<int64_t>(m_offset + 7);
+        append_le(code, static_cast<uint64_t>(disp), 4);
+    }
+
+    /// @brief Condition code of a conditional jump, shared by its short and near form.
+    static uint8_t condition_code(const Opcode op)
+    {
+        switch (op)
+        {
+        case Opcode::jb:
+            return 0x2;
+        case Opcode::jae:
+            return 0x3;
+        case Opcode::jz:
+            return 0x4;
+        case Opcode::jnz:
+            return 0x5;
+        case Opcode::jbe:
+            return 0x6;
+        default:
+            assert(false);
+            return 0x0;
+        }
+    }
+
+    /**
+     * @brief Appends the machine code of a call to a runtime routine or through a register.
+     *
+     * Calls to routines defined elsewhere get a zero displacement, for the linker to fill in.
+     *
+     * @param instr The call to encode.
+     * @param code The output.
+     */
+    void encode_call(const MachineInstr &instr, std::vector<uint8_t> &code) const
+    {
+        if (instr.dst.kind == OperandKind::reg)
+        {
+            append_modrm(code, false, {0xFF}, 2, instr.dst);
+            return;
+        }
+        code.push_back(0xE8);
+        const std::optional<size_t> target = m_symbols[instr.dst.value];
+        const int64_t disp = target.has_value() ? static_cast<int64_t>(target.value()) - static_cast<int64_t>(m_offset + 5) : 0;
+        append_le(code, static_cast<uint64_t>(disp), 4);
+    }
+
+    LabelTable &m_labels;                                                // The labels of the program.
+    std::array<std::optional<size_t>, runtime_symbol_count> m_symbols{}; // Offsets of the runtime routines.
+    std::vector<Relocation> m_relocations{};                             // Calls in the code last encoded.
+    std::vector<uint8_t> m_scratch;                                      // Buffer for sizing instructions.
+    size_t m_offset = 0;                                                 // Offset of the instruction being encoded.
+};
@@ -0,0 +1,395 @@
+#pragma once
+#include <charconv>
+#include <cstdint>
+#include "parser.hpp"
+
+/// @brief Class to run a program at compile time and compute its exit code.
+///
+/// A terminating program that reads no input always exits with the same code. The evaluator interprets the parse
+/// tree with the same semantics as the generated assembly (unsigned 64-bit arithmetic on the stack) and gives up as
+/// soon as the step or memory budget is exhausted, or the program would fault at runtime.
+/// Programs that print are given up on as well, their output has to be produced when they run, and so are programs
+/// that read arguments or stdin, which are only known then. Arrays and mapped files are not modeled either, so programs
+/// that allocate or map files are left to the generated code, and so are parallel loops.
+/// Variables are looked up by the stack slots the resolver assigned, so the parse tree must be resolved first.
+/// The evaluator recurses through the parse tree, so it also gives up on deeply nested programs and leaves them to the
+/// generator, which does not recurse.
+class Evaluator
+{
+public:
+    static constexpr size_t default_max_steps = 1 << 24;              // Nodes evaluated before giving up.
+    static constexpr size_t default_max_stack_bytes = 1024 * 1024 * 8; // Stack usage before giving up (8 mb).
+    static constexpr size_t max_depth = 4096;                          // Nesting depth before giving up.
+
+    /**
+     * @brief Constructs the evaluator for a given parse tree.
+     *
+     * @param prog The root of the parse tree.
+     * @param max_steps The number of nodes the evaluator may visit.
+     * @param max_stack_bytes The number of bytes of variable stack the program may use.
+     */
+    explicit Evaluator(
+        const NodeProg &prog,
+        const size_t max_steps = default_max_steps,
+        const size_t max_stack_bytes = default_max_stack_bytes)
+        : m_prog(prog), m_max_steps(max_steps), m_max_stack_bytes(max_stack_bytes)
+    {
+    }
+
+    /**
+     * @brief Evaluates an expression node.
+     *
+     * @param expr The expression node to evaluate.
+     * @return The value of the expression, or an empty optional if the evaluation was given up.
+     */
+    std::optional<uint64_t> evaluate_expression(const NodeExpr *expr)
+    {
+        if (!step() || m_depth == max_depth)
+        {
+            return {};
+        }
+
+        struct ExprVisitor
+        {
+            Evaluator &eval;
+
+            std::optional<uint64_t> operator()(const NodeTerm *term) const
+            {
+                return eval.evaluate_term(term);
+            }
+
+            std::optional<uint64_t> operator()(const NodeBinExpr *bin_expr) const
+            {
+                return eval.evaluate_binary_expression(bin_expr);
+            }
+        };
+
+        ExprVisitor visitor{.eval = *this};
+        m_depth++;
+        const std::optional<uint64_t> value = std::visit(visitor, expr->var);
+        m_depth--;
+        return value;
+    }
+
+    /**
+     * @brief Runs the whole program.
+     *
+     * @return The exit code of the program, or an empty optional if the evaluation was given up.
+     */
+    std::optional<uint64_t> evaluate_program()
+    {
+        for (const NodeStmt *stmt : m_prog.stmts)
+        {
+            switch (evaluate_statement(stmt))
+            {
+            case Status::next:
+                break;
+            case Status::exit:
+                return m_exit_code;
+            case Status::abort:
+                return {};
+            }
+        }
+
+        // Falling off the end of the program exits with 0.
+        return 0;
+    }
+
+private:
+    /// @brief Outcome of evaluating a statement.
+    enum class Status
+    {
+        next,  // Continue with the next statement.
+        exit,  // The program exited, `m_exit_code` holds the code.
+        abort, // The evaluation was given up.
+    };
+
+    /**
+     * @brief Evaluates a term node.
+     *
+     * @param term The term node to evaluate.
+     * @return The value of the term, or an empty optional if the evaluation was given up.
+     */
+    std::optional<uint64_t> evaluate_term(const NodeTerm *term)
+    {
+        struct TermVisitor
+        {
+            Evaluator &eval;
+
+            std::optional<uint64_t> operator()(const NodeTermIntLit *term_int_lit) const
+            {
+                // Literals that do not fit in 64 bits are left to the generated code.
+                const std::string_view lit = term_int_lit->int_lit.value;
+                uint64_t value = 0;
+                if (std::from_chars(lit.data(), lit.data() + lit.size(), value).ec != std::errc{})
+                {
+                    return {};
+                }
+                return value;
+            }
+
+            std::optional<uint64_t> operator()(const NodeTermIdent *term_ident) const
+            {
+                return eval.m_vars[term_ident->slot];
+            }
+
+            std::optional<uint64_t> operator()(const NodeTermParen *term_paren) const
+            {
+                return eval.evaluate_expression(term_paren->expr);
+            }
+
+            std::optional<uint64_t> operator()(const NodeTermArg *) const
+            {
+                return {};
+            }
+
+            std::optional<uint64_t> operator()(const NodeTermRead *) const
+            {
+                return {};
+            }
+
+            std::optional<uint64_t> operator()(const NodeTermAlloc *) const
+            {
+                return {};
+            }
+
+            std::optional<uint64_t> operator()(const NodeTermIndex *) const
+            {
+                return {};
+            }
+
+            std::optional<uint64_t> operator()(const NodeTermMap *) const
+            {
+                return {};
+            }
+
+            std::optional<uint64_t> operator()(const NodeTermSize *) const
+            {
+                return {};
+            }
+
+            std::optional<uint64_t> operator()(const NodeTermLoad *) const
+            {
+                return {};
+            }
+        };
+
+        TermVisitor visitor{.eval = *this};
+        return std::visit(visitor, term->var);
+    }
+
+    /**
+     * @brief Evaluates a binary expression node.
+     *
+     * @param bin_expr The binary expression node to evaluate.
+     * @return The value of the expression, or an empty optional if the evaluation was given up.
+     */
+    std::optional<uint64_t> evaluate_binary_expression(const NodeBinExpr *bin_expr)
+    {
+        struct BinExprVisitor
+        {
+            Evaluator &eval;
+
+            std::optional<uint64_t> operator()(const NodeBinExprAdd *bin_expr_add) const
+            {
+                const auto [lhs, rhs] = eval.evaluate_operands(bin_expr_add->lhs, bin_expr_add->rhs);
+                if (!lhs.has_value() || !rhs.has_value())
+                {
+                    return {};
+                }
+                return lhs.value() + rhs.value();
+            }
+
+            std::optional<uint64_t> operator()(const NodeBinExprMulti *bin_expr_mult) const
+            {
+                const auto [lhs, rhs] = eval.evaluate_operands(bin_expr_mult->lhs, bin_expr_mult->rhs);
+                if (!lhs.has_value() || !rhs.has_value())
+                {
+                    return {};
+                }
+                return lhs.value() * rhs.value();
+            }
+
+            std::optional<uint64_t> operator()(const NodeBinExprSub *bin_expr_sub) const
+            {
+                const auto [lhs, rhs] = eval.evaluate_operands(bin_expr_sub->lhs, bin_expr_sub->rhs);
+                if (!lhs.has_value() || !rhs.has_value())
+                {
+                    return {};
+                }
+                return lhs.value() - rhs.value();
+            }
+
+            std::optional<uint64_t> operator()(const NodeBinExprDiv *bin_expr_div) const
+            {
+                const auto [lhs, rhs] = eval.evaluate_operands(bin_expr_div->lhs, bin_expr_div->rhs);
+                // Division by zero faults at runtime, so leave it to the generated code.
+                if (!lhs.has_value() || !rhs.has_value() || rhs.value() == 0)
+                {
+                    return {};
+                }
+                return lhs.value() / rhs.value();
+            }
+        };
+
+        BinExprVisitor visitor{.eval = *this};
+        return std::visit(visitor, bin_expr->var);
+    }
+
+    /**
+     * @brief Evaluates both operands of a binary expression, lhs first like the generated code.
+     *
+     * @param lhs Left-hand side of the binary expression.
+     * @param rhs Right-hand side of the binary expression.
+     * @return The values of the lhs and rhs.
+     */
+    std::pair<std::optional<uint64_t>, std::optional<uint64_t>> evaluate_operands(const NodeExpr *lhs, const NodeExpr *rhs)
+    {
+        const std::optional<uint64_t> lhs_value = evaluate_expression(lhs);
+        if (!lhs_value.has_value())
+        {
+            return {};
+        }
+        return {lhs_value, evaluate_expression(rhs)};
+    }
+
+    /**
+     * @brief Evaluates every statement of a scope, dropping its variables afterwards.
+     *
+     * @param scope The scope node to evaluate.
+     * @return Status of the evaluation.
+     */
+    Status evaluate_scope(const NodeScope *scope)
+    {
+        const size_t var_count = m_vars.size();
+        for (const NodeStmt *stmt : scope->stmts)
+        {
+            if (const Status status = evaluate_statement(stmt); status != Status::next)
+            {
+                return status;
+            }
+        }
+        m_vars.resize(var_count);
+        return Status::next;
+    }
+
+    /**
+     * @brief Evaluates a statement node.
+     *
+     * @param stmt The statement node to evaluate.
+     * @return Status of the evaluation.
+     */
+    Status evaluate_statement(const NodeStmt *stmt)
+    {
+        if (!step() || m_depth == max_depth)
+        {
+            return Status::abort;
+        }
+
+        struct StmtVisitor
+        {
+            Evaluator &eval;
+
+            Status operator()(const NodeStmtExit *stmt_exit) const
+            {
+                const std::optional<uint64_t> value = eval.evaluate_expression(stmt_exit->expr);
+                if (!value.has_value())
+                {
+                    return Status::abort;
+                }
+                eval.m_exit_code = value.value();
+                return Status::exit;
+            }
+
+            Status operator()(const NodeStmtPrint *) const
+            {
+                return Status::abort;
+            }
+
+            Status operator()(const NodeStmtStore *) const
+            {
+                return Status::abort;
+            }
+
+            Status operator()(const NodeStmtReset *) const
+            {
+                return Status::abort;
+            }
+
+            Status operator()(const NodeStmtParallel *) const
+            {
+                return Status::abort;
+            }
+
+            Status operator()(const NodeStmtLet *stmt_let) const
+            {
+                const std::optional<uint64_t> value = eval.evaluate_expression(stmt_let->expr);
+                if (!value.has_value() || (eval.m_vars.size() + 1) * 8 > eval.m_max_stack_bytes)
+                {
+                    return Status::abort;
+                }
+                eval.m_vars.push_back(value.value());
+                return Status::next;
+            }
+
+            Status operator()(const NodeStmtAssign *stmt_assign) const
+            {
+                const std::optional<uint64_t> value = eval.evaluate_expression(stmt_assign->expr);
+                if (!value.has_value())
+                {
+                    return Status::abort;
+                }
+                eval.m_vars[stmt_assign->slot] = value.value();
+                return Status::next;
+            }
+
+            Status operator()(const NodeScope *stmt_scope) const
+            {
+                return eval.evaluate_scope(stmt_scope);
+            }
+
+            Status operator()(const NodeStmtIf *stmt_if) const
+            {
+                for (const NodeIfArm &arm : stmt_if->arms)
+                {
+                    const std::optional<uint64_t> cond = eval.evaluate_expression(arm.expr);
+                    if (!cond.has_value())
+                    {
+                        return Status::abort;
+                    }
+                    if (cond.value() != 0)
+                    {
+                        return eval.evaluate_scope(arm.scope);
+                    }
+                }
+                if (stmt_if->else_scope.has_value())
+                {
+                    return eval.evaluate_scope(stmt_if->else_scope.value());
+                }
+                return Status::next;
+            }
+        };
+
+        StmtVisitor visitor{.eval = *this};
+        m_depth++;
+        const Status status = std::visit(visitor, stmt->var);
+        m_depth--;
+        return status;
+    }
+
+    /// @brief Counts one evaluation step against the budget.
+    /// @return Whether the budget still allows the evaluation to continue.
+    bool step()
+    {
+        return ++m_steps <= m_max_steps;
+    }
+
+    const NodeProg &m_prog;        // The root of the parse tree.
+    const size_t m_max_steps;      // Maximum number of evaluation steps.
+    const size_t m_max_stack_bytes; // Maximum number of bytes of variables on the stack.
+
+    size_t m_steps = 0;        // Number of evaluation steps taken so far.
+    size_t m_depth = 0;        // Number of expressions and statements currently being evaluated.
+    std::vector<uint64_t> m_vars{}; // Values of the variables currently in scope, indexed by stack slot.
+    uint64_t m_exit_code = 0;  // Exit code of the program once it has exited.
+};
@@ -0,0 +1,158 @@
+#pragma once
+#include <charconv>
+#include <optional>
+#include <string>
+#include "arena.hpp"
+#include "parser.hpp"
+#include "visitor.hpp"
+
+/// @brief Folds the arithmetic on integer literals in a resolved parse tree, and the 'if' statements it decides.
+///
+/// Binary expressions whose operands are both literals become the literal of their value, wrapping like the generated
+/// code, and a literal in parentheses becomes the bare literal. A division by zero is left to fault at run time. An
+/// 'if' drops the arms whose condition folded to 0, and becomes the scope of the first arm whose condition folded to
+/// anything else, or of its 'else' once no arm is left, so no condition is tested for it. Folding happens bottom-up in
+/// one traversal, so an expression is folded as far as its literals allow even when the program cannot be evaluated.
+///
+/// Replacements are allocated in the parse tree's memory, the nodes they replace stay there until it is released.
+class ConstantFolder : public AstRewriter<ConstantFolder>
+{
+public:
+    /**
+     * @brief Constructs the folder for a parse tree.
+     *
+     * @param allocator Memory of the parse tree, see `Parser::allocator`.
+     */
+    explicit ConstantFolder(PoolAllocator &allocator)
+        : m_allocator(allocator)
+    {
+    }
+
+    /**
+     * @brief Folds every statement of a program, which the resolver has annotated.
+     *
+     * @param prog The root of the parse tree, rewritten in place.
+     */
+    void fold_program(NodeProg &prog)
+    {
+        traverse_program(prog);
+    }
+
+private:
+    friend class AstVisitor<ConstantFolder>;
+
+    /// @brief The value of an expression that is an integer literal.
+    static std::optional<uint64_t> literal(const NodeExpr *expr)
+    {
+        const auto term = std::get_if<NodeTerm *>(&expr->var);
+        if (term == nullptr)
+        {
+            return {};
+        }
+        const auto term_int_lit = std::get_if<NodeTermIntLit *>(&(*term)->var);
+        if (term_int_lit == nullptr)
+        {
+            return {};
+        }
+        const std::string_view lit = (*term_int_lit)->int_lit.value;
+        uint64_t value = 0;
+        if (std::from_chars(lit.data(), lit.data() + lit.size(), value).ec != std::errc{})
+        {
+            return {}; // The generator reports the literal.
+        }
+        return value;
+    }
+
+    /// @brief Line of an expression that is an integer literal.
+    static size_t literal_line(const NodeExpr *expr)
+    {
+        return std::get<NodeTermIntLit *>(std::get<NodeTerm *>(expr->var)->var)->int_lit.line;
+    }
+
+    NodeExpr *rewrite_expr(NodeExpr *expr)
+    {
+        if (const auto term = std::get_if<NodeTerm *>(&expr->var))
+        {
+            const auto term_paren = std::get_if<NodeTermParen *>(&(*term)->var);
+            if (term_paren != nullptr && literal((*term_paren)->expr).has_value())
+            {
+                return (*term_paren)->expr;
+            }
+            return expr;
+        }
+
+        const NodeBinExpr *bin_expr = std::get<NodeBinExpr *>(expr->var);
+        const auto operands = [](const auto *bin) { return std::pair(bin->lhs, bin->rhs); };
+        const auto [lhs, rhs] = std::visit(operands, bin_expr->var);
+        const std::optional<uint64_t> lhs_value = literal(lhs);
+        const std::optional<uint64_t> rhs_value = literal(rhs);
+        if (!lhs_value.has_value() || !rhs_value.has_value())
+        {
+            return expr;
+        }
+
+        uint64_t value = 0;
+        if (std::holds_alternative<NodeBinExprAdd *>(bin_expr->var))
+        {
+            value = lhs_value.value() + rhs_value.value();
+        }
+        else if (std::holds_alternative<NodeBinExprMulti *>(bin_expr->var))
+        {
+            value = lhs_value.value() * rhs_value.value();
+        }
+        else if (std::holds_alternative<NodeBinExprSub *>(bin_expr->var))
+        {
+            value = lhs_value.value() - rhs_value.value();
+        }
+        else if (rhs_value.value() != 0)
+        {
+            value = lhs_value.value() / rhs_value.value();
+        }
+        else
+        {
+            return expr;
+        }
+
+        const NodeToken int_lit{.value = m_allocator.alloc_string(std::to_string(value)), .line = literal_line(lhs)};
+        auto term_int_lit = m_allocator.emplace<NodeTermIntLit>(int_lit);
+        auto term = m_allocator.emplace<NodeTerm>(term_int_lit);
+        return m_allocator.emplace<NodeExpr>(term);
+    }
+
+    NodeStmt *rewrite_stmt(NodeStmt *stmt)
+    {
+        const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var);
+        if (stmt_if == nullptr)
+        {
+            return stmt;
+        }
+
+        std::span<NodeIfArm> arms = (*stmt_if)->arms;
+        while (!arms.empty())
+        {
+            const std::optional<uint64_t> condition = literal(arms.front().expr);
+            if (!condition.has_value())
+            {
+                break;
+            }
+            if (condition.value() != 0)
+            {
+                return m_allocator.emplace<NodeStmt>(arms.front().scope);
+            }
+            arms = arms.subspan(1);
+        }
+        if (arms.size() == (*stmt_if)->arms.size())
+        {
+            return stmt;
+        }
+
+        if (arms.empty())
+        {
+            NodeScope *scope = (*stmt_if)->else_scope.value_or(nullptr);
+            return m_allocator.emplace<NodeStmt>(scope != nullptr ? scope : m_allocator.emplace<NodeScope>());
+        }
+        return m_allocator.emplace<NodeStmt>(m_allocator.emplace<NodeStmtIf>(arms, (*stmt_if)->else_scope));
+    }
+
+    PoolAllocator &m_allocator; // Memory of the parse tree, which replacements are allocated in.
+};
@@ -1,387 +1,3019 @@
 #pragma once
-#include <sstream>
 #include <map>
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <charconv>
+#include <span>
+#include <thread>
 #include "parser.hpp"
+#include "machine.hpp"
+#include "superopt.hpp"
+#include "compact.hpp"
+#include "visitor.hpp"
 #include <cassert>
 
-/// @brief Class to generate assembly code from the parse tree.
+/// @brief Class to generate machine instructions from the parse tree.
+///
+/// The parse tree must be resolved first, variables are addressed by the stack slots the resolver assigned.
+///
+/// A program sets up a frame for the runtime at the top of its stack, addressed through rbp, and the routines of the
+/// runtime are emitted after the program. Both only hold the parts of the runtime the program calls, a program that
+/// calls none gets neither. `print` appends to an output buffer in the frame, which is written to stdout with a single
+/// `write` when it fills up and before the program exits. `read` parses stdin out of an input buffer in the frame,
+/// refilled by a `read` of the whole buffer, and `arg` parses the arguments the program was started with. `alloc` bumps
+/// a pointer through a heap that is mapped on first use, and `reset` moves the pointer back to free a whole region of
+/// arrays at once. `map` maps a file read-only, into a table of the mapped files in the frame that `byte` and `word`
+/// check their loads against. A 'parallel for' runs its body as a routine on a pool of threads that is started on first
+/// use with `clone` and synchronized through futexes on words of the frame.
 class Generator
 {
 public:
+    /// @brief Set of the routines of the runtime, indexed by RuntimeSymbol.
+    using RuntimeCalls = std::bitset<runtime_symbol_count>;
+
+    /**
+     * @brief Constructs the generator with a given parse tree root.
+     *
+     * @param root The root of the parse tree.
+     * @param superopt_table Table of superoptimized sequences to consult, or nullptr to not use any.
+     * @param superopt_search Whether to search for sequences missing from the table and add them.
+     * @param kind How the program is entered and left.
+     */
+    Generator(NodeProg root, SuperoptTable *superopt_table = nullptr, const bool superopt_search = false,
+              const ProgramKind kind = ProgramKind::executable)
+        : m_prog(std::move(root)), m_superopt_table(superopt_table), m_superopt_search(superopt_search), m_kind(kind)
+    {
+        m_tasks.reserve(64);
+    }
+
+    /**
+     * @brief Generates machine instructions for an expression node.
+     *
+     * @param expr The expression node to generate code for.
+     */
+    void generate_expression(const NodeExpr *expr)
+    {
+        m_tasks.emplace_back(ExprTask{.expr = expr});
+        run_tasks();
+    }
+
+    /// @brief Generates machine instructions for a scope node.
+    /// @param scope NodeScope to generate code for.
+    void generate_scope(const NodeScope *scope)
+    {
+        const size_t base = m_tasks.size();
+        spill(base, expand_scope(scope, false, max_direct_depth));
+        run_tasks();
+    }
+
+    /**
+     * @brief Generates machine instructions for a statement node.
+     *
+     * @param stmt The statement node to generate code for.
+     */
+    void generate_statement(const NodeStmt *stmt)
+    {
+        const size_t base = m_tasks.size();
+        spill(base, expand_statement(stmt, max_direct_depth));
+        run_tasks();
+    }
+
+    /**
+     * @brief Makes room for the instructions of a program handed on one statement at a time, when their number is
+     * known beforehand.
+     *
+     * @param instr_count Number of instructions expected.
+     */
+    void reserve_instrs(const size_t instr_count)
+    {
+        m_instrs.reserve(instr_count);
+    }
+
+    /// @brief Code of a top-level statement, numbered from its first label so it can be reused at another place.
+    struct StmtCode
+    {
+        std::vector<MachineInstr> instrs; // The instructions, label IDs relative to the first label of the statement.
+        size_t label_count;               // Number of labels the statement created.
+        size_t var_count;                 // Number of variables the statement left on the stack.
+        RuntimeCalls calls;               // Routines of the runtime the statement calls.
+    };
+
+    /**
+     * @brief Generates machine instructions for a top-level statement and returns a copy of them for reusing later.
+     *
+     * @param stmt The statement node to generate code for.
+     * @return The code of the statement.
+     */
+    StmtCode generate_statement_code(const NodeStmt *stmt)
+    {
+        const size_t begin = m_instrs.size();
+        const size_t label_base = m_label_count;
+        const size_t var_count = m_var_count;
+        const RuntimeCalls calls = std::exchange(m_calls, {});
+        generate_statement(stmt);
+        StmtCode code{.instrs = std::vector(m_instrs.begin() + static_cast<std::ptrdiff_t>(begin), m_instrs.end()),
+                      .label_count = m_label_count - label_base,
+                      .var_count = m_var_count - var_count,
+                      .calls = m_calls};
+        shift_labels(code.instrs, -static_cast<int64_t>(label_base));
+        m_calls |= calls;
+        return code;
+    }
+
+    /**
+     * @brief Appends the code of a top-level statement generated earlier, instead of generating the statement again.
+     *
+     * The code only depends on the statement and on how far below the top of the stack the variables declared before
+     * it are, so it can be reused wherever those are the same. Its labels are moved after the ones created so far.
+     *
+     * @param code The code of the statement.
+     */
+    void append_statement_code(const StmtCode &code)
+    {
+        const size_t begin = m_instrs.size();
+        m_instrs.insert(m_instrs.end(), code.instrs.begin(), code.instrs.end());
+        if (code.label_count != 0)
+        {
+            shift_labels(std::span(m_instrs).subspan(begin), static_cast<int64_t>(m_label_count));
+        }
+        m_label_count += code.label_count;
+        m_stack_size += code.var_count;
+        m_var_count += code.var_count;
+        m_calls |= code.calls;
+    }
+
+    /**
+     * @brief Generates the machine instructions for the entire program.
+     *
+     * Large programs are split into chunks of top-level statements that are generated on up to `jobs` threads and
+     * concatenated. Every chunk starts from the stack depth and label ID the statements before it leave behind, so the
+     * output is the same as generating the statements one after another.
+     *
+     * @param jobs Maximum number of threads to generate on.
+     * @return The generated instructions, to be printed or encoded by the caller.
+     */
+    const std::vector<MachineInstr> &generate_program(const size_t jobs = 1)
+    {
+        // Searching the superoptimizer updates the shared table, so it is only done serially.
+        const size_t chunk_count = m_superopt_search ? 1 : std::min(jobs * chunks_per_job, m_prog.stmts.size() / min_chunk_stmts);
+        if (chunk_count > 1)
+        {
+            generate_chunks(chunk_count, std::min(jobs, chunk_count));
+        }
+        else
+        {
+            // Generate instructions for every statement in the parse tree.
+            for (const NodeStmt *stmt : m_prog.stmts)
+            {
+                generate_statement(stmt);
+            }
+        }
+        return finish_program();
+    }
+
+    /**
+     * @brief Generates the machine instructions for a program in the compact encoding.
+     *
+     * The compact tree is read directly, without decoding it back into a parse tree. Superoptimized sequences are
+     * matched on the parse tree, so they are not used here.
+     *
+     * @param ast The compact parse tree, which must outlive the call.
+     * @return The generated instructions, to be printed or encoded by the caller.
+     */
+    const std::vector<MachineInstr> &generate_compact_program(const CompactAst &ast)
+    {
+        m_compact = &ast;
+        for (size_t pos = 0; pos != ast.end();)
+        {
+            const size_t size = ast.read_varint(pos);
+            m_tasks.emplace_back(CompactStmtTask{.pos = pos});
+            run_tasks();
+            pos += size;
+        }
+        m_compact = nullptr;
+        return finish_program();
+    }
+
+    /**
+     * @brief Ends the program after its statements were generated, for programs handed on one statement at a time.
+     *
+     * Only the statements tell which parts of the runtime the program uses, so the start of the program is generated
+     * last and moved in front of them.
+     *
+     * @return The generated instructions, to be printed or encoded by the caller.
+     */
+    const std::vector<MachineInstr> &finish_program()
+    {
+        const bool begun = m_prologue_count.has_value();
+        if (!begun)
+        {
+            m_layout = layout_runtime();
+        }
+        end_runtime();
+        exit_with(Operand::imm(0));
+        generate_runtime();
+        if (!begun)
+        {
+            prepend_prologue();
+        }
+        m_labels = LabelTable(m_label_count - m_label_base, m_label_base);
+        return m_instrs;
+    }
+
+    /**
+     * @brief Hands over the instructions generated since the last call, for programs emitted one statement at a time.
+     *
+     * The labels of the instructions are moved to `labels`, and later instructions never jump to them. The start of
+     * the program is handed over before it is known which parts of the runtime the program uses, so it sets up all of
+     * them.
+     *
+     * @return The instructions generated since the last call.
+     */
+    std::vector<MachineInstr> take_instrs()
+    {
+        if (!m_prologue_count.has_value())
+        {
+            m_calls.set();
+            m_layout = layout_runtime();
+            prepend_prologue();
+        }
+        m_labels = LabelTable(m_label_count - m_label_base, m_label_base);
+        m_label_base = m_label_count;
+        return std::exchange(m_instrs, {});
+    }
+
+    /// @brief Number of instructions of the start of the program, in front of the statements once it is finished.
+    size_t prologue_count() const
+    {
+        return m_prologue_count.value_or(0);
+    }
+
+    /// @brief Routines of the runtime the program calls, which decide the runtime generated after it.
+    const RuntimeCalls &runtime_calls() const
+    {
+        return m_calls;
+    }
+
+    /// @brief Labels of the generated instructions.
+    LabelTable &labels()
+    {
+        return m_labels;
+    }
+
+    /**
+     * @brief Generates a program that only exits with a known code, for programs evaluated at compile time.
+     *
+     * @param exit_code The exit code of the program.
+     * @return The generated instructions, to be printed or encoded by the caller.
+     */
+    const std::vector<MachineInstr> &generate_exit_program(const uint64_t exit_code)
+    {
+        // Nothing is printed, so the program needs neither the runtime nor its frame.
+        const Operand code = Operand::imm(static_cast<int64_t>(exit_code));
+        if (m_kind == ProgramKind::function)
+        {
+            emit(Opcode::mov, Operand::reg(Reg::rax), code);
+            emit(Opcode::ret);
+            return m_instrs;
+        }
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(60));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), code);
+        emit(Opcode::syscall);
+        return m_instrs;
+    }
+
+private:
+    static constexpr size_t chunks_per_job = 4;       // Chunks per thread, so threads that finish early pick up more.
+    static constexpr size_t min_chunk_stmts = 256;    // Minimum number of top-level statements in a chunk.
+    static constexpr size_t parallel_label_count = 6; // Labels created by a 'parallel for', see `begin_parallel`.
+    static constexpr size_t max_direct_depth = 32;    // Nodes nested deeper go through the worklist.
+
+    // The runtime frame right below rbp holds the words of the runtime followed by its tables and buffers.
+    static constexpr int64_t input_buffer_size = 64 * 1024;  // Bytes of input buffered at most.
+    static constexpr int64_t output_buffer_size = 64 * 1024; // Bytes of output buffered at most.
+    static constexpr int64_t max_print_size = 21;            // Longest printed number and its newline.
+    static constexpr int64_t heap_size = int64_t{1} << 36;   // Bytes of address space reserved for the heap.
+    static constexpr int64_t max_maps = 16;                  // Files mapped at most, and the handle of a failed map.
+    static constexpr int64_t out_of_bounds_exit_code = 255;  // Exit code of a program loading out of a mapped file.
+    static constexpr int64_t max_threads = 64;               // Threads in the pool at most, including the main one.
+    static constexpr int64_t thread_stack_shift = 23;        // Log2 of the stack size of the other threads, 8 MiB.
+    static constexpr int64_t thread_entry_shift = 6;         // Log2 of the size of an entry of the thread table.
+    static constexpr int64_t clone_flags = 0x350F00;         // Flags of `clone` for a thread, see `generate_fork`.
+    static constexpr int64_t argv_offset = -8;               // Offset from rbp of argv.
+    static constexpr int64_t input_pos_offset = -16;         // Offset of the address of the next unread input byte.
+    static constexpr int64_t input_end_offset = -24;         // Offset of the address after the buffered input.
+    static constexpr int64_t input_eof_offset = -32;         // Offset of the flag set once stdin has ended.
+    static constexpr int64_t output_count_offset = -40;      // Offset of the number of buffered output bytes.
+    static constexpr int64_t heap_base_offset = -48;         // Offset of the address of the heap, 0 until it is mapped.
+    static constexpr int64_t heap_pos_offset = -56;          // Offset of the address of the next free heap byte.
+    static constexpr int64_t heap_end_offset = -64;          // Offset of the address after the heap.
+    static constexpr int64_t map_count_offset = -72;         // Offset of the number of mapped files.
+    static constexpr int64_t pool_size_offset = map_count_offset - 8;          // Threads in the pool, 0 until started.
+    static constexpr int64_t pool_stacks_offset = pool_size_offset - 8;        // Address of the stacks of the pool.
+    static constexpr int64_t pool_stacks_size_offset = pool_stacks_offset - 8; // Size of the stacks of the pool.
+    static constexpr int64_t pool_stop_offset = pool_stacks_size_offset - 8;   // Flag telling the pool to exit.
+    static constexpr int64_t job_gen_offset = pool_stop_offset - 8;            // Number of jobs started.
+    static constexpr int64_t job_routine_offset = job_gen_offset - 8;          // Address of the routine of the job.
+    static constexpr int64_t job_vars_offset = job_routine_offset - 8;         // Address of the variables it copies.
+    static constexpr int64_t job_lo_offset = job_vars_offset - 8;              // First index of the job.
+    static constexpr int64_t job_count_offset = job_lo_offset - 8;             // Number of indices of the job.
+    static constexpr int64_t job_chunk_offset = job_count_offset - 8;          // Number of indices in a chunk.
+    static constexpr int64_t job_chunks_offset = job_chunk_offset - 8;         // Number of chunks of the job.
+    static constexpr int64_t job_running_offset = job_chunks_offset - 8;       // Flag set while a job runs.
+    static constexpr int64_t job_failed_offset = job_running_offset - 8;       // Flag set by a failed load in a job.
+
+    /// @brief Parts of the runtime a program uses, and where their tables and buffers are in the frame.
+    ///
+    /// The words of the runtime have fixed offsets, the tables and buffers follow them only if they are used. A program
+    /// using no part of the runtime gets no frame.
+    struct RuntimeLayout
+    {
+        bool output = false;       // `print`, with `flush` and the output buffer.
+        bool input = false;        // `read`, with `fill` and the input buffer.
+        bool args = false;         // argv, found by `arg` and `map`, and the environment after it, by `fork`.
+        bool heap = false;         // `alloc` and `reset`.
+        bool files = false;        // `map`, `size`, `byte` and `word`, with the table of mapped files.
+        bool threads = false;      // `fork`, with the thread pool and the thread table.
+        int64_t map_table = 0;     // Offset of the address and size of every mapped file.
+        int64_t thread_table = 0;  // Offset of the generation of the last job done, sum and thread ID of every thread.
+        int64_t input_buffer = 0;  // Offset of the input buffer.
+        int64_t output_buffer = 0; // Offset of the output buffer.
+        int64_t frame_size = 0;    // Bytes of the frame, 0 without one.
+
+        /// @brief Whether the runtime holds memory or threads a function must release before returning.
+        bool holds_resources() const
+        {
+            return heap || files || threads;
+        }
+    };
+
+    /// @brief State of the generator at the start of a top-level statement.
+    struct StmtEntry
+    {
+        size_t var_count; // Number of variables declared by the statements before, all on the stack.
+        size_t label_id;  // ID of the first label created by the statement.
+    };
+
+    /// @brief Counts the labels created by the statements it visits.
+    struct LabelCounter : AstVisitor<LabelCounter>
+    {
+        size_t label_count = 0;
+
+        /// @brief Every 'if', however deeply nested, creates a label for each arm and one for its end.
+        bool enter_if(NodeStmtIf *stmt_if)
+        {
+            label_count += stmt_if->arms.size() + 1;
+            return true;
+        }
+
+        /// @brief Every 'parallel for' creates the labels of its routine, its body is counted as it is visited.
+        bool enter_parallel(NodeStmtParallel *)
+        {
+            label_count += parallel_label_count;
+            return true;
+        }
+
+        /// @brief Expressions create no labels.
+        bool enter_expr(NodeExpr *)
+        {
+            return false;
+        }
+    };
+
+    /**
+     * @brief Computes the state of the generator at the start of every top-level statement.
+     *
+     * @return The state at the start of every statement, followed by the state at the end of the program.
+     */
+    std::vector<StmtEntry> plan_statements() const
+    {
+        std::vector<StmtEntry> entries;
+        entries.reserve(m_prog.stmts.size() + 1);
+        StmtEntry entry{.var_count = 0, .label_id = 0};
+        LabelCounter counter;
+        for (NodeStmt *stmt : m_prog.stmts)
+        {
+            entries.push_back(entry);
+            if (std::holds_alternative<NodeStmtLet *>(stmt->var))
+            {
+                entry.var_count++;
+            }
+            counter.traverse_statement(stmt);
+            entry.label_id = counter.label_count;
+        }
+        entries.push_back(entry);
+        return entries;
+    }
+
+    /**
+     * @brief Constructs a generator for a chunk of the top-level statements of another one, which only generates the
+     * statements while the other one finishes the program.
+     *
+     * @param parent The generator of the whole program.
+     * @param entry State of the generator at the first statement of the chunk.
+     */
+    Generator(const Generator &parent, const StmtEntry &entry)
+        : m_superopt_table(parent.m_superopt_table), m_superopt_search(false), m_kind(parent.m_kind),
+          m_stack_size(entry.var_count), m_var_count(entry.var_count), m_label_count(entry.label_id)
+    {
+        m_tasks.reserve(64);
+    }
+
+    /**
+     * @brief Finds the parts of the runtime used by the routines the program calls, and lays out their frame.
+     *
+     * @return The layout of the runtime.
+     */
+    RuntimeLayout layout_runtime() const
+    {
+        const auto calls = [this](const std::initializer_list<RuntimeSymbol> symbols)
+        {
+            return std::ranges::any_of(symbols, [this](const RuntimeSymbol symbol)
+                                       { return m_calls.test(static_cast<size_t>(symbol)); });
+        };
+        RuntimeLayout layout{
+            .output = calls({RuntimeSymbol::print}),
+            .input = calls({RuntimeSymbol::read}),
+            .args = calls({RuntimeSymbol::arg, RuntimeSymbol::map, RuntimeSymbol::fork}),
+            .heap = calls({RuntimeSymbol::alloc, RuntimeSymbol::reset}),
+            .files = calls({RuntimeSymbol::map, RuntimeSymbol::size, RuntimeSymbol::byte, RuntimeSymbol::word}),
+            .threads = calls({RuntimeSymbol::fork}),
+        };
+        if (!layout.output && !layout.input && !layout.args && !layout.holds_resources())
+        {
+            return layout;
+        }
+
+        // The input buffer has 8 spare bytes after it, so a zeroed QWORD can always follow the buffered input and the
+        // input be scanned 8 bytes at a time without taking stale bytes for digits.
+        int64_t offset = job_failed_offset;
+        if (layout.files)
+        {
+            offset -= max_maps * 16;
+            layout.map_table = offset;
+        }
+        if (layout.threads)
+        {
+            offset -= max_threads << thread_entry_shift;
+            layout.thread_table = offset;
+        }
+        if (layout.input)
+        {
+            offset -= 8 + input_buffer_size;
+            layout.input_buffer = offset;
+        }
+        if (layout.output)
+        {
+            offset -= output_buffer_size;
+            layout.output_buffer = offset;
+        }
+        layout.frame_size = -offset;
+        return layout;
+    }
+
+    /// @brief Generates the start of the program in front of the instructions generated so far.
+    void prepend_prologue()
+    {
+        const auto body_end = static_cast<std::ptrdiff_t>(m_instrs.size());
+        begin_program();
+        m_prologue_count = m_instrs.size() - static_cast<size_t>(body_end);
+        std::rotate(m_instrs.begin(), m_instrs.begin() + body_end, m_instrs.end());
+    }
+
+    /// @brief Sets up the stack frame of the runtime at the start of the program, with the parts it uses.
+    void begin_program()
+    {
+        // A function saves the callee-saved registers it uses, to restore them on return along with the stack.
+        if (m_kind == ProgramKind::function)
+        {
+            emit(Opcode::push, Operand::reg(Reg::rbx));
+            emit(Opcode::push, Operand::reg(Reg::rbp));
+            emit(Opcode::mov, Operand::reg(Reg::rbp), Operand::reg(Reg::rsp));
+        }
+        if (m_layout.frame_size == 0)
+        {
+            return;
+        }
+        if (m_kind != ProgramKind::function)
+        {
+            emit(Opcode::mov, Operand::reg(Reg::rbp), Operand::reg(Reg::rsp));
+        }
+        emit(Opcode::sub, Operand::reg(Reg::rsp), Operand::imm(m_layout.frame_size));
+
+        // A function takes argc and argv like `main`, an executable finds them at the top of its stack.
+        if (m_layout.args && m_kind == ProgramKind::function)
+        {
+            emit(Opcode::mov, Operand::mem(Reg::rbp, argv_offset), Operand::reg(Reg::rsi));
+        }
+        else if (m_layout.args)
+        {
+            emit(Opcode::lea, Operand::reg(Reg::rax), Operand::mem(Reg::rbp, 8));
+            emit(Opcode::mov, Operand::mem(Reg::rbp, argv_offset), Operand::reg(Reg::rax));
+        }
+        if (m_layout.input)
+        {
+            emit(Opcode::lea, Operand::reg(Reg::rax), Operand::mem(Reg::rbp, m_layout.input_buffer));
+            emit(Opcode::mov, Operand::mem(Reg::rbp, input_pos_offset), Operand::reg(Reg::rax));
+            emit(Opcode::mov, Operand::mem(Reg::rbp, input_end_offset), Operand::reg(Reg::rax));
+            emit(Opcode::mov, Operand::mem(Reg::rbp, input_eof_offset), Operand::imm(0));
+        }
+        if (m_layout.output)
+        {
+            emit(Opcode::mov, Operand::mem(Reg::rbp, output_count_offset), Operand::imm(0));
+        }
+        if (m_layout.heap)
+        {
+            emit(Opcode::mov, Operand::mem(Reg::rbp, heap_base_offset), Operand::imm(0));
+            emit(Opcode::mov, Operand::mem(Reg::rbp, heap_pos_offset), Operand::imm(0));
+            emit(Opcode::mov, Operand::mem(Reg::rbp, heap_end_offset), Operand::imm(0));
+        }
+        if (m_layout.files)
+        {
+            emit(Opcode::mov, Operand::mem(Reg::rbp, map_count_offset), Operand::imm(0));
+        }
+        if (m_layout.threads)
+        {
+            emit(Opcode::mov, Operand::mem(Reg::rbp, pool_size_offset), Operand::imm(0));
+            emit(Opcode::mov, Operand::mem(Reg::rbp, pool_stop_offset), Operand::imm(0));
+            emit(Opcode::mov, Operand::mem(Reg::rbp, job_gen_offset), Operand::imm(0));
+            emit(Opcode::mov, Operand::mem(Reg::rbp, job_running_offset), Operand::imm(0));
+        }
+    }
+
+    /**
+     * @brief Generates the top-level statements in chunks on a pool of threads and concatenates the results.
+     *
+     * @param chunk_count Number of chunks to split the statements into.
+     * @param thread_count Number of threads to generate on, including the calling one.
+     */
+    void generate_chunks(const size_t chunk_count, const size_t thread_count)
+    {
+        const std::vector<StmtEntry> entries = plan_statements();
+        const size_t stmt_count = m_prog.stmts.size();
+        std::vector<std::vector<MachineInstr>> outputs(chunk_count);
+        std::vector<RuntimeCalls> calls(chunk_count);
+        std::atomic<size_t> next_chunk = 0;
+        const auto worker = [&]
+        {
+            for (size_t chunk = next_chunk++; chunk < chunk_count; chunk = next_chunk++)
+            {
+                const size_t begin = stmt_count * chunk / chunk_count;
+                const size_t end = stmt_count * (chunk + 1) / chunk_count;
+                Generator gen(*this, entries[begin]);
+                for (size_t i = begin; i < end; i++)
+                {
+                    gen.generate_statement(m_prog.stmts[i]);
+                }
+                assert(gen.m_label_count == entries[end].label_id);
+                outputs[chunk] = std::move(gen.m_instrs);
+                calls[chunk] = gen.m_calls;
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < thread_count; i++)
+        {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+
+        size_t instr_count = 0;
+        for (const std::vector<MachineInstr> &output : outputs)
+        {
+            instr_count += output.size();
+        }
+        m_instrs.reserve(instr_count + 3);
+        for (const std::vector<MachineInstr> &output : outputs)
+        {
+            m_instrs.insert(m_instrs.end(), output.cbegin(), output.cend());
+        }
+        for (const RuntimeCalls &chunk_calls : calls)
+        {
+            m_calls |= chunk_calls;
+        }
+        m_stack_size = entries.back().var_count;
+        m_var_count = entries.back().var_count;
+        m_label_count = entries.back().label_id;
+    }
+
+    // Code generation recurses through the parse tree only `max_direct_depth` levels deep and hands the rest to an
+    // explicit worklist, so the depth of the input does not cost native stack. Each node pushes tasks for its children
+    // followed by a task that finishes it; the worklist is a stack, so tasks are pushed in reverse of the order they
+    // run in.
+
+    /// @brief Generate an expression, leaving its value pushed on the stack.
+    struct ExprTask
+    {
+        const NodeExpr *expr;
+    };
+
+    /// @brief Combine the two operands of a binary expression on the stack.
+    struct BinExprEndTask
+    {
+        AstKind op; // The kind of the binary expression.
+    };
+
+    /// @brief Generate a statement.
+    struct StmtTask
+    {
+        const NodeStmt *stmt;
+    };
+
+    /// @brief Drop the variables of a scope.
+    struct ScopeEndTask
+    {
+        bool is_stmt; // Whether the scope is a scope statement rather than the body of an 'if'.
+    };
+
+    /// @brief Exit with the value on the stack.
+    struct ExitEndTask
+    {
+    };
+
+    /// @brief Print the value on the stack.
+    struct PrintEndTask
+    {
+    };
+
+    /// @brief Replace the value on the stack by the result of a runtime routine called on it.
+    struct CallEndTask
+    {
+        RuntimeSymbol symbol; // The routine, taking and returning its value in rax.
+        bool pair = false;    // Whether the routine takes the two values on the stack, the top one in rbx.
+    };
+
+    /// @brief Finish a 'let', its value on the stack is the variable.
+    struct LetEndTask
+    {
+    };
+
+    /// @brief Store the value on the stack into a variable.
+    struct AssignEndTask
+    {
+        size_t slot; // The stack slot of the variable.
+    };
+
+    /// @brief Replace the index on the stack by the element of an array.
+    struct IndexEndTask
+    {
+        size_t slot; // The stack slot of the variable holding the address of the array.
+    };
+
+    /// @brief Store the value on the stack into an element of an array, its index is on the stack below it.
+    struct StoreEndTask
+    {
+        size_t slot; // The stack slot of the variable holding the address of the array.
+    };
+
+    /// @brief Free the array whose address is on the stack and every array allocated after it.
+    struct ResetEndTask
+    {
+    };
+
+    /// @brief Test the condition of an arm on the stack and generate the arm.
+    struct IfArmTask
+    {
+        const NodeStmtIf *stmt_if;
+        size_t arm;       // Index of the arm.
+        size_t end_label; // Label after the whole 'if' statement.
+    };
+
+    /// @brief Finish an arm and move on to the next arm or the 'else'.
+    struct IfArmEndTask
+    {
+        const NodeStmtIf *stmt_if;
+        size_t arm;       // Index of the arm.
+        size_t end_label; // Label after the whole 'if' statement.
+        size_t label;     // Label of the next arm.
+    };
+
+    /// @brief Finish an 'if' statement.
+    struct IfEndTask
+    {
+        size_t end_label; // Label after the whole 'if' statement.
+    };
+
+    /// @brief Finish the body of a 'parallel for' and the routine running it.
+    struct ForBodyEndTask
+    {
+        size_t labels;             // First label of the loop.
+        size_t copied;             // Number of variables the routine copies.
+        std::optional<size_t> sum; // The stack slot of the sum variable, if any.
+    };
+
+    /// @brief Run the routine of a 'parallel for' over the bounds on the stack and add up its sum.
+    struct ForkEndTask
+    {
+        size_t labels;             // First label of the loop.
+        bool chunked;              // Whether the chunk size is on the stack, above the bounds.
+        std::optional<size_t> sum; // The stack slot of the sum variable, if any.
+    };
+
+    // Tasks reading the compact parse tree refer to nodes by their offset in it.
+
+    /// @brief Generate an expression of the compact parse tree.
+    struct CompactExprTask
+    {
+        size_t pos;
+    };
+
+    /// @brief Generate a statement of the compact parse tree.
+    struct CompactStmtTask
+    {
+        size_t pos;
+    };
+
+    /// @brief Generate the remaining statements of a scope of the compact parse tree, one at a time.
+    struct CompactStmtsTask
+    {
+        size_t pos;   // Offset of the next statement, including its size if it is not the last.
+        size_t count; // Number of statements left.
+    };
+
+    /// @brief Generate a scope of the compact parse tree, without the scope comments of a scope statement.
+    struct CompactScopeTask
+    {
+        size_t pos;
+    };
+
+    /// @brief Test the condition of an arm on the stack and generate the arm of a compact 'if'.
+    struct CompactIfArmTask
+    {
+        size_t pos;       // Offset of the scope of the arm, including its size if it is not the last child.
+        size_t arm_count; // Number of arms left, including this one.
+        bool has_else;    // Whether the 'if' has an 'else'.
+        size_t end_label; // Label after the whole 'if' statement.
+    };
+
+    /// @brief Finish an arm of a compact 'if' and move on to the next arm or the 'else'.
+    struct CompactIfArmEndTask
+    {
+        size_t pos;       // Offset of the next arm or the 'else' scope.
+        size_t arm_count; // Number of arms left, including this one.
+        bool has_else;    // Whether the 'if' has an 'else'.
+        size_t end_label; // Label after the whole 'if' statement.
+        size_t label;     // Label of the next arm.
+    };
+
+    using Task = std::variant<
+        ExprTask,
+        BinExprEndTask,
+        StmtTask,
+        ScopeEndTask,
+        ExitEndTask,
+        PrintEndTask,
+        CallEndTask,
+        LetEndTask,
+        AssignEndTask,
+        IndexEndTask,
+        StoreEndTask,
+        ResetEndTask,
+        IfArmTask,
+        IfArmEndTask,
+        IfEndTask,
+        ForBodyEndTask,
+        ForkEndTask,
+        CompactExprTask,
+        CompactStmtTask,
+        CompactStmtsTask,
+        CompactScopeTask,
+        CompactIfArmTask,
+        CompactIfArmEndTask>;
+
+    /// @brief Runs a task, which may generate code and push further tasks.
+    struct TaskVisitor
+    {
+        Generator &gen;
+
+        void operator()(const ExprTask &task) const
+        {
+            const size_t base = gen.m_tasks.size();
+            gen.spill(base, gen.expand_expression(task.expr, max_direct_depth));
+        }
+
+        void operator()(const BinExprEndTask &task) const
+        {
+            gen.finish_binary_expression(task.op);
+        }
+
+        void operator()(const StmtTask &task) const
+        {
+            const size_t base = gen.m_tasks.size();
+            gen.spill(base, gen.expand_statement(task.stmt, max_direct_depth));
+        }
+
+        void operator()(const ScopeEndTask &task) const
+        {
+            gen.end_scope();
+            if (task.is_stmt)
+            {
+                gen.comment("/scope");
+            }
+        }
+
+        void operator()(const ExitEndTask &) const
+        {
+            // What is left of the runtime is only known once the program is finished, so a routine leaves it.
+            gen.pop(Reg::rdi);
+            gen.call_runtime(RuntimeSymbol::exit);
+            gen.comment("/exit");
+        }
+
+        void operator()(const PrintEndTask &) const
+        {
+            gen.pop(Reg::rax);
+            gen.call_runtime(RuntimeSymbol::print);
+            gen.comment("/print");
+        }
+
+        void operator()(const CallEndTask &task) const
+        {
+            if (task.pair)
+            {
+                gen.pop(Reg::rbx);
+            }
+            gen.pop(Reg::rax);
+            gen.call_runtime(task.symbol);
+            gen.push(Operand::reg(Reg::rax));
+        }
+
+        void operator()(const LetEndTask &) const
+        {
+            gen.comment("/let");
+        }
+
+        void operator()(const AssignEndTask &task) const
+        {
+            gen.pop(Reg::rax);
+            gen.emit(
+                Opcode::mov,
+                Operand::mem(Reg::rsp, static_cast<int64_t>((gen.m_stack_size - task.slot - 1) * 8)),
+                Operand::reg(Reg::rax));
+            gen.comment("/reassign");
+        }
+
+        void operator()(const IndexEndTask &task) const
+        {
+            gen.pop(Reg::rax);
+            gen.emit(Opcode::mov, Operand::reg(Reg::rbx), gen.variable(task.slot));
+            gen.push(Operand::mem(Reg::rbx, Reg::rax, 8));
+        }
+
+        void operator()(const StoreEndTask &task) const
+        {
+            gen.pop(Reg::rcx);
+            gen.pop(Reg::rax);
+            gen.emit(Opcode::mov, Operand::reg(Reg::rbx), gen.variable(task.slot));
+            gen.emit(Opcode::mov, Operand::mem(Reg::rbx, Reg::rax, 8), Operand::reg(Reg::rcx));
+            gen.comment("/store");
+        }
+
+        void operator()(const ResetEndTask &) const
+        {
+            gen.pop(Reg::rax);
+            gen.call_runtime(RuntimeSymbol::reset);
+            gen.comment("/reset");
+        }
+
+        void operator()(const IfArmTask &task) const
+        {
+            const size_t base = gen.m_tasks.size();
+            const bool finished = gen.expand_if_arm(task.stmt_if, task.arm, task.end_label, max_direct_depth) &&
+                                  gen.expand_if_arms(task.stmt_if, task.arm + 1, task.end_label, max_direct_depth);
+            gen.spill(base, finished);
+        }
+
+        void operator()(const IfArmEndTask &task) const
+        {
+            const NodeStmtIf *stmt_if = task.stmt_if;
+            gen.end_if_arm(
+                task.arm + 1 == stmt_if->arms.size(), stmt_if->else_scope.has_value(), task.end_label, task.label);
+            const size_t base = gen.m_tasks.size();
+            gen.spill(base, gen.expand_if_arms(stmt_if, task.arm + 1, task.end_label, max_direct_depth));
+        }
+
+        void operator()(const IfEndTask &task) const
+        {
+            gen.emit(Opcode::label, Operand::label(task.end_label));
+            gen.comment("/if");
+        }
+
+        void operator()(const ForBodyEndTask &task) const
+        {
+            gen.end_parallel_body(task.labels, task.copied, task.sum);
+        }
+
+        void operator()(const ForkEndTask &task) const
+        {
+            if (task.chunked)
+            {
+                gen.pop(Reg::rcx);
+            }
+            else
+            {
+                gen.emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::imm(0));
+            }
+            gen.pop(Reg::rbx);
+            gen.pop(Reg::rax);
+            gen.emit(Opcode::lea, Operand::reg(Reg::rdx), Operand::label(task.labels));
+            gen.call_runtime(RuntimeSymbol::fork);
+            if (task.sum.has_value())
+            {
+                gen.emit(Opcode::add, gen.variable(task.sum.value()), Operand::reg(Reg::rax));
+            }
+            gen.comment("/parallel");
+        }
+
+        void operator()(const CompactExprTask &task) const
+        {
+            gen.expand_compact_expression(task.pos);
+        }
+
+        void operator()(const CompactStmtTask &task) const
+        {
+            gen.expand_compact_statement(task.pos);
+        }
+
+        void operator()(const CompactStmtsTask &task) const
+        {
+            size_t pos = task.pos;
+            if (task.count != 1)
+            {
+                const size_t size = gen.m_compact->read_varint(pos);
+                gen.m_tasks.emplace_back(CompactStmtsTask{.pos = pos + size, .count = task.count - 1});
+            }
+            gen.m_tasks.emplace_back(CompactStmtTask{.pos = pos});
+        }
+
+        void operator()(const CompactScopeTask &task) const
+        {
+            gen.expand_compact_scope(task.pos, false);
+        }
+
+        void operator()(const CompactIfArmTask &task) const
+        {
+            const size_t label = gen.test_condition();
+
+            // The scope of the last arm is the last child unless there is an 'else'.
+            size_t pos = task.pos;
+            size_t next = 0;
+            if (task.arm_count != 1 || task.has_else)
+            {
+                const size_t size = gen.m_compact->read_varint(pos);
+                next = pos + size;
+            }
+            gen.m_tasks.emplace_back(CompactIfArmEndTask{
+                .pos = next,
+                .arm_count = task.arm_count,
+                .has_else = task.has_else,
+                .end_label = task.end_label,
+                .label = label,
+            });
+            gen.m_tasks.emplace_back(CompactScopeTask{.pos = pos});
+        }
+
+        void operator()(const CompactIfArmEndTask &task) const
+        {
+            gen.end_if_arm(task.arm_count == 1, task.has_else, task.end_label, task.label);
+            if (task.arm_count != 1)
+            {
+                gen.comment("elif");
+                gen.push_compact_if_arm(task.pos, task.arm_count - 1, task.has_else, task.end_label);
+                return;
+            }
+            gen.m_tasks.emplace_back(IfEndTask{.end_label = task.end_label});
+            if (task.has_else)
+            {
+                gen.comment("else");
+                gen.m_tasks.emplace_back(CompactScopeTask{.pos = task.pos});
+            }
+        }
+    };
+
+    /**
+     * @brief Runs tasks until only the ones below the worklist entry `base` are left.
+     *
+     * @param base Number of tasks to leave on the worklist.
+     */
+    void run_tasks(const size_t base = 0)
+    {
+        TaskVisitor visitor{.gen = *this};
+        while (m_tasks.size() != base)
+        {
+            const Task task = m_tasks.back();
+            m_tasks.pop_back();
+            std::visit(visitor, task);
+        }
+    }
+
+    /**
+     * @brief Generates an expression by recursion, handing the parts nested too deep for that to the worklist.
+     *
+     * @param expr The expression node to generate code for.
+     * @param depth How many levels deep the expression may be generated by recursion, at least 1.
+     * @return Whether it was generated entirely. If not, the tasks for the rest were added in the order they run, see
+     * `expand_operands`.
+     */
+    bool expand_expression(const NodeExpr *expr, const size_t depth)
+    {
+        if (m_superopt_table != nullptr && generate_superoptimized(expr))
+        {
+            return true;
+        }
+
+        struct ExprVisitor
+        {
+            Generator &gen;
+            size_t depth;
+
+            bool operator()(const NodeTerm *node_term) const
+            {
+                return gen.expand_term(node_term, depth);
+            }
+
+            bool operator()(const NodeBinExpr *bin_expr) const
+            {
+                const auto [lhs, rhs] = std::visit([](const auto *bin) { return std::pair<const NodeExpr *, const NodeExpr *>(bin->lhs, bin->rhs); }, bin_expr->var);
+
+                // Pushing both lhs and rhs on the stack, lhs first so input is read from left to right.
+                return gen.expand_operands({lhs, rhs}, BinExprEndTask{.op = kind_of(bin_expr)}, depth);
+            }
+        };
+
+        ExprVisitor visitor{.gen = *this, .depth = depth};
+        return std::visit(visitor, expr->var);
+    }
+
+    /**
+     * @brief Generates the operands of a node by recursion and then finishes the node.
+     *
+     * Once an operand is nested deeper than `depth`, the operand, the ones after it and the end are added to the
+     * worklist instead, in the order they run, and so are the rest of the nodes it is nested in as the recursion
+     * returns. The code generated up to there is kept, and `spill` puts the tasks in the order the worklist takes
+     * them, so every node is generated once and the native stack stays bounded however deep the input is nested.
+     *
+     * @param operands The operands, in the order their values are pushed.
+     * @param end The task finishing the node once the operands are on the stack.
+     * @param depth How many levels deep the node may be generated by recursion, at least 1.
+     * @return Whether the node was generated entirely.
+     */
+    template <typename EndTask>
+    bool expand_operands(const std::initializer_list<const NodeExpr *> operands, const EndTask &end, const size_t depth)
+    {
+        for (auto it = operands.begin(); it != operands.end(); ++it)
+        {
+            if (depth == 1)
+            {
+                m_tasks.emplace_back(ExprTask{.expr = *it});
+            }
+            else if (expand_expression(*it, depth - 1))
+            {
+                continue;
+            }
+            for (++it; it != operands.end(); ++it)
+            {
+                m_tasks.emplace_back(ExprTask{.expr = *it});
+            }
+            m_tasks.emplace_back(end);
+            return false;
+        }
+        TaskVisitor{.gen = *this}(end);
+        return true;
+    }
+
+    /**
+     * @brief Reverses the tasks added by a recursion that did not finish, so the worklist takes them in order.
+     *
+     * @param base Number of tasks on the worklist before the recursion.
+     * @param finished Whether the recursion finished without adding tasks.
+     */
+    void spill(const size_t base, const bool finished)
+    {
+        if (!finished)
+        {
+            std::reverse(m_tasks.begin() + static_cast<std::ptrdiff_t>(base), m_tasks.end());
+        }
+    }
+
+    /**
+     * @brief Generates machine instructions for a term node.
+     *
+     * @param term The term node to generate code for.
+     * @param depth How many levels deep the term may be generated by recursion, see `expand_expression`.
+     * @return Whether the term was generated entirely.
+     */
+    bool expand_term(const NodeTerm *term, const size_t depth)
+    {
+        struct TermVisitor
+        {
+            Generator &gen;
+            size_t depth;
+
+            bool operator()(const NodeTermIntLit *term_int_lit) const
+            {
+                const std::string_view lit = term_int_lit->int_lit.value;
+                uint64_t value = 0;
+                if (std::from_chars(lit.data(), lit.data() + lit.size(), value).ec != std::errc{})
+                {
+                    std::cerr << "Integer literal out of range: " << lit << "\n";
+                    exit(EXIT_FAILURE);
+                }
+                gen.emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(static_cast<int64_t>(value)));
+                gen.push(Operand::reg(Reg::rax));
+                return true;
+            }
+
+            bool operator()(const NodeTermIdent *term_ident) const
+            {
+                // Make a copy of the value from the position in stack again on stack (Multiply by 8 for bytes).
+                gen.push(Operand::mem(Reg::rsp, static_cast<int64_t>((gen.m_stack_size - term_ident->slot - 1) * 8)));
+                return true;
+            }
+
+            bool operator()(const NodeTermParen *term_paren) const
+            {
+                if (depth == 1)
+                {
+                    gen.m_tasks.emplace_back(ExprTask{.expr = term_paren->expr});
+                    return false;
+                }
+                return gen.expand_expression(term_paren->expr, depth - 1);
+            }
+
+            bool operator()(const NodeTermArg *term_arg) const
+            {
+                return gen.expand_operands({term_arg->expr}, CallEndTask{.symbol = RuntimeSymbol::arg}, depth);
+            }
+
+            bool operator()(const NodeTermRead *) const
+            {
+                gen.call_runtime(RuntimeSymbol::read);
+                gen.push(Operand::reg(Reg::rax));
+                return true;
+            }
+
+            bool operator()(const NodeTermAlloc *term_alloc) const
+            {
+                return gen.expand_operands({term_alloc->expr}, CallEndTask{.symbol = RuntimeSymbol::alloc}, depth);
+            }
+
+            bool operator()(const NodeTermIndex *term_index) const
+            {
+                return gen.expand_operands({term_index->index}, IndexEndTask{.slot = term_index->array.slot}, depth);
+            }
+
+            bool operator()(const NodeTermMap *term_map) const
+            {
+                return gen.expand_operands({term_map->expr}, CallEndTask{.symbol = RuntimeSymbol::map}, depth);
+            }
+
+            bool operator()(const NodeTermSize *term_size) const
+            {
+                return gen.expand_operands({term_size->expr}, CallEndTask{.symbol = RuntimeSymbol::size}, depth);
+            }
+
+            bool operator()(const NodeTermLoad *term_load) const
+            {
+                const RuntimeSymbol symbol = term_load->word ? RuntimeSymbol::word : RuntimeSymbol::byte;
+                const CallEndTask end{.symbol = symbol, .pair = true};
+                return gen.expand_operands({term_load->file, term_load->index}, end, depth);
+            }
+        };
+
+        TermVisitor visitor{.gen = *this, .depth = depth};
+        return std::visit(visitor, term->var);
+    }
+
+    /// @brief Generates the operation of a binary expression whose operands are on the stack.
+    /// @param op The kind of the binary expression.
+    void finish_binary_expression(const AstKind op)
+    {
+        pop(Reg::rbx);
+        pop(Reg::rax);
+        switch (op)
+        {
+        case AstKind::add:
+            emit(Opcode::add, Operand::reg(Reg::rax), Operand::reg(Reg::rbx));
+            break;
+        case AstKind::mul:
+            emit(Opcode::mul, Operand::reg(Reg::rbx));
+            break;
+        case AstKind::sub:
+            emit(Opcode::sub, Operand::reg(Reg::rax), Operand::reg(Reg::rbx));
+            break;
+        case AstKind::div:
+            // `div` divides rdx:rax, so clear the upper half left over from earlier `mul`s.
+            emit(Opcode::xor_, Operand::reg(Reg::rdx), Operand::reg(Reg::rdx));
+            emit(Opcode::div, Operand::reg(Reg::rbx));
+            break;
+        default:
+            assert(false);
+        }
+
+        // Putting result back on stack.
+        push(Operand::reg(Reg::rax));
+    }
+
+    /**
+     * @brief Generates a scope by recursion, handing the statements nested too deep for that to the worklist.
+     *
+     * Once a statement is not generated entirely, the statements after it and the end of the scope are added to the
+     * worklist in the order they run, see `expand_operands`.
+     *
+     * @param scope NodeScope to generate code for.
+     * @param is_stmt Whether the scope is a scope statement rather than the body of an 'if'.
+     * @param depth How many levels deep the scope may be generated by recursion, at least 1.
+     * @return Whether it was generated entirely.
+     */
+    bool expand_scope(const NodeScope *scope, const bool is_stmt, const size_t depth)
+    {
+        begin_scope();
+        for (auto it = scope->stmts.begin(); it != scope->stmts.end(); ++it)
+        {
+            if (expand_statement(*it, depth))
+            {
+                continue;
+            }
+            for (++it; it != scope->stmts.end(); ++it)
+            {
+                m_tasks.emplace_back(StmtTask{.stmt = *it});
+            }
+            m_tasks.emplace_back(ScopeEndTask{.is_stmt = is_stmt});
+            return false;
+        }
+        TaskVisitor{.gen = *this}(ScopeEndTask{.is_stmt = is_stmt});
+        return true;
+    }
+
+    /// @brief Whether a statement has a scope of its own, such as an 'if'.
+    static bool has_scope(const NodeStmt *stmt)
+    {
+        return std::holds_alternative<NodeScope *>(stmt->var) || std::holds_alternative<NodeStmtIf *>(stmt->var) ||
+               std::holds_alternative<NodeStmtParallel *>(stmt->var);
+    }
+
+    /**
+     * @brief Generates a statement by recursion, handing the parts nested too deep for that to the worklist.
+     *
+     * @param stmt The statement node to generate code for.
+     * @param depth How many levels deep the statement may be generated by recursion, at least 1. A statement with a
+     * scope of its own is added to the worklist whole at 1.
+     * @return Whether it was generated entirely. If not, the tasks for the rest were added in the order they run.
+     */
+    bool expand_statement(const NodeStmt *stmt, const size_t depth)
+    {
+        if (depth == 1 && has_scope(stmt))
+        {
+            m_tasks.emplace_back(StmtTask{.stmt = stmt});
+            return false;
+        }
+
+        struct StmtVisitor
+        {
+            Generator &gen;
+            size_t depth;
+
+            bool operator()(const NodeStmtExit *stmt_exit) const
+            {
+                gen.comment("exit");
+                return gen.expand_operands({stmt_exit->expr}, ExitEndTask{}, depth);
+            }
+
+            bool operator()(const NodeStmtPrint *stmt_print) const
+            {
+                gen.comment("print");
+                return gen.expand_operands({stmt_print->expr}, PrintEndTask{}, depth);
+            }
+
+            bool operator()(const NodeStmtLet *stmt_let) const
+            {
+                gen.comment("let");
+                // The value of the expression is left on the stack in the variable's slot.
+                assert(stmt_let->slot == gen.m_stack_size);
+                gen.m_var_count++;
+                return gen.expand_operands({stmt_let->expr}, LetEndTask{}, depth);
+            }
+
+            bool operator()(const NodeStmtAssign *stmt_assign) const
+            {
+                gen.comment("reassign");
+                return gen.expand_operands({stmt_assign->expr}, AssignEndTask{.slot = stmt_assign->slot}, depth);
+            }
+
+            bool operator()(const NodeStmtStore *stmt_store) const
+            {
+                gen.comment("store");
+                const StoreEndTask end{.slot = stmt_store->array.slot};
+                return gen.expand_operands({stmt_store->index, stmt_store->expr}, end, depth);
+            }
+
+            bool operator()(const NodeStmtReset *stmt_reset) const
+            {
+                gen.comment("reset");
+                return gen.expand_operands({stmt_reset->expr}, ResetEndTask{}, depth);
+            }
+
+            bool operator()(const NodeScope *stmt_scope) const
+            {
+                gen.comment("scope");
+                return gen.expand_scope(stmt_scope, true, depth - 1);
+            }
+
+            bool operator()(const NodeStmtIf *stmt_if) const
+            {
+                gen.comment("if");
+                const size_t end_label = gen.create_label();
+                return gen.expand_if_arms(stmt_if, 0, end_label, depth);
+            }
+
+            bool operator()(const NodeStmtParallel *stmt_parallel) const
+            {
+                gen.comment("parallel");
+                assert(stmt_parallel->slot == gen.m_stack_size);
+                std::optional<size_t> sum;
+                if (stmt_parallel->sum.has_value())
+                {
+                    sum = stmt_parallel->sum->slot;
+                }
+                const size_t labels = gen.begin_parallel(stmt_parallel->copied, sum);
+
+                // The routine comes first, the bounds are only pushed once it is done.
+                const ForBodyEndTask body_end{.labels = labels, .copied = stmt_parallel->copied, .sum = sum};
+                const ForkEndTask end{.labels = labels, .chunked = stmt_parallel->chunk != nullptr, .sum = sum};
+                if (!gen.expand_scope(stmt_parallel->scope, false, depth - 1))
+                {
+                    gen.m_tasks.emplace_back(body_end);
+                    gen.m_tasks.emplace_back(ExprTask{.expr = stmt_parallel->lo});
+                    gen.m_tasks.emplace_back(ExprTask{.expr = stmt_parallel->hi});
+                    if (stmt_parallel->chunk != nullptr)
+                    {
+                        gen.m_tasks.emplace_back(ExprTask{.expr = stmt_parallel->chunk});
+                    }
+                    gen.m_tasks.emplace_back(end);
+                    return false;
+                }
+                TaskVisitor{.gen = gen}(body_end);
+                if (stmt_parallel->chunk != nullptr)
+                {
+                    return gen.expand_operands({stmt_parallel->lo, stmt_parallel->hi, stmt_parallel->chunk}, end, depth);
+                }
+                return gen.expand_operands({stmt_parallel->lo, stmt_parallel->hi}, end, depth);
+            }
+        };
+
+        StmtVisitor visitor{.gen = *this, .depth = depth};
+        return std::visit(visitor, stmt->var);
+    }
+
+    /**
+     * @brief Generates the arms of an 'if' statement from a given one on, and its 'else', by recursion.
+     *
+     * The arms are generated in a loop, so the native stack stays bounded however long the elif chain is. Once a
+     * condition or a scope is not generated entirely, the task finishing its arm is added after the tasks for the rest
+     * of it, and that task goes on with the next arm.
+     *
+     * @param stmt_if The 'if' statement.
+     * @param arm Index of the first arm to generate, the number of arms for only the 'else'.
+     * @param end_label Label after the whole 'if' statement.
+     * @param depth How many levels deep the 'if' may be generated by recursion, at least 2.
+     * @return Whether it was generated entirely.
+     */
+    bool expand_if_arms(const NodeStmtIf *stmt_if, size_t arm, const size_t end_label, const size_t depth)
+    {
+        for (; arm != stmt_if->arms.size(); ++arm)
+        {
+            if (arm != 0)
+            {
+                comment("elif");
+            }
+            if (!expand_expression(stmt_if->arms[arm].expr, depth - 1))
+            {
+                m_tasks.emplace_back(IfArmTask{.stmt_if = stmt_if, .arm = arm, .end_label = end_label});
+                return false;
+            }
+            if (!expand_if_arm(stmt_if, arm, end_label, depth))
+            {
+                return false;
+            }
+        }
+        if (stmt_if->else_scope.has_value())
+        {
+            comment("else");
+            if (!expand_scope(stmt_if->else_scope.value(), false, depth - 1))
+            {
+                m_tasks.emplace_back(IfEndTask{.end_label = end_label});
+                return false;
+            }
+        }
+        TaskVisitor{.gen = *this}(IfEndTask{.end_label = end_label});
+        return true;
+    }
+
+    /**
+     * @brief Tests the condition of an arm of an 'if' statement on the stack and generates the arm by recursion.
+     *
+     * @param stmt_if The 'if' statement.
+     * @param arm Index of the arm.
+     * @param end_label Label after the whole 'if' statement.
+     * @param depth How many levels deep the 'if' may be generated by recursion, at least 2.
+     * @return Whether the arm was generated entirely.
+     */
+    bool expand_if_arm(const NodeStmtIf *stmt_if, const size_t arm, const size_t end_label, const size_t depth)
+    {
+        const size_t label = test_condition();
+        if (!expand_scope(stmt_if->arms[arm].scope, false, depth - 1))
+        {
+            m_tasks.emplace_back(IfArmEndTask{.stmt_if = stmt_if, .arm = arm, .end_label = end_label, .label = label});
+            return false;
+        }
+        end_if_arm(arm + 1 == stmt_if->arms.size(), stmt_if->else_scope.has_value(), end_label, label);
+        return true;
+    }
+
+    /**
+     * @brief Emits the jump over an arm of an 'if' taken when its condition on the stack is false.
+     *
+     * @return The label of the jump, to emit after the arm.
+     */
+    size_t test_condition()
+    {
+        pop(Reg::rax);
+
+        const size_t label = create_label();
+
+        emit(Opcode::test, Operand::reg(Reg::rax), Operand::reg(Reg::rax)); // check condition in assembly.
+        emit(Opcode::jz, Operand::label(label)); // jump to label if condition is false i.e 0.
+        return label;
+    }
+
+    /**
+     * @brief Emits the jump over the remaining arms of an 'if' and the label of the next arm.
+     *
+     * @param last_arm Whether the arm is the last one.
+     * @param has_else Whether the 'if' has an 'else'.
+     * @param end_label Label after the whole 'if' statement.
+     * @param label Label of the next arm.
+     */
+    void end_if_arm(const bool last_arm, const bool has_else, const size_t end_label, const size_t label)
+    {
+        // Skip the remaining arms, the last one simply falls through.
+        if (!last_arm || has_else)
+        {
+            emit(Opcode::jmp, Operand::label(end_label));
+        }
+        emit(Opcode::label, Operand::label(label));
+    }
+
+    /**
+     * @brief Emits the start of the routine running a 'parallel for', up to its body.
+     *
+     * The routine is emitted in place and jumped over, `fork` calls it on every thread of the pool with the index of
+     * the thread in rax. It copies the variables the body uses to the stack of its thread, at the same depth below rsp
+     * as on the stack of the loop, so the body addresses them like the code around it. A sum variable starts at 0 in
+     * every copy. Above the copies it keeps the next index, the end of the chunk and the number of its next chunk.
+     * With T threads, thread t runs chunks t, t + T, t + 2T and so on, so threads share no counter.
+     *
+     * @param copied Number of variables at the top of the stack to copy.
+     * @param sum The stack slot of the sum variable, if any.
+     * @return The first of the `parallel_label_count` labels of the loop, the routine.
+     */
+    size_t begin_parallel(const size_t copied, const std::optional<size_t> sum)
+    {
+        const size_t routine = create_label();
+        const size_t over = create_label();
+        const size_t next_chunk = create_label();
+        const size_t fits = create_label();
+        const size_t iter = create_label();
+        const size_t done = create_label();
+
+        emit(Opcode::jmp, Operand::label(over));
+        emit(Opcode::label, Operand::label(routine));
+        emit(Opcode::push, Operand::reg(Reg::rax));
+        emit(Opcode::push, Operand::reg(Reg::rax));
+        emit(Opcode::push, Operand::reg(Reg::rax));
+        if (copied != 0)
+        {
+            emit(Opcode::sub, Operand::reg(Reg::rsp), Operand::imm(static_cast<int64_t>(copied * 8)));
+            emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::mem(Reg::rbp, job_vars_offset));
+            emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::reg(Reg::rsp));
+            emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::imm(static_cast<int64_t>(copied * 8)));
+            emit(Opcode::movsb);
+        }
+        if (sum.has_value())
+        {
+            emit(Opcode::mov, variable(sum.value()), Operand::imm(0));
+        }
+
+        // The next chunk starts at chunk * size, and ends after size indices or at the end of the loop. Chunks are
+        // not started once a load failed.
+        emit(Opcode::label, Operand::label(next_chunk));
+        emit(Opcode::cmp, Operand::mem(Reg::rbp, job_failed_offset), Operand::imm(0));
+        emit(Opcode::jnz, Operand::label(done));
+        emit(Opcode::mov, Operand::reg(Reg::rax), loop_word(copied, 2));
+        emit(Opcode::cmp, Operand::mem(Reg::rbp, job_chunks_offset), Operand::reg(Reg::rax));
+        emit(Opcode::jbe, Operand::label(done));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rbp, pool_size_offset));
+        emit(Opcode::add, loop_word(copied, 2), Operand::reg(Reg::rcx));
+        emit(Opcode::imul, Operand::reg(Reg::rax), Operand::mem(Reg::rbp, job_chunk_offset));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rbp, job_count_offset));
+        emit(Opcode::sub, Operand::reg(Reg::rcx), Operand::reg(Reg::rax)); // rcx = indices left
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::mem(Reg::rbp, job_chunk_offset));
+        emit(Opcode::cmp, Operand::reg(Reg::rcx), Operand::reg(Reg::rdx));
+        emit(Opcode::jbe, Operand::label(fits));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::reg(Reg::rdx));
+        emit(Opcode::label, Operand::label(fits));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::mem(Reg::rbp, job_lo_offset));
+        emit(Opcode::add, Operand::reg(Reg::rax), Operand::reg(Reg::rdx));
+        emit(Opcode::add, Operand::reg(Reg::rcx), Operand::reg(Reg::rax));
+        emit(Opcode::mov, loop_word(copied, 0), Operand::reg(Reg::rax));
+        emit(Opcode::mov, loop_word(copied, 1), Operand::reg(Reg::rcx));
+
+        // Every chunk holds at least one index, the index variable is a copy of the next index.
+        emit(Opcode::label, Operand::label(iter));
+        push(loop_word(copied, 0));
+        m_var_count++;
+        return routine;
+    }
+
+    /**
+     * @brief Emits the end of the routine of a 'parallel for' after its body, returning the sum of the thread in rax.
+     *
+     * @param labels The first label of the loop.
+     * @param copied Number of variables the routine copied.
+     * @param sum The stack slot of the sum variable, if any.
+     */
+    void end_parallel_body(const size_t labels, const size_t copied, const std::optional<size_t> sum)
+    {
+        const size_t over = labels + 1;
+        const size_t next_chunk = labels + 2;
+        const size_t iter = labels + 4;
+        const size_t done = labels + 5;
+
+        emit(Opcode::add, Operand::reg(Reg::rsp), Operand::imm(8));
+        m_stack_size--;
+        m_var_count--;
+        emit(Opcode::add, loop_word(copied, 0), Operand::imm(1));
+        emit(Opcode::mov, Operand::reg(Reg::rax), loop_word(copied, 0));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), loop_word(copied, 1));
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::reg(Reg::rcx));
+        emit(Opcode::jb, Operand::label(iter));
+        emit(Opcode::jmp, Operand::label(next_chunk));
+        emit(Opcode::label, Operand::label(done));
+        emit(Opcode::mov, Operand::reg(Reg::rax), sum.has_value() ? variable(sum.value()) : Operand::imm(0));
+        emit(Opcode::add, Operand::reg(Reg::rsp), Operand::imm(static_cast<int64_t>((copied + 3) * 8)));
+        emit(Opcode::ret);
+        emit(Opcode::label, Operand::label(over));
+    }
+
+    /**
+     * @brief Operand addressing a word the routine of a 'parallel for' keeps above the variables it copied, while
+     * nothing but the variables is on the stack.
+     *
+     * @param copied Number of variables the routine copied.
+     * @param index 0 for the next index, 1 for the end of the chunk and 2 for the number of the next chunk.
+     * @return The memory operand.
+     */
+    static Operand loop_word(const size_t copied, const int64_t index)
+    {
+        return Operand::mem(Reg::rsp, static_cast<int64_t>(copied * 8) + index * 8);
+    }
+
+    /**
+     * @brief Generates a leaf or pushes the tasks for an expression of the compact parse tree.
+     *
+     * @param pos Offset of the expression.
+     */
+    void expand_compact_expression(const size_t pos)
+    {
+        if (generate_compact_leaf(pos))
+        {
+            return;
+        }
+        size_t operand = pos + 1;
+        switch (m_compact->kind(pos))
+        {
+        case AstKind::arg:
+            m_tasks.emplace_back(CallEndTask{.symbol = RuntimeSymbol::arg});
+            m_tasks.emplace_back(CompactExprTask{.pos = operand});
+            return;
+        case AstKind::alloc:
+            m_tasks.emplace_back(CallEndTask{.symbol = RuntimeSymbol::alloc});
+            m_tasks.emplace_back(CompactExprTask{.pos = operand});
+            return;
+        case AstKind::map:
+            m_tasks.emplace_back(CallEndTask{.symbol = RuntimeSymbol::map});
+            m_tasks.emplace_back(CompactExprTask{.pos = operand});
+            return;
+        case AstKind::size:
+            m_tasks.emplace_back(CallEndTask{.symbol = RuntimeSymbol::size});
+            m_tasks.emplace_back(CompactExprTask{.pos = operand});
+            return;
+        case AstKind::byte:
+        case AstKind::word:
+        {
+            const size_t file_size = m_compact->read_varint(operand);
+            const RuntimeSymbol symbol = m_compact->kind(pos) == AstKind::word ? RuntimeSymbol::word : RuntimeSymbol::byte;
+            m_tasks.emplace_back(CallEndTask{.symbol = symbol, .pair = true});
+            m_tasks.emplace_back(CompactExprTask{.pos = operand + file_size});
+            m_tasks.emplace_back(CompactExprTask{.pos = operand});
+            return;
+        }
+        case AstKind::index:
+        {
+            const size_t slot = m_compact->read_varint(operand);
+            m_tasks.emplace_back(IndexEndTask{.slot = slot});
+            m_tasks.emplace_back(CompactExprTask{.pos = operand});
+            return;
+        }
+        default:
+            break;
+        }
+
+        // Same order as for the parse tree: lhs first, leaf operands right away.
+        size_t lhs = pos + 1;
+        const size_t lhs_size = m_compact->read_varint(lhs);
+        const size_t rhs = lhs + lhs_size;
+        const AstKind op = m_compact->kind(pos);
+        if (!generate_compact_leaf(lhs))
+        {
+            m_tasks.emplace_back(BinExprEndTask{.op = op});
+            m_tasks.emplace_back(CompactExprTask{.pos = rhs});
+            m_tasks.emplace_back(CompactExprTask{.pos = lhs});
+            return;
+        }
+        if (!generate_compact_leaf(rhs))
+        {
+            m_tasks.emplace_back(BinExprEndTask{.op = op});
+            m_tasks.emplace_back(CompactExprTask{.pos = rhs});
+            return;
+        }
+        finish_binary_expression(op);
+    }
+
+    /**
+     * @brief Generates an expression of the compact parse tree if it is a term without operands.
+     *
+     * @param pos Offset of the expression.
+     * @return Whether the expression was a leaf and got generated.
+     */
+    bool generate_compact_leaf(const size_t pos)
+    {
+        size_t operand = pos + 1;
+        switch (m_compact->kind(pos))
+        {
+        case AstKind::int_lit:
+        {
+            const uint64_t value = m_compact->literal(m_compact->read_varint(operand));
+            emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(static_cast<int64_t>(value)));
+            push(Operand::reg(Reg::rax));
+            return true;
+        }
+        case AstKind::ident:
+        {
+            const size_t slot = m_compact->read_varint(operand);
+            push(Operand::mem(Reg::rsp, static_cast<int64_t>((m_stack_size - slot - 1) * 8)));
+            return true;
+        }
+        case AstKind::read:
+            call_runtime(RuntimeSymbol::read);
+            push(Operand::reg(Reg::rax));
+            return true;
+        default:
+            return false;
+        }
+    }
+
     /**
-     * @brief Constructs the generator with a given parse tree root.
+     * @brief Opens a scope of the compact parse tree and pushes the tasks for its statements.
      *
-     * @param root The root of the parse tree.
+     * @param pos Offset of the scope.
+     * @param is_stmt Whether the scope is a scope statement rather than the body of an 'if'.
      */
-    Generator(NodeProg root) : m_prog(std::move(root))
+    void expand_compact_scope(const size_t pos, const bool is_stmt)
     {
+        begin_scope();
+        m_tasks.emplace_back(ScopeEndTask{.is_stmt = is_stmt});
+        size_t stmts = pos + 1;
+        const size_t count = m_compact->read_varint(stmts);
+        if (count != 0)
+        {
+            m_tasks.emplace_back(CompactStmtsTask{.pos = stmts, .count = count});
+        }
     }
 
     /**
-     * @brief Generates assembly code for a term node.
+     * @brief Generates the start of a statement of the compact parse tree and pushes the tasks for the rest of it.
      *
-     * @param term The term node to generate code for.
+     * @param pos Offset of the statement.
      */
-    void generate_term(const NodeTerm *term)
+    void expand_compact_statement(const size_t pos)
     {
-        struct TermVisitor
+        size_t operand = pos + 1;
+        switch (m_compact->kind(pos))
         {
-            Generator &gen;
+        case AstKind::exit:
+            comment("exit");
+            m_tasks.emplace_back(ExitEndTask{});
+            m_tasks.emplace_back(CompactExprTask{.pos = operand});
+            break;
+        case AstKind::print:
+            comment("print");
+            m_tasks.emplace_back(PrintEndTask{});
+            m_tasks.emplace_back(CompactExprTask{.pos = operand});
+            break;
+        case AstKind::let:
+            comment("let");
+            m_var_count++;
+            m_tasks.emplace_back(LetEndTask{});
+            m_tasks.emplace_back(CompactExprTask{.pos = operand});
+            break;
+        case AstKind::assign:
+        {
+            comment("reassign");
+            const size_t slot = m_compact->read_varint(operand);
+            m_tasks.emplace_back(AssignEndTask{.slot = slot});
+            m_tasks.emplace_back(CompactExprTask{.pos = operand});
+            break;
+        }
+        case AstKind::store:
+        {
+            comment("store");
+            const size_t slot = m_compact->read_varint(operand);
+            const size_t index_size = m_compact->read_varint(operand);
+            m_tasks.emplace_back(StoreEndTask{.slot = slot});
+            m_tasks.emplace_back(CompactExprTask{.pos = operand + index_size});
+            m_tasks.emplace_back(CompactExprTask{.pos = operand});
+            break;
+        }
+        case AstKind::reset:
+            comment("reset");
+            m_tasks.emplace_back(ResetEndTask{});
+            m_tasks.emplace_back(CompactExprTask{.pos = operand});
+            break;
+        case AstKind::scope:
+            comment("scope");
+            expand_compact_scope(pos, true);
+            break;
+        case AstKind::if_:
+        case AstKind::if_else:
+        {
+            comment("if");
+            const size_t end_label = create_label();
+            const size_t arm_count = m_compact->read_varint(operand);
+            push_compact_if_arm(operand, arm_count, m_compact->kind(pos) == AstKind::if_else, end_label);
+            break;
+        }
+        case AstKind::for_:
+        case AstKind::for_sum:
+        {
+            comment("parallel");
+            const size_t copied = m_compact->read_varint(operand);
 
-            void operator()(const NodeTermIntLit *term_int_lit) const
+            // Every child but the body, the last one, is preceded by its size.
+            const auto next_child = [this, &operand]()
+            {
+                const size_t size = m_compact->read_varint(operand);
+                const size_t child = operand;
+                operand += size;
+                return child;
+            };
+            const size_t lo = next_child();
+            const size_t hi = next_child();
+            const size_t chunk = next_child();
+            std::optional<size_t> sum;
+            if (m_compact->kind(pos) == AstKind::for_sum)
             {
-                gen.m_output << "    mov rax, " << term_int_lit->int_lit.value.value() << "\n";
-                gen.push("rax");
+                size_t slot = next_child() + 1;
+                sum = m_compact->read_varint(slot);
             }
+            const size_t labels = begin_parallel(copied, sum);
+            m_tasks.emplace_back(ForkEndTask{.labels = labels, .chunked = true, .sum = sum});
+            m_tasks.emplace_back(CompactExprTask{.pos = chunk});
+            m_tasks.emplace_back(CompactExprTask{.pos = hi});
+            m_tasks.emplace_back(CompactExprTask{.pos = lo});
+            m_tasks.emplace_back(ForBodyEndTask{.labels = labels, .copied = copied, .sum = sum});
+            m_tasks.emplace_back(CompactScopeTask{.pos = operand});
+            break;
+        }
+        default:
+            assert(false);
+        }
+    }
+
+    /**
+     * @brief Pushes the tasks for an arm of a compact 'if' statement.
+     *
+     * @param pos Offset of the condition of the arm, including its size.
+     * @param arm_count Number of arms left, including this one.
+     * @param has_else Whether the 'if' has an 'else'.
+     * @param end_label Label after the whole 'if' statement.
+     */
+    void push_compact_if_arm(size_t pos, const size_t arm_count, const bool has_else, const size_t end_label)
+    {
+        const size_t size = m_compact->read_varint(pos);
+        m_tasks.emplace_back(CompactIfArmTask{
+            .pos = pos + size,
+            .arm_count = arm_count,
+            .has_else = has_else,
+            .end_label = end_label,
+        });
+        m_tasks.emplace_back(CompactExprTask{.pos = pos});
+    }
+
+    /**
+     * @brief Appends a machine instruction to the output.
+     *
+     * @param op The instruction.
+     * @param dst First operand.
+     * @param src Second operand.
+     * @param src2 Third operand.
+     */
+    void emit(const Opcode op, const Operand dst = {}, const Operand src = {}, const Operand src2 = {})
+    {
+        m_instrs.push_back({.op = op, .dst = dst, .src = src, .src2 = src2});
+    }
+
+    /**
+     * @brief Appends a comment to the output.
+     *
+     * @param text Text of the comment, must outlive the generated instructions.
+     */
+    void comment(const char *text)
+    {
+        m_instrs.push_back({.op = Opcode::comment, .comment = text});
+    }
 
-            void operator()(const NodeTermIdent *term_ident) const
+    /**
+     * @brief Ends the program with an exit code, exiting the process or returning it from the function. The output
+     * must already be flushed.
+     *
+     * @param value The exit code, an immediate or a register.
+     */
+    void exit_with(const Operand value)
+    {
+        if (m_kind == ProgramKind::function)
+        {
+            if (value != Operand::reg(Reg::rax))
             {
-                const auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var &var)
-                                             { return var.name == term_ident->ident.value.value(); });
-                if (it == gen.m_vars.cend())
-                {
-                    std::cerr << "Undeclared Identifier: " << term_ident->ident.value.value() << "\n";
-                    exit(EXIT_FAILURE);
-                }
-                std::stringstream offset;
-                // Make a copy of the value from the position in stack again on stack (Multiply by 8 for bytes).
-                offset << "QWORD [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "]";
-                gen.push(offset.str());
+                emit(Opcode::mov, Operand::reg(Reg::rax), value);
             }
+            emit(Opcode::mov, Operand::reg(Reg::rsp), Operand::reg(Reg::rbp));
+            emit(Opcode::pop, Operand::reg(Reg::rbp));
+            emit(Opcode::pop, Operand::reg(Reg::rbx));
+            emit(Opcode::ret);
+            return;
+        }
+        // exit_group, which also ends the threads of the pool.
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(231));
+        if (value != Operand::reg(Reg::rdi))
+        {
+            emit(Opcode::mov, Operand::reg(Reg::rdi), value);
+        }
+        emit(Opcode::syscall);
+    }
+
+    /// @brief Leaves the runtime before the program ends, writing out the buffered output. A function also unmaps the
+    /// heap, which would otherwise outlive the call.
+    void end_runtime()
+    {
+        if (m_layout.output)
+        {
+            emit(Opcode::call, Operand::symbol(RuntimeSymbol::flush));
+        }
+        if (m_kind == ProgramKind::function && m_layout.holds_resources())
+        {
+            emit(Opcode::call, Operand::symbol(RuntimeSymbol::release));
+        }
+    }
+
+    /**
+     * @brief Calls a routine of the runtime, which is then generated after the program.
+     *
+     * @param symbol The routine.
+     */
+    void call_runtime(const RuntimeSymbol symbol)
+    {
+        m_calls.set(static_cast<size_t>(symbol));
+        emit(Opcode::call, Operand::symbol(symbol));
+    }
+
+    /**
+     * @brief Operand addressing a variable on the stack.
+     *
+     * @param slot The stack slot of the variable.
+     * @return The memory operand.
+     */
+    Operand variable(const size_t slot) const
+    {
+        return Operand::mem(Reg::rsp, static_cast<int64_t>((m_stack_size - slot - 1) * 8));
+    }
 
-            void operator()(const NodeTermParen *term_paren) const
+    /**
+     * @brief Generates the routines of the runtime the program uses, after the end of the program.
+     *
+     * The routines find the runtime frame through rbp and may clobber every register the generator uses but rsp and
+     * rbp, which is fine as statements keep nothing in registers across them.
+     */
+    void generate_runtime()
+    {
+        comment("runtime");
+        if (m_calls.test(static_cast<size_t>(RuntimeSymbol::exit)))
+        {
+            // The exit code is kept on the stack while the runtime is left.
+            emit(Opcode::label, Operand::symbol(RuntimeSymbol::exit));
+            if (m_layout.output || (m_kind == ProgramKind::function && m_layout.holds_resources()))
             {
-                gen.generate_expression(term_paren->expr);
+                emit(Opcode::push, Operand::reg(Reg::rdi));
+                end_runtime();
+                emit(Opcode::pop, Operand::reg(Reg::rdi));
             }
-        };
+            exit_with(Operand::reg(Reg::rdi));
+        }
+        if (m_layout.output)
+        {
+            generate_output();
+        }
+        if (m_layout.input)
+        {
+            generate_read();
+            generate_fill();
+        }
+        if (m_calls.test(static_cast<size_t>(RuntimeSymbol::arg)))
+        {
+            generate_arg();
+        }
+        if (m_layout.heap)
+        {
+            generate_heap();
+        }
 
-        TermVisitor visitor{.gen = *this};
-        std::visit(visitor, term->var);
+        // Ends a program whose load was out of bounds.
+        const std::optional<size_t> out_of_bounds = m_layout.files ? std::optional(create_label()) : std::nullopt;
+        if (m_layout.files)
+        {
+            generate_files(out_of_bounds.value());
+        }
+        if (m_layout.threads)
+        {
+            generate_fork(out_of_bounds);
+        }
+        if (m_kind == ProgramKind::function && m_layout.holds_resources())
+        {
+            generate_release();
+        }
     }
 
-    /// @brief Generates assembly code for a binary expression node.
-    /// @param bin_expr The binary expression node to generate code for.
-    void generate_binary_expression(const NodeBinExpr *bin_expr)
+    /// @brief Generates the `print` and `flush` routines of the runtime.
+    void generate_output()
     {
-        struct BinExprVisitor
-        {
-            Generator &gen;
+        // print: rax is converted to decimal from the last digit up, multiplying by the inverse of 10 instead of
+        // dividing. The digits are stored backwards below the stack, in the red zone, and copied into the buffer at
+        // once, so the only branch per digit is the loop itself.
+        const size_t fits = create_label();
+        const size_t digit = create_label();
+        emit(Opcode::label, Operand::symbol(RuntimeSymbol::print));
+        emit(Opcode::cmp, Operand::mem(Reg::rbp, output_count_offset), Operand::imm(output_buffer_size - max_print_size));
+        emit(Opcode::jbe, Operand::label(fits));
+        emit(Opcode::push, Operand::reg(Reg::rax));
+        emit(Opcode::call, Operand::symbol(RuntimeSymbol::flush));
+        emit(Opcode::pop, Operand::reg(Reg::rax));
+        emit(Opcode::label, Operand::label(fits));
+        emit(Opcode::mov, Operand::reg(Reg::rbx), Operand::reg(Reg::rax));
+        emit(Opcode::lea, Operand::reg(Reg::rdi), Operand::mem(Reg::rsp, -1));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::reg(Reg::rdi));
+        emit(Opcode::std);
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm('\n'));
+        emit(Opcode::stosb);
+        emit(Opcode::label, Operand::label(digit));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::reg(Reg::rbx));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(static_cast<int64_t>(0xCCCCCCCCCCCCCCCD)));
+        emit(Opcode::mul, Operand::reg(Reg::rdx));
+        emit(Opcode::shr, Operand::reg(Reg::rdx), Operand::imm(3)); // rdx = rbx / 10
+        emit(Opcode::lea, Operand::reg(Reg::rax), Operand::mem(Reg::rdx, Reg::rdx, 4));
+        emit(Opcode::add, Operand::reg(Reg::rax), Operand::reg(Reg::rax));
+        emit(Opcode::sub, Operand::reg(Reg::rbx), Operand::reg(Reg::rax)); // rbx = rbx % 10
+        emit(Opcode::lea, Operand::reg(Reg::rax), Operand::mem(Reg::rbx, '0'));
+        emit(Opcode::stosb);
+        emit(Opcode::mov, Operand::reg(Reg::rbx), Operand::reg(Reg::rdx));
+        emit(Opcode::test, Operand::reg(Reg::rbx), Operand::reg(Reg::rbx));
+        emit(Opcode::jnz, Operand::label(digit));
+        emit(Opcode::cld);
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::reg(Reg::rsi));
+        emit(Opcode::sub, Operand::reg(Reg::rcx), Operand::reg(Reg::rdi));
+        emit(Opcode::lea, Operand::reg(Reg::rsi), Operand::mem(Reg::rdi, 1));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::mem(Reg::rbp, output_count_offset));
+        emit(Opcode::lea, Operand::reg(Reg::rdi), Operand::mem(Reg::rbp, Reg::rax, 1));
+        emit(Opcode::add, Operand::reg(Reg::rdi), Operand::imm(m_layout.output_buffer));
+        emit(Opcode::add, Operand::mem(Reg::rbp, output_count_offset), Operand::reg(Reg::rcx));
+        emit(Opcode::movsb);
+        emit(Opcode::ret);
 
-            void operator()(const NodeBinExprAdd *bin_expr_add) const
-            {
-                // Pushing both lhs and rhs on the stack.
-                gen.generate_expression(bin_expr_add->rhs);
-                gen.generate_expression(bin_expr_add->lhs);
+        // flush: a single `write` of the whole buffer to stdout.
+        const size_t empty = create_label();
+        emit(Opcode::label, Operand::symbol(RuntimeSymbol::flush));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::mem(Reg::rbp, output_count_offset));
+        emit(Opcode::test, Operand::reg(Reg::rdx), Operand::reg(Reg::rdx));
+        emit(Opcode::jz, Operand::label(empty));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(1));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::imm(1));
+        emit(Opcode::lea, Operand::reg(Reg::rsi), Operand::mem(Reg::rbp, m_layout.output_buffer));
+        emit(Opcode::syscall);
+        emit(Opcode::mov, Operand::mem(Reg::rbp, output_count_offset), Operand::imm(0));
+        emit(Opcode::label, Operand::label(empty));
+        emit(Opcode::ret);
+    }
 
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    add rax, rbx\n";
+    /// @brief Generates the `arg` routine of the runtime, which parses the argument a byte at a time as it may end
+    /// anywhere in memory.
+    void generate_arg()
+    {
+        const size_t arg_digit = create_label();
+        const size_t missing = create_label();
+        const size_t arg_end = create_label();
+        emit(Opcode::label, Operand::symbol(RuntimeSymbol::arg));
+        emit_find_arg(missing);
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(0));
+        emit(Opcode::label, Operand::label(arg_digit));
+        emit(Opcode::movzx, Operand::reg(Reg::rcx), Operand::mem(Reg::rdx, 0));
+        emit(Opcode::sub, Operand::reg(Reg::rcx), Operand::imm('0'));
+        emit(Opcode::cmp, Operand::reg(Reg::rcx), Operand::imm(10));
+        emit(Opcode::jae, Operand::label(arg_end));
+        emit(Opcode::imul, Operand::reg(Reg::rax), Operand::reg(Reg::rax), Operand::imm(10));
+        emit(Opcode::add, Operand::reg(Reg::rax), Operand::reg(Reg::rcx));
+        emit(Opcode::add, Operand::reg(Reg::rdx), Operand::imm(1));
+        emit(Opcode::jmp, Operand::label(arg_digit));
+        emit(Opcode::label, Operand::label(missing));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(0));
+        emit(Opcode::label, Operand::label(arg_end));
+        emit(Opcode::ret);
+    }
 
-                // Putting result back on stack.
-                gen.push("rax");
-            }
+    /**
+     * @brief Emits the search of argv for the argument with the index in rax. argv ends in a null pointer, so missing
+     * arguments are found without argc.
+     *
+     * @param missing Label jumped to if there is no such argument. Otherwise the address of the argument is left in
+     * rdx. Clobbers rsi.
+     */
+    void emit_find_arg(const size_t missing)
+    {
+        const size_t find = create_label();
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::mem(Reg::rbp, argv_offset));
+        emit(Opcode::label, Operand::label(find));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::mem(Reg::rsi, 0));
+        emit(Opcode::test, Operand::reg(Reg::rdx), Operand::reg(Reg::rdx));
+        emit(Opcode::jz, Operand::label(missing));
+        emit(Opcode::add, Operand::reg(Reg::rsi), Operand::imm(8));
+        emit(Opcode::sub, Operand::reg(Reg::rax), Operand::imm(1));
+        emit(Opcode::jae, Operand::label(find));
+    }
 
-            void operator()(const NodeBinExprMulti *bin_expr_mult) const
-            {
-                // Pushing both lhs and rhs on the stack.
-                gen.generate_expression(bin_expr_mult->rhs);
-                gen.generate_expression(bin_expr_mult->lhs);
+    /**
+     * @brief Generates the `alloc` and `reset` routines of the runtime.
+     *
+     * The heap is a single region of address space reserved on the first `alloc` that does not fit, with transparent
+     * huge pages asked for so large arrays take fewer TLB entries. Pages are only backed once touched, so reserving
+     * far more than is used costs nothing. An allocation moves the free pointer past the array, and `reset` moves it
+     * back to an array, which frees that array and every array after it. Memory is not cleared when it is reused.
+     * `alloc` returns 0 once the heap is exhausted or cannot be mapped.
+     */
+    void generate_heap()
+    {
+        const size_t retry = create_label();
+        const size_t map = create_label();
+        const size_t mapped = create_label();
+        const size_t fits = create_label();
+        emit(Opcode::label, Operand::symbol(RuntimeSymbol::alloc));
+        emit(Opcode::label, Operand::label(retry));
+        emit(Opcode::mov, Operand::reg(Reg::rbx), Operand::mem(Reg::rbp, heap_pos_offset));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rbp, heap_end_offset));
+        emit(Opcode::sub, Operand::reg(Reg::rcx), Operand::reg(Reg::rbx));
+        emit(Opcode::shr, Operand::reg(Reg::rcx), Operand::imm(3)); // rcx = elements left
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::reg(Reg::rcx));
+        emit(Opcode::jb, Operand::label(fits));
+        emit(Opcode::cmp, Operand::mem(Reg::rbp, heap_base_offset), Operand::imm(0));
+        emit(Opcode::jz, Operand::label(map));
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::reg(Reg::rcx));
+        emit(Opcode::jbe, Operand::label(fits));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(0));
+        emit(Opcode::ret);
 
-                gen.pop("rax");
-                gen.pop("rbx");
+        // mmap(NULL, heap_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)
+        emit(Opcode::label, Operand::label(map));
+        emit(Opcode::push, Operand::reg(Reg::rax));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(9));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::imm(0));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::imm(heap_size));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(0x3));
+        emit(Opcode::mov, Operand::reg(Reg::r10), Operand::imm(0x4022));
+        emit(Opcode::mov, Operand::reg(Reg::r8), Operand::imm(-1));
+        emit(Opcode::mov, Operand::reg(Reg::r9), Operand::imm(0));
+        emit(Opcode::syscall);
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::imm(-4096));
+        emit(Opcode::jbe, Operand::label(mapped)); // errors are -4095 to -1
+        emit(Opcode::pop, Operand::reg(Reg::rax));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(0));
+        emit(Opcode::ret);
+        emit(Opcode::label, Operand::label(mapped));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, heap_base_offset), Operand::reg(Reg::rax));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, heap_pos_offset), Operand::reg(Reg::rax));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::reg(Reg::rax));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::imm(heap_size));
+        emit(Opcode::add, Operand::reg(Reg::rax), Operand::reg(Reg::rsi));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, heap_end_offset), Operand::reg(Reg::rax));
 
-                gen.m_output << "    mul rbx\n";
+        // madvise(heap, heap_size, MADV_HUGEPAGE), only a hint, so its result is ignored.
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(28));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(14));
+        emit(Opcode::syscall);
+        emit(Opcode::pop, Operand::reg(Reg::rax));
+        emit(Opcode::jmp, Operand::label(retry));
+        emit(Opcode::label, Operand::label(fits));
+        emit(Opcode::lea, Operand::reg(Reg::rcx), Operand::mem(Reg::rbx, Reg::rax, 8));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, heap_pos_offset), Operand::reg(Reg::rcx));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::reg(Reg::rbx));
+        emit(Opcode::ret);
 
-                // Putting result back on stack.
-                gen.push("rax");
-            }
+        // reset: addresses outside the allocated part of the heap, such as the 0 of a failed alloc, are ignored.
+        const size_t reset_end = create_label();
+        emit(Opcode::label, Operand::symbol(RuntimeSymbol::reset));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rbp, heap_base_offset));
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::reg(Reg::rcx));
+        emit(Opcode::jb, Operand::label(reset_end));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rbp, heap_pos_offset));
+        emit(Opcode::cmp, Operand::reg(Reg::rcx), Operand::reg(Reg::rax));
+        emit(Opcode::jb, Operand::label(reset_end));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, heap_pos_offset), Operand::reg(Reg::rax));
+        emit(Opcode::label, Operand::label(reset_end));
+        emit(Opcode::ret);
 
-            void operator()(const NodeBinExprSub *bin_expr_sub) const
-            {
-                // Pushing both rhs and lhs on the stack.
-                gen.generate_expression(bin_expr_sub->rhs);
-                gen.generate_expression(bin_expr_sub->lhs);
+    }
 
-                gen.pop("rax");
-                gen.pop("rbx");
+    /**
+     * @brief Generates the `map`, `size`, `byte` and `word` routines of the runtime.
+     *
+     * A file is mapped read-only and private, so the program reads it straight from the page cache without copying it,
+     * and the kernel is told it is read sequentially so it reads ahead. Handles index the table of mapped files in
+     * the frame. A map that fails, including for a file that does not exist or a full table, returns the handle
+     * `max_maps`, whose size is 0 like that of an empty file. A `byte` or `word` load past the end of the file, or from
+     * an invalid handle, ends the program with `out_of_bounds_exit_code` after flushing the output. During a 'parallel
+     * for' the load only returns 0 and flags the job as failed, `fork` ends the program once every thread is done.
+     *
+     * @param out_of_bounds Label of the end of a program whose load was out of bounds, emitted here.
+     */
+    void generate_files(const size_t out_of_bounds)
+    {
+        const size_t open_failed = create_label();
+        const size_t failed = create_label();
+        const size_t empty = create_label();
+        emit(Opcode::label, Operand::symbol(RuntimeSymbol::map));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rbp, map_count_offset));
+        emit(Opcode::cmp, Operand::reg(Reg::rcx), Operand::imm(max_maps));
+        emit(Opcode::jae, Operand::label(failed));
+        emit_find_arg(failed);
 
-                gen.m_output << "    sub rax, rbx\n";
+        // open(path, O_RDONLY), errors are -4095 to -1, above any file descriptor or address unsigned.
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(2));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::reg(Reg::rdx));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::imm(0));
+        emit(Opcode::syscall);
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::imm(-4096));
+        emit(Opcode::jae, Operand::label(failed));
+        emit(Opcode::mov, Operand::reg(Reg::rbx), Operand::reg(Reg::rax)); // rbx = file descriptor
 
-                // Putting result back on stack.
-                gen.push("rax");
-            }
+        // lseek(fd, 0, SEEK_END) gives the size, an empty file cannot be mapped and needs no mapping.
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(8));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::reg(Reg::rbx));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::imm(0));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(2));
+        emit(Opcode::syscall);
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::imm(-4096));
+        emit(Opcode::jae, Operand::label(open_failed));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::reg(Reg::rax));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::imm(0));
+        emit(Opcode::test, Operand::reg(Reg::rsi), Operand::reg(Reg::rsi));
+        emit(Opcode::jz, Operand::label(empty));
 
-            void operator()(const NodeBinExprDiv *bin_expr_div) const
-            {
-                // Pushing both lhs and rhs on the stack.
-                gen.generate_expression(bin_expr_div->rhs);
-                gen.generate_expression(bin_expr_div->lhs);
+        // mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(9));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(1));
+        emit(Opcode::mov, Operand::reg(Reg::r10), Operand::imm(2));
+        emit(Opcode::mov, Operand::reg(Reg::r8), Operand::reg(Reg::rbx));
+        emit(Opcode::mov, Operand::reg(Reg::r9), Operand::imm(0));
+        emit(Opcode::syscall);
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::imm(-4096));
+        emit(Opcode::jae, Operand::label(open_failed));
+
+        // madvise(address, size, MADV_SEQUENTIAL), only a hint, so its result is ignored.
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::reg(Reg::rax));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(28));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(2));
+        emit(Opcode::syscall);
+        emit(Opcode::label, Operand::label(empty));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rbp, map_count_offset));
+        emit(Opcode::shl, Operand::reg(Reg::rcx), Operand::imm(4));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, Reg::rcx, 1, m_layout.map_table), Operand::reg(Reg::rdi));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, Reg::rcx, 1, m_layout.map_table + 8), Operand::reg(Reg::rsi));
 
-                gen.pop("rax");
-                gen.pop("rbx");
+        // close(fd), the mapping keeps the file open.
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(3));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::reg(Reg::rbx));
+        emit(Opcode::syscall);
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::mem(Reg::rbp, map_count_offset));
+        emit(Opcode::add, Operand::mem(Reg::rbp, map_count_offset), Operand::imm(1));
+        emit(Opcode::ret);
+        emit(Opcode::label, Operand::label(open_failed));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(3));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::reg(Reg::rbx));
+        emit(Opcode::syscall);
+        emit(Opcode::label, Operand::label(failed));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(max_maps));
+        emit(Opcode::ret);
 
-                gen.m_output << "    div rbx\n";
+        const size_t invalid = create_label();
+        emit(Opcode::label, Operand::symbol(RuntimeSymbol::size));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rbp, map_count_offset));
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::reg(Reg::rcx));
+        emit(Opcode::jae, Operand::label(invalid));
+        emit(Opcode::shl, Operand::reg(Reg::rax), Operand::imm(4));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::mem(Reg::rbp, Reg::rax, 1, m_layout.map_table + 8));
+        emit(Opcode::ret);
+        emit(Opcode::label, Operand::label(invalid));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(0));
+        emit(Opcode::ret);
 
-                // Putting result back on stack.
-                gen.push("rax");
+        // byte and word: an invalid handle fails the first check, an index past the end the second one.
+        const size_t failed_load = create_label();
+        for (const RuntimeSymbol symbol : {RuntimeSymbol::byte, RuntimeSymbol::word})
+        {
+            emit(Opcode::label, Operand::symbol(symbol));
+            emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rbp, map_count_offset));
+            emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::reg(Reg::rcx));
+            emit(Opcode::jae, Operand::label(failed_load));
+            emit(Opcode::shl, Operand::reg(Reg::rax), Operand::imm(4));
+            emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rbp, Reg::rax, 1, m_layout.map_table + 8));
+            if (symbol == RuntimeSymbol::word)
+            {
+                emit(Opcode::shr, Operand::reg(Reg::rcx), Operand::imm(3)); // a partial last word cannot be loaded
             }
-        };
+            emit(Opcode::cmp, Operand::reg(Reg::rbx), Operand::reg(Reg::rcx));
+            emit(Opcode::jae, Operand::label(failed_load));
+            emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rbp, Reg::rax, 1, m_layout.map_table));
+            if (symbol == RuntimeSymbol::word)
+            {
+                emit(Opcode::mov, Operand::reg(Reg::rax), Operand::mem(Reg::rcx, Reg::rbx, 8));
+            }
+            else
+            {
+                emit(Opcode::movzx, Operand::reg(Reg::rax), Operand::mem(Reg::rcx, Reg::rbx, 1));
+            }
+            emit(Opcode::ret);
+        }
 
-        BinExprVisitor visitor{.gen = *this};
-        std::visit(visitor, bin_expr->var);
+        // The frame is found through rbp, so the program is ended from inside the routine like from a statement.
+        emit(Opcode::label, Operand::label(failed_load));
+        if (m_layout.threads)
+        {
+            emit(Opcode::cmp, Operand::mem(Reg::rbp, job_running_offset), Operand::imm(0));
+            emit(Opcode::jz, Operand::label(out_of_bounds));
+            emit(Opcode::mov, Operand::mem(Reg::rbp, job_failed_offset), Operand::imm(1));
+            emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(0));
+            emit(Opcode::ret);
+        }
+        emit(Opcode::label, Operand::label(out_of_bounds));
+        end_runtime();
+        exit_with(Operand::imm(out_of_bounds_exit_code));
     }
 
     /**
-     * @brief Generates assembly code for an expression node.
+     * @brief Generates the `fork` routine of the runtime, which runs the routine of a 'parallel for' on a pool of
+     * threads.
      *
-     * @param expr The expression node to generate code for.
+     * The pool is started on the first call, with a thread for every CPU the process may run on, up to `max_threads`,
+     * the thread calling `fork` being the first one. `HYDRO_THREADS=<n>` in the environment sets the number of
+     * threads instead, so the pool can be tested on any machine. A function finds the environment after the null
+     * pointer ending argv, where it is for the argv `main` is called with. The other threads are created by `clone` sharing everything, on
+     * stacks of their own mapped in one region, and run a loop waiting for a job. A job is published through the
+     * frame: its routine, bounds and chunks, then a new generation in `job_gen` that the threads wait on with a futex.
+     * Every thread records the generation in its entry of the thread table once it is done, along with its sum, and
+     * wakes the calling thread waiting there. x86-64 keeps stores in order, so the words need no atomic instructions.
+     * Without a chunk size, the indices are split evenly between the threads.
+     *
+     * @param out_of_bounds Label of the end of a program whose load was out of bounds, or nullopt if it loads nothing.
      */
-    void generate_expression(const NodeExpr *expr)
+    void generate_fork(const std::optional<size_t> out_of_bounds)
     {
-        struct ExprVisitor
+        const size_t counted = create_label();
+        const size_t started = create_label();
+        const size_t cpu_word = create_label();
+        const size_t cpu_bit = create_label();
+        const size_t cpus_counted = create_label();
+        const size_t env_args = create_label();
+        const size_t env_var = create_label();
+        const size_t env_digit = create_label();
+        const size_t env_end = create_label();
+        const size_t affinity = create_label();
+        const size_t sized = create_label();
+        const size_t few = create_label();
+        const size_t some = create_label();
+        const size_t spawn = create_label();
+        const size_t spawned = create_label();
+        const size_t chunked = create_label();
+        const size_t no_chunks = create_label();
+        const size_t alone = create_label();
+        const size_t join = create_label();
+        const size_t join_wait = create_label();
+        const size_t join_next = create_label();
+        const size_t joined = create_label();
+        const size_t worker = create_label();
+        const size_t work = create_label();
+        const size_t stop = create_label();
+
+        // rax = first index, rbx = end, rcx = chunk size, rdx = routine, the variables are right above the return.
+        emit(Opcode::label, Operand::symbol(RuntimeSymbol::fork));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, job_routine_offset), Operand::reg(Reg::rdx));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, job_lo_offset), Operand::reg(Reg::rax));
+        emit(Opcode::lea, Operand::reg(Reg::rdx), Operand::mem(Reg::rsp, 8));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, job_vars_offset), Operand::reg(Reg::rdx));
+        emit(Opcode::sub, Operand::reg(Reg::rbx), Operand::reg(Reg::rax));
+        emit(Opcode::jae, Operand::label(counted));
+        emit(Opcode::mov, Operand::reg(Reg::rbx), Operand::imm(0)); // an end before the start means no indices
+        emit(Opcode::label, Operand::label(counted));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, job_count_offset), Operand::reg(Reg::rbx));
+        emit(Opcode::cmp, Operand::mem(Reg::rbp, pool_size_offset), Operand::imm(0));
+        emit(Opcode::jnz, Operand::label(started));
+        emit(Opcode::push, Operand::reg(Reg::rcx));
+        emit(Opcode::push, Operand::reg(Reg::rbx));
+
+        // The environment is a list of `name=value` strings after argv, ended by a null pointer like it.
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::mem(Reg::rbp, argv_offset));
+        emit(Opcode::label, Operand::label(env_args));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::mem(Reg::rsi, 0));
+        emit(Opcode::add, Operand::reg(Reg::rsi), Operand::imm(8));
+        emit(Opcode::test, Operand::reg(Reg::rdi), Operand::reg(Reg::rdi));
+        emit(Opcode::jnz, Operand::label(env_args));
+        emit(Opcode::label, Operand::label(env_var));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::mem(Reg::rsi, 0));
+        emit(Opcode::add, Operand::reg(Reg::rsi), Operand::imm(8));
+        emit(Opcode::test, Operand::reg(Reg::rdi), Operand::reg(Reg::rdi));
+        emit(Opcode::jz, Operand::label(affinity));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(text_word("HYDRO_TH")));
+        emit(Opcode::cmp, Operand::mem(Reg::rdi, 0), Operand::reg(Reg::rax));
+        emit(Opcode::jnz, Operand::label(env_var));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(text_word("_THREADS")));
+        emit(Opcode::cmp, Operand::mem(Reg::rdi, 5), Operand::reg(Reg::rax));
+        emit(Opcode::jnz, Operand::label(env_var));
+        emit(Opcode::movzx, Operand::reg(Reg::rax), Operand::mem(Reg::rdi, 13));
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::imm('='));
+        emit(Opcode::jnz, Operand::label(env_var));
+        emit(Opcode::add, Operand::reg(Reg::rdi), Operand::imm(14));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::imm(0));
+        emit(Opcode::label, Operand::label(env_digit));
+        emit(Opcode::movzx, Operand::reg(Reg::rax), Operand::mem(Reg::rdi, 0));
+        emit(Opcode::sub, Operand::reg(Reg::rax), Operand::imm('0'));
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::imm(10));
+        emit(Opcode::jae, Operand::label(env_end));
+        emit(Opcode::imul, Operand::reg(Reg::rcx), Operand::reg(Reg::rcx), Operand::imm(10));
+        emit(Opcode::add, Operand::reg(Reg::rcx), Operand::reg(Reg::rax));
+        emit(Opcode::add, Operand::reg(Reg::rdi), Operand::imm(1));
+        emit(Opcode::jmp, Operand::label(env_digit));
+        emit(Opcode::label, Operand::label(env_end));
+        emit(Opcode::test, Operand::reg(Reg::rcx), Operand::reg(Reg::rcx)); // a size of 0 or no digits counts CPUs
+        emit(Opcode::jnz, Operand::label(sized));
+
+        // sched_getaffinity(0, 128, mask) returns the bytes of the mask it wrote, the CPUs are its set bits.
+        emit(Opcode::label, Operand::label(affinity));
+        emit(Opcode::sub, Operand::reg(Reg::rsp), Operand::imm(128));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(204));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::imm(0));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::imm(128));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::reg(Reg::rsp));
+        emit(Opcode::syscall);
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::imm(max_threads));
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::imm(-4096));
+        emit(Opcode::jae, Operand::label(cpus_counted));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::imm(0));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::reg(Reg::rsp));
+        emit(Opcode::lea, Operand::reg(Reg::rdi), Operand::mem(Reg::rsp, Reg::rax, 1));
+        emit(Opcode::label, Operand::label(cpu_word));
+        emit(Opcode::cmp, Operand::reg(Reg::rsi), Operand::reg(Reg::rdi));
+        emit(Opcode::jae, Operand::label(cpus_counted));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::mem(Reg::rsi, 0));
+        emit(Opcode::add, Operand::reg(Reg::rsi), Operand::imm(8));
+        emit(Opcode::label, Operand::label(cpu_bit));
+        emit(Opcode::test, Operand::reg(Reg::rdx), Operand::reg(Reg::rdx));
+        emit(Opcode::jz, Operand::label(cpu_word));
+        emit(Opcode::lea, Operand::reg(Reg::rax), Operand::mem(Reg::rdx, -1));
+        emit(Opcode::and_, Operand::reg(Reg::rdx), Operand::reg(Reg::rax)); // clears the lowest set bit
+        emit(Opcode::add, Operand::reg(Reg::rcx), Operand::imm(1));
+        emit(Opcode::jmp, Operand::label(cpu_bit));
+        emit(Opcode::label, Operand::label(cpus_counted));
+        emit(Opcode::add, Operand::reg(Reg::rsp), Operand::imm(128));
+        emit(Opcode::label, Operand::label(sized));
+        emit(Opcode::cmp, Operand::reg(Reg::rcx), Operand::imm(max_threads));
+        emit(Opcode::jbe, Operand::label(few));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::imm(max_threads));
+        emit(Opcode::label, Operand::label(few));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, pool_size_offset), Operand::imm(1));
+        emit(Opcode::cmp, Operand::reg(Reg::rcx), Operand::imm(1));
+        emit(Opcode::jbe, Operand::label(spawned));
+
+        // mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0)
+        // for the stacks of the other threads, which are only backed once touched. Without them the pool is the
+        // calling thread alone.
+        emit(Opcode::push, Operand::reg(Reg::rcx));
+        emit(Opcode::lea, Operand::reg(Reg::rsi), Operand::mem(Reg::rcx, -1));
+        emit(Opcode::shl, Operand::reg(Reg::rsi), Operand::imm(thread_stack_shift));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, pool_stacks_size_offset), Operand::reg(Reg::rsi));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(9));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::imm(0));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(3));
+        emit(Opcode::mov, Operand::reg(Reg::r10), Operand::imm(0x24022));
+        emit(Opcode::mov, Operand::reg(Reg::r8), Operand::imm(-1));
+        emit(Opcode::mov, Operand::reg(Reg::r9), Operand::imm(0));
+        emit(Opcode::syscall);
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::imm(-4096));
+        emit(Opcode::jae, Operand::label(some));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, pool_stacks_offset), Operand::reg(Reg::rax));
+
+        // Thread t starts on the top of the t-th stack, holding its index and the generation it has seen. Its entry
+        // is done with that generation, the kernel writes its thread ID and clears it once the thread has exited.
+        emit(Opcode::mov, Operand::reg(Reg::rbx), Operand::imm(1));
+        emit(Opcode::label, Operand::label(spawn));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rsp, 0));
+        emit(Opcode::cmp, Operand::reg(Reg::rbx), Operand::reg(Reg::rcx));
+        emit(Opcode::jae, Operand::label(some));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::reg(Reg::rbx));
+        emit(Opcode::shl, Operand::reg(Reg::rsi), Operand::imm(thread_stack_shift));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::mem(Reg::rbp, pool_stacks_offset));
+        emit(Opcode::add, Operand::reg(Reg::rsi), Operand::reg(Reg::rax));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::mem(Reg::rbp, job_gen_offset));
+        emit(Opcode::mov, Operand::mem(Reg::rsi, -8), Operand::reg(Reg::rax));
+        emit(Opcode::mov, Operand::mem(Reg::rsi, -16), Operand::reg(Reg::rbx));
+        emit(Opcode::sub, Operand::reg(Reg::rsi), Operand::imm(16));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::reg(Reg::rbx));
+        emit(Opcode::shl, Operand::reg(Reg::rdx), Operand::imm(thread_entry_shift));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, Reg::rdx, 1, m_layout.thread_table), Operand::reg(Reg::rax));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, Reg::rdx, 1, m_layout.thread_table + 16), Operand::imm(0));
+        emit(Opcode::lea, Operand::reg(Reg::rdx), Operand::mem(Reg::rbp, Reg::rdx, 1, m_layout.thread_table + 16));
+
+        // clone(CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD | CLONE_SYSVSEM |
+        // CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID, stack, &tid, &tid, 0) returns 0 in the new thread.
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(56));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::imm(clone_flags));
+        emit(Opcode::mov, Operand::reg(Reg::r10), Operand::reg(Reg::rdx));
+        emit(Opcode::mov, Operand::reg(Reg::r8), Operand::imm(0));
+        emit(Opcode::syscall);
+        emit(Opcode::test, Operand::reg(Reg::rax), Operand::reg(Reg::rax));
+        emit(Opcode::jz, Operand::label(worker));
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::imm(-4096));
+        emit(Opcode::jae, Operand::label(some));
+        emit(Opcode::add, Operand::reg(Reg::rbx), Operand::imm(1));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, pool_size_offset), Operand::reg(Reg::rbx));
+        emit(Opcode::jmp, Operand::label(spawn));
+        emit(Opcode::label, Operand::label(some));
+        emit(Opcode::pop, Operand::reg(Reg::rcx));
+        emit(Opcode::label, Operand::label(spawned));
+        emit(Opcode::pop, Operand::reg(Reg::rbx));
+        emit(Opcode::pop, Operand::reg(Reg::rcx));
+
+        // An even split gives each thread ceil(count / threads) indices, the chunks are ceil(count / size).
+        emit(Opcode::label, Operand::label(started));
+        emit(Opcode::test, Operand::reg(Reg::rcx), Operand::reg(Reg::rcx));
+        emit(Opcode::jnz, Operand::label(chunked));
+        emit(Opcode::lea, Operand::reg(Reg::rax), Operand::mem(Reg::rbx, -1));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(0));
+        emit(Opcode::div, Operand::mem(Reg::rbp, pool_size_offset));
+        emit(Opcode::lea, Operand::reg(Reg::rcx), Operand::mem(Reg::rax, 1));
+        emit(Opcode::label, Operand::label(chunked));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, job_chunk_offset), Operand::reg(Reg::rcx));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(0));
+        emit(Opcode::test, Operand::reg(Reg::rbx), Operand::reg(Reg::rbx));
+        emit(Opcode::jz, Operand::label(no_chunks));
+        emit(Opcode::lea, Operand::reg(Reg::rax), Operand::mem(Reg::rbx, -1));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(0));
+        emit(Opcode::div, Operand::reg(Reg::rcx));
+        emit(Opcode::add, Operand::reg(Reg::rax), Operand::imm(1));
+        emit(Opcode::label, Operand::label(no_chunks));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, job_chunks_offset), Operand::reg(Reg::rax));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, job_failed_offset), Operand::imm(0));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, job_running_offset), Operand::imm(1));
+
+        // A new generation starts the job, futex(&job_gen, FUTEX_WAKE_PRIVATE, INT_MAX) wakes the waiting threads.
+        emit(Opcode::add, Operand::mem(Reg::rbp, job_gen_offset), Operand::imm(1));
+        emit(Opcode::cmp, Operand::mem(Reg::rbp, pool_size_offset), Operand::imm(1));
+        emit(Opcode::jbe, Operand::label(alone));
+        emit(Opcode::lea, Operand::reg(Reg::rdi), Operand::mem(Reg::rbp, job_gen_offset));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(202));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::imm(129));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(INT32_MAX));
+        emit(Opcode::syscall);
+        emit(Opcode::label, Operand::label(alone));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(0));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rbp, job_routine_offset));
+        emit(Opcode::call, Operand::reg(Reg::rcx));
+        emit(Opcode::push, Operand::reg(Reg::rax));
+
+        // Waits for every other thread to be done with the generation, futex(&done, FUTEX_WAIT_PRIVATE, done, NULL).
+        emit(Opcode::mov, Operand::reg(Reg::rbx), Operand::imm(1));
+        emit(Opcode::label, Operand::label(join));
+        emit(Opcode::cmp, Operand::mem(Reg::rbp, pool_size_offset), Operand::reg(Reg::rbx));
+        emit(Opcode::jbe, Operand::label(joined));
+        emit(Opcode::label, Operand::label(join_wait));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::reg(Reg::rbx));
+        emit(Opcode::shl, Operand::reg(Reg::rcx), Operand::imm(thread_entry_shift));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::mem(Reg::rbp, Reg::rcx, 1, m_layout.thread_table));
+        emit(Opcode::cmp, Operand::mem(Reg::rbp, job_gen_offset), Operand::reg(Reg::rdx));
+        emit(Opcode::jz, Operand::label(join_next));
+        emit(Opcode::lea, Operand::reg(Reg::rdi), Operand::mem(Reg::rbp, Reg::rcx, 1, m_layout.thread_table));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(202));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::imm(128));
+        emit(Opcode::mov, Operand::reg(Reg::r10), Operand::imm(0));
+        emit(Opcode::syscall);
+        emit(Opcode::jmp, Operand::label(join_wait));
+        emit(Opcode::label, Operand::label(join_next));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::mem(Reg::rbp, Reg::rcx, 1, m_layout.thread_table + 8));
+        emit(Opcode::add, Operand::mem(Reg::rsp, 0), Operand::reg(Reg::rax));
+        emit(Opcode::add, Operand::reg(Reg::rbx), Operand::imm(1));
+        emit(Opcode::jmp, Operand::label(join));
+        emit(Opcode::label, Operand::label(joined));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, job_running_offset), Operand::imm(0));
+        emit(Opcode::pop, Operand::reg(Reg::rax));
+        if (out_of_bounds.has_value())
         {
-            Generator &gen;
+            emit(Opcode::cmp, Operand::mem(Reg::rbp, job_failed_offset), Operand::imm(0));
+            emit(Opcode::jnz, Operand::label(out_of_bounds.value()));
+        }
+        emit(Opcode::ret);
 
-            void operator()(const NodeTerm *node_term) const
-            {
-                gen.generate_term(node_term);
-            }
+        // The loop of the other threads, futex(&job_gen, FUTEX_WAIT_PRIVATE, seen, NULL) until a new generation.
+        emit(Opcode::label, Operand::label(worker));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::mem(Reg::rbp, job_gen_offset));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::mem(Reg::rsp, 8));
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::reg(Reg::rdx));
+        emit(Opcode::jnz, Operand::label(work));
+        emit(Opcode::lea, Operand::reg(Reg::rdi), Operand::mem(Reg::rbp, job_gen_offset));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(202));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::imm(128));
+        emit(Opcode::mov, Operand::reg(Reg::r10), Operand::imm(0));
+        emit(Opcode::syscall);
+        emit(Opcode::jmp, Operand::label(worker));
+        emit(Opcode::label, Operand::label(work));
+        emit(Opcode::mov, Operand::mem(Reg::rsp, 8), Operand::reg(Reg::rax));
+        emit(Opcode::cmp, Operand::mem(Reg::rbp, pool_stop_offset), Operand::imm(0));
+        emit(Opcode::jnz, Operand::label(stop));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::mem(Reg::rsp, 0));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rbp, job_routine_offset));
+        emit(Opcode::call, Operand::reg(Reg::rcx));
 
-            void operator()(const NodeBinExpr *bin_expr) const
-            {
-                gen.generate_binary_expression(bin_expr);
-            }
-        };
+        // The sum is stored before the generation, the calling thread reads it once it sees the generation.
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rsp, 0));
+        emit(Opcode::shl, Operand::reg(Reg::rcx), Operand::imm(thread_entry_shift));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, Reg::rcx, 1, m_layout.thread_table + 8), Operand::reg(Reg::rax));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::mem(Reg::rsp, 8));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, Reg::rcx, 1, m_layout.thread_table), Operand::reg(Reg::rax));
+        emit(Opcode::lea, Operand::reg(Reg::rdi), Operand::mem(Reg::rbp, Reg::rcx, 1, m_layout.thread_table));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(202));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::imm(129));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(1));
+        emit(Opcode::syscall);
+        emit(Opcode::jmp, Operand::label(worker));
 
-        ExprVisitor visitor{.gen = *this};
-        std::visit(visitor, expr->var);
+        // exit ends only the thread, its stack is not touched afterwards.
+        emit(Opcode::label, Operand::label(stop));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(60));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::imm(0));
+        emit(Opcode::syscall);
     }
 
-    /// @brief Generates assembly code for a scope node.
-    /// @param scope NodeScope to generate code for.
-    void generate_scope(const NodeScope *scope)
+    /// @brief Generates the `release` routine of the runtime, which stops the thread pool and unmaps the heap and the
+    /// mapped files, as far as the program uses them.
+    void generate_release()
     {
-        begin_scope();
-        for (const NodeStmt *stmt : scope->stmts)
+        emit(Opcode::label, Operand::symbol(RuntimeSymbol::release));
+        if (m_layout.threads)
+        {
+            release_threads();
+        }
+        if (m_layout.heap)
+        {
+            release_heap();
+        }
+        if (m_layout.files)
         {
-            generate_statement(stmt);
+            release_files();
         }
-        end_scope();
+        emit(Opcode::ret);
     }
 
-    /// @brief Generates code for If predicates after the if statement.
-    /// @param pred The Predicate node to generate code for.
-    /// @param end_label
-    void generate_if_pred(const NodeIfPred *pred, const std::string &end_label)
+    /// @brief The first 8 characters of a string as the word loaded from memory holding them.
+    static constexpr int64_t text_word(const std::string_view text)
     {
-        struct PredVisitor
+        uint64_t word = 0;
+        for (size_t i = 0; i < 8; i++)
         {
-            Generator &gen;
-            const std::string &end_label;
-
-            void operator()(const NodeIfPredElif *elif) const
-            {
-                gen.m_output << "    ;; elif\n";
-                gen.generate_expression(elif->expr);
-                gen.pop("rax");
-                const std::string label = gen.create_label();
-                gen.m_output << "    test rax, rax\n";
-                gen.m_output << "    jz " << label << "\n";
-                gen.generate_scope(elif->scope);
-                gen.m_output << "    jmp " << end_label << "\n";
-                if (elif->pred.has_value())
-                {
-                    gen.m_output << label << ":\n";
-                    gen.generate_if_pred(elif->pred.value(), end_label);
-                }
-            }
+            word |= uint64_t{static_cast<unsigned char>(text[i])} << (i * 8);
+        }
+        return static_cast<int64_t>(word);
+    }
 
-            void operator()(const NodeIfPredElse *else_) const
-            {
-                gen.m_output << "    ;; else\n";
-                gen.generate_scope(else_->scope);
-            }
-        };
+    /// @brief Emits the part of `release` that stops the thread pool.
+    void release_threads()
+    {
+        const size_t stop_wait = create_label();
+        const size_t stop_next = create_label();
+        const size_t stopped = create_label();
+        const size_t all_stopped = create_label();
+
+        // A new generation with the stop flag set makes the threads exit, their thread IDs are cleared once they have,
+        // futex(&tid, FUTEX_WAIT, tid, NULL) waits for that. Their stacks can only be unmapped afterwards.
+        emit(Opcode::cmp, Operand::mem(Reg::rbp, pool_size_offset), Operand::imm(1));
+        emit(Opcode::jbe, Operand::label(stopped));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, pool_stop_offset), Operand::imm(1));
+        emit(Opcode::add, Operand::mem(Reg::rbp, job_gen_offset), Operand::imm(1));
+        emit(Opcode::lea, Operand::reg(Reg::rdi), Operand::mem(Reg::rbp, job_gen_offset));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(202));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::imm(129));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(INT32_MAX));
+        emit(Opcode::syscall);
+        emit(Opcode::mov, Operand::reg(Reg::rbx), Operand::imm(1));
+        emit(Opcode::label, Operand::label(stop_wait));
+        emit(Opcode::cmp, Operand::mem(Reg::rbp, pool_size_offset), Operand::reg(Reg::rbx));
+        emit(Opcode::jbe, Operand::label(all_stopped));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::reg(Reg::rbx));
+        emit(Opcode::shl, Operand::reg(Reg::rcx), Operand::imm(thread_entry_shift));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::mem(Reg::rbp, Reg::rcx, 1, m_layout.thread_table + 16));
+        emit(Opcode::test, Operand::reg(Reg::rdx), Operand::reg(Reg::rdx));
+        emit(Opcode::jz, Operand::label(stop_next));
+        emit(Opcode::lea, Operand::reg(Reg::rdi), Operand::mem(Reg::rbp, Reg::rcx, 1, m_layout.thread_table + 16));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(202));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::imm(0));
+        emit(Opcode::mov, Operand::reg(Reg::r10), Operand::imm(0));
+        emit(Opcode::syscall);
+        emit(Opcode::jmp, Operand::label(stop_wait));
+        emit(Opcode::label, Operand::label(stop_next));
+        emit(Opcode::add, Operand::reg(Reg::rbx), Operand::imm(1));
+        emit(Opcode::jmp, Operand::label(stop_wait));
+        emit(Opcode::label, Operand::label(all_stopped));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(11));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::mem(Reg::rbp, pool_stacks_offset));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::mem(Reg::rbp, pool_stacks_size_offset));
+        emit(Opcode::syscall);
+        emit(Opcode::mov, Operand::mem(Reg::rbp, pool_stop_offset), Operand::imm(0));
+        emit(Opcode::label, Operand::label(stopped));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, pool_size_offset), Operand::imm(0));
+    }
+
+    /// @brief Emits the part of `release` that unmaps the heap.
+    void release_heap()
+    {
+        const size_t unmapped = create_label();
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::mem(Reg::rbp, heap_base_offset));
+        emit(Opcode::test, Operand::reg(Reg::rdi), Operand::reg(Reg::rdi));
+        emit(Opcode::jz, Operand::label(unmapped));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(11));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::imm(heap_size));
+        emit(Opcode::syscall);
+        emit(Opcode::mov, Operand::mem(Reg::rbp, heap_base_offset), Operand::imm(0));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, heap_pos_offset), Operand::imm(0));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, heap_end_offset), Operand::imm(0));
+        emit(Opcode::label, Operand::label(unmapped));
+    }
 
-        PredVisitor visitor{.gen = *this, .end_label = end_label};
-        std::visit(visitor, pred->var);
+    /// @brief Emits the part of `release` that unmaps the files, from the last one. Empty files have no mapping.
+    void release_files()
+    {
+        const size_t files = create_label();
+        const size_t release_end = create_label();
+        emit(Opcode::label, Operand::label(files));
+        emit(Opcode::mov, Operand::reg(Reg::rbx), Operand::mem(Reg::rbp, map_count_offset));
+        emit(Opcode::test, Operand::reg(Reg::rbx), Operand::reg(Reg::rbx));
+        emit(Opcode::jz, Operand::label(release_end));
+        emit(Opcode::sub, Operand::reg(Reg::rbx), Operand::imm(1));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, map_count_offset), Operand::reg(Reg::rbx));
+        emit(Opcode::shl, Operand::reg(Reg::rbx), Operand::imm(4));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::mem(Reg::rbp, Reg::rbx, 1, m_layout.map_table));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::mem(Reg::rbp, Reg::rbx, 1, m_layout.map_table + 8));
+        emit(Opcode::test, Operand::reg(Reg::rsi), Operand::reg(Reg::rsi));
+        emit(Opcode::jz, Operand::label(files));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(11));
+        emit(Opcode::syscall);
+        emit(Opcode::jmp, Operand::label(files));
+        emit(Opcode::label, Operand::label(release_end));
     }
 
     /**
-     * @brief Generates assembly code for a statement node.
+     * @brief Generates the `read` routine of the runtime.
      *
-     * @param stmt The statement node to generate code for.
+     * The separators before the number and the digits of the number are both found 8 bytes at a time, as the lowest
+     * set byte of a SWAR mask. The digits are then converted 8 at a time with three multiplications, the first group
+     * taking the digits left over from a multiple of 8. A number running into the end of the buffered input is kept in
+     * the buffer while more input is read, unless stdin has ended.
      */
-    void generate_statement(const NodeStmt *stmt)
+    void generate_read()
     {
-        struct StmtVisitor
-        {
-            Generator &gen;
-
-            void operator()(const NodeStmtExit *stmt_exit) const
-            {
-                gen.m_output << "    ;; exit\n";
-                gen.generate_expression(stmt_exit->expr);
-                gen.m_output << "    mov rax, 60\n";
-                gen.pop("rdi");
-                gen.m_output << "    syscall\n";
-                gen.m_output << "    ;; /exit\n";
-            }
-
-            void operator()(const NodeStmtLet *stmt_let) const
-            {
-                gen.m_output << "    ;; let\n";
-                auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var &var)
-                                       { return var.name == stmt_let->ident.value.value(); });
-                if (it != gen.m_vars.cend())
-                {
-                    std::cerr << "Identifier already used: " << stmt_let->ident.value.value() << "\n";
-                    exit(EXIT_FAILURE);
-                }
-                gen.m_vars.push_back(Var{.name = stmt_let->ident.value.value(), .stack_loc = gen.m_stack_size});
-                gen.generate_expression(stmt_let->expr);
-                gen.m_output << "    ;; /let\n";
-            }
-
-            void operator()(const NodeStmtAssign *stmt_assign) const
-            {
-                gen.m_output << "    ;; reassign\n";
-                auto it = std::find_if(gen.m_vars.cbegin(), gen.m_vars.cend(), [&](const Var &var)
-                                       { return var.name == stmt_assign->ident.value.value(); });
-                if (it == gen.m_vars.end())
-                {
-                    std::cerr << "Undeclared identifier: " << stmt_assign->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                gen.generate_expression(stmt_assign->expr);
-                gen.pop("rax");
-                gen.m_output << "    mov [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "], rax\n";
-                gen.m_output << "    ;; /reassign\n";
-            }
-
-            void operator()(const NodeScope *stmt_scope)
-            {
-                gen.m_output << "    ;; scope\n";
-                gen.generate_scope(stmt_scope);
-                gen.m_output << "    ;; /scope\n";
-            }
+        const size_t skip = create_label();
+        const size_t skip_next = create_label();
+        const size_t found = create_label();
+        const size_t scan = create_label();
+        const size_t scan_end = create_label();
+        const size_t convert = create_label();
+        const size_t group = create_label();
+        const size_t done = create_label();
+        const size_t empty = create_label();
+        const size_t end_of_input = create_label();
+        emit(Opcode::label, Operand::symbol(RuntimeSymbol::read));
+        emit(Opcode::label, Operand::label(skip));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::mem(Reg::rbp, input_pos_offset));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::mem(Reg::rbp, input_end_offset));
+        emit(Opcode::label, Operand::label(skip_next));
+        emit(Opcode::cmp, Operand::reg(Reg::rsi), Operand::reg(Reg::rdi));
+        emit(Opcode::jae, Operand::label(empty));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::mem(Reg::rsi, 0));
+        emit_nondigit_mask();
+        emit(Opcode::xor_, Operand::reg(Reg::rcx), Operand::reg(Reg::rdx)); // rcx = mask of the digits
+        emit(Opcode::jnz, Operand::label(found));
+        emit(Opcode::add, Operand::reg(Reg::rsi), Operand::imm(8));
+        emit(Opcode::jmp, Operand::label(skip_next));
+        emit(Opcode::label, Operand::label(found));
+        emit(Opcode::bsf, Operand::reg(Reg::rcx), Operand::reg(Reg::rcx));
+        emit(Opcode::shr, Operand::reg(Reg::rcx), Operand::imm(3));
+        emit(Opcode::add, Operand::reg(Reg::rsi), Operand::reg(Reg::rcx));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, input_pos_offset), Operand::reg(Reg::rsi));
 
-            void operator()(const NodeStmtIf *stmt_if)
-            {
-                gen.m_output << "    ;; if\n";
-                gen.generate_expression(stmt_if->expr);
-                gen.pop("rax");
+        // The number starts at the input position, its end is found into rsi.
+        emit(Opcode::label, Operand::label(scan));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::mem(Reg::rsi, 0));
+        emit_nondigit_mask();
+        emit(Opcode::test, Operand::reg(Reg::rcx), Operand::reg(Reg::rcx));
+        emit(Opcode::jnz, Operand::label(scan_end));
+        emit(Opcode::add, Operand::reg(Reg::rsi), Operand::imm(8));
+        emit(Opcode::jmp, Operand::label(scan));
+        emit(Opcode::label, Operand::label(scan_end));
+        emit(Opcode::bsf, Operand::reg(Reg::rcx), Operand::reg(Reg::rcx));
+        emit(Opcode::shr, Operand::reg(Reg::rcx), Operand::imm(3));
+        emit(Opcode::add, Operand::reg(Reg::rsi), Operand::reg(Reg::rcx));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::mem(Reg::rbp, input_end_offset));
+        emit(Opcode::cmp, Operand::reg(Reg::rsi), Operand::reg(Reg::rdi));
+        emit(Opcode::jb, Operand::label(convert));
+        emit(Opcode::cmp, Operand::mem(Reg::rbp, input_eof_offset), Operand::imm(0));
+        emit(Opcode::jnz, Operand::label(convert));
+        emit(Opcode::call, Operand::symbol(RuntimeSymbol::fill));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::mem(Reg::rbp, input_pos_offset));
+        emit(Opcode::jmp, Operand::label(scan));
 
-                const std::string label = gen.create_label();
+        // The first group is shifted up so the bytes after its digits drop out and zeros come in as leading digits.
+        emit(Opcode::label, Operand::label(convert));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::reg(Reg::rsi));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::mem(Reg::rbp, input_pos_offset));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, input_pos_offset), Operand::reg(Reg::rdi));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::reg(Reg::rdi));
+        emit(Opcode::sub, Operand::reg(Reg::rcx), Operand::reg(Reg::rsi));
+        emit(Opcode::sub, Operand::reg(Reg::rcx), Operand::imm(1));
+        emit(Opcode::and_, Operand::reg(Reg::rcx), Operand::imm(7));
+        emit(Opcode::add, Operand::reg(Reg::rcx), Operand::imm(1)); // rcx = digits of the first group, 1 to 8
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::mem(Reg::rsi, 0));
+        emit(Opcode::add, Operand::reg(Reg::rsi), Operand::reg(Reg::rcx));
+        emit(Opcode::shl, Operand::reg(Reg::rcx), Operand::imm(3));
+        emit(Opcode::neg, Operand::reg(Reg::rcx));
+        emit(Opcode::add, Operand::reg(Reg::rcx), Operand::imm(64));
+        emit(Opcode::shl, Operand::reg(Reg::rax), Operand::reg(Reg::rcx));
+        emit_convert_digits();
+        emit(Opcode::mov, Operand::reg(Reg::rbx), Operand::reg(Reg::rax));
+        emit(Opcode::label, Operand::label(group));
+        emit(Opcode::cmp, Operand::reg(Reg::rsi), Operand::reg(Reg::rdi));
+        emit(Opcode::jae, Operand::label(done));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::mem(Reg::rsi, 0));
+        emit(Opcode::add, Operand::reg(Reg::rsi), Operand::imm(8));
+        emit_convert_digits();
+        emit(Opcode::imul, Operand::reg(Reg::rbx), Operand::reg(Reg::rbx), Operand::imm(100000000));
+        emit(Opcode::add, Operand::reg(Reg::rbx), Operand::reg(Reg::rax));
+        emit(Opcode::jmp, Operand::label(group));
+        emit(Opcode::label, Operand::label(done));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::reg(Reg::rbx));
+        emit(Opcode::ret);
 
-                gen.m_output << "    test rax, rax\n";      // check condition in assembly.
-                gen.m_output << "    jz " << label << "\n"; // jump to label if condition is false i.e 0.
-                gen.generate_scope(stmt_if->scope);
-                if (stmt_if->pred.has_value())
-                {
-                    const std::string end_label = gen.create_label();
-                    gen.m_output << "    jmp " << end_label << "\n";
-                    gen.m_output << label << ":\n";
-                    gen.generate_if_pred(stmt_if->pred.value(), end_label);
-                    gen.m_output << end_label << ":\n";
-                }
-                else
-                {
-                    gen.m_output << label << ":\n";
-                }
-                gen.m_output << "    ;; /if\n";
-            }
-        };
+        // Only separators are left in the buffer, it is refilled from scratch.
+        emit(Opcode::label, Operand::label(empty));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, input_pos_offset), Operand::reg(Reg::rdi));
+        emit(Opcode::cmp, Operand::mem(Reg::rbp, input_eof_offset), Operand::imm(0));
+        emit(Opcode::jnz, Operand::label(end_of_input));
+        emit(Opcode::call, Operand::symbol(RuntimeSymbol::fill));
+        emit(Opcode::jmp, Operand::label(skip));
+        emit(Opcode::label, Operand::label(end_of_input));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(0));
+        emit(Opcode::ret);
+    }
 
-        StmtVisitor visitor{.gen = *this};
-        std::visit(visitor, stmt->var);
+    /// @brief Generates the `fill` routine of the runtime, which `read`s as much of stdin as fits after the unread
+    /// input. A failed `read` ends the input like the end of stdin does.
+    void generate_fill()
+    {
+        const size_t valid = create_label();
+        const size_t more = create_label();
+        emit(Opcode::label, Operand::symbol(RuntimeSymbol::fill));
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::mem(Reg::rbp, input_pos_offset));
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::mem(Reg::rbp, input_end_offset));
+        emit(Opcode::sub, Operand::reg(Reg::rcx), Operand::reg(Reg::rsi));
+        emit(Opcode::lea, Operand::reg(Reg::rdi), Operand::mem(Reg::rbp, m_layout.input_buffer));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, input_pos_offset), Operand::reg(Reg::rdi));
+        emit(Opcode::movsb);
+        emit(Opcode::mov, Operand::reg(Reg::rsi), Operand::reg(Reg::rdi));
+        emit(Opcode::lea, Operand::reg(Reg::rdx), Operand::mem(Reg::rbp, m_layout.input_buffer + input_buffer_size));
+        emit(Opcode::sub, Operand::reg(Reg::rdx), Operand::reg(Reg::rsi));
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(0));
+        emit(Opcode::mov, Operand::reg(Reg::rdi), Operand::imm(0));
+        emit(Opcode::syscall);
+        emit(Opcode::cmp, Operand::reg(Reg::rax), Operand::reg(Reg::rdx));
+        emit(Opcode::jbe, Operand::label(valid)); // errors are negative, so above the room left unsigned
+        emit(Opcode::mov, Operand::reg(Reg::rax), Operand::imm(0));
+        emit(Opcode::label, Operand::label(valid));
+        emit(Opcode::test, Operand::reg(Reg::rax), Operand::reg(Reg::rax));
+        emit(Opcode::jnz, Operand::label(more));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, input_eof_offset), Operand::imm(1));
+        emit(Opcode::label, Operand::label(more));
+        emit(Opcode::add, Operand::reg(Reg::rsi), Operand::reg(Reg::rax));
+        emit(Opcode::mov, Operand::mem(Reg::rbp, input_end_offset), Operand::reg(Reg::rsi));
+        emit(Opcode::mov, Operand::mem(Reg::rsi, 0), Operand::imm(0));
+        emit(Opcode::ret);
     }
 
     /**
-     * @brief Generates the assembly code for the entire program.
+     * @brief Emits the SWAR test of which of the 8 bytes in rax are not decimal digits.
      *
-     * @return The generated assembly code as a string.
+     * A byte is a digit if its high nibble is 3 and adding 6 to its low nibble does not carry. Both tests leave a
+     * nonzero high nibble in the bytes that fail them, which is folded into their top bit without carrying across
+     * bytes. Leaves 0x80 in every such byte of rcx and 0 in the others, and 0x8080808080808080 in rdx.
      */
-    std::string generate_program()
+    void emit_nondigit_mask()
     {
-        m_output << "global _start\n_start:\n";
-
-        // Generate assembly for every statement in the parse tree.
-        for (const NodeStmt *stmt : m_prog.stmts)
-        {
-            generate_statement(stmt);
-        }
+        emit(Opcode::mov, Operand::reg(Reg::rcx), Operand::imm(0x0F0F0F0F0F0F0F0F));
+        emit(Opcode::and_, Operand::reg(Reg::rcx), Operand::reg(Reg::rax));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(0x0606060606060606));
+        emit(Opcode::add, Operand::reg(Reg::rcx), Operand::reg(Reg::rdx));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(0x3030303030303030));
+        emit(Opcode::xor_, Operand::reg(Reg::rdx), Operand::reg(Reg::rax));
+        emit(Opcode::or_, Operand::reg(Reg::rcx), Operand::reg(Reg::rdx));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(static_cast<int64_t>(0xF0F0F0F0F0F0F0F0)));
+        emit(Opcode::and_, Operand::reg(Reg::rcx), Operand::reg(Reg::rdx));
+        emit(Opcode::shr, Operand::reg(Reg::rcx), Operand::imm(1));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(0x7878787878787878));
+        emit(Opcode::add, Operand::reg(Reg::rcx), Operand::reg(Reg::rdx));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(static_cast<int64_t>(0x8080808080808080)));
+        emit(Opcode::and_, Operand::reg(Reg::rcx), Operand::reg(Reg::rdx));
+    }
 
-        m_output << "    mov rax, 60\n";
-        m_output << "    mov rdi, 0\n";
-        m_output << "    syscall\n";
-        return m_output.str();
+    /**
+     * @brief Emits the SWAR conversion of the 8 decimal digits in rax, the first in the lowest byte, to their value.
+     *
+     * Every step multiplies adjacent groups of digits into one twice as wide, from bytes up to dwords. Clobbers rdx.
+     */
+    void emit_convert_digits()
+    {
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(0x0F0F0F0F0F0F0F0F));
+        emit(Opcode::and_, Operand::reg(Reg::rax), Operand::reg(Reg::rdx));
+        emit(Opcode::imul, Operand::reg(Reg::rax), Operand::reg(Reg::rax), Operand::imm(10 * 0x100 + 1));
+        emit(Opcode::shr, Operand::reg(Reg::rax), Operand::imm(8));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(0x00FF00FF00FF00FF));
+        emit(Opcode::and_, Operand::reg(Reg::rax), Operand::reg(Reg::rdx));
+        emit(Opcode::imul, Operand::reg(Reg::rax), Operand::reg(Reg::rax), Operand::imm(100 * 0x10000 + 1));
+        emit(Opcode::shr, Operand::reg(Reg::rax), Operand::imm(16));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(0x0000FFFF0000FFFF));
+        emit(Opcode::and_, Operand::reg(Reg::rax), Operand::reg(Reg::rdx));
+        emit(Opcode::mov, Operand::reg(Reg::rdx), Operand::imm(10000 * 0x100000000 + 1));
+        emit(Opcode::imul, Operand::reg(Reg::rax), Operand::reg(Reg::rdx));
+        emit(Opcode::shr, Operand::reg(Reg::rax), Operand::imm(32));
     }
 
-private:
     /**
-     * @brief Pushes a register onto the system stack in assembly.
+     * @brief Pushes a register or memory operand onto the system stack.
      *
-     * @param reg The register to push.
+     * @param operand The register or memory operand to push.
      */
-    void push(const std::string &reg)
+    void push(const Operand operand)
     {
-        m_output << "    push " << reg << "\n";
+        emit(Opcode::push, operand);
         m_stack_size++;
     }
 
     /**
-     * @brief Pops a register from the system stack in assembly.
+     * @brief Pops from the system stack into a register.
      *
      * @param reg The register to pop into.
      */
-    void pop(const std::string &reg)
+    void pop(const Reg reg)
     {
-        m_output << "    pop " << reg << "\n";
+        emit(Opcode::pop, Operand::reg(reg));
         m_stack_size--;
     }
 
+    /**
+     * @brief Generates a small expression from the superoptimizer table, if it has a sequence for it.
+     *
+     * @param expr The expression node to generate code for.
+     * @return Whether code was generated.
+     */
+    bool generate_superoptimized(const NodeExpr *expr)
+    {
+        const std::optional<SuperTarget> target = make_super_target(expr);
+        if (!target.has_value())
+        {
+            return false;
+        }
+        const std::string key = target.value().key();
+        const std::vector<SuperInstr> *sequence = m_superopt_table->find(key);
+        if (sequence == nullptr && m_superopt_search)
+        {
+            m_superopt_table->insert(key, Superoptimizer(target.value()).search().value_or(std::vector<SuperInstr>{}));
+            sequence = m_superopt_table->find(key);
+        }
+        if (sequence == nullptr || sequence->empty())
+        {
+            return false;
+        }
+
+        // Load the variables into the registers the sequence expects them in.
+        comment("superoptimized");
+        for (size_t i = 0; i < target.value().vars.size(); i++)
+        {
+            const size_t offset = (m_stack_size - target.value().vars[i] - 1) * 8;
+            emit(Opcode::mov, Operand::reg(super_regs[i]), Operand::mem(Reg::rsp, static_cast<int64_t>(offset)));
+        }
+        for (const SuperInstr &instr : *sequence)
+        {
+            m_instrs.push_back(to_machine_instr(instr));
+        }
+        push(Operand::reg(Reg::rax));
+        return true;
+    }
+
+    /**
+     * @brief Adds an offset to the label IDs of instructions.
+     *
+     * @param instrs The instructions.
+     * @param offset The offset.
+     */
+    static void shift_labels(const std::span<MachineInstr> instrs, const int64_t offset)
+    {
+        for (MachineInstr &instr : instrs)
+        {
+            for (Operand *operand : {&instr.dst, &instr.src, &instr.src2})
+            {
+                if (operand->kind == OperandKind::label)
+                {
+                    operand->value += offset;
+                }
+            }
+        }
+    }
+
     /// @brief Beginning the scope.
     void begin_scope()
     {
-        m_scopes.push_back(m_vars.size());
+        m_scopes.push_back(m_var_count);
     }
 
     /// @brief Ending the scope.
     void end_scope()
     {
-        const size_t pop_count = m_vars.size() - m_scopes.back();
+        const size_t pop_count = m_var_count - m_scopes.back();
         if (pop_count != 0)
         {
-            m_output << "    add rsp, " << pop_count * 8 << "\n";
+            emit(Opcode::add, Operand::reg(Reg::rsp), Operand::imm(static_cast<int64_t>(pop_count * 8)));
         }
         m_stack_size -= pop_count;
-        for (size_t i = 0; i < pop_count; i++)
-        {
-            m_vars.pop_back();
-        }
+        m_var_count -= pop_count;
         m_scopes.pop_back();
     }
 
     /// @brief Create 'label' in assembly to jump to when 'if' condition is not true.
-    /// @return
-    std::string create_label()
+    /// @return ID of the label.
+    size_t create_label()
     {
-        return "label" + std::to_string(m_label_count++);
+        return m_label_count++;
     }
 
-    const NodeProg m_prog;      // The root of the parse tree.
-    std::stringstream m_output; // The output string stream for the generated assembly code.
+    const NodeProg m_prog;                 // The root of the parse tree.
+    const CompactAst *m_compact = nullptr; // The compact parse tree being generated, or nullptr.
+    std::vector<MachineInstr> m_instrs;    // The generated machine instructions.
+    SuperoptTable *m_superopt_table;       // Table of superoptimized sequences, or nullptr.
+    const bool m_superopt_search;          // Whether to search for sequences missing from the table.
+    const ProgramKind m_kind;              // How the program is entered and left.
 
-    /// @brief Represents a variable in the stack with its location.
-    struct Var
-    {
-        std::string name; // Name of the variable.
-        size_t stack_loc; // The location of the variable in the stack.
-    };
+    RuntimeCalls m_calls{};                   // Routines of the runtime called by the program so far.
+    RuntimeLayout m_layout{};                 // Parts of the runtime generated, once the program is finished.
+    std::optional<size_t> m_prologue_count{}; // Instructions of the start of the program, once generated.
 
-    size_t m_stack_size = 0;   // The current size of the stack.
-    std::vector<Var> m_vars{}; // List of all the variables created.
-    std::vector<size_t> m_scopes{};
-    int m_label_count = 0; // Number of labels created.
+    size_t m_stack_size = 0;        // The current size of the stack.
+    size_t m_var_count = 0;         // Number of variables in scope, resolved to slots by the resolver.
+    std::vector<size_t> m_scopes{}; // Number of variables in scope when each open scope began.
+    size_t m_label_count = 0; // Number of labels created.
+    size_t m_label_base = 0;  // ID of the first label not handed over by `take_instrs`.
+    LabelTable m_labels{};    // All the labels created, filled in once the program is generated.
+    std::vector<Task> m_tasks{}; // Worklist of code generation tasks.
 };
@@ -0,0 +1,243 @@
+#pragma once
+#include <elf.h>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "encoding.hpp"
+
+/// @brief Machine code of a chunk, with the calls it makes into the runtime and the runtime routines it defines.
+struct ObjectCode
+{
+    std::vector<uint8_t> machine_code{};                               // The code.
+    std::vector<Relocation> relocations{};                             // Calls to routines defined by other chunks.
+    std::array<std::optional<size_t>, runtime_symbol_count> symbols{}; // Offsets of the routines the code defines.
+};
+
+/// @brief Class to write a static x86-64 ELF executable laid out in padded chunks of code, so the chunks that change
+/// between builds can be patched in place instead of writing the whole file again.
+///
+/// The chunks run one after the other, entering at the first one. Every chunk is followed by spare bytes that a jump
+/// at the end of its code skips, and that the code can grow into when it is patched. Where each chunk starts and how
+/// large it may get is kept in a side map; code that outgrows its chunk needs the whole executable linked again.
+/// Calls into the runtime are filled in whenever a chunk is written, as its place is only known then.
+class ChunkedExecutable
+{
+public:
+    /**
+     * @brief Constructs the executable for a given path, nothing is written until it is linked.
+     *
+     * @param path Path of the executable.
+     */
+    explicit ChunkedExecutable(std::string path)
+        : m_path(std::move(path))
+    {
+    }
+
+    /**
+     * @brief Writes the whole executable, giving every chunk spare bytes to grow into.
+     *
+     * The file is written next to the executable and renamed over it, so a copy that is still running is not touched.
+     *
+     * @param chunks The code of every chunk, in the order it runs. Every runtime routine called must be defined by
+     * one of them.
+     */
+    void link(const std::vector<const ObjectCode *> &chunks)
+    {
+        m_chunks.clear();
+        size_t offset = text_offset;
+        for (const ObjectCode *code : chunks)
+        {
+            const size_t size = code->machine_code.size();
+            const size_t capacity = size + size / spare_ratio + min_spare;
+            m_chunks.push_back({.offset = offset, .capacity = capacity});
+            for (size_t i = 0; i < runtime_symbol_count; i++)
+            {
+                if (code->symbols[i].has_value())
+                {
+                    m_symbols[i] = offset + code->symbols[i].value();
+                }
+            }
+            offset += capacity;
+        }
+
+        const std::string tmp_path = m_path + ".tmp";
+        {
+            std::ofstream file(tmp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+            const std::vector<uint8_t> headers = make_headers(offset);
+            file.write(reinterpret_cast<const char *>(headers.data()), static_cast<std::streamsize>(headers.size()));
+            std::vector<uint8_t> bytes;
+            for (size_t i = 0; i < chunks.size(); i++)
+            {
+                fill_chunk(*chunks[i], m_chunks[i], bytes);
+                file.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+            }
+        }
+        std::filesystem::permissions(tmp_path, std::filesystem::perms::owner_all | std::filesystem::perms::group_read |
+                                                   std::filesystem::perms::group_exec | std::filesystem::perms::others_read |
+                                                   std::filesystem::perms::others_exec);
+        std::filesystem::rename(tmp_path, m_path);
+        m_write_time = std::filesystem::last_write_time(m_path);
+    }
+
+    /**
+     * @brief Patches chunks of the executable in place.
+     *
+     * @param changes Index of every chunk to patch along with its new code, which must fit the chunk and define no
+     * runtime routines.
+     * @return Whether the chunks were patched, false if the executable changed since it was written, is running or
+     * could not be written. It has to be linked again then.
+     */
+    bool patch(const std::vector<std::pair<size_t, const ObjectCode *>> &changes)
+    {
+        std::error_code ec;
+        if (std::filesystem::last_write_time(m_path, ec) != m_write_time || ec)
+        {
+            return false;
+        }
+        {
+            std::fstream file(m_path, std::ios::in | std::ios::out | std::ios::binary);
+            std::vector<uint8_t> bytes;
+            for (const auto &[index, code] : changes)
+            {
+                fill_chunk(*code, m_chunks[index], bytes);
+                file.seekp(static_cast<std::streamoff>(m_chunks[index].offset));
+                file.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+            }
+            file.flush();
+            if (!file)
+            {
+                return false;
+            }
+        }
+        m_write_time = std::filesystem::last_write_time(m_path, ec);
+        return !ec;
+    }
+
+    /**
+     * @brief Checks whether machine code fits into a chunk of the executable as it was linked.
+     *
+     * @param index Index of the chunk.
+     * @param size Size of the machine code.
+     * @return Whether the code fits.
+     */
+    bool fits(const size_t index, const size_t size) const
+    {
+        return size <= m_chunks[index].capacity;
+    }
+
+    /// @brief Number of chunks the executable was linked with.
+    size_t chunk_count() const
+    {
+        return m_chunks.size();
+    }
+
+private:
+    /// @brief Where a chunk is in the file.
+    struct Chunk
+    {
+        size_t offset;   // Offset of the chunk in the file.
+        size_t capacity; // Size of the chunk, including its spare bytes.
+    };
+
+    static constexpr uint64_t load_address = 0x400000; // Address the file is mapped at, the default of ld.
+    static constexpr size_t text_offset = 0x80;        // Offset of the first chunk, after the headers.
+    static constexpr size_t spare_ratio = 4;           // A chunk has its code size over this in spare bytes...
+    static constexpr size_t min_spare = 16;            // ...plus this many, so small statements can grow too.
+
+    /**
+     * @brief Builds the ELF header and the program header mapping the whole file, padded up to the first chunk.
+     *
+     * @param file_size Size of the whole file.
+     * @return The headers.
+     */
+    static std::vector<uint8_t> make_headers(const size_t file_size)
+    {
+        Elf64_Ehdr ehdr{};
+        ehdr.e_ident[EI_MAG0] = ELFMAG0;
+        ehdr.e_ident[EI_MAG1] = ELFMAG1;
+        ehdr.e_ident[EI_MAG2] = ELFMAG2;
+        ehdr.e_ident[EI_MAG3] = ELFMAG3;
+        ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+        ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+        ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+        ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+        ehdr.e_type = ET_EXEC;
+        ehdr.e_machine = EM_X86_64;
+        ehdr.e_version = EV_CURRENT;
+        ehdr.e_entry = load_address + text_offset;
+        ehdr.e_phoff = sizeof(Elf64_Ehdr);
+        ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+        ehdr.e_phentsize = sizeof(Elf64_Phdr);
+        ehdr.e_phnum = 1;
+
+        // A single segment maps the headers and the code, the program has no data.
+        Elf64_Phdr phdr{};
+        phdr.p_type = PT_LOAD;
+        phdr.p_flags = PF_R | PF_X;
+        phdr.p_offset = 0;
+        phdr.p_vaddr = load_address;
+        phdr.p_paddr = load_address;
+        phdr.p_filesz = file_size;
+        phdr.p_memsz = file_size;
+        phdr.p_align = 0x1000;
+
+        static_assert(sizeof(Elf64_Ehdr) + sizeof(Elf64_Phdr) <= text_offset);
+        std::vector<uint8_t> headers(text_offset, 0);
+        std::memcpy(headers.data(), &ehdr, sizeof(ehdr));
+        std::memcpy(headers.data() + sizeof(ehdr), &phdr, sizeof(phdr));
+        return headers;
+    }
+
+    /**
+     * @brief Lays out the machine code of a chunk with its calls into the runtime filled in, followed by a jump over
+     * its spare bytes.
+     *
+     * @param code The code.
+     * @param chunk Where the chunk is.
+     * @param bytes Receives the contents of the chunk.
+     */
+    void fill_chunk(const ObjectCode &code, const Chunk &chunk, std::vector<uint8_t> &bytes) const
+    {
+        bytes.assign(code.machine_code.begin(), code.machine_code.end());
+        for (const Relocation &relocation : code.relocations)
+        {
+            // The displacement is relative to the end of the call, right after it.
+            const size_t target = m_symbols[static_cast<size_t>(relocation.symbol)];
+            const auto disp = static_cast<uint32_t>(target - (chunk.offset + relocation.offset + 4));
+            std::memcpy(bytes.data() + relocation.offset, &disp, sizeof(disp));
+        }
+        const size_t spare = chunk.capacity - code.machine_code.size();
+        if (spare == 1)
+        {
+            bytes.push_back(0x90); // nop
+        }
+        else if (spare >= 2 && spare - 2 <= INT8_MAX)
+        {
+            bytes.push_back(0xEB); // jmp short
+            bytes.push_back(static_cast<uint8_t>(spare - 2));
+        }
+        else if (spare > 0)
+        {
+            bytes.push_back(0xE9); // jmp near
+            const auto disp = static_cast<uint32_t>(spare - 5);
+            for (size_t i = 0; i < 4; i++)
+            {
+                bytes.push_back(static_cast<uint8_t>(disp >> (8 * i)));
+            }
+        }
+
+        // The spare bytes are never run, int3 traps if a jump goes astray.
+        bytes.resize(chunk.capacity, 0xCC);
+    }
+
+    const std::string m_path;                             // Path of the executable.
+    std::vector<Chunk> m_chunks{};                        // Side map of the chunks, in the order they run.
+    std::array<size_t, runtime_symbol_count> m_symbols{}; // Offset of every runtime routine in the file.
+    std::filesystem::file_time_type m_write_time{};       // Time the executable was last written, to notice other writers.
+};
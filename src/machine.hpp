@@ -0,0 +1,749 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// @brief Enumeration of the x86-64 registers the generator uses.
+enum class Reg : uint8_t
+{
+    rax,
+    rcx,
+    rdx,
+    rbx,
+    rsp,
+    rbp,
+    rsi,
+    rdi,
+    r8,
+    r9,
+    r10,
+};
+
+/// @brief Enumeration of the machine instructions the generator emits.
+enum class Opcode : uint8_t
+{
+    mov,     // mov dst, src
+    movzx,   // movzx dst, BYTE src
+    push,    // push dst
+    pop,     // pop dst
+    add,     // add dst, src
+    sub,     // sub dst, src
+    mul,     // mul dst
+    imul,    // imul dst, src (, src2)
+    div,     // div dst
+    xor_,    // xor dst, src
+    and_,    // and dst, src
+    or_,     // or dst, src
+    neg,     // neg dst
+    lea,     // lea dst, src, the address of a label if src is one
+    shl,     // shl dst, src
+    shr,     // shr dst, src
+    bsf,     // bsf dst, src
+    test,    // test dst, src
+    cmp,     // cmp dst, src
+    jz,      // jz dst
+    jnz,     // jnz dst
+    jb,      // jb dst
+    jae,     // jae dst
+    jbe,     // jbe dst
+    jmp,     // jmp dst
+    call,    // call dst, a runtime routine or a register
+    syscall, // syscall
+    ret,     // ret
+    std,     // std
+    cld,     // cld
+    stosb,   // stosb
+    movsb,   // rep movsb
+    label,   // dst:
+    comment, // ;; text
+};
+
+/// @brief Enumeration of the kinds of operands.
+enum class OperandKind : uint8_t
+{
+    none,  // No operand.
+    reg,   // A register.
+    imm,   // An immediate value.
+    mem,    // A QWORD in memory at [base + index*scale + disp].
+    label,  // A label ID.
+    symbol, // A routine of the runtime, by its RuntimeSymbol.
+};
+
+/// @brief Enumeration of the routines of the runtime emitted after every program.
+enum class RuntimeSymbol : uint8_t
+{
+    print,   // Appends the decimal digits of rax and a newline to the output buffer.
+    flush,   // Writes the output buffer to stdout and empties it.
+    read,    // Parses the next integer on stdin into rax.
+    fill,    // Moves the unread input to the start of the input buffer and reads more after it.
+    arg,     // Parses the command-line argument with the index in rax into rax.
+    alloc,   // Allocates an array of rax elements on the heap, mapping it first, and returns its address in rax.
+    reset,   // Frees the array at rax and every array allocated after it.
+    map,     // Maps the file named by the command-line argument with the index in rax, returning its handle in rax.
+    size,    // Returns the size in bytes of the mapped file with the handle in rax.
+    byte,    // Loads byte rbx of the mapped file with the handle in rax into rax, ending the program if out of bounds.
+    word,    // Loads 64-bit word rbx of the mapped file with the handle in rax into rax, likewise.
+    fork,    // Runs the loop routine at rdx over the indices rax to rbx on the thread pool, rcx at a time, and sums up.
+    exit,    // Ends the program with the exit code in rdi, after leaving the runtime.
+    release, // Unmaps the heap and the mapped files, and stops the thread pool.
+};
+
+/// @brief Number of runtime routines, for tables indexed by RuntimeSymbol.
+constexpr size_t runtime_symbol_count = static_cast<size_t>(RuntimeSymbol::release) + 1;
+
+/// @brief Represents an operand of a machine instruction.
+struct Operand
+{
+    OperandKind kind = OperandKind::none; // The kind of operand.
+    Reg base = Reg::rax;                  // The register, or base register of a memory operand.
+    Reg index = Reg::rax;                 // Index register of a memory operand, used if scale is not 0.
+    uint8_t scale = 0;                    // Scale of the index register of a memory operand.
+    int64_t value = 0;                    // Immediate value, displacement of a memory operand or label ID.
+
+    /// @brief Creates a register operand.
+    static Operand reg(const Reg reg)
+    {
+        return {.kind = OperandKind::reg, .base = reg};
+    }
+
+    /// @brief Creates an immediate operand.
+    static Operand imm(const int64_t value)
+    {
+        return {.kind = OperandKind::imm, .value = value};
+    }
+
+    /// @brief Creates a memory operand at [base + disp].
+    static Operand mem(const Reg base, const int64_t disp)
+    {
+        return {.kind = OperandKind::mem, .base = base, .value = disp};
+    }
+
+    /// @brief Creates a memory operand at [base + index*scale + disp].
+    static Operand mem(const Reg base, const Reg index, const uint8_t scale, const int64_t disp = 0)
+    {
+        return {.kind = OperandKind::mem, .base = base, .index = index, .scale = scale, .value = disp};
+    }
+
+    /// @brief Creates a label operand.
+    static Operand label(const size_t id)
+    {
+        return {.kind = OperandKind::label, .value = static_cast<int64_t>(id)};
+    }
+
+    /// @brief Creates an operand naming a runtime routine.
+    static Operand symbol(const RuntimeSymbol symbol)
+    {
+        return {.kind = OperandKind::symbol, .value = static_cast<int64_t>(symbol)};
+    }
+
+    bool operator==(const Operand &) const = default;
+};
+
+/// @brief Represents a single machine instruction.
+struct MachineInstr
+{
+    Opcode op;                     // The instruction.
+    uint8_t disp_size = 0;         // Displacement size in bytes of a jump chosen by relaxation, 0 if not relaxed.
+    Operand dst{};                 // First operand.
+    Operand src{};                 // Second operand.
+    Operand src2{};                // Third operand, only used by three-operand `imul`.
+    const char *comment = nullptr; // Text of a comment pseudo-instruction.
+};
+
+/// @brief Enumeration of the ways a generated program is entered and left.
+///
+/// A function is `uint64_t <name>(int argc, char **argv)` under the System V ABI, taking argc and argv like `main`.
+/// `arg` and `map` read the null-terminated argv passed in rsi, argc in rdi is not used.
+enum class ProgramKind : uint8_t
+{
+    executable, // Entered at `_start`, `exit` ends the process.
+    function,   // Called through the C ABI, `exit` returns its value to the caller.
+};
+
+/// @brief Table of the labels of a program, indexed by label ID.
+///
+/// Labels are plain integers in the instruction list and only become names or offsets when the list is printed or
+/// encoded. The table tracks how often each label is referenced and where it ends up once the code is laid out.
+class LabelTable
+{
+public:
+    /// @brief Creates a table of labels.
+    /// @param count Number of labels already created, with IDs first_id to first_id + count - 1.
+    /// @param first_id ID of the first label, for tables covering only part of a program.
+    explicit LabelTable(const size_t count = 0, const size_t first_id = 0)
+        : m_labels(count), m_first_id(first_id)
+    {
+    }
+
+    /// @brief Creates a new label.
+    /// @return ID of the label.
+    size_t create_label()
+    {
+        m_labels.push_back({});
+        return m_first_id + m_labels.size() - 1;
+    }
+
+    /// @brief Number of labels created.
+    size_t size() const
+    {
+        return m_labels.size();
+    }
+
+    /// @brief Offset of a label in the encoded code, valid after relaxation.
+    /// @param id ID of the label.
+    size_t offset(const size_t id) const
+    {
+        return m_labels[id - m_first_id].offset;
+    }
+
+    /// @brief Records the offset of a label in the encoded code.
+    /// @param id ID of the label.
+    /// @param offset Offset of the label.
+    void set_offset(const size_t id, const size_t offset)
+    {
+        m_labels[id - m_first_id].offset = offset;
+    }
+
+    /**
+     * @brief Removes jumps to the next instruction and labels that are never jumped to or have their address taken.
+     *
+     * @param instrs The instructions to clean up.
+     */
+    void remove_dead_labels(std::vector<MachineInstr> &instrs)
+    {
+        // A jump whose target follows it with only labels and comments in between does nothing.
+        std::vector<MachineInstr> live;
+        live.reserve(instrs.size());
+        for (size_t i = 0; i < instrs.size(); i++)
+        {
+            if (!is_jump(instrs[i].op) || !falls_through_to(instrs, i + 1, static_cast<size_t>(instrs[i].dst.value)))
+            {
+                live.push_back(instrs[i]);
+            }
+        }
+
+        for (Label &label : m_labels)
+        {
+            label.references = 0;
+        }
+        for (const MachineInstr &instr : live)
+        {
+            if (is_jump(instr.op))
+            {
+                m_labels[instr.dst.value - m_first_id].references++;
+            }
+            else if (instr.op == Opcode::lea && instr.src.kind == OperandKind::label)
+            {
+                m_labels[instr.src.value - m_first_id].references++;
+            }
+        }
+
+        instrs.clear();
+        for (const MachineInstr &instr : live)
+        {
+            // Runtime routines are called, not jumped to, and always kept.
+            if (instr.op != Opcode::label || instr.dst.kind != OperandKind::label ||
+                m_labels[instr.dst.value - m_first_id].references != 0)
+            {
+                instrs.push_back(instr);
+            }
+        }
+    }
+
+    /// @brief Checks weather the given Opcode is a jump to a label or not.
+    static bool is_jump(const Opcode op)
+    {
+        return op == Opcode::jz || op == Opcode::jnz || op == Opcode::jb || op == Opcode::jae || op == Opcode::jbe ||
+               op == Opcode::jmp;
+    }
+
+private:
+    /// @brief Represents a label with its uses and position.
+    struct Label
+    {
+        size_t references = 0; // Number of jumps to the label and of `lea`s of its address.
+        size_t offset = 0;      // Offset of the label in the encoded code.
+    };
+
+    /**
+     * @brief Checks whether a label is reached from a position without executing any instruction.
+     *
+     * @param instrs The instructions.
+     * @param begin The position to start at.
+     * @param id ID of the label.
+     * @return Whether only labels and comments lie between the position and the label.
+     */
+    static bool falls_through_to(const std::vector<MachineInstr> &instrs, const size_t begin, const size_t id)
+    {
+        for (size_t i = begin; i < instrs.size(); i++)
+        {
+            if (instrs[i].op == Opcode::label && instrs[i].dst.kind == OperandKind::label &&
+                static_cast<size_t>(instrs[i].dst.value) == id)
+            {
+                return true;
+            }
+            if (instrs[i].op != Opcode::label && instrs[i].op != Opcode::comment)
+            {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    std::vector<Label> m_labels{}; // All the labels, indexed by ID minus the first ID.
+    size_t m_first_id = 0;         // ID of the first label in the table.
+};
+
+/// @brief Register to assembly syntax.
+/// @param reg The register.
+/// @return Name of the register.
+std::string to_string(const Reg reg)
+{
+    switch (reg)
+    {
+    case Reg::rax:
+        return "rax";
+    case Reg::rcx:
+        return "rcx";
+    case Reg::rdx:
+        return "rdx";
+    case Reg::rbx:
+        return "rbx";
+    case Reg::rsp:
+        return "rsp";
+    case Reg::rbp:
+        return "rbp";
+    case Reg::rsi:
+        return "rsi";
+    case Reg::rdi:
+        return "rdi";
+    case Reg::r8:
+        return "r8";
+    case Reg::r9:
+        return "r9";
+    case Reg::r10:
+        return "r10";
+    }
+    assert(false);
+    __builtin_unreachable();
+}
+
+/// @brief Runtime routine to assembly syntax.
+/// @param symbol The routine.
+/// @return Name of the routine, local to the object file.
+std::string to_string(const RuntimeSymbol symbol)
+{
+    switch (symbol)
+    {
+    case RuntimeSymbol::print:
+        return "hy_print";
+    case RuntimeSymbol::flush:
+        return "hy_flush";
+    case RuntimeSymbol::read:
+        return "hy_read";
+    case RuntimeSymbol::fill:
+        return "hy_fill";
+    case RuntimeSymbol::arg:
+        return "hy_arg";
+    case RuntimeSymbol::alloc:
+        return "hy_alloc";
+    case RuntimeSymbol::reset:
+        return "hy_reset";
+    case RuntimeSymbol::map:
+        return "hy_map";
+    case RuntimeSymbol::size:
+        return "hy_size";
+    case RuntimeSymbol::byte:
+        return "hy_byte";
+    case RuntimeSymbol::word:
+        return "hy_word";
+    case RuntimeSymbol::fork:
+        return "hy_fork";
+    case RuntimeSymbol::exit:
+        return "hy_exit";
+    case RuntimeSymbol::release:
+        return "hy_release";
+    }
+    assert(false);
+    __builtin_unreachable();
+}
+
+/// @brief Opcode to assembly syntax.
+/// @param op The opcode.
+/// @return Mnemonic of the instruction.
+std::string to_string(const Opcode op)
+{
+    switch (op)
+    {
+    case Opcode::mov:
+        return "mov";
+    case Opcode::movzx:
+        return "movzx";
+    case Opcode::push:
+        return "push";
+    case Opcode::pop:
+        return "pop";
+    case Opcode::add:
+        return "add";
+    case Opcode::sub:
+        return "sub";
+    case Opcode::mul:
+        return "mul";
+    case Opcode::imul:
+        return "imul";
+    case Opcode::div:
+        return "div";
+    case Opcode::xor_:
+        return "xor";
+    case Opcode::and_:
+        return "and";
+    case Opcode::or_:
+        return "or";
+    case Opcode::neg:
+        return "neg";
+    case Opcode::lea:
+        return "lea";
+    case Opcode::shl:
+        return "shl";
+    case Opcode::shr:
+        return "shr";
+    case Opcode::bsf:
+        return "bsf";
+    case Opcode::test:
+        return "test";
+    case Opcode::cmp:
+        return "cmp";
+    case Opcode::jz:
+        return "jz";
+    case Opcode::jnz:
+        return "jnz";
+    case Opcode::jb:
+        return "jb";
+    case Opcode::jae:
+        return "jae";
+    case Opcode::jbe:
+        return "jbe";
+    case Opcode::jmp:
+        return "jmp";
+    case Opcode::call:
+        return "call";
+    case Opcode::syscall:
+        return "syscall";
+    case Opcode::ret:
+        return "ret";
+    case Opcode::std:
+        return "std";
+    case Opcode::cld:
+        return "cld";
+    case Opcode::stosb:
+        return "stosb";
+    case Opcode::movsb:
+        return "rep movsb";
+    case Opcode::label:
+    case Opcode::comment:
+        break;
+    }
+    assert(false);
+    __builtin_unreachable();
+}
+
+/// @brief Enumeration of the assemblers the printed assembly code is written for.
+enum class AsmDialect : uint8_t
+{
+    nasm, // NASM, Intel syntax.
+    yasm, // YASM, which reads the same syntax as NASM.
+    gas,  // GNU as, AT&T syntax.
+};
+
+/// @brief Class to print machine instructions as assembly code for one of the supported assemblers.
+class AsmPrinter
+{
+public:
+    /**
+     * @brief Constructs the printer for a given assembler and kind of program.
+     *
+     * @param dialect The assembler to print for.
+     * @param kind How the program is entered.
+     * @param symbol Name of the function a function program is entered at.
+     */
+    explicit AsmPrinter(const AsmDialect dialect = AsmDialect::nasm, const ProgramKind kind = ProgramKind::executable,
+                        std::string symbol = "")
+        : m_dialect(dialect), m_kind(kind), m_symbol(std::move(symbol))
+    {
+    }
+
+    /**
+     * @brief Prints a list of machine instructions as a program with its entry point.
+     *
+     * @param instrs The instructions to print.
+     * @return The assembly code as a string.
+     */
+    std::string print_program(const std::vector<MachineInstr> &instrs)
+    {
+        return print_header() + print_instrs(instrs);
+    }
+
+    /// @brief Prints the header declaring the entry point, for programs printed piece by piece.
+    std::string print_header() const
+    {
+        // The note keeps the stack of whatever links a function's object from being made executable.
+        if (m_dialect == AsmDialect::gas)
+        {
+            if (m_kind == ProgramKind::function)
+            {
+                return ".section .note.GNU-stack,\"\",@progbits\n.text\n.globl " + m_symbol + "\n.type " + m_symbol +
+                       ", @function\n" + m_symbol + ":\n";
+            }
+            return ".globl _start\n_start:\n";
+        }
+        if (m_kind == ProgramKind::function)
+        {
+            return "section .note.GNU-stack noalloc noexec nowrite progbits\nsection .text\nglobal " + m_symbol +
+                   ":function\n" + m_symbol + ":\n";
+        }
+        return "global _start\n_start:\n";
+    }
+
+    /**
+     * @brief Prints a list of machine instructions without a header, for programs printed piece by piece.
+     *
+     * @param instrs The instructions to print.
+     * @return The assembly code as a string.
+     */
+    std::string print_instrs(const std::vector<MachineInstr> &instrs)
+    {
+        m_output.str({});
+        for (const MachineInstr &instr : instrs)
+        {
+            print_instr(instr);
+        }
+        return m_output.str();
+    }
+
+private:
+    /**
+     * @brief Prints a single instruction.
+     *
+     * @param instr The instruction to print.
+     */
+    void print_instr(const MachineInstr &instr)
+    {
+        if (instr.op == Opcode::label)
+        {
+            if (instr.dst.kind == OperandKind::symbol)
+            {
+                m_output << to_string(static_cast<RuntimeSymbol>(instr.dst.value)) << ":\n";
+                return;
+            }
+            m_output << "label" << instr.dst.value << ":\n";
+            return;
+        }
+        if (instr.op == Opcode::comment)
+        {
+            m_output << (m_dialect == AsmDialect::gas ? "    # " : "    ;; ") << instr.comment << "\n";
+            return;
+        }
+        if (m_dialect == AsmDialect::gas)
+        {
+            print_att_instr(instr);
+            return;
+        }
+
+        // Memory operands need an explicit size unless a register operand of the same size implies it.
+        const bool sized = instr.dst.kind != OperandKind::reg && instr.src.kind != OperandKind::reg;
+        const char *size = instr.op == Opcode::movzx ? "BYTE " : sized && instr.op != Opcode::lea ? "QWORD " : "";
+        m_output << "    " << to_string(instr.op);
+        const char *separator = " ";
+        for (const Operand *operand : {&instr.dst, &instr.src, &instr.src2})
+        {
+            if (operand->kind == OperandKind::none)
+            {
+                break;
+            }
+            m_output << separator;
+            if (operand->kind == OperandKind::label && instr.disp_size != 0)
+            {
+                // Relaxation already picked the jump size, so the assembler does not have to.
+                m_output << (instr.disp_size == 1 ? "short " : "near ");
+            }
+            if (is_shift_count(instr, *operand))
+            {
+                m_output << "cl";
+            }
+            else if (operand->kind == OperandKind::label && instr.op == Opcode::lea)
+            {
+                m_output << "[rel label" << operand->value << "]";
+            }
+            else
+            {
+                print_operand(*operand, size);
+            }
+            separator = ", ";
+        }
+        m_output << "\n";
+    }
+
+    /**
+     * @brief Prints a single instruction in AT&T syntax.
+     *
+     * The operands come in reverse order and the instruction is sized by a suffix instead of its operands. GNU as
+     * picks jump sizes itself, so the ones relaxation chose are not printed.
+     *
+     * @param instr The instruction to print.
+     */
+    void print_att_instr(const MachineInstr &instr)
+    {
+        // AT&T names the zero extension by both of its sizes.
+        m_output << "    " << (instr.op == Opcode::movzx ? "movzb" : to_string(instr.op));
+        if (has_operand_size(instr.op))
+        {
+            m_output << 'q';
+        }
+        const char *separator = " ";
+        for (const Operand *operand : {&instr.src2, &instr.src, &instr.dst})
+        {
+            if (operand->kind == OperandKind::none)
+            {
+                continue;
+            }
+            m_output << separator;
+            if (is_shift_count(instr, *operand))
+            {
+                m_output << "%cl";
+            }
+            else if (operand->kind == OperandKind::label && instr.op == Opcode::lea)
+            {
+                m_output << "label" << operand->value << "(%rip)";
+            }
+            else
+            {
+                // Calls through a register are marked as indirect.
+                m_output << (instr.op == Opcode::call && operand->kind == OperandKind::reg ? "*" : "");
+                print_att_operand(*operand);
+            }
+            separator = ", ";
+        }
+        m_output << "\n";
+    }
+
+    /// @brief Whether an instruction operates on QWORDs, for the size suffix of AT&T syntax.
+    static bool has_operand_size(const Opcode op)
+    {
+        switch (op)
+        {
+        case Opcode::jz:
+        case Opcode::jnz:
+        case Opcode::jb:
+        case Opcode::jae:
+        case Opcode::jbe:
+        case Opcode::jmp:
+        case Opcode::call:
+        case Opcode::syscall:
+        case Opcode::ret:
+        case Opcode::std:
+        case Opcode::cld:
+        case Opcode::stosb:
+        case Opcode::movsb:
+        case Opcode::label:
+        case Opcode::comment:
+            return false;
+        default:
+            return true;
+        }
+    }
+
+    /// @brief Whether an operand is the count of a shift by a register, which is always in cl.
+    static bool is_shift_count(const MachineInstr &instr, const Operand &operand)
+    {
+        return (instr.op == Opcode::shl || instr.op == Opcode::shr) && &operand == &instr.src &&
+               operand.kind == OperandKind::reg;
+    }
+
+    /**
+     * @brief Prints a single operand.
+     *
+     * @param operand The operand to print.
+     * @param size Size of memory operands, such as "QWORD ", or an empty string to leave it to the assembler.
+     */
+    void print_operand(const Operand &operand, const char *size)
+    {
+        switch (operand.kind)
+        {
+        case OperandKind::none:
+            break;
+        case OperandKind::reg:
+            m_output << to_string(operand.base);
+            break;
+        case OperandKind::imm:
+            m_output << operand.value;
+            break;
+        case OperandKind::mem:
+            m_output << size << "[" << to_string(operand.base);
+            if (operand.scale != 0)
+            {
+                m_output << " + " << to_string(operand.index) << "*" << static_cast<int>(operand.scale);
+            }
+            if (operand.value < 0)
+            {
+                m_output << " - " << -operand.value;
+            }
+            else if (operand.value > 0 || operand.scale == 0)
+            {
+                m_output << " + " << operand.value;
+            }
+            m_output << "]";
+            break;
+        case OperandKind::label:
+            m_output << "label" << operand.value;
+            break;
+        case OperandKind::symbol:
+            m_output << to_string(static_cast<RuntimeSymbol>(operand.value));
+            break;
+        }
+    }
+
+    /**
+     * @brief Prints a single operand in AT&T syntax.
+     *
+     * @param operand The operand to print.
+     */
+    void print_att_operand(const Operand &operand)
+    {
+        switch (operand.kind)
+        {
+        case OperandKind::none:
+            break;
+        case OperandKind::reg:
+            m_output << "%" << to_string(operand.base);
+            break;
+        case OperandKind::imm:
+            m_output << "$" << operand.value;
+            break;
+        case OperandKind::mem:
+            if (operand.scale != 0)
+            {
+                m_output << (operand.value != 0 ? std::to_string(operand.value) : "") << "(%" << to_string(operand.base)
+                         << ", %" << to_string(operand.index) << ", " << static_cast<int>(operand.scale) << ")";
+            }
+            else
+            {
+                m_output << operand.value << "(%" << to_string(operand.base) << ")";
+            }
+            break;
+        case OperandKind::label:
+            m_output << "label" << operand.value;
+            break;
+        case OperandKind::symbol:
+            m_output << to_string(static_cast<RuntimeSymbol>(operand.value));
+            break;
+        }
+    }
+
+    const AsmDialect m_dialect; // The assembler to print for.
+    const ProgramKind m_kind;   // How the program is entered.
+    const std::string m_symbol; // Name of the function, for function programs.
+    std::stringstream m_output; // The output string stream for the assembly code.
+};
@@ -1,51 +1,334 @@
+#include "resolution.hpp"
 #include "generation.hpp"
+#include "compact.hpp"
+#include "pipeline.hpp"
+#include "streaming.hpp"
+#include "watch.hpp"
+#include "evaluation.hpp"
+#include "folding.hpp"
+#include "peephole.hpp"
+#include "encoding.hpp"
+#include <cctype>
+#include <filesystem>
 #include <fstream>
+#include <thread>
+
+/**
+ * @brief Names the C function an object file exposes after the hydrogen file it was compiled from.
+ *
+ * @param input_path Path of the hydrogen file.
+ * @return The file name without its extension, with every character that cannot be in a C identifier replaced by `_`.
+ */
+std::string function_symbol(const std::string &input_path)
+{
+    std::string symbol = std::filesystem::path(input_path).stem().string();
+    for (char &c : symbol)
+    {
+        if (!std::isalnum(static_cast<unsigned char>(c)))
+        {
+            c = '_';
+        }
+    }
+    if (symbol.empty() || std::isdigit(static_cast<unsigned char>(symbol.front())))
+    {
+        symbol.insert(0, "_");
+    }
+    return symbol;
+}
+
+/**
+ * @brief Command assembling out.asm into out.o.
+ *
+ * @param dialect The assembler out.asm was printed for.
+ * @return The command.
+ */
+const char *assemble_command(const AsmDialect dialect)
+{
+    switch (dialect)
+    {
+    case AsmDialect::nasm:
+        return "nasm -felf64 out.asm";
+    case AsmDialect::yasm:
+        return "yasm -felf64 -o out.o out.asm";
+    case AsmDialect::gas:
+        return "as -o out.o out.asm";
+    }
+    return "";
+}
 
 int main(int argc, char *argv[])
 {
-    // Arguments to get the hydrogen file
-    if (argc != 2)
+    // Arguments to get the hydrogen file and options
+    std::optional<std::string> input_path;
+    std::optional<std::string> superopt_table_path;
+    bool superopt_search = false;
+    bool evaluate = true;
+    bool fold = false;
+    bool pipelined = false;
+    bool streamed = false;
+    bool watched = false;
+    bool compact_ast = false;
+    bool object = false;
+    AsmDialect dialect = AsmDialect::nasm;
+    size_t memory_budget = 0;
+    size_t jobs = std::max(std::thread::hardware_concurrency(), 1u);
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--superopt")
+        {
+            superopt_search = true;
+        }
+        else if (arg.starts_with("--superopt-table="))
+        {
+            superopt_table_path = arg.substr(std::string("--superopt-table=").size());
+        }
+        else if (arg == "--no-eval")
+        {
+            evaluate = false;
+        }
+        else if (arg == "--fold")
+        {
+            fold = true;
+        }
+        else if (arg == "--pipeline")
+        {
+            pipelined = true;
+        }
+        else if (arg == "--compact-ast")
+        {
+            compact_ast = true;
+        }
+        else if (arg == "--stream")
+        {
+            streamed = true;
+        }
+        else if (arg == "--watch")
+        {
+            watched = true;
+        }
+        else if (arg == "-c")
+        {
+            object = true;
+        }
+        else if (arg.starts_with("--assembler="))
+        {
+            const std::string value = arg.substr(std::string("--assembler=").size());
+            if (value == "nasm")
+            {
+                dialect = AsmDialect::nasm;
+            }
+            else if (value == "yasm")
+            {
+                dialect = AsmDialect::yasm;
+            }
+            else if (value == "as")
+            {
+                dialect = AsmDialect::gas;
+            }
+            else
+            {
+                input_path.reset();
+                break;
+            }
+        }
+        else if (arg.starts_with("--memory-budget="))
+        {
+            // Bounding the memory only works one statement at a time.
+            streamed = true;
+            const std::string value = arg.substr(std::string("--memory-budget=").size());
+            if (std::from_chars(value.data(), value.data() + value.size(), memory_budget).ec != std::errc{} || memory_budget == 0)
+            {
+                input_path.reset();
+                break;
+            }
+        }
+        else if (arg.starts_with("--jobs="))
+        {
+            const std::string value = arg.substr(std::string("--jobs=").size());
+            if (std::from_chars(value.data(), value.data() + value.size(), jobs).ec != std::errc{} || jobs == 0)
+            {
+                input_path.reset();
+                break;
+            }
+        }
+        else if (!arg.starts_with("-") && !input_path.has_value())
+        {
+            input_path = arg;
+        }
+        else
+        {
+            input_path.reset();
+            break;
+        }
+    }
+    // The watch session links an executable itself, it cannot write an object file.
+    if (!input_path.has_value() || (object && watched))
     {
         std::cerr << "Incorrect Usage" << std::endl;
-        std::cerr << "Try using : hydro <input.hy>" << std::endl;
+        std::cerr << "Try using : hydro [--no-eval] [--fold] [--jobs=<n>] [--pipeline] [--compact-ast] [--stream] [--memory-budget=<bytes>] [--watch] [-c] [--assembler=nasm|yasm|as] [--superopt] [--superopt-table=<file>] <input.hy>" << std::endl;
         return EXIT_FAILURE;
     }
 
-    // Reading the hydrogen file
-    std::string contents;
+    // With `-c` the program is a C function `uint64_t <name>(int argc, char **argv)` in out.o, returning the exit code.
+    const ProgramKind kind = object ? ProgramKind::function : ProgramKind::executable;
+    const std::string symbol = object ? function_symbol(input_path.value()) : "";
+
+    // Superoptimized sequences are searched with `--superopt` and kept in the table for later compiles.
+    SuperoptTable superopt_table;
+    if (superopt_table_path.has_value())
     {
-        std::stringstream contents_stream;
-        std::fstream input(argv[1], std::ios::in);
-        contents_stream << input.rdbuf();
-        contents = contents_stream.str();
+        superopt_table.load(superopt_table_path.value());
     }
+    SuperoptTable *const superopt = superopt_search || superopt_table_path.has_value() ? &superopt_table : nullptr;
 
-    // Tokenizing the contents
-    Tokenizer tokenizer(std::move(contents));
-    std::vector<Token> tokens = tokenizer.tokenize();
+    if (watched)
+    {
+        // Building every time the file changes, until it is removed. The session writes the executable itself.
+        WatchSession session(input_path.value(), evaluate, superopt, superopt_search, dialect);
+        session.run();
+        if (superopt_search && superopt_table_path.has_value())
+        {
+            superopt_table.save(superopt_table_path.value());
+        }
+        return EXIT_SUCCESS;
+    }
+    if (streamed)
+    {
+        // Compiling one statement at a time, the output only replaces out.asm once the whole program compiled.
+        std::ifstream input(input_path.value());
+        std::vector<std::string> errors;
+        {
+            std::ofstream output("out.asm.tmp");
+            StreamCompiler compiler(input, output, memory_budget, superopt, superopt_search, dialect, kind, symbol);
+            errors = compiler.run();
+        }
+        for (const std::string &error : errors)
+        {
+            std::cerr << error << std::endl;
+        }
+        if (!errors.empty())
+        {
+            std::remove("out.asm.tmp");
+            return EXIT_FAILURE;
+        }
+        std::rename("out.asm.tmp", "out.asm");
+    }
+    else
+    {
+        // Reading the hydrogen file straight into the string, without a second copy in a string stream.
+        std::string contents;
+        {
+            std::ifstream input(input_path.value(), std::ios::in | std::ios::binary | std::ios::ate);
+            contents.resize(input ? static_cast<size_t>(input.tellg()) : 0);
+            input.seekg(0);
+            input.read(contents.data(), static_cast<std::streamsize>(contents.size()));
+        }
 
-    // Creating parse tree
-    Parser parser(std::move(tokens));
-    std::optional<NodeProg> prog = parser.parse_prog();
+        std::optional<Parser> parser;
+        std::optional<Pipeline> pipeline;
+        const std::vector<MachineInstr> *pipeline_instrs = nullptr;
+        std::optional<NodeProg> prog;
+        std::vector<std::string> errors;
+        if (pipelined)
+        {
+            // Tokenizing, parsing and generating asm code at the same time.
+            pipeline.emplace(std::move(contents), superopt, superopt_search, kind);
+            pipeline_instrs = &pipeline->run();
+            prog = pipeline->prog();
+            errors = pipeline->errors();
+        }
+        else
+        {
+            // Tokenizing the contents, the source is freed along with the tokenizer.
+            std::vector<Token> tokens = Tokenizer(std::move(contents)).tokenize();
 
-    // Generating asm code
-    if (!prog.has_value())
-    {
-        std::cerr << "No Exit Statement Found." << std::endl;
-        return EXIT_FAILURE;
+            // Creating parse tree, the tokens are freed once it is complete.
+            parser.emplace(std::move(tokens));
+            prog = parser->parse_prog();
+
+            // Generating asm code
+            if (!prog.has_value())
+            {
+                std::cerr << "No Exit Statement Found." << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            // Binding every identifier to its declaration, all errors are reported at once.
+            Resolver resolver(prog.value());
+            errors = resolver.resolve_program();
+
+            // Folding the literals of the resolved tree, the pipeline and the stream generate statements as they come.
+            if (fold && errors.empty())
+            {
+                ConstantFolder folder(parser->allocator());
+                folder.fold_program(prog.value());
+            }
+        }
+        for (const std::string &error : errors)
+        {
+            std::cerr << error << std::endl;
+        }
+        if (!errors.empty())
+        {
+            return EXIT_FAILURE;
+        }
+
+        // Running the program at compile time, falls back to normal codegen if it does not finish within the budget.
+        std::optional<uint64_t> exit_code;
+        if (evaluate)
+        {
+            Evaluator evaluator(prog.value());
+            exit_code = evaluator.evaluate_program();
+        }
+
+        // The parse tree is swapped for its compact encoding, which is all codegen needs, before generating.
+        std::optional<CompactAst> compact;
+        if (compact_ast && !exit_code.has_value() && !pipeline.has_value())
+        {
+            compact.emplace(prog.value());
+            prog.emplace();
+            parser.reset();
+        }
+
+        // Creating asm file
+        {
+            // The pipeline already generated the program, which is only replaced if it could be evaluated.
+            Generator codeGenerator(std::move(prog.value()), superopt, superopt_search, kind);
+            Generator &generator = pipeline.has_value() && !exit_code.has_value() ? pipeline->generator() : codeGenerator;
+            const std::vector<MachineInstr> &instrs = exit_code.has_value()   ? generator.generate_exit_program(exit_code.value())
+                                                      : pipeline.has_value() ? *pipeline_instrs
+                                                      : compact.has_value()  ? generator.generate_compact_program(compact.value())
+                                                                              : generator.generate_program(jobs);
+            compact.reset();
+
+            // The instructions do not refer to the parse tree, so it is freed before the post-codegen passes.
+            parser.reset();
+
+            // Post-codegen passes run on the instruction list, it is only printed at the very end.
+            PeepholeOptimizer peephole;
+            std::vector<MachineInstr> optimized = peephole.optimize(instrs);
+            generator.labels().remove_dead_labels(optimized);
+            Encoder encoder(generator.labels());
+            encoder.relax(optimized);
+
+            AsmPrinter printer(dialect, kind, symbol);
+            std::fstream file("out.asm", std::ios::out);
+            file << printer.print_program(optimized);
+        }
     }
-    
-    // Creating asm file
+    if (superopt_search && superopt_table_path.has_value())
     {
-        Generator codeGenerator(prog.value());
-        std::fstream file("out.asm", std::ios::out);
-        file << codeGenerator.generate_program();
+        superopt_table.save(superopt_table_path.value());
     }
 
-    // System call to NASM to assemble assemby code and ld command for GNU linker
-    // to link libs.
-    system("nasm -felf64 out.asm");
-    system("ld -o out out.o");
+    // System call to the assembler to assemble assemby code and ld command for GNU linker
+    // to link libs. An object file is left for the caller to link.
+    system(assemble_command(dialect));
+    if (!object)
+    {
+        system("ld -o out out.o");
+    }
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
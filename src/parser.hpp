@@ -1,22 +1,39 @@
 #pragma once
 #include "tokenization.hpp"
 #include "arena.hpp"
+#include "grammar_tables.hpp"
+#include <functional>
+#include <span>
+#include <string_view>
+#include <unordered_set>
 #include <variant>
 #include <vector>
 #include <cassert>
 
+// Nodes live in the arena and are released without being destroyed, so they only hold trivially destructible
+// members: text is copied into the arena and lists are arena arrays.
+
+/// @brief Represents the text and position of a token in the parse tree.
+struct NodeToken
+{
+    std::string_view value; // Text of the token, stored in the arena.
+    size_t line;            // Line number of the token.
+};
+
 // Expressions ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 /// @brief Represents an integer literal term in the parse tree.
 struct NodeTermIntLit
 {
-    Token int_lit; // The token representing the integer literal.
+    NodeToken int_lit; // The token representing the integer literal.
 };
 
 /// @brief Represents an identifier term in the parse tree.
 struct NodeTermIdent
 {
-    Token ident; // The token representing the identifier.
+    NodeToken ident;    // The token representing the identifier.
+    size_t decl_id = 0; // ID of the 'let' declaring the variable, set by the resolver.
+    size_t slot = 0;    // Stack slot of the variable, set by the resolver.
 };
 
 struct NodeExpr; // Forward declaration of NodeExpr
@@ -27,6 +44,51 @@ struct NodeTermParen
     NodeExpr *expr; // An expression inside the parenthesis.
 };
 
+/// @brief Represents an 'arg' term in the parse tree, the integer value of a command-line argument.
+struct NodeTermArg
+{
+    NodeExpr *expr; // Index of the argument, 0 being the program itself.
+};
+
+/// @brief Represents a 'read' term in the parse tree, the next integer on stdin.
+struct NodeTermRead
+{
+};
+
+/// @brief Represents an 'alloc' term in the parse tree, the address of a new array on the heap.
+struct NodeTermAlloc
+{
+    NodeExpr *expr; // Number of elements of the array.
+};
+
+/// @brief Represents a 'map' term in the parse tree, the handle of the file named by a command-line argument mapped
+/// into memory.
+struct NodeTermMap
+{
+    NodeExpr *expr; // Index of the argument.
+};
+
+/// @brief Represents a 'size' term in the parse tree, the size of a mapped file in bytes.
+struct NodeTermSize
+{
+    NodeExpr *expr; // Handle of the file.
+};
+
+/// @brief Represents a 'byte' or 'word' term in the parse tree, a load from a mapped file.
+struct NodeTermLoad
+{
+    bool word;       // Whether a 64-bit word is loaded rather than a byte.
+    NodeExpr *file;  // Handle of the file.
+    NodeExpr *index; // Index of the byte or word in the file.
+};
+
+/// @brief Represents an element of an array in the parse tree, read through the variable holding its address.
+struct NodeTermIndex
+{
+    NodeTermIdent array; // The variable holding the address of the array.
+    NodeExpr *index;     // Index of the element.
+};
+
 /// @brief Represents an addition binary expression in the parse tree.
 struct NodeBinExprAdd
 {
@@ -64,7 +126,7 @@ struct NodeBinExpr
 /// @brief Represents a term in the parse tree.
 struct NodeTerm
 {
-    std::variant<NodeTermIntLit *, NodeTermIdent *, NodeTermParen *> var; // Variant holding the term type.
+    std::variant<NodeTermIntLit *, NodeTermIdent *, NodeTermParen *, NodeTermArg *, NodeTermRead *, NodeTermAlloc *, NodeTermIndex *, NodeTermMap *, NodeTermSize *, NodeTermLoad *> var; // Variant holding the term type.
 };
 
 /// @brief Represents an expression in the parse tree.
@@ -81,61 +143,84 @@ struct NodeStmtExit
     NodeExpr *expr; // Expression associated with the 'exit' statement.
 };
 
+/// @brief Represents a 'print' statement in the parse tree.
+struct NodeStmtPrint
+{
+    NodeExpr *expr; // Expression whose value is printed.
+};
+
 /// @brief Represents a 'let' statement in the parse tree.
 struct NodeStmtLet
 {
-    Token ident;      // The identifier token.
-    NodeExpr *expr{}; // The expression associated with the 'let' statement.
+    NodeToken ident;    // The identifier token.
+    NodeExpr *expr{};   // The expression associated with the 'let' statement.
+    size_t decl_id = 0; // ID of the declaration, set by the resolver.
+    size_t slot = 0;    // Stack slot of the variable, set by the resolver.
 };
 
 struct NodeStmt; // Forward declaration of NodeStmt
 
-struct NodeIfPred; // Forward declaration of NodeIfPred
-
 /// @brief Represents a 'scope' in the parse tree. Scope contains a list of statements inside.
 struct NodeScope
 {
-    std::vector<NodeStmt *> stmts; // List of statements in the scope.
+    std::span<NodeStmt *> stmts; // List of statements in the scope, contiguous in the arena.
+};
+
+/// @brief Represents an 'if' or 'elif' arm of an 'if' statement in the parse tree.
+struct NodeIfArm
+{
+    NodeExpr *expr;   // Condition expression of the arm.
+    NodeScope *scope; // Scope of statements executed if the condition is true.
 };
 
 /// @brief Represents an 'if' statement in the parse tree.
 struct NodeStmtIf
 {
-    NodeExpr *expr;   // Condition expression of the 'if' statement.
-    NodeScope *scope; // Scope of statements executed if the condition is true.
-    std::optional<NodeIfPred *> pred;
+    std::span<NodeIfArm> arms;            // The 'if' arm followed by every 'elif' arm, contiguous in the arena.
+    std::optional<NodeScope *> else_scope; // Scope of statements executed if no condition is true.
 };
 
-/// @brief Represents a Else If Predicate in the parse tree.
-struct NodeIfPredElif
+/// @brief Represents a reassignment of a variable in the parse tree.
+struct NodeStmtAssign
 {
-    NodeExpr *expr{};
-    NodeScope *scope{};
-    std::optional<NodeIfPred *> pred;
+    NodeToken ident;    // The identifier token.
+    NodeExpr *expr{};   // The expression associated with the reassignment.
+    size_t decl_id = 0; // ID of the 'let' declaring the variable, set by the resolver.
+    size_t slot = 0;    // Stack slot of the variable, set by the resolver.
 };
 
-/// @brief Represents a Else Predicate in the parse tree.
-struct NodeIfPredElse
+/// @brief Represents an assignment to an element of an array in the parse tree.
+struct NodeStmtStore
 {
-    NodeScope *scope;
+    NodeTermIdent array; // The variable holding the address of the array.
+    NodeExpr *index;     // Index of the element.
+    NodeExpr *expr;      // The value assigned.
 };
 
-/// @brief Represents a If Predicate in the parse tree.
-struct NodeIfPred
+/// @brief Represents a 'reset' statement in the parse tree, freeing an array and every array allocated after it.
+struct NodeStmtReset
 {
-    std::variant<NodeIfPredElif *, NodeIfPredElse *> var;
+    NodeExpr *expr; // Address of the array.
 };
 
-struct NodeStmtAssign
+/// @brief Represents a 'parallel for' statement in the parse tree, a loop over a range of indices split across threads.
+struct NodeStmtParallel
 {
-    Token ident;      // The identifier token.
-    NodeExpr *expr{}; // The expression associated with the reassignment.
+    NodeToken ident;                  // The loop index, declared for the body.
+    NodeExpr *lo{};                   // First index.
+    NodeExpr *hi{};                   // Index after the last one.
+    NodeExpr *chunk{};                // Indices a thread takes at a time, nullptr to split the range evenly.
+    std::optional<NodeTermIdent> sum; // Variable the values it takes in the body are added to.
+    NodeScope *scope{};               // The body, run once for every index.
+    size_t decl_id = 0;               // ID of the declaration of the index, set by the resolver.
+    size_t slot = 0;                  // Stack slot of the index, set by the resolver.
+    size_t copied = 0;                // Variables from before the loop the threads copy, set by the resolver.
 };
 
 /// @brief Represents a statement in the parse tree.
 struct NodeStmt
 {
-    std::variant<NodeStmtExit *, NodeStmtLet *, NodeScope *, NodeStmtIf *, NodeStmtAssign *> var; // Variant holding the statement type.
+    std::variant<NodeStmtExit *, NodeStmtLet *, NodeScope *, NodeStmtIf *, NodeStmtAssign *, NodeStmtPrint *, NodeStmtStore *, NodeStmtReset *, NodeStmtParallel *> var; // Variant holding the statement type.
 };
 
 // Program Parse Tree ~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -149,315 +234,671 @@ struct NodeProg
 /// @brief Class to parse tokens into a parse tree.
 class Parser
 {
+    /// @brief An expression being parsed, or a term waiting for an expression nested in it.
+    struct ExprFrame
+    {
+        TermRule rule = TermRule::none; // Rule of the term, `none` for an expression.
+        int min_prec = 0;               // Minimum precedence of the operators of the expression.
+        bool rhs = false;               // Whether the expression is the right-hand side of a binary expression.
+        TokenType op{};                 // Operator whose right-hand side is being parsed.
+        NodeExpr *expr = nullptr;       // The expression so far, or the file of a 'byte' or 'word' term once parsed.
+        NodeToken ident{};              // Array of an element read.
+    };
+
+    /// @brief A scope being parsed, with the statement it belongs to.
+    struct ScopeFrame
+    {
+        StmtRule rule;                              // Statement the scope belongs to.
+        size_t stmts_begin = 0;                     // Index of its first statement in the pending statements.
+        size_t arms_begin = 0;                      // Index of the first arm of an 'if' in the pending arms.
+        NodeStmtIf *stmt_if = nullptr;              // The 'if' statement whose 'else' scope it is.
+        NodeStmtParallel *stmt_parallel = nullptr; // The 'parallel for' statement whose body it is.
+    };
+
 public:
+    /// @brief Callback appending more tokens to the given list, returning false once there are none left.
+    using Refill = std::function<bool(std::vector<Token> &)>;
+
     /**
      * @brief Constructs the parser with a given list of tokens.
      *
      * @param tokens The list of tokens to parse.
+     * @param refill Called for more tokens when the list runs out, if the tokens are still being produced.
+     * @param arena_block_size Size of the memory blocks the parse tree is allocated in, 4 mb by default.
      */
-    explicit Parser(std::vector<Token> tokens)
-        : m_tokens(std::move(tokens)), m_allocator(1024 * 1024 * 4) // 4 mb
+    explicit Parser(std::vector<Token> tokens, Refill refill = {}, const size_t arena_block_size = 1024 * 1024 * 4)
+        : m_tokens(std::move(tokens)), m_refill(std::move(refill)), m_allocator(arena_block_size)
+    {
+    }
+
+    void error_expected(const std::string &msg)
     {
+        syntax_error("[Parse Error] Expected " + msg + " on line " + std::to_string(peek(-1).value().line), m_throw_errors);
     }
 
-    void error_expected(const std::string &msg) const
+    /// @brief Makes syntax errors throw a SyntaxError rather than exit, for callers that report them and go on.
+    void throw_errors()
     {
-        std::cerr << "[Parse Error] Expected " << msg << " on line " << peek(-1).value().line << std::endl;
-        exit(EXIT_FAILURE);
+        m_throw_errors = true;
     }
 
     /**
-     * @brief Parses a term from the tokens.
+     * @brief Parses a term from the tokens, or the start of a term with an expression nested in it.
      *
-     * @return An optional NodeTerm pointer if a term is parsed successfully.
+     * @param rule The rule of the term, picked from its first token, not `none`.
+     * @return The term, or nullptr if a frame for the term was pushed and its nested expression comes next.
      */
-    std::optional<NodeTerm *> parse_term()
+    NodeTerm *parse_term(const TermRule rule)
     {
-        if (auto int_lit = try_consume(TokenType::int_lit))
+        switch (rule)
+        {
+        case TermRule::int_lit:
         {
-            auto term_int_lit = m_allocator.emplace<NodeTermIntLit>(int_lit.value());
+            auto term_int_lit = m_allocator.emplace<NodeTermIntLit>(node_token(consume()));
             auto term = m_allocator.emplace<NodeTerm>(term_int_lit);
             return term;
         }
-        if (auto ident = try_consume(TokenType::ident))
+        case TermRule::ident:
         {
-            auto expr_ident = m_allocator.emplace<NodeTermIdent>(ident.value());
+            const NodeToken ident = node_token(consume());
+            if (peek().has_value() && peek()->type == TokenType::open_bracket)
+            {
+                consume();
+                m_expr_frames.push_back({.rule = TermRule::ident, .ident = ident});
+                return nullptr;
+            }
+            auto expr_ident = m_allocator.emplace<NodeTermIdent>(ident);
             auto term = m_allocator.emplace<NodeTerm>(expr_ident);
             return term;
         }
-        if (const auto open_paren = try_consume(TokenType::open_paren))
+        case TermRule::read:
         {
-            auto expr = parse_expr();
-            if (!expr.has_value())
-            {
-                error_expected("expression");
-            }
+            consume();
+            try_consume_err(TokenType::open_paren);
             try_consume_err(TokenType::close_paren);
-            auto term_paren = m_allocator.emplace<NodeTermParen>(expr.value());
-            auto term = m_allocator.emplace<NodeTerm>(term_paren);
+            auto term_read = m_allocator.emplace<NodeTermRead>();
+            auto term = m_allocator.emplace<NodeTerm>(term_read);
             return term;
         }
-        return {};
+        case TermRule::paren:
+            consume();
+            break;
+        case TermRule::arg:
+        case TermRule::alloc:
+        case TermRule::map:
+        case TermRule::size:
+        case TermRule::byte:
+        case TermRule::word:
+            consume();
+            try_consume_err(TokenType::open_paren);
+            break;
+        case TermRule::none:
+            assert(false);
+            break;
+        }
+        m_expr_frames.push_back({.rule = rule});
+        return nullptr;
     }
 
     /**
-     * @brief Parses an expression from the tokens.
-     * @param min_prec Minimum precedence to check for operator precedence climbing for Binary Expressions.
-     * @return An optional NodeExpr pointer if an expression is parsed successfully.
+     * @brief Finishes a term once an expression nested in it is parsed.
+     *
+     * @param frame The frame of the term.
+     * @param expr The nested expression.
+     * @return The term, or nullptr if it nests another expression, which comes next.
      */
-    std::optional<NodeExpr *> parse_expr(const int min_prec = 0)
+    NodeTerm *close_term(ExprFrame &frame, NodeExpr *expr)
     {
-        std::optional<NodeTerm *> term = parse_term();
-        if (!term.has_value())
+        switch (frame.rule)
         {
-            return {};
+        case TermRule::ident:
+        {
+            try_consume_err(TokenType::close_bracket);
+            auto term_index = m_allocator.emplace<NodeTermIndex>(NodeTermIdent{.ident = frame.ident}, expr);
+            return m_allocator.emplace<NodeTerm>(term_index);
         }
-        auto expr = m_allocator.emplace<NodeExpr>(term.value());
-
-        // Operator Precedence Climbing for Binary operations.
-        //+ https://eli.thegreenplace.net/2012/08/02/parsing-expressions-by-precedence-climbing
-        while (true)
+        case TermRule::paren:
         {
-            std::optional<Token> curr_tok = peek();
-            std::optional<int> prec;
-
-            // Break if not a Binary Expression.
-            if (!curr_tok.has_value())
-                break;
-            prec = checkAndGetBinaryPrecedence(curr_tok.value().type);
-            if (!prec.has_value() || prec < min_prec)
-            {
-                break;
-            }
-
-            // Get the operator's precedence and associativity, and compute a
-            // minimal precedence for the recursive call
-            const auto [type, line, value] = consume();
-            const int next_min_prec = prec.value() + 1;
-            auto expr_rhs = parse_expr(next_min_prec);
-            if (!expr_rhs.has_value())
-            {
-                error_expected("RHS of Binary Expression");
-            }
-            auto bin_expr = m_allocator.emplace<NodeBinExpr>();
-            auto expr_lhs = m_allocator.emplace<NodeExpr>();
-            if (type == TokenType::plus)
-            {
-                expr_lhs->var = expr->var;
-                auto add = m_allocator.emplace<NodeBinExprAdd>(expr_lhs, expr_rhs.value());
-                bin_expr->var = add;
-            }
-            else if (type == TokenType::star)
-            {
-                expr_lhs->var = expr->var;
-                auto multi = m_allocator.emplace<NodeBinExprMulti>(expr_lhs, expr_rhs.value());
-                bin_expr->var = multi;
-            }
-            else if (type == TokenType::minus)
-            {
-                expr_lhs->var = expr->var;
-                auto sub = m_allocator.emplace<NodeBinExprSub>(expr_lhs, expr_rhs.value());
-                bin_expr->var = sub;
-            }
-            else if (type == TokenType::fslash)
-            {
-                expr_lhs->var = expr->var;
-                auto div = m_allocator.emplace<NodeBinExprDiv>(expr_lhs, expr_rhs.value());
-                bin_expr->var = div;
-            }
-            else
+            try_consume_err(TokenType::close_paren);
+            auto term_paren = m_allocator.emplace<NodeTermParen>(expr);
+            return m_allocator.emplace<NodeTerm>(term_paren);
+        }
+        case TermRule::arg:
+        {
+            try_consume_err(TokenType::close_paren);
+            auto term_arg = m_allocator.emplace<NodeTermArg>(expr);
+            return m_allocator.emplace<NodeTerm>(term_arg);
+        }
+        case TermRule::alloc:
+        {
+            try_consume_err(TokenType::close_paren);
+            auto term_alloc = m_allocator.emplace<NodeTermAlloc>(expr);
+            return m_allocator.emplace<NodeTerm>(term_alloc);
+        }
+        case TermRule::map:
+        {
+            try_consume_err(TokenType::close_paren);
+            auto term_map = m_allocator.emplace<NodeTermMap>(expr);
+            return m_allocator.emplace<NodeTerm>(term_map);
+        }
+        case TermRule::size:
+        {
+            try_consume_err(TokenType::close_paren);
+            auto term_size = m_allocator.emplace<NodeTermSize>(expr);
+            return m_allocator.emplace<NodeTerm>(term_size);
+        }
+        case TermRule::byte:
+        case TermRule::word:
+        {
+            // The file comes first, then the index.
+            if (frame.expr == nullptr)
             {
-                assert(false); // Unreachable;
+                frame.expr = expr;
+                try_consume_err(TokenType::comma);
+                return nullptr;
             }
-            expr->var = bin_expr;
+            try_consume_err(TokenType::close_paren);
+            auto term_load = m_allocator.emplace<NodeTermLoad>(frame.rule == TermRule::word, frame.expr, expr);
+            return m_allocator.emplace<NodeTerm>(term_load);
+        }
+        case TermRule::int_lit:
+        case TermRule::read:
+        case TermRule::none:
+            break;
         }
-        return expr;
+        assert(false);
+        __builtin_unreachable();
     }
 
     /**
-     * @brief Parses a 'scope'.
-     * @return An optional NodeScope pointer if a scope is parsed successfully.
+     * @brief Replaces an expression by a binary expression with it on the left-hand side.
+     *
+     * @param expr The expression, which becomes the binary expression.
+     * @param type The operator.
+     * @param rhs The right-hand side.
      */
-    std::optional<NodeScope *> parse_scope()
+    void add_binary_expr(NodeExpr *expr, const TokenType type, NodeExpr *rhs)
     {
-        if (!try_consume(TokenType::open_curly).has_value())
+        auto bin_expr = m_allocator.emplace<NodeBinExpr>();
+        auto expr_lhs = m_allocator.emplace<NodeExpr>();
+        expr_lhs->var = expr->var;
+        if (type == TokenType::plus)
         {
-            return {};
+            auto add = m_allocator.emplace<NodeBinExprAdd>(expr_lhs, rhs);
+            bin_expr->var = add;
         }
-        auto scope = m_allocator.emplace<NodeScope>();
-        while (auto stmt = parse_stmt())
+        else if (type == TokenType::star)
         {
-            scope->stmts.push_back(stmt.value());
+            auto multi = m_allocator.emplace<NodeBinExprMulti>(expr_lhs, rhs);
+            bin_expr->var = multi;
         }
-        try_consume_err(TokenType::close_curly);
-        return scope;
+        else if (type == TokenType::minus)
+        {
+            auto sub = m_allocator.emplace<NodeBinExprSub>(expr_lhs, rhs);
+            bin_expr->var = sub;
+        }
+        else if (type == TokenType::fslash)
+        {
+            auto div = m_allocator.emplace<NodeBinExprDiv>(expr_lhs, rhs);
+            bin_expr->var = div;
+        }
+        else
+        {
+            assert(false); // Unreachable;
+        }
+        expr->var = bin_expr;
     }
 
-    /// @brief Parses additional predicates after the if statements.
-    /// @return
-    std::optional<NodeIfPred *> parse_if_pred()
+    /**
+     * @brief Parses an expression from the tokens.
+     *
+     * Terms such as parentheses nest expressions, which are parsed on an explicit stack of frames rather than by
+     * recursion, so deeply nested input cannot overflow the call stack. Each frame is an expression being parsed by
+     * operator precedence climbing, or a term waiting for the expression nested in it.
+     * + https://eli.thegreenplace.net/2012/08/02/parsing-expressions-by-precedence-climbing
+     *
+     * @return An optional NodeExpr pointer if an expression is parsed successfully.
+     */
+    std::optional<NodeExpr *> parse_expr()
     {
-        if (try_consume(TokenType::elif_).has_value())
+        m_expr_frames.clear();
+        m_expr_frames.push_back({});
+        while (true)
         {
-            try_consume_err(TokenType::open_paren);
-            auto elif_pred = m_allocator.alloc<NodeIfPredElif>();
-            if (const auto expr = parse_expr())
+            // Parsing the next operand, a term or the start of a term with an expression nested in it.
+            const std::optional<Token> first = peek();
+            const TermRule rule = first.has_value() ? term_rules[static_cast<size_t>(first->type)] : TermRule::none;
+            if (rule == TermRule::none)
             {
-                elif_pred->expr = expr.value();
+                if (m_expr_frames.size() == 1)
+                {
+                    return {};
+                }
+                error_expected(m_expr_frames.back().rhs ? "RHS of Binary Expression" : "expression");
             }
-            else
+            NodeTerm *term = parse_term(rule);
+            if (term == nullptr)
             {
-                std::cerr << "Exprected an expression.";
-                exit(EXIT_FAILURE);
+                m_expr_frames.push_back({});
+                continue;
             }
-            try_consume_err(TokenType::close_paren);
-            if (const auto scope = parse_scope())
-            {
-                elif_pred->scope = scope.value();
-            }
-            else
+
+            // Handing the finished operand to the frames waiting for it, until one needs another operand.
+            NodeExpr *value = m_allocator.emplace<NodeExpr>(term);
+            while (true)
             {
-                std::cerr << "Exprected a scope.";
-                exit(EXIT_FAILURE);
+                ExprFrame &frame = m_expr_frames.back();
+                if (frame.rule != TermRule::none)
+                {
+                    term = close_term(frame, value);
+                    if (term == nullptr)
+                    {
+                        m_expr_frames.push_back({});
+                        break;
+                    }
+                    m_expr_frames.pop_back();
+                    value = m_allocator.emplace<NodeExpr>(term);
+                    continue;
+                }
+                if (frame.expr == nullptr)
+                {
+                    frame.expr = value;
+                }
+                else
+                {
+                    add_binary_expr(frame.expr, frame.op, value);
+                }
+
+                // Operators binding at least as tightly as the frame's minimum take the next operand as their
+                // right-hand side, with a minimum one higher, so operators of equal precedence associate to the left.
+                const std::optional<Token> curr_tok = peek();
+                const std::optional<int> prec =
+                    curr_tok.has_value() ? binary_precedence[static_cast<size_t>(curr_tok->type)] : std::nullopt;
+                if (prec.has_value() && prec.value() >= frame.min_prec)
+                {
+                    frame.op = consume().type;
+                    m_expr_frames.push_back({.min_prec = prec.value() + 1, .rhs = true});
+                    break;
+                }
+                value = frame.expr;
+                m_expr_frames.pop_back();
+                if (m_expr_frames.empty())
+                {
+                    return value;
+                }
             }
-            elif_pred->pred = parse_if_pred();
+        }
+    }
+
+    /// @brief Parses the 'if' keyword and the condition of its first arm, and opens the arm's scope.
+    void open_if_stmt()
+    {
+        consume();
+        open_if_arm(m_if_arms.size());
+    }
 
-            auto if_pred = m_allocator.emplace<NodeIfPred>(elif_pred);
-            return if_pred;
+    /// @brief Parses the parenthesised condition of an 'if' or 'elif' arm and opens its scope.
+    /// @param arms_begin Index in the pending arms of the first arm of the 'if' statement.
+    void open_if_arm(const size_t arms_begin)
+    {
+        NodeIfArm arm{};
+        try_consume_err(TokenType::open_paren);
+        if (const auto expr = parse_expr())
+        {
+            arm.expr = expr.value();
         }
-        if (try_consume(TokenType::else_).has_value())
+        else
         {
-            auto else_pred = m_allocator.alloc<NodeIfPredElse>();
-
-            if (const auto scope = parse_scope())
-            {
-                else_pred->scope = scope.value();
-            }
-            else
-            {
-                std::cerr << "Exprected a scope.";
-                exit(EXIT_FAILURE);
-            }
-            auto if_pred = m_allocator.emplace<NodeIfPred>(else_pred);
-            return if_pred;
+            syntax_error("Invalid expression", m_throw_errors);
         }
-        return {};
+        try_consume_err(TokenType::close_paren);
+        m_if_arms.push_back(arm);
+        open_scope({.rule = StmtRule::if_, .arms_begin = arms_begin});
     }
 
     /**
      * @brief Parses a statement from the tokens.
      *
+     * The statement rule is picked from the type of its first token alone, with the table generated from the grammar,
+     * so the next token is only fetched once. Statements with scopes keep a frame on an explicit stack while the
+     * statements of the scope are parsed, rather than recursing, so deeply nested scopes cannot overflow the call
+     * stack.
+     *
      * @return An optional NodeStmt pointer if a statement is parsed successfully.
      */
     std::optional<NodeStmt *> parse_stmt()
     {
-        // Parse 'exit' statement
-        if (peek().value().type == TokenType::exit && peek(1).has_value() && peek(1).value().type == TokenType::open_paren)
+        m_scope_frames.clear();
+        m_scope_stmts.clear();
+        m_if_arms.clear();
+        while (true)
         {
-            consume();
-            consume();
-
-            auto stmt_exit = m_allocator.emplace<NodeStmtExit>();
-
-            if (const auto node_expr = parse_expr())
+            const std::optional<Token> first = peek();
+            NodeStmt *stmt = nullptr;
+            switch (first.has_value() ? stmt_rules[static_cast<size_t>(first->type)] : StmtRule::none)
             {
-                stmt_exit->expr = node_expr.value();
+            case StmtRule::exit:
+                stmt = parse_exit_stmt();
+                break;
+            case StmtRule::print:
+                stmt = parse_print_stmt();
+                break;
+            case StmtRule::reset:
+                stmt = parse_reset_stmt();
+                break;
+            case StmtRule::let:
+                stmt = parse_let_stmt();
+                break;
+            case StmtRule::assign:
+                stmt = parse_assign_stmt();
+                break;
+            case StmtRule::scope:
+                open_scope({.rule = StmtRule::scope});
+                break;
+            case StmtRule::if_:
+                open_if_stmt();
+                break;
+            case StmtRule::parallel:
+                open_parallel_stmt();
+                break;
+            case StmtRule::none:
+                // Only a scope can end here, which may finish the statement it belongs to.
+                if (m_scope_frames.empty())
+                {
+                    return {};
+                }
+                stmt = close_scope_stmt();
+                break;
             }
-            else
+            if (stmt == nullptr)
             {
-                std::cerr << "Invalid expression" << std::endl;
-                exit(EXIT_FAILURE);
+                continue;
+            }
+            if (m_scope_frames.empty())
+            {
+                return stmt;
             }
+            m_scope_stmts.push_back(stmt);
+        }
+    }
 
-            try_consume_err(TokenType::close_paren);
-            try_consume_err(TokenType::semi);
+    /// @brief Parses an 'exit' statement, its first token is known to be 'exit'.
+    /// @return The parsed statement.
+    NodeStmt *parse_exit_stmt()
+    {
+        consume();
+        try_consume_err(TokenType::open_paren);
 
-            auto stmt = m_allocator.emplace<NodeStmt>();
-            stmt->var = stmt_exit;
-            return stmt;
+        auto stmt_exit = m_allocator.emplace<NodeStmtExit>();
+
+        if (const auto node_expr = parse_expr())
+        {
+            stmt_exit->expr = node_expr.value();
         }
-        // Parse 'let' statement
-        if (peek().has_value() && peek().value().type == TokenType::let &&
-            peek(1).has_value() && peek(1).value().type == TokenType::ident &&
-            peek(2).has_value() && peek(2).value().type == TokenType::eq)
+        else
         {
-            consume();
-            auto stmt_let = m_allocator.emplace<NodeStmtLet>();
-            stmt_let->ident = consume();
-            consume();
-            if (const auto expr = parse_expr())
-            {
-                stmt_let->expr = expr.value();
-            }
-            else
-            {
-                std::cerr << "Invalid expression" << std::endl;
-                exit(EXIT_FAILURE);
-            }
-            try_consume_err(TokenType::semi);
-            auto stmt = m_allocator.emplace<NodeStmt>();
-            stmt->var = stmt_let;
-            return stmt;
+            syntax_error("Invalid expression", m_throw_errors);
         }
-        // Parse variable reassignment.
-        if (peek().has_value() && peek().value().type == TokenType::ident && peek(1).has_value() && peek(1).value().type == TokenType::eq)
+
+        try_consume_err(TokenType::close_paren);
+        try_consume_err(TokenType::semi);
+
+        auto stmt = m_allocator.emplace<NodeStmt>();
+        stmt->var = stmt_exit;
+        return stmt;
+    }
+
+    /// @brief Parses a 'print' statement, its first token is known to be 'print'.
+    /// @return The parsed statement.
+    NodeStmt *parse_print_stmt()
+    {
+        consume();
+        try_consume_err(TokenType::open_paren);
+
+        auto stmt_print = m_allocator.emplace<NodeStmtPrint>();
+
+        if (const auto node_expr = parse_expr())
         {
-            const auto assign = m_allocator.alloc<NodeStmtAssign>();
-            assign->ident = consume();
-            consume();
-            if (const auto expr = parse_expr())
-            {
-                assign->expr = expr.value();
-            }
-            else
-            {
-                std::cerr << "Expected expression" << std::endl;
-                exit(EXIT_FAILURE);
-            }
-            try_consume_err(TokenType::semi);
-            auto stmt = m_allocator.emplace<NodeStmt>(assign);
-            return stmt;
+            stmt_print->expr = node_expr.value();
         }
-        // Parse Scopes.
-        if (peek().has_value() && peek().value().type == TokenType::open_curly)
+        else
         {
-            if (const auto scope = parse_scope())
-            {
-                auto stmt = m_allocator.emplace<NodeStmt>(scope.value());
-                return stmt;
-            }
-            std::cerr << "Invalid scope" << std::endl;
-            exit(EXIT_FAILURE);
+            syntax_error("Invalid expression", m_throw_errors);
+        }
+
+        try_consume_err(TokenType::close_paren);
+        try_consume_err(TokenType::semi);
+
+        auto stmt = m_allocator.emplace<NodeStmt>();
+        stmt->var = stmt_print;
+        return stmt;
+    }
+
+    /// @brief Parses a 'reset' statement, its first token is known to be 'reset'.
+    /// @return The parsed statement.
+    NodeStmt *parse_reset_stmt()
+    {
+        consume();
+        try_consume_err(TokenType::open_paren);
+
+        auto stmt_reset = m_allocator.emplace<NodeStmtReset>();
+
+        if (const auto node_expr = parse_expr())
+        {
+            stmt_reset->expr = node_expr.value();
         }
-        // Parse 'if' statement
-        if (auto if_ = try_consume(TokenType::if_))
+        else
         {
-            try_consume_err(TokenType::open_paren);
-            auto stmt_if = m_allocator.emplace<NodeStmtIf>();
-            if (const auto expr = parse_expr())
+            syntax_error("Invalid expression", m_throw_errors);
+        }
+
+        try_consume_err(TokenType::close_paren);
+        try_consume_err(TokenType::semi);
+
+        auto stmt = m_allocator.emplace<NodeStmt>();
+        stmt->var = stmt_reset;
+        return stmt;
+    }
+
+    /// @brief Parses a 'let' statement, its first token is known to be 'let'.
+    /// @return The parsed statement.
+    NodeStmt *parse_let_stmt()
+    {
+        consume();
+        auto stmt_let = m_allocator.emplace<NodeStmtLet>();
+        stmt_let->ident = node_token(try_consume_err(TokenType::ident));
+        try_consume_err(TokenType::eq);
+        if (const auto expr = parse_expr())
+        {
+            stmt_let->expr = expr.value();
+        }
+        else
+        {
+            syntax_error("Invalid expression", m_throw_errors);
+        }
+        try_consume_err(TokenType::semi);
+        auto stmt = m_allocator.emplace<NodeStmt>();
+        stmt->var = stmt_let;
+        return stmt;
+    }
+
+    /// @brief Parses a variable reassignment, its first token is known to be an identifier.
+    /// @return The parsed statement.
+    NodeStmt *parse_assign_stmt()
+    {
+        const NodeToken ident = node_token(consume());
+        if (peek().has_value() && peek()->type == TokenType::open_bracket)
+        {
+            return parse_store_stmt(ident);
+        }
+        const auto assign = m_allocator.emplace<NodeStmtAssign>();
+        assign->ident = ident;
+        try_consume_err(TokenType::eq);
+        if (const auto expr = parse_expr())
+        {
+            assign->expr = expr.value();
+        }
+        else
+        {
+            syntax_error("Expected expression", m_throw_errors);
+        }
+        try_consume_err(TokenType::semi);
+        auto stmt = m_allocator.emplace<NodeStmt>(assign);
+        return stmt;
+    }
+
+    /// @brief Parses an assignment to an element of an array, after the identifier of the array.
+    /// @param ident The identifier.
+    /// @return The parsed statement.
+    NodeStmt *parse_store_stmt(const NodeToken ident)
+    {
+        const auto store = m_allocator.emplace<NodeStmtStore>();
+        store->array = NodeTermIdent{.ident = ident};
+        store->index = parse_index();
+        try_consume_err(TokenType::eq);
+        if (const auto expr = parse_expr())
+        {
+            store->expr = expr.value();
+        }
+        else
+        {
+            syntax_error("Expected expression", m_throw_errors);
+        }
+        try_consume_err(TokenType::semi);
+        auto stmt = m_allocator.emplace<NodeStmt>(store);
+        return stmt;
+    }
+
+    /// @brief Parses the index of an array element, its first token is known to be '['.
+    /// @return The index expression.
+    NodeExpr *parse_index()
+    {
+        consume();
+        auto expr = parse_expr();
+        if (!expr.has_value())
+        {
+            error_expected("expression");
+        }
+        try_consume_err(TokenType::close_bracket);
+        return expr.value();
+    }
+
+    /**
+     * @brief Opens a scope, its statements are parsed next.
+     *
+     * @param frame The frame of the scope, with the statement it belongs to.
+     */
+    void open_scope(ScopeFrame frame)
+    {
+        if (!try_consume(TokenType::open_curly).has_value())
+        {
+            syntax_error("Invalid scope", m_throw_errors);
+        }
+        frame.stmts_begin = m_scope_stmts.size();
+        m_scope_frames.push_back(frame);
+    }
+
+    /**
+     * @brief Closes the innermost scope once its statements are parsed, finishing the statement it belongs to.
+     *
+     * Arms of an 'if' statement are collected in a loop rather than by recursion, so long elif chains cannot overflow
+     * the stack.
+     *
+     * @return The statement, or nullptr if it has another scope, which is opened and parsed next.
+     */
+    NodeStmt *close_scope_stmt()
+    {
+        try_consume_err(TokenType::close_curly);
+        const ScopeFrame frame = m_scope_frames.back();
+        m_scope_frames.pop_back();
+
+        auto scope = m_allocator.emplace<NodeScope>();
+        const size_t count = m_scope_stmts.size() - frame.stmts_begin;
+        NodeStmt **arena_stmts = m_allocator.alloc_array<NodeStmt *>(count);
+        std::copy(m_scope_stmts.cbegin() + static_cast<std::ptrdiff_t>(frame.stmts_begin), m_scope_stmts.cend(), arena_stmts);
+        scope->stmts = std::span<NodeStmt *>(arena_stmts, count);
+        m_scope_stmts.resize(frame.stmts_begin);
+
+        switch (frame.rule)
+        {
+        case StmtRule::scope:
+            return m_allocator.emplace<NodeStmt>(scope);
+        case StmtRule::parallel:
+            frame.stmt_parallel->scope = scope;
+            return m_allocator.emplace<NodeStmt>(frame.stmt_parallel);
+        case StmtRule::if_:
+        {
+            if (frame.stmt_if != nullptr)
             {
-                stmt_if->expr = expr.value();
+                frame.stmt_if->else_scope = scope;
+                return m_allocator.emplace<NodeStmt>(frame.stmt_if);
             }
-            else
+            m_if_arms.back().scope = scope;
+            if (try_consume(TokenType::elif_).has_value())
             {
-                std::cerr << "Invalid expression" << std::endl;
-                exit(EXIT_FAILURE);
+                open_if_arm(frame.arms_begin);
+                return nullptr;
             }
-            try_consume_err(TokenType::close_paren);
-            if (const auto scope = parse_scope())
+            auto stmt_if = m_allocator.emplace<NodeStmtIf>();
+            const size_t arm_count = m_if_arms.size() - frame.arms_begin;
+            NodeIfArm *arena_arms = m_allocator.alloc_array<NodeIfArm>(arm_count);
+            std::copy(m_if_arms.cbegin() + static_cast<std::ptrdiff_t>(frame.arms_begin), m_if_arms.cend(), arena_arms);
+            stmt_if->arms = std::span<NodeIfArm>(arena_arms, arm_count);
+            m_if_arms.resize(frame.arms_begin);
+            if (try_consume(TokenType::else_).has_value())
             {
-                stmt_if->scope = scope.value();
+                open_scope({.rule = StmtRule::if_, .stmt_if = stmt_if});
+                return nullptr;
             }
-            else
+            return m_allocator.emplace<NodeStmt>(stmt_if);
+        }
+        default:
+            break;
+        }
+        assert(false);
+        __builtin_unreachable();
+    }
+
+    /// @brief Parses the header of a 'parallel for' statement, its first token is known to be 'parallel', and opens
+    /// its body.
+    void open_parallel_stmt()
+    {
+        consume();
+        try_consume_err(TokenType::for_);
+        try_consume_err(TokenType::open_paren);
+        auto stmt_parallel = m_allocator.emplace<NodeStmtParallel>();
+        stmt_parallel->ident = node_token(try_consume_err(TokenType::ident));
+        try_consume_err(TokenType::comma);
+        auto lo = parse_expr();
+        if (!lo.has_value())
+        {
+            error_expected("expression");
+        }
+        stmt_parallel->lo = lo.value();
+        try_consume_err(TokenType::comma);
+        auto hi = parse_expr();
+        if (!hi.has_value())
+        {
+            error_expected("expression");
+        }
+        stmt_parallel->hi = hi.value();
+        if (try_consume(TokenType::comma).has_value())
+        {
+            auto chunk = parse_expr();
+            if (!chunk.has_value())
             {
-                std::cerr << "Invalid scope" << std::endl;
-                exit(EXIT_FAILURE);
+                error_expected("expression");
             }
-            stmt_if->pred = parse_if_pred();
-            auto stmt = m_allocator.emplace<NodeStmt>(stmt_if);
-            return stmt;
+            stmt_parallel->chunk = chunk.value();
         }
-        return {};
+        try_consume_err(TokenType::close_paren);
+        if (try_consume(TokenType::sum).has_value())
+        {
+            try_consume_err(TokenType::open_paren);
+            stmt_parallel->sum = NodeTermIdent{.ident = node_token(try_consume_err(TokenType::ident))};
+            try_consume_err(TokenType::close_paren);
+        }
+        open_scope({.rule = StmtRule::parallel, .stmt_parallel = stmt_parallel});
     }
 
     /**
@@ -468,21 +909,98 @@ public:
     std::optional<NodeProg> parse_prog()
     {
         NodeProg prog;
-        while (peek().has_value())
+        while (const auto stmt = parse_top_level_stmt())
         {
-            if (auto stmt = parse_stmt())
-            {
-                prog.stmts.push_back(stmt.value());
-            }
-            else
-            {
-                std::cerr << "Invalid statement" << std::endl;
-                exit(EXIT_FAILURE);
-            }
+            prog.stmts.push_back(stmt.value());
         }
+
+        // The parse tree holds its own copy of every name, so the tokens and the name lookup are not needed anymore.
+        std::vector<Token>().swap(m_tokens);
+        m_index = 0;
+        m_names = {};
         return prog;
     }
 
+    /**
+     * @brief Parses the next top-level statement, for programs handed on one statement at a time.
+     *
+     * @return The statement, or an empty optional at the end of the tokens.
+     */
+    std::optional<NodeStmt *> parse_top_level_stmt()
+    {
+        if (!peek().has_value())
+        {
+            return {};
+        }
+        if (auto stmt = parse_stmt())
+        {
+            return stmt;
+        }
+        syntax_error("Invalid statement", m_throw_errors);
+    }
+
+    /**
+     * @brief Parses a top-level statement from its own tokens, for sessions that only reparse the statements edited.
+     *
+     * Names stay interned across calls, so a long session does not copy them again for every statement.
+     *
+     * @param tokens The tokens of exactly one top-level statement.
+     * @return The statement.
+     */
+    NodeStmt *parse_top_level_stmt(std::vector<Token> tokens)
+    {
+        m_tokens = std::move(tokens);
+        m_index = 0;
+        const std::optional<NodeStmt *> stmt = parse_top_level_stmt();
+        if (!stmt.has_value() || peek().has_value())
+        {
+            syntax_error("Invalid statement", m_throw_errors);
+        }
+        return stmt.value();
+    }
+
+    /// @brief Memory of the parse tree, for returning the nodes of statements replaced by a reparse.
+    PoolAllocator &allocator()
+    {
+        return m_allocator;
+    }
+
+    /// @brief Line of the next token, or an empty optional at the end of the tokens.
+    std::optional<size_t> next_line()
+    {
+        const std::optional<Token> token = peek();
+        return token.has_value() ? std::optional(token->line) : std::nullopt;
+    }
+
+    /// @brief Marks the parse tree's memory, to release the statements parsed after it once they are compiled.
+    [[nodiscard]] PoolAllocator::Mark mark() const
+    {
+        return m_allocator.mark();
+    }
+
+    /// @brief Releases the statements parsed after a mark, which must no longer be used.
+    void rewind(const PoolAllocator::Mark &mark)
+    {
+        // Names interned after the mark are released along with the statements.
+        m_names.clear();
+        m_allocator.rewind(mark);
+    }
+
+    /// @brief Bytes of memory held by the parse tree.
+    size_t tree_bytes() const
+    {
+        return m_allocator.used_bytes();
+    }
+
+    /// @brief Bytes of memory held by the parser besides the parse tree: the buffered tokens, by their size in the
+    /// buffer, and the stacks of the expressions, scopes and 'if' arms being parsed.
+    size_t work_bytes() const
+    {
+        return m_tokens.capacity() * sizeof(Token) + m_expr_frames.capacity() * sizeof(ExprFrame) +
+               m_scope_frames.capacity() * sizeof(ScopeFrame) + m_scope_stmts.capacity() * sizeof(NodeStmt *) +
+               m_if_arms.capacity() * sizeof(NodeIfArm);
+    }
+
 private:
     /**
      * @brief Peeks at the current position in the list of tokens.
@@ -490,15 +1008,61 @@ private:
      * @param offset The offset from the current position to peek at.
      * @return The token at the current position plus the offset, if valid; otherwise, an empty optional.
      */
-    std::optional<Token> peek(const int offset = 0) const
+    std::optional<Token> peek(const int offset = 0)
     {
-        if (m_index + offset >= m_tokens.size())
+        while (m_index + offset >= m_tokens.size())
         {
-            return {};
+            if (!refill())
+            {
+                return {};
+            }
         }
         return m_tokens.at(m_index + offset);
     }
 
+    /**
+     * @brief Fetches more tokens, dropping the consumed ones except the last, which errors still refer to.
+     *
+     * @return Whether more tokens were fetched.
+     */
+    bool refill()
+    {
+        if (!m_refill)
+        {
+            return false;
+        }
+        if (m_index > 1)
+        {
+            m_tokens.erase(m_tokens.begin(), m_tokens.begin() + static_cast<std::ptrdiff_t>(m_index - 1));
+            m_index = 1;
+        }
+        const size_t size = m_tokens.size();
+        if (!m_refill(m_tokens))
+        {
+            m_refill = {};
+        }
+        return m_tokens.size() != size;
+    }
+
+    /**
+     * @brief Interns the text of a token in the arena for the parse tree.
+     *
+     * Every name is stored once, however many times it is used, so the parse tree does not grow with repeated names.
+     *
+     * @param token A token with a value.
+     * @return The token as stored in the parse tree.
+     */
+    NodeToken node_token(const Token &token)
+    {
+        const std::string &value = token.value.value();
+        auto it = m_names.find(value);
+        if (it == m_names.end())
+        {
+            it = m_names.insert(m_allocator.alloc_string(value)).first;
+        }
+        return {.value = *it, .line = token.line};
+    }
+
     /**
      * @brief Consumes the current token in the list of tokens and increments the index.
      *
@@ -540,7 +1104,14 @@ private:
         return {};
     }
 
-    const std::vector<Token> m_tokens;
-    size_t m_index = 0;
-    ArenaAllocator m_allocator;
+    std::vector<Token> m_tokens;                    // Tokens not yet consumed, plus the last consumed one.
+    size_t m_index = 0;                             // Index of the next token.
+    Refill m_refill;                                // Source of more tokens, empty once there are none left.
+    PoolAllocator m_allocator;                      // Memory for the parse tree.
+    std::unordered_set<std::string_view> m_names{}; // Names interned in the arena, only needed while parsing.
+    bool m_throw_errors = false;                    // Whether syntax errors are thrown rather than exit.
+    std::vector<ExprFrame> m_expr_frames{};         // Expressions and terms being parsed, innermost last.
+    std::vector<ScopeFrame> m_scope_frames{};       // Scopes being parsed, innermost last.
+    std::vector<NodeStmt *> m_scope_stmts{};        // Statements of the scopes being parsed, innermost scope's last.
+    std::vector<NodeIfArm> m_if_arms{};             // Arms of the 'if' statements being parsed, innermost last.
 };
\ No newline at end of file
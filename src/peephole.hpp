@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include "machine.hpp"
+
+/// @brief Class to run local optimizations over the generated machine instructions.
+///
+/// The generator is a stack machine, so most of its output is values pushed only to be popped again right away.
+class PeepholeOptimizer
+{
+public:
+    /**
+     * @brief Optimizes a list of machine instructions.
+     *
+     * @param instrs The instructions to optimize.
+     * @return The optimized instructions.
+     */
+    std::vector<MachineInstr> optimize(const std::vector<MachineInstr> &instrs)
+    {
+        std::vector<MachineInstr> output;
+        output.reserve(instrs.size());
+        for (const MachineInstr &instr : instrs)
+        {
+            if (instr.op == Opcode::pop && !output.empty() && output.back().op == Opcode::push)
+            {
+                fold_push_pop(output, instr);
+                continue;
+            }
+            output.push_back(instr);
+        }
+        return output;
+    }
+
+private:
+    /**
+     * @brief Replaces a `push` at the end of the output and the `pop` after it with a move.
+     *
+     * Folding against the end of the output also catches pairs that only become adjacent once an inner pair is gone.
+     *
+     * @param output The optimized instructions so far, ending with the `push`.
+     * @param pop The `pop` instruction.
+     */
+    static void fold_push_pop(std::vector<MachineInstr> &output, const MachineInstr &pop)
+    {
+        // The address of a pushed memory operand is computed before rsp moves, so it is the same for `mov`.
+        const Operand pushed = output.back().dst;
+        output.pop_back();
+        if (pushed != pop.dst)
+        {
+            output.push_back({.op = Opcode::mov, .dst = pop.dst, .src = pushed});
+        }
+    }
+};
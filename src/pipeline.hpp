@@ -0,0 +1,141 @@
+#pragma once
+#include <thread>
+#include "tokenization.hpp"
+#include "parser.hpp"
+#include "resolution.hpp"
+#include "generation.hpp"
+#include "spsc.hpp"
+
+/// @brief Class to tokenize, parse and generate a program on three threads at once.
+///
+/// The tokenizer hands batches of tokens to the parser and the parser hands finished top-level statements to the
+/// generator, through lock-free rings, so the three phases overlap instead of running one after another. Tokens are
+/// dropped once they are parsed, so the full token list never exists at once. The output is the same as running the
+/// phases in order.
+class Pipeline
+{
+public:
+    /**
+     * @brief Constructs the pipeline for a given source code string.
+     *
+     * @param src The source code to compile.
+     * @param superopt_table Table of superoptimized sequences to consult, or nullptr to not use any.
+     * @param superopt_search Whether to search for sequences missing from the table and add them.
+     * @param kind How the program is entered and left.
+     */
+    explicit Pipeline(std::string src, SuperoptTable *superopt_table = nullptr, const bool superopt_search = false,
+                      const ProgramKind kind = ProgramKind::executable)
+        : m_tokenizer(std::move(src)),
+          m_parser({}, [this](std::vector<Token> &tokens) { return next_batch(tokens); }),
+          m_resolver(m_prog),
+          m_generator(NodeProg{}, superopt_table, superopt_search, kind)
+    {
+    }
+
+    /**
+     * @brief Compiles the program, generating code for every statement as long as no errors are found.
+     *
+     * @return The generated instructions, only valid if there are no errors.
+     */
+    const std::vector<MachineInstr> &run()
+    {
+        std::thread tokenizer_thread([this]
+                                     { tokenize(); });
+        std::thread parser_thread([this]
+                                  { parse(); });
+
+        // Generating on the calling thread, statements are resolved right before they are generated.
+        while (NodeStmt *stmt = m_stmts.pop())
+        {
+            m_prog.stmts.push_back(stmt);
+            m_resolver.resolve_statement(stmt);
+            if (m_resolver.errors().empty())
+            {
+                m_generator.generate_statement(stmt);
+            }
+        }
+        tokenizer_thread.join();
+        parser_thread.join();
+        return m_generator.finish_program();
+    }
+
+    /// @brief Errors found while resolving the program.
+    const std::vector<std::string> &errors() const
+    {
+        return m_resolver.errors();
+    }
+
+    /// @brief The parsed program, complete once `run` returns.
+    const NodeProg &prog() const
+    {
+        return m_prog;
+    }
+
+    /// @brief The generator holding the generated instructions and their labels.
+    Generator &generator()
+    {
+        return m_generator;
+    }
+
+private:
+    static constexpr size_t batch_size = 4096; // Tokens per batch handed to the parser.
+
+    /// @brief Tokenizes the source code into batches, an empty batch marks the end.
+    void tokenize()
+    {
+        std::vector<Token> batch;
+        batch.reserve(batch_size);
+        m_tokenizer.tokenize([&](Token &&token)
+                             {
+                                 batch.push_back(std::move(token));
+                                 if (batch.size() == batch_size)
+                                 {
+                                     m_token_batches.push(std::move(batch));
+                                     batch = {};
+                                     batch.reserve(batch_size);
+                                 } });
+        if (!batch.empty())
+        {
+            m_token_batches.push(std::move(batch));
+        }
+        m_token_batches.push({});
+
+        // Every token was handed over, so the source is not needed anymore.
+        m_tokenizer = Tokenizer(std::string());
+    }
+
+    /**
+     * @brief Appends the next batch of tokens for the parser.
+     *
+     * @param tokens The parser's tokens.
+     * @return Whether there are more batches after this one.
+     */
+    bool next_batch(std::vector<Token> &tokens)
+    {
+        std::vector<Token> batch = m_token_batches.pop();
+        if (batch.empty())
+        {
+            return false;
+        }
+        tokens.insert(tokens.end(), std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+        return true;
+    }
+
+    /// @brief Parses top-level statements as tokens arrive, a null statement marks the end.
+    void parse()
+    {
+        while (const auto stmt = m_parser.parse_top_level_stmt())
+        {
+            m_stmts.push(stmt.value());
+        }
+        m_stmts.push(nullptr);
+    }
+
+    Tokenizer m_tokenizer;                           // Tokenizer, run on its own thread.
+    Parser m_parser;                                 // Parser, run on its own thread, owns the parse tree.
+    NodeProg m_prog{};                               // Statements received by the generator so far.
+    Resolver m_resolver;                             // Resolver, run on the calling thread.
+    Generator m_generator;                           // Generator, run on the calling thread.
+    SpscRing<std::vector<Token>, 16> m_token_batches{}; // Token batches from the tokenizer to the parser.
+    SpscRing<NodeStmt *, 1024> m_stmts{};            // Statements from the parser to the generator.
+};
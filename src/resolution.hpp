@@ -0,0 +1,272 @@
+#pragma once
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "parser.hpp"
+#include "visitor.hpp"
+
+/// @brief Class to bind every use of a variable in the parse tree to its declaration.
+///
+/// Every 'let' gets a declaration ID and the stack slot its variable lives in, which is the number of variables
+/// visible at that point. Identifiers and reassignments are annotated with the ID and slot of the variable they refer
+/// to, so later passes never look names up. All undeclared and duplicate identifiers are collected in one pass.
+///
+/// The body of a 'parallel for' runs on several threads at once, each on its own copy of the variables declared
+/// before the loop. Only its sum variable may be reassigned there, and nothing that touches the state of the runtime
+/// shared by the threads, such as printing, reading stdin, the heap pointer or the table of mapped files, is allowed.
+class Resolver : public AstVisitor<Resolver>
+{
+public:
+    /**
+     * @brief Constructs the resolver for a given parse tree.
+     *
+     * @param prog The root of the parse tree, annotated in place.
+     */
+    explicit Resolver(const NodeProg &prog)
+        : m_prog(prog)
+    {
+    }
+
+    /**
+     * @brief Resolves every identifier in the program.
+     *
+     * @return The errors found, empty if every identifier was resolved.
+     */
+    std::vector<std::string> resolve_program()
+    {
+        for (NodeStmt *stmt : m_prog.stmts)
+        {
+            resolve_statement(stmt);
+        }
+        return std::move(m_errors);
+    }
+
+    /**
+     * @brief Resolves every identifier in a top-level statement, for programs handed on one statement at a time.
+     *
+     * @param stmt The statement, following the statements resolved before.
+     */
+    void resolve_statement(NodeStmt *stmt)
+    {
+        traverse_statement(stmt);
+    }
+
+    /// @brief Errors found so far.
+    const std::vector<std::string> &errors() const
+    {
+        return m_errors;
+    }
+
+    /// @brief Number of declarations in the program, valid after `resolve_program`.
+    size_t decl_count() const
+    {
+        return m_decl_count;
+    }
+
+private:
+    friend class AstVisitor<Resolver>;
+
+    /// @brief Represents a declared variable. Names are copied, so statements can be released once resolved.
+    struct Decl
+    {
+        size_t decl_id; // ID of the declaration.
+        size_t slot;    // Stack slot of the variable.
+    };
+
+    bool enter_scope(NodeScope *)
+    {
+        m_scope_starts.push_back(m_visible.size());
+        return true;
+    }
+
+    /// @brief Drops the variables declared in the scope.
+    void leave_scope(NodeScope *)
+    {
+        while (m_visible.size() != m_scope_starts.back())
+        {
+            m_names.erase(m_visible.back());
+            m_visible.pop_back();
+        }
+        m_scope_starts.pop_back();
+    }
+
+    /// @brief Declares the variable of a 'let', which is only visible after its own initializer.
+    void leave_let(NodeStmtLet *stmt_let)
+    {
+        std::string name(stmt_let->ident.value);
+        if (m_names.contains(name))
+        {
+            error("Identifier already used", stmt_let->ident);
+            return;
+        }
+        stmt_let->decl_id = m_decl_count++;
+        stmt_let->slot = m_visible.size();
+        m_names.emplace(name, Decl{.decl_id = stmt_let->decl_id, .slot = stmt_let->slot});
+        m_visible.push_back(std::move(name));
+    }
+
+    bool enter_assign(NodeStmtAssign *stmt_assign)
+    {
+        if (const Decl *decl = find_decl(stmt_assign->ident))
+        {
+            stmt_assign->decl_id = decl->decl_id;
+            stmt_assign->slot = decl->slot;
+            use(decl->slot);
+            if (m_parallel != nullptr && decl->slot < m_parallel_vars &&
+                (!m_parallel->sum.has_value() || decl->slot != m_parallel->sum->slot))
+            {
+                error("Only the sum variable can be reassigned in a parallel loop, not", stmt_assign->ident);
+            }
+        }
+        return true;
+    }
+
+    void visit_ident(NodeTermIdent *term_ident)
+    {
+        if (const Decl *decl = find_decl(term_ident->ident))
+        {
+            term_ident->decl_id = decl->decl_id;
+            term_ident->slot = decl->slot;
+            use(decl->slot);
+        }
+    }
+
+    bool enter_exit(NodeStmtExit *)
+    {
+        forbid("exit");
+        return true;
+    }
+
+    bool enter_print(NodeStmtPrint *)
+    {
+        forbid("print");
+        return true;
+    }
+
+    bool enter_reset(NodeStmtReset *)
+    {
+        forbid("reset the heap");
+        return true;
+    }
+
+    bool enter_alloc(NodeTermAlloc *)
+    {
+        forbid("allocate");
+        return true;
+    }
+
+    bool enter_map(NodeTermMap *)
+    {
+        forbid("map files");
+        return true;
+    }
+
+    void visit_read(NodeTermRead *)
+    {
+        forbid("read stdin");
+    }
+
+    /// @brief Nested loops are not resolved, the threads are already busy with the outer one.
+    bool enter_parallel(NodeStmtParallel *)
+    {
+        forbid("nest parallel loops");
+        return m_parallel == nullptr;
+    }
+
+    /// @brief Declares the index of a 'parallel for' in a scope around its body, after the bounds and the sum
+    /// variable, which refer to the variables before the loop.
+    bool enter_parallel_body(NodeStmtParallel *stmt_parallel)
+    {
+        m_parallel = stmt_parallel;
+        m_parallel_vars = m_visible.size();
+        stmt_parallel->copied = stmt_parallel->sum.has_value() ? m_parallel_vars - stmt_parallel->sum->slot : 0;
+        m_scope_starts.push_back(m_visible.size());
+        std::string name(stmt_parallel->ident.value);
+        if (m_names.contains(name))
+        {
+            error("Identifier already used", stmt_parallel->ident);
+            return true;
+        }
+        stmt_parallel->decl_id = m_decl_count++;
+        stmt_parallel->slot = m_visible.size();
+        m_names.emplace(name, Decl{.decl_id = stmt_parallel->decl_id, .slot = stmt_parallel->slot});
+        m_visible.push_back(std::move(name));
+        return true;
+    }
+
+    /// @brief Drops the index of a 'parallel for'.
+    void leave_parallel(NodeStmtParallel *stmt_parallel)
+    {
+        if (m_parallel != stmt_parallel)
+        {
+            return;
+        }
+        leave_scope(stmt_parallel->scope);
+        m_parallel = nullptr;
+    }
+
+    /**
+     * @brief Records the use of a variable, so a 'parallel for' around it copies the variable to its threads along
+     * with every variable above it on the stack.
+     *
+     * @param slot The stack slot of the variable.
+     */
+    void use(const size_t slot)
+    {
+        if (m_parallel != nullptr && slot < m_parallel_vars)
+        {
+            m_parallel->copied = std::max(m_parallel->copied, m_parallel_vars - slot);
+        }
+    }
+
+    /**
+     * @brief Records an error if the statement being resolved is in the body of a 'parallel for'.
+     *
+     * @param what What the body may not do.
+     */
+    void forbid(const std::string &what)
+    {
+        if (m_parallel != nullptr)
+        {
+            error("Cannot " + what + " in the parallel loop over", m_parallel->ident);
+        }
+    }
+
+    /**
+     * @brief Finds the declaration of a visible variable, recording an error if there is none.
+     *
+     * @param ident The identifier token.
+     * @return The declaration of the variable, or nullptr if it is not declared.
+     */
+    const Decl *find_decl(const NodeToken &ident)
+    {
+        const auto it = m_names.find(std::string(ident.value));
+        if (it == m_names.end())
+        {
+            error("Undeclared identifier", ident);
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+    /**
+     * @brief Records an error about an identifier.
+     *
+     * @param msg The error message.
+     * @param ident The identifier token.
+     */
+    void error(const std::string &msg, const NodeToken &ident)
+    {
+        m_errors.push_back("[Resolve Error] " + msg + " `" + std::string(ident.value) + "` on line " + std::to_string(ident.line));
+    }
+
+    const NodeProg &m_prog;                           // The root of the parse tree.
+    std::unordered_map<std::string, Decl> m_names{}; // Visible variables by name.
+    std::vector<std::string> m_visible{};            // Names of the visible variables in stack order.
+    size_t m_decl_count = 0;                          // Number of declarations so far.
+    std::vector<std::string> m_errors{};              // Errors found so far.
+    std::vector<size_t> m_scope_starts{};             // Number of variables visible before every open scope.
+    NodeStmtParallel *m_parallel = nullptr;           // The 'parallel for' whose body is being resolved, if any.
+    size_t m_parallel_vars = 0;                       // Number of variables visible before that loop.
+};
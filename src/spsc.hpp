@@ -0,0 +1,104 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+
+/**
+ * @class SpscRing
+ * @brief A bounded lock-free ring buffer for one producer thread and one consumer thread.
+ *
+ * The producer only writes the tail and the consumer only writes the head, so each side publishes its progress with a
+ * single release store. Both indices grow without wrapping and are reduced modulo the capacity when a slot is
+ * accessed. Each side caches the last index it read from the other side and only reloads it when the ring looks full
+ * or empty, which keeps the shared cache lines from bouncing on every operation.
+ *
+ * @tparam T The type of the elements.
+ * @tparam Capacity The number of slots, a power of two.
+ */
+template <typename T, std::size_t Capacity>
+class SpscRing
+{
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    /**
+     * @brief Pushes an element if there is room, only to be called by the producer.
+     *
+     * @param value The element, only moved from if it was pushed.
+     * @return Whether the element was pushed.
+     */
+    bool try_push(T &value)
+    {
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cached_head == Capacity)
+        {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            if (tail - m_cached_head == Capacity)
+            {
+                return false;
+            }
+        }
+        m_slots[tail & (Capacity - 1)] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Pops an element if there is one, only to be called by the consumer.
+     *
+     * @param value Receives the element if one was popped.
+     * @return Whether an element was popped.
+     */
+    bool try_pop(T &value)
+    {
+        const std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cached_tail)
+        {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cached_tail)
+            {
+                return false;
+            }
+        }
+        value = std::move(m_slots[head & (Capacity - 1)]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Pushes an element, yielding to other threads while the ring is full.
+     *
+     * @param value The element.
+     */
+    void push(T value)
+    {
+        while (!try_push(value))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief Pops an element, yielding to other threads while the ring is empty.
+     *
+     * @return The element.
+     */
+    T pop()
+    {
+        T value{};
+        while (!try_pop(value))
+        {
+            std::this_thread::yield();
+        }
+        return value;
+    }
+
+private:
+    alignas(64) std::atomic<std::size_t> m_head{0}; // Index of the next slot to pop, written by the consumer.
+    std::size_t m_cached_tail = 0;                    // Last tail seen by the consumer.
+    alignas(64) std::atomic<std::size_t> m_tail{0}; // Index of the next slot to push, written by the producer.
+    std::size_t m_cached_head = 0;                    // Last head seen by the producer.
+    alignas(64) std::array<T, Capacity> m_slots{};  // The elements.
+};
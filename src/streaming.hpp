@@ -0,0 +1,192 @@
+#pragma once
+#include <istream>
+#include <ostream>
+#include "tokenization.hpp"
+#include "parser.hpp"
+#include "resolution.hpp"
+#include "generation.hpp"
+#include "peephole.hpp"
+#include "encoding.hpp"
+
+/// @brief Class to compile a program one top-level statement at a time, with bounded memory.
+///
+/// Every statement is tokenized, parsed, resolved, generated and printed before the next one is read, and its parse
+/// tree is released right after. Only a window of the source code, the tokens of one statement and the names of the
+/// variables in scope are kept, so the memory used does not grow with the length of the program. The program is not
+/// evaluated at compile time, which needs all of it, so the output is the same as with `--no-eval`.
+///
+/// The memory budget bounds what one statement holds while it is compiled: its parse tree, the tokens the parser has
+/// buffered, the parser's stacks of the expressions and scopes it is in, and the instructions generated for it. It is
+/// checked whenever the parser takes more tokens, so a statement too big for it is stopped before it is all parsed,
+/// and once more with the instructions after it is generated. The window of the source code, the names the resolver
+/// keeps and the printed output are not counted.
+class StreamCompiler
+{
+public:
+    /**
+     * @brief Constructs the compiler for a given input and output stream.
+     *
+     * @param input The stream to read the source code from.
+     * @param output The stream to print the assembly code to.
+     * @param memory_budget Bytes a single statement may take to compile, see the class, or 0 for no limit.
+     * @param superopt_table Table of superoptimized sequences to consult, or nullptr to not use any.
+     * @param superopt_search Whether to search for sequences missing from the table and add them.
+     * @param dialect The assembler to print for.
+     * @param kind How the program is entered and left.
+     * @param symbol Name of the function a function program is entered at.
+     */
+    StreamCompiler(std::istream &input, std::ostream &output, const size_t memory_budget,
+                   SuperoptTable *superopt_table = nullptr, const bool superopt_search = false,
+                   const AsmDialect dialect = AsmDialect::nasm, const ProgramKind kind = ProgramKind::executable,
+                   std::string symbol = "")
+        : m_tokenizer(input),
+          m_parser({}, [this](std::vector<Token> &tokens) { return next_batch(tokens); }, arena_block_size),
+          m_resolver(m_prog),
+          m_generator(NodeProg{}, superopt_table, superopt_search, kind),
+          m_printer(dialect, kind, std::move(symbol)),
+          m_output(output),
+          m_memory_budget(memory_budget)
+    {
+    }
+
+    /**
+     * @brief Compiles the program, printing the code of every statement as long as no errors are found.
+     *
+     * @return The errors found, empty if the whole program was printed.
+     */
+    std::vector<std::string> run()
+    {
+        m_output << m_printer.print_header();
+        size_t stmt_count = 0;
+        while (true)
+        {
+            const PoolAllocator::Mark mark = m_parser.mark();
+            size_t line = 0;
+            std::optional<NodeStmt *> stmt;
+            try
+            {
+                line = m_parser.next_line().value_or(0);
+                stmt = m_parser.parse_top_level_stmt();
+            }
+            catch (const OverBudget &over)
+            {
+                // Over the budget before the statement's first token was seen, that token was just taken.
+                line = line != 0 ? line : over.line;
+                return over_budget(stmt_count + 1, line, "at least " + std::to_string(over.used));
+            }
+            if (!stmt.has_value())
+            {
+                break;
+            }
+            stmt_count++;
+
+            // Statements are still resolved after an error, so every error is reported at once.
+            m_resolver.resolve_statement(stmt.value());
+            if (m_resolver.errors().empty())
+            {
+                m_generator.generate_statement(stmt.value());
+                std::vector<MachineInstr> instrs = m_generator.take_instrs();
+                const size_t used = parser_bytes() + instrs.capacity() * sizeof(MachineInstr);
+                if (m_memory_budget != 0 && used > m_memory_budget)
+                {
+                    return over_budget(stmt_count, line, std::to_string(used));
+                }
+                m_output << m_printer.print_instrs(optimize(instrs));
+            }
+            m_parser.rewind(mark);
+        }
+        if (!m_resolver.errors().empty())
+        {
+            return m_resolver.errors();
+        }
+        m_output << m_printer.print_instrs(optimize(m_generator.finish_program()));
+        return {};
+    }
+
+private:
+    static constexpr size_t batch_size = 256;             // Tokens handed to the parser at once.
+    static constexpr size_t arena_block_size = 64 * 1024; // Size of the blocks the parse tree is allocated in.
+
+    /// @brief Thrown through the parser once a statement being parsed is over the memory budget.
+    struct OverBudget
+    {
+        size_t used; // Bytes held when the budget was checked.
+        size_t line; // Line of the first token taken then.
+    };
+
+    /**
+     * @brief Appends the next batch of tokens for the parser.
+     *
+     * @param tokens The parser's tokens.
+     * @return Whether there may be more tokens after this batch.
+     */
+    bool next_batch(std::vector<Token> &tokens)
+    {
+        const size_t begin = tokens.size();
+        bool more = true;
+        for (size_t i = 0; i < batch_size && more; i++)
+        {
+            std::optional<Token> token = m_tokenizer.next();
+            more = token.has_value();
+            if (more)
+            {
+                tokens.push_back(std::move(token.value()));
+            }
+        }
+        // The statement being parsed only grows from here, so it is stopped as soon as it is over the budget.
+        const size_t used = parser_bytes();
+        if (m_memory_budget != 0 && used > m_memory_budget)
+        {
+            throw OverBudget{.used = used, .line = tokens.size() != begin ? tokens[begin].line : 0};
+        }
+        return more;
+    }
+
+    /// @brief Bytes held by the parser for the statement being compiled.
+    size_t parser_bytes() const
+    {
+        return m_parser.tree_bytes() + m_parser.work_bytes();
+    }
+
+    /**
+     * @brief Reports a statement over the memory budget, after the errors found before it.
+     *
+     * @param stmt_number Number of the statement, from 1.
+     * @param line Line the statement starts on.
+     * @param used Bytes the statement needs, as reported.
+     * @return The errors to report.
+     */
+    std::vector<std::string> over_budget(const size_t stmt_number, const size_t line, const std::string &used) const
+    {
+        std::vector<std::string> errors = m_resolver.errors();
+        errors.push_back("[Memory Error] Statement " + std::to_string(stmt_number) + " on line " + std::to_string(line) +
+                         " needs " + used + " bytes to compile, over the memory budget of " +
+                         std::to_string(m_memory_budget) + " bytes");
+        return errors;
+    }
+
+    /**
+     * @brief Runs the post-codegen passes over the code of a statement, with the labels it was generated with.
+     *
+     * @param instrs The instructions of the statement.
+     * @return The instructions ready to print.
+     */
+    std::vector<MachineInstr> optimize(const std::vector<MachineInstr> &instrs)
+    {
+        PeepholeOptimizer peephole;
+        std::vector<MachineInstr> optimized = peephole.optimize(instrs);
+        m_generator.labels().remove_dead_labels(optimized);
+        Encoder encoder(m_generator.labels());
+        encoder.relax(optimized);
+        return optimized;
+    }
+
+    Tokenizer m_tokenizer;        // Tokenizer reading the source code as the parser needs it.
+    Parser m_parser;              // Parser, its memory is released after every statement.
+    NodeProg m_prog{};            // Empty program, statements are handed to the resolver one at a time.
+    Resolver m_resolver;          // Resolver, keeps the names of the variables in scope.
+    Generator m_generator;        // Generator, hands over the code of every statement.
+    AsmPrinter m_printer;         // Printer of the entry point and the code of every statement.
+    std::ostream &m_output;       // Stream to print the assembly code to.
+    const size_t m_memory_budget; // Bytes a single statement may take to compile, or 0 for no limit.
+};
@@ -0,0 +1,920 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <type_traits>
+#include "machine.hpp"
+#include "parser.hpp"
+
+/// @brief Operations the superoptimizer searches over.
+enum class SuperOp : uint8_t
+{
+    mov,      // mov dst, src
+    add,      // add dst, src
+    sub,      // sub dst, src
+    neg,      // neg dst
+    lea,      // lea dst, [src + idx*scale]
+    shl,      // shl dst, imm
+    imul,     // imul dst, src
+    imul_imm, // imul dst, src, imm
+    add_imm,  // add dst, imm
+    sub_imm,  // sub dst, imm
+};
+
+/// @brief Number of operations, `sub_imm` is the last one.
+constexpr size_t super_op_count = static_cast<size_t>(SuperOp::sub_imm) + 1;
+
+/// @brief Represents a single instruction of a superoptimized sequence.
+///
+/// Registers are numbered rax, rbx, rcx. The first variable of the expression is loaded into rax, the second into
+/// rbx, and the result is left in rax.
+struct SuperInstr
+{
+    SuperOp op;    // The operation.
+    uint8_t dst;   // Destination register.
+    uint8_t src;   // Source register (base register for `lea`).
+    uint8_t idx;   // Index register for `lea`.
+    uint8_t scale; // Scale of the index register for `lea`.
+    int64_t imm;   // Immediate operand.
+};
+
+/// @brief Registers used by the superoptimizer, indexed by register number.
+constexpr std::array<Reg, 3> super_regs = {Reg::rax, Reg::rbx, Reg::rcx};
+
+/// @brief Converts a superoptimizer instruction into a machine instruction.
+/// @param instr The instruction.
+/// @return The machine instruction.
+MachineInstr to_machine_instr(const SuperInstr &instr)
+{
+    const Operand dst = Operand::reg(super_regs[instr.dst]);
+    const Operand src = Operand::reg(super_regs[instr.src]);
+    switch (instr.op)
+    {
+    case SuperOp::mov:
+        return {.op = Opcode::mov, .dst = dst, .src = src};
+    case SuperOp::add:
+        return {.op = Opcode::add, .dst = dst, .src = src};
+    case SuperOp::sub:
+        return {.op = Opcode::sub, .dst = dst, .src = src};
+    case SuperOp::neg:
+        return {.op = Opcode::neg, .dst = dst};
+    case SuperOp::lea:
+        return {
+            .op = Opcode::lea,
+            .dst = dst,
+            .src = Operand::mem(super_regs[instr.src], super_regs[instr.idx], instr.scale)};
+    case SuperOp::shl:
+        return {.op = Opcode::shl, .dst = dst, .src = Operand::imm(instr.imm)};
+    case SuperOp::imul:
+        return {.op = Opcode::imul, .dst = dst, .src = src};
+    case SuperOp::imul_imm:
+        return {.op = Opcode::imul, .dst = dst, .src = src, .src2 = Operand::imm(instr.imm)};
+    case SuperOp::add_imm:
+        return {.op = Opcode::add, .dst = dst, .src = Operand::imm(instr.imm)};
+    case SuperOp::sub_imm:
+        return {.op = Opcode::sub, .dst = dst, .src = Operand::imm(instr.imm)};
+    }
+    assert(false);
+    __builtin_unreachable();
+}
+
+/// @brief A small arithmetic expression over at most two variables that the superoptimizer can search for.
+///
+/// The expression is stored in postfix order, with variables numbered in order of first appearance.
+struct SuperTarget
+{
+    /// @brief Represents a single postfix operation.
+    struct Op
+    {
+        enum class Kind : uint8_t
+        {
+            var,
+            constant,
+            add,
+            sub,
+            mul,
+        } kind;
+        uint64_t value; // Variable number or constant value.
+    };
+
+    static constexpr size_t max_vars = 2;      // Maximum number of distinct variables.
+    static constexpr size_t max_bin_ops = 3;   // Maximum number of binary operations.
+    static constexpr size_t max_constants = 2; // Maximum number of constants.
+    static constexpr size_t max_parens = 8;    // Maximum number of parentheses, which nest without binary operations.
+
+    std::vector<Op> ops;             // The expression in postfix order.
+    std::vector<size_t> vars;        // Stack slots of the variables, rax holds vars[0] and rbx holds vars[1].
+    std::vector<uint64_t> constants; // Constants appearing in the expression.
+
+    /// @brief Evaluates the expression.
+    /// @tparam T Integer type to evaluate in, which selects the bit width of the model.
+    /// @param inputs Values of the variables.
+    /// @return Value of the expression.
+    template <typename T>
+    T evaluate(const std::array<T, max_vars> &inputs) const
+    {
+        std::array<T, max_bin_ops + 1> stack{};
+        size_t size = 0;
+        for (const Op &op : ops)
+        {
+            switch (op.kind)
+            {
+            case Op::Kind::var:
+                stack[size++] = inputs[op.value];
+                break;
+            case Op::Kind::constant:
+                stack[size++] = static_cast<T>(op.value);
+                break;
+            case Op::Kind::add:
+                size--;
+                stack[size - 1] = static_cast<T>(stack[size - 1] + stack[size]);
+                break;
+            case Op::Kind::sub:
+                size--;
+                stack[size - 1] = static_cast<T>(stack[size - 1] - stack[size]);
+                break;
+            case Op::Kind::mul:
+                size--;
+                stack[size - 1] = static_cast<T>(stack[size - 1] * stack[size]);
+                break;
+            }
+        }
+        return stack[0];
+    }
+
+    /// @brief Key of the expression in the rewrite table, independent of the variable names.
+    /// @return The key.
+    std::string key() const
+    {
+        std::string key;
+        for (const Op &op : ops)
+        {
+            if (!key.empty())
+            {
+                key += ' ';
+            }
+            switch (op.kind)
+            {
+            case Op::Kind::var:
+                key += op.value == 0 ? "x" : "y";
+                break;
+            case Op::Kind::constant:
+                key += std::to_string(op.value);
+                break;
+            case Op::Kind::add:
+                key += '+';
+                break;
+            case Op::Kind::sub:
+                key += '-';
+                break;
+            case Op::Kind::mul:
+                key += '*';
+                break;
+            }
+        }
+        return key;
+    }
+
+    /**
+     * @brief Parses a key back into its expression, for checking the entries of a table file.
+     *
+     * Only the number of variables matters to a sequence, so they are given the slots 0 and 1.
+     *
+     * @param key The key.
+     * @return The expression, or an empty optional if `key()` never makes the key.
+     */
+    static std::optional<SuperTarget> from_key(const std::string &key)
+    {
+        SuperTarget target{};
+        size_t depth = 0;
+        size_t bin_ops = 0;
+        std::stringstream tokens(key);
+        std::string token;
+        while (tokens >> token)
+        {
+            Op op{.kind = Op::Kind::var, .value = 0};
+            if (token == "+" || token == "-" || token == "*")
+            {
+                if (depth < 2 || ++bin_ops > max_bin_ops)
+                {
+                    return {};
+                }
+                op.kind = token == "+" ? Op::Kind::add : token == "-" ? Op::Kind::sub : Op::Kind::mul;
+                depth--;
+            }
+            else if (token == "x" || token == "y")
+            {
+                // Variables are numbered in order of first appearance, so y never comes before x.
+                op.value = token == "x" ? 0 : 1;
+                if (op.value > target.vars.size())
+                {
+                    return {};
+                }
+                if (op.value == target.vars.size())
+                {
+                    target.vars.push_back(op.value);
+                }
+                depth++;
+            }
+            else
+            {
+                if (std::from_chars(token.data(), token.data() + token.size(), op.value).ec != std::errc{} ||
+                    target.constants.size() == max_constants)
+                {
+                    return {};
+                }
+                op.kind = Op::Kind::constant;
+                target.constants.push_back(op.value);
+                depth++;
+            }
+            target.ops.push_back(op);
+        }
+        if (depth != 1 || bin_ops == 0 || target.vars.empty() || target.key() != key)
+        {
+            return {};
+        }
+        return target;
+    }
+};
+
+/**
+ * @brief Converts an expression into a superoptimizer target if it is small enough.
+ *
+ * @param expr The expression node.
+ * @return The target, or an empty optional if the expression is not eligible.
+ */
+std::optional<SuperTarget> make_super_target(const NodeExpr *expr)
+{
+    struct Builder
+    {
+        SuperTarget target{};
+        size_t bin_ops = 0;
+        size_t parens = 0;
+
+        bool add_expr(const NodeExpr *expr)
+        {
+            if (const auto term = std::get_if<NodeTerm *>(&expr->var))
+            {
+                return add_term(*term);
+            }
+            const NodeBinExpr *bin_expr = std::get<NodeBinExpr *>(expr->var);
+            if (++bin_ops > SuperTarget::max_bin_ops)
+            {
+                return false;
+            }
+            if (const auto add = std::get_if<NodeBinExprAdd *>(&bin_expr->var))
+            {
+                return add_bin_expr((*add)->lhs, (*add)->rhs, SuperTarget::Op::Kind::add);
+            }
+            if (const auto sub = std::get_if<NodeBinExprSub *>(&bin_expr->var))
+            {
+                return add_bin_expr((*sub)->lhs, (*sub)->rhs, SuperTarget::Op::Kind::sub);
+            }
+            if (const auto multi = std::get_if<NodeBinExprMulti *>(&bin_expr->var))
+            {
+                return add_bin_expr((*multi)->lhs, (*multi)->rhs, SuperTarget::Op::Kind::mul);
+            }
+            // Division does not map onto the searched instructions.
+            return false;
+        }
+
+        bool add_bin_expr(const NodeExpr *lhs, const NodeExpr *rhs, const SuperTarget::Op::Kind kind)
+        {
+            if (!add_expr(lhs) || !add_expr(rhs))
+            {
+                return false;
+            }
+            target.ops.push_back({.kind = kind, .value = 0});
+            return true;
+        }
+
+        bool add_term(const NodeTerm *term)
+        {
+            if (const auto paren = std::get_if<NodeTermParen *>(&term->var))
+            {
+                // Parentheses cost no instructions, but deeply nested ones would make the walk recurse as deep.
+                return ++parens <= SuperTarget::max_parens && add_expr((*paren)->expr);
+            }
+            if (const auto ident = std::get_if<NodeTermIdent *>(&term->var))
+            {
+                const size_t slot = (*ident)->slot;
+                const auto it = std::find(target.vars.cbegin(), target.vars.cend(), slot);
+                if (it == target.vars.cend() && target.vars.size() == SuperTarget::max_vars)
+                {
+                    return false;
+                }
+                if (it == target.vars.cend())
+                {
+                    target.vars.push_back(slot);
+                }
+                const auto index = std::find(target.vars.cbegin(), target.vars.cend(), slot) - target.vars.cbegin();
+                target.ops.push_back({.kind = SuperTarget::Op::Kind::var, .value = static_cast<uint64_t>(index)});
+                return true;
+            }
+            const auto int_lit = std::get_if<NodeTermIntLit *>(&term->var);
+            if (int_lit == nullptr)
+            {
+                // Input is read by the runtime, which the searched instructions cannot call.
+                return false;
+            }
+            const std::string_view lit = (*int_lit)->int_lit.value;
+            uint64_t value = 0;
+            if (std::from_chars(lit.data(), lit.data() + lit.size(), value).ec != std::errc{} ||
+                target.constants.size() == SuperTarget::max_constants)
+            {
+                return false;
+            }
+            target.constants.push_back(value);
+            target.ops.push_back({.kind = SuperTarget::Op::Kind::constant, .value = value});
+            return true;
+        }
+    };
+
+    Builder builder;
+    if (!builder.add_expr(expr) || builder.bin_ops == 0 || builder.target.vars.empty())
+    {
+        return {};
+    }
+    return builder.target;
+}
+
+/// @brief Polynomial in the two variables of a target with coefficients modulo 2^64.
+///
+/// Every searched operation is a ring operation modulo 2^64 (shifts and `lea` scales multiply by constants), so the
+/// value of a sequence is such a polynomial. Two sequences with the same coefficients compute the same function on
+/// every 64-bit input. The converse does not hold, so comparing coefficients may reject a correct sequence but never
+/// accepts a wrong one.
+struct SuperPoly
+{
+    static constexpr size_t max_degree = 8; // Highest power of a variable kept, beyond it the polynomial overflows.
+
+    std::array<uint64_t, (max_degree + 1) * (max_degree + 1)> coeffs{}; // Coefficient of x^i y^j at i * 9 + j.
+    bool overflow = false; // Whether a product went past `max_degree`, the polynomial is then unknown.
+
+    SuperPoly() = default;
+
+    /// @brief Constructs a constant polynomial, implicitly so the evaluators can mix it with integers.
+    SuperPoly(const uint64_t constant)
+    {
+        coeffs[0] = constant;
+    }
+
+    /// @brief The polynomial of a variable.
+    /// @param var Number of the variable, 0 for x and 1 for y.
+    static SuperPoly variable(const size_t var)
+    {
+        SuperPoly poly;
+        poly.coeffs[var == 0 ? max_degree + 1 : 1] = 1;
+        return poly;
+    }
+
+    friend SuperPoly operator+(const SuperPoly &lhs, const SuperPoly &rhs)
+    {
+        SuperPoly sum = lhs;
+        for (size_t i = 0; i < sum.coeffs.size(); i++)
+        {
+            sum.coeffs[i] += rhs.coeffs[i];
+        }
+        sum.overflow |= rhs.overflow;
+        return sum;
+    }
+
+    friend SuperPoly operator-(const SuperPoly &lhs, const SuperPoly &rhs)
+    {
+        SuperPoly diff = lhs;
+        for (size_t i = 0; i < diff.coeffs.size(); i++)
+        {
+            diff.coeffs[i] -= rhs.coeffs[i];
+        }
+        diff.overflow |= rhs.overflow;
+        return diff;
+    }
+
+    friend SuperPoly operator*(const SuperPoly &lhs, const SuperPoly &rhs)
+    {
+        SuperPoly product;
+        product.overflow = lhs.overflow || rhs.overflow;
+        for (size_t a = 0; a < lhs.coeffs.size(); a++)
+        {
+            for (size_t b = 0; lhs.coeffs[a] != 0 && b < rhs.coeffs.size(); b++)
+            {
+                if (rhs.coeffs[b] == 0)
+                {
+                    continue;
+                }
+                const size_t x = a / (max_degree + 1) + b / (max_degree + 1);
+                const size_t y = a % (max_degree + 1) + b % (max_degree + 1);
+                if (x > max_degree || y > max_degree)
+                {
+                    product.overflow = true;
+                    continue;
+                }
+                product.coeffs[x * (max_degree + 1) + y] += lhs.coeffs[a] * rhs.coeffs[b];
+            }
+        }
+        return product;
+    }
+
+    /// @brief Shifting left multiplies by a power of two, which is 0 modulo 2^64 from 64 on.
+    friend SuperPoly operator<<(const SuperPoly &lhs, const int64_t shift)
+    {
+        return lhs * SuperPoly(shift >= 64 ? 0 : uint64_t{1} << shift);
+    }
+
+    /// @brief Whether two polynomials are known to be the same function, never true once either overflowed.
+    bool same_as(const SuperPoly &other) const
+    {
+        return !overflow && !other.overflow && coeffs == other.coeffs;
+    }
+};
+
+/// @brief Class to exhaustively search for the cheapest instruction sequence computing a small expression.
+///
+/// Candidates are first run on edge-case and random 64-bit inputs. Sequences that pass are then checked for every
+/// input on an 8-bit model of the same instructions, which quickly rules out most of the rest. A sequence is only
+/// accepted once it is proven equivalent for every 64-bit input, by computing it and the target symbolically as
+/// polynomials modulo 2^64, see `SuperPoly`.
+class Superoptimizer
+{
+public:
+    static constexpr size_t default_max_length = 3; // Longest sequence searched.
+
+    /**
+     * @brief Constructs the superoptimizer for a target expression.
+     *
+     * @param target The expression to compute.
+     */
+    explicit Superoptimizer(const SuperTarget &target)
+        : m_target(target), m_reg_count(target.vars.size() + 1)
+    {
+        // Edge values catch sign and carry mistakes that random ones rarely do.
+        constexpr std::array<uint64_t, 6> edges = {0, 1, UINT64_MAX, uint64_t{1} << 63, uint64_t{1} << 32, 2};
+        std::mt19937_64 rng(0x5eed);
+        for (size_t i = 0; i < test_count; i++)
+        {
+            for (size_t var = 0; var < SuperTarget::max_vars; var++)
+            {
+                m_tests[i].inputs[var] = i < edges.size() ? edges[(i + var) % edges.size()] : rng();
+            }
+            m_tests[i].expected = m_target.evaluate<uint64_t>(m_tests[i].inputs);
+        }
+        build_alphabet();
+    }
+
+    /**
+     * @brief Searches for the cheapest sequence computing the target.
+     *
+     * @param max_length The longest sequence to consider.
+     * @return The sequence, or an empty optional if none exists within the length.
+     */
+    std::optional<std::vector<SuperInstr>> search(const size_t max_length = default_max_length)
+    {
+        m_best.reset();
+        for (size_t length = 1; length <= max_length; length++)
+        {
+            // Every instruction costs at least one, so longer sequences cannot beat the best one found.
+            if (m_best.has_value() && length >= m_best_cost)
+            {
+                break;
+            }
+            std::array<Regs, test_count> regs{};
+            for (size_t i = 0; i < test_count; i++)
+            {
+                for (size_t var = 0; var < m_target.vars.size(); var++)
+                {
+                    regs[i][var] = m_tests[i].inputs[var];
+                }
+            }
+            m_sequence.clear();
+            search_from(regs, (1u << m_target.vars.size()) - 1, length, 0);
+        }
+        return m_best;
+    }
+
+    /**
+     * @brief Proves a sequence that was not found by a search computes a target on every 64-bit input.
+     *
+     * Like the sequences a search finds, it may only read registers that hold a variable or were written before.
+     *
+     * @param target The expression to compute.
+     * @param sequence The sequence, with registers and operations in range.
+     * @return Whether the sequence is proven to compute the target.
+     */
+    static bool proves(const SuperTarget &target, const std::vector<SuperInstr> &sequence)
+    {
+        unsigned defined = (1u << target.vars.size()) - 1;
+        for (const SuperInstr &instr : sequence)
+        {
+            if ((reads(instr) & ~defined) != 0)
+            {
+                return false;
+            }
+            defined |= 1u << instr.dst;
+        }
+        return verify_symbolic(target, sequence);
+    }
+
+private:
+    static constexpr size_t test_count = 12; // Number of 64-bit test inputs.
+
+    using Regs = std::array<uint64_t, super_regs.size()>;
+
+    /// @brief Represents a 64-bit test input with its expected result.
+    struct Test
+    {
+        std::array<uint64_t, SuperTarget::max_vars> inputs; // Values of the variables.
+        uint64_t expected;                                  // Expected value of the expression.
+    };
+
+    /// @brief Latency-based cost of an instruction.
+    static size_t cost(const SuperInstr &instr)
+    {
+        return instr.op == SuperOp::imul || instr.op == SuperOp::imul_imm ? 3 : 1;
+    }
+
+    /// @brief Executes an instruction on a register file.
+    /// @tparam T Integer type to execute in, which selects the bit width of the model.
+    template <typename T>
+    static void execute(const SuperInstr &instr, std::array<T, super_regs.size()> &regs)
+    {
+        T &dst = regs[instr.dst];
+        const T src = regs[instr.src];
+        const T imm = static_cast<T>(instr.imm);
+        switch (instr.op)
+        {
+        case SuperOp::mov:
+            dst = src;
+            break;
+        case SuperOp::add:
+            dst = static_cast<T>(dst + src);
+            break;
+        case SuperOp::sub:
+            dst = static_cast<T>(dst - src);
+            break;
+        case SuperOp::neg:
+            dst = static_cast<T>(0 - dst);
+            break;
+        case SuperOp::lea:
+            dst = static_cast<T>(src + regs[instr.idx] * instr.scale);
+            break;
+        case SuperOp::shl:
+            // Shifting out every bit of the narrow model leaves zero, like the wide result reduced to it.
+            if constexpr (std::is_integral_v<T>)
+            {
+                dst = instr.imm >= static_cast<int64_t>(sizeof(T) * 8) ? 0 : static_cast<T>(dst << instr.imm);
+            }
+            else
+            {
+                dst = dst << instr.imm;
+            }
+            break;
+        case SuperOp::imul:
+            dst = static_cast<T>(dst * src);
+            break;
+        case SuperOp::imul_imm:
+            dst = static_cast<T>(src * imm);
+            break;
+        case SuperOp::add_imm:
+            dst = static_cast<T>(dst + imm);
+            break;
+        case SuperOp::sub_imm:
+            dst = static_cast<T>(dst - imm);
+            break;
+        }
+    }
+
+    /// @brief Registers an instruction reads.
+    static unsigned reads(const SuperInstr &instr)
+    {
+        switch (instr.op)
+        {
+        case SuperOp::mov:
+        case SuperOp::imul_imm:
+            return 1u << instr.src;
+        case SuperOp::lea:
+            return (1u << instr.src) | (1u << instr.idx);
+        case SuperOp::add:
+        case SuperOp::sub:
+        case SuperOp::imul:
+            return (1u << instr.dst) | (1u << instr.src);
+        case SuperOp::neg:
+        case SuperOp::shl:
+        case SuperOp::add_imm:
+        case SuperOp::sub_imm:
+            return 1u << instr.dst;
+        }
+        assert(false);
+        __builtin_unreachable();
+    }
+
+    /// @brief Builds every instruction the search may use for the target.
+    void build_alphabet()
+    {
+        // Immediates are encoded as sign-extended 32-bit values.
+        std::vector<int64_t> imms;
+        std::vector<int64_t> shifts = {1, 2, 3, 4};
+        for (const uint64_t constant : m_target.constants)
+        {
+            if (constant <= INT32_MAX)
+            {
+                imms.push_back(static_cast<int64_t>(constant));
+            }
+            if (constant != 0)
+            {
+                shifts.push_back(std::countr_zero(constant));
+                shifts.push_back(63 - std::countl_zero(constant));
+            }
+        }
+        std::sort(shifts.begin(), shifts.end());
+        shifts.erase(std::unique(shifts.begin(), shifts.end()), shifts.end());
+        std::erase(shifts, 0);
+
+        for (uint8_t dst = 0; dst < m_reg_count; dst++)
+        {
+            m_alphabet.push_back({.op = SuperOp::neg, .dst = dst});
+            for (const int64_t shift : shifts)
+            {
+                m_alphabet.push_back({.op = SuperOp::shl, .dst = dst, .imm = shift});
+            }
+            for (const int64_t imm : imms)
+            {
+                m_alphabet.push_back({.op = SuperOp::add_imm, .dst = dst, .imm = imm});
+                m_alphabet.push_back({.op = SuperOp::sub_imm, .dst = dst, .imm = imm});
+            }
+            for (uint8_t src = 0; src < m_reg_count; src++)
+            {
+                if (src != dst)
+                {
+                    m_alphabet.push_back({.op = SuperOp::mov, .dst = dst, .src = src});
+                }
+                m_alphabet.push_back({.op = SuperOp::add, .dst = dst, .src = src});
+                m_alphabet.push_back({.op = SuperOp::sub, .dst = dst, .src = src});
+                m_alphabet.push_back({.op = SuperOp::imul, .dst = dst, .src = src});
+                for (const int64_t imm : imms)
+                {
+                    m_alphabet.push_back({.op = SuperOp::imul_imm, .dst = dst, .src = src, .imm = imm});
+                }
+                for (uint8_t idx = 0; idx < m_reg_count; idx++)
+                {
+                    for (const uint8_t scale : {1, 2, 4, 8})
+                    {
+                        m_alphabet.push_back({.op = SuperOp::lea, .dst = dst, .src = src, .idx = idx, .scale = scale});
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Depth-first search over every sequence of the remaining length.
+     *
+     * @param regs Register files for every test input after the current prefix.
+     * @param defined Mask of registers holding a value.
+     * @param remaining Number of instructions still to place.
+     * @param cost Cost of the current prefix.
+     */
+    void search_from(const std::array<Regs, test_count> &regs, const unsigned defined, const size_t remaining, const size_t cost)
+    {
+        if (m_best.has_value() && cost >= m_best_cost)
+        {
+            return;
+        }
+        if (remaining == 0)
+        {
+            if ((defined & 1u) == 0)
+            {
+                return;
+            }
+            for (size_t i = 0; i < test_count; i++)
+            {
+                if (regs[i][0] != m_tests[i].expected)
+                {
+                    return;
+                }
+            }
+            if (verify_reduced() && verify_symbolic(m_target, m_sequence))
+            {
+                m_best = m_sequence;
+                m_best_cost = cost;
+            }
+            return;
+        }
+        for (const SuperInstr &instr : m_alphabet)
+        {
+            // Reading a register that holds garbage can never be correct.
+            if ((reads(instr) & ~defined) != 0)
+            {
+                continue;
+            }
+            std::array<Regs, test_count> next = regs;
+            for (Regs &test_regs : next)
+            {
+                execute(instr, test_regs);
+            }
+            m_sequence.push_back(instr);
+            search_from(next, defined | (1u << instr.dst), remaining - 1, cost + Superoptimizer::cost(instr));
+            m_sequence.pop_back();
+        }
+    }
+
+    /// @brief Checks the current sequence against the target for every input of the 8-bit model.
+    /// @return Whether the sequence computes the target on every input.
+    bool verify_reduced() const
+    {
+        const unsigned y_count = m_target.vars.size() > 1 ? 256 : 1;
+        for (unsigned x = 0; x < 256; x++)
+        {
+            for (unsigned y = 0; y < y_count; y++)
+            {
+                const std::array<uint8_t, SuperTarget::max_vars> inputs = {static_cast<uint8_t>(x), static_cast<uint8_t>(y)};
+                std::array<uint8_t, super_regs.size()> regs = {inputs[0], inputs[1], 0};
+                for (const SuperInstr &instr : m_sequence)
+                {
+                    execute(instr, regs);
+                }
+                if (regs[0] != m_target.evaluate<uint8_t>(inputs))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Proves a sequence computes a target on every 64-bit input.
+     *
+     * @param target The expression to compute.
+     * @param sequence The sequence.
+     * @return Whether the sequence and the target are the same polynomial.
+     */
+    static bool verify_symbolic(const SuperTarget &target, const std::vector<SuperInstr> &sequence)
+    {
+        const std::array<SuperPoly, SuperTarget::max_vars> inputs = {SuperPoly::variable(0), SuperPoly::variable(1)};
+        std::array<SuperPoly, super_regs.size()> regs = {inputs[0], inputs[1], SuperPoly()};
+        for (const SuperInstr &instr : sequence)
+        {
+            execute(instr, regs);
+        }
+        return regs[0].same_as(target.evaluate<SuperPoly>(inputs));
+    }
+
+    const SuperTarget &m_target;                     // The expression to compute.
+    const size_t m_reg_count;                        // Number of registers the search may use.
+    std::array<Test, test_count> m_tests{};          // The 64-bit test inputs.
+    std::vector<SuperInstr> m_alphabet{};            // Every instruction the search may use.
+    std::vector<SuperInstr> m_sequence{};            // The sequence currently being built.
+    std::optional<std::vector<SuperInstr>> m_best{}; // The cheapest correct sequence found so far.
+    size_t m_best_cost = 0;                          // Cost of the cheapest sequence.
+};
+
+/// @brief Table of superoptimized sequences, keyed by `SuperTarget::key()`.
+///
+/// The table is stored as a text file with one `key<TAB>sequence` entry per line, so searches done once can be
+/// reused by every later compile. An empty sequence records that the search found nothing. A sequence is a list of
+/// instructions of six numbers each: the operation, the three registers, the scale and the immediate.
+class SuperoptTable
+{
+public:
+    /**
+     * @brief Loads the entries of a table file, a missing file is an empty table.
+     *
+     * The file may be corrupt or written by a version that searched differently, so every sequence is proven again
+     * before it is used. Lines that are malformed, out of range or not proven are ignored with a warning.
+     *
+     * @param path Path of the table file.
+     */
+    void load(const std::string &path)
+    {
+        std::ifstream file(path);
+        std::string line;
+        for (size_t line_number = 1; std::getline(file, line); line_number++)
+        {
+            const size_t tab = line.find('\t');
+            const std::string key = line.substr(0, tab);
+            const std::optional<SuperTarget> target = tab == std::string::npos ? std::nullopt : SuperTarget::from_key(key);
+            std::vector<SuperInstr> sequence;
+            const char *error = target.has_value() ? parse_sequence(line.substr(tab + 1), sequence) : "no valid key";
+            if (error == nullptr && !sequence.empty() && !Superoptimizer::proves(target.value(), sequence))
+            {
+                error = "a sequence that does not compute its key";
+            }
+            if (error != nullptr)
+            {
+                std::cerr << "[Superopt Warning] Ignoring line " << line_number << " of " << path << ", it has " << error
+                          << std::endl;
+                continue;
+            }
+            m_entries[key] = std::move(sequence);
+        }
+    }
+
+    /**
+     * @brief Saves every entry to a table file.
+     *
+     * @param path Path of the table file.
+     */
+    void save(const std::string &path) const
+    {
+        std::ofstream file(path);
+        for (const auto &[key, sequence] : m_entries)
+        {
+            file << key << '\t';
+            for (const SuperInstr &instr : sequence)
+            {
+                file << static_cast<unsigned>(instr.op) << ' ' << static_cast<unsigned>(instr.dst) << ' '
+                     << static_cast<unsigned>(instr.src) << ' ' << static_cast<unsigned>(instr.idx) << ' '
+                     << static_cast<unsigned>(instr.scale) << ' ' << instr.imm << ' ';
+            }
+            file << '\n';
+        }
+    }
+
+    /// @brief Finds the entry for a key.
+    /// @param key Key of the target expression.
+    /// @return Pointer to the sequence, or nullptr if the target was never searched.
+    const std::vector<SuperInstr> *find(const std::string &key) const
+    {
+        const auto it = m_entries.find(key);
+        return it == m_entries.end() ? nullptr : &it->second;
+    }
+
+    /// @brief Adds or replaces an entry.
+    /// @param key Key of the target expression.
+    /// @param sequence The sequence, empty if none was found.
+    void insert(const std::string &key, std::vector<SuperInstr> sequence)
+    {
+        m_entries[key] = std::move(sequence);
+    }
+
+private:
+    static constexpr size_t instr_fields = 6; // Numbers of an instruction in a table file.
+
+    /**
+     * @brief Parses the sequence of an entry of a table file.
+     *
+     * @param text The sequence.
+     * @param sequence Receives the instructions.
+     * @return What is wrong with the sequence, or nullptr if it parsed.
+     */
+    static const char *parse_sequence(const std::string &text, std::vector<SuperInstr> &sequence)
+    {
+        std::stringstream fields(text);
+        std::vector<int64_t> values;
+        int64_t value = 0;
+        while (fields >> value)
+        {
+            values.push_back(value);
+        }
+        if (!fields.eof() || values.size() % instr_fields != 0)
+        {
+            return "a partial or malformed instruction";
+        }
+        for (size_t i = 0; i < values.size(); i += instr_fields)
+        {
+            const auto [op, dst, src, idx, scale, imm] =
+                std::array{values[i], values[i + 1], values[i + 2], values[i + 3], values[i + 4], values[i + 5]};
+            if (op < 0 || op >= static_cast<int64_t>(super_op_count))
+            {
+                return "an operation out of range";
+            }
+            const auto in_range = [](const int64_t reg) { return reg >= 0 && reg < static_cast<int64_t>(super_regs.size()); };
+            if (!in_range(dst) || !in_range(src) || !in_range(idx))
+            {
+                return "a register out of range";
+            }
+            const SuperOp super_op = static_cast<SuperOp>(op);
+            const bool lea = super_op == SuperOp::lea;
+            if (lea ? scale != 1 && scale != 2 && scale != 4 && scale != 8 : scale != 0)
+            {
+                return "a scale out of range";
+            }
+            // Shift counts are taken modulo 64 and immediates are encoded as sign-extended 32-bit values.
+            const bool imm_fits = super_op == SuperOp::shl ? imm >= 1 && imm <= 63
+                                  : super_op == SuperOp::imul_imm || super_op == SuperOp::add_imm || super_op == SuperOp::sub_imm
+                                      ? imm >= INT32_MIN && imm <= INT32_MAX
+                                      : imm == 0;
+            if (!imm_fits)
+            {
+                return "an immediate out of range";
+            }
+            sequence.push_back({
+                .op = super_op,
+                .dst = static_cast<uint8_t>(dst),
+                .src = static_cast<uint8_t>(src),
+                .idx = static_cast<uint8_t>(idx),
+                .scale = static_cast<uint8_t>(scale),
+                .imm = imm,
+            });
+        }
+        return nullptr;
+    }
+
+    std::map<std::string, std::vector<SuperInstr>> m_entries{}; // Sequences by target key.
+};
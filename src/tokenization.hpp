@@ -2,31 +2,50 @@
 
 #include <iostream>
 #include <optional>
+#include <string>
 #include <vector>
 #include <cassert>
 
 /// @brief Enumeration of token types that the tokenizer can recognize.
 enum class TokenType
 {
-    exit,        // Represents the 'exit' keyword.
-    int_lit,     // Represents an integer literal.
-    if_,         // Represents the 'if' keyword.
-    else_,       // Represents the 'else' keyword.
-    elif_,       // Represents the 'else if' keyword.
-    semi,        // Represents a semicolon.
-    open_paren,  // Represents an opening parenthesis.
-    close_paren, // Represents a closing parenthesis.
-    ident,       // Represents an identifier.
-    let,         // Represents the 'let' keyword.
-    eq,          // Represents the equals sign.
-    plus,        // Represents the plus sign.
-    star,        // Represents the star sign.
-    minus,       // Represents the subtraction sign.
-    fslash,      // Represents the forward slash sign.
-    open_curly,  // Represents open curly braces.
-    close_curly  // Represents closed curly braces.
+    exit,          // Represents the 'exit' keyword.
+    int_lit,       // Represents an integer literal.
+    if_,           // Represents the 'if' keyword.
+    else_,         // Represents the 'else' keyword.
+    elif_,         // Represents the 'else if' keyword.
+    semi,          // Represents a semicolon.
+    open_paren,    // Represents an opening parenthesis.
+    close_paren,   // Represents a closing parenthesis.
+    ident,         // Represents an identifier.
+    let,           // Represents the 'let' keyword.
+    eq,            // Represents the equals sign.
+    plus,          // Represents the plus sign.
+    star,          // Represents the star sign.
+    minus,         // Represents the subtraction sign.
+    fslash,        // Represents the forward slash sign.
+    open_curly,    // Represents open curly braces.
+    close_curly,   // Represents closed curly braces.
+    print,         // Represents the 'print' keyword.
+    arg,           // Represents the 'arg' keyword.
+    read,          // Represents the 'read' keyword.
+    open_bracket,  // Represents an opening square bracket.
+    close_bracket, // Represents a closing square bracket.
+    alloc,         // Represents the 'alloc' keyword.
+    reset,         // Represents the 'reset' keyword.
+    comma,         // Represents a comma.
+    map,           // Represents the 'map' keyword.
+    size,          // Represents the 'size' keyword.
+    byte,          // Represents the 'byte' keyword.
+    word,          // Represents the 'word' keyword.
+    parallel,      // Represents the 'parallel' keyword.
+    for_,          // Represents the 'for' keyword.
+    sum            // Represents the 'sum' keyword.
 };
 
+/// @brief Number of token types, for tables indexed by token type.
+constexpr size_t token_type_count = static_cast<size_t>(TokenType::sum) + 1;
+
 /// @brief Token types to string,
 /// @param type
 /// @return
@@ -68,27 +87,39 @@ std::string to_string(const TokenType type)
         return "`elif`";
     case TokenType::else_:
         return "`else`";
+    case TokenType::print:
+        return "`print`";
+    case TokenType::arg:
+        return "`arg`";
+    case TokenType::read:
+        return "`read`";
+    case TokenType::open_bracket:
+        return "`[`";
+    case TokenType::close_bracket:
+        return "`]`";
+    case TokenType::alloc:
+        return "`alloc`";
+    case TokenType::reset:
+        return "`reset`";
+    case TokenType::comma:
+        return "`,`";
+    case TokenType::map:
+        return "`map`";
+    case TokenType::size:
+        return "`size`";
+    case TokenType::byte:
+        return "`byte`";
+    case TokenType::word:
+        return "`word`";
+    case TokenType::parallel:
+        return "`parallel`";
+    case TokenType::for_:
+        return "`for`";
+    case TokenType::sum:
+        return "`sum`";
     }
     assert(false);
-}
-
-/// @brief Checks weather the given TokenType is a Binary Operator or not.
-/// @param type The expected token type.
-/// @return Precedence of the token.
-std::optional<int> checkAndGetBinaryPrecedence(const TokenType type)
-{
-    switch (type)
-    {
-    case TokenType::plus:
-    case TokenType::minus:
-        return 0;
-    case TokenType::star:
-    case TokenType::fslash:
-        return 1;
-
-    default:
-        return {};
-    }
+    __builtin_unreachable();
 }
 
 /// @brief Structure to represent a token.
@@ -99,6 +130,28 @@ struct Token
     std::optional<std::string> value; // The value of the token, if applicable.
 };
 
+/// @brief A syntax error, thrown by a tokenizer or parser asked to leave the reporting to its caller.
+struct SyntaxError
+{
+    std::string message; // The error message.
+};
+
+/**
+ * @brief Reports a syntax error, by exiting or by throwing it to a caller that reports it and goes on.
+ *
+ * @param message The error message.
+ * @param throw_error Whether to throw a SyntaxError rather than exit.
+ */
+[[noreturn]] inline void syntax_error(const std::string &message, const bool throw_error)
+{
+    if (throw_error)
+    {
+        throw SyntaxError{.message = message};
+    }
+    std::cerr << message << std::endl;
+    exit(EXIT_FAILURE);
+}
+
 /// @brief Class to convert source code into a list of tokens.
 class Tokenizer
 {
@@ -113,6 +166,25 @@ public:
     {
     }
 
+    /**
+     * @brief Constructs the tokenizer reading the source code from a stream as it goes.
+     *
+     * Only a window of the source code is kept in memory, the characters already tokenized are dropped whenever more
+     * are read.
+     *
+     * @param input The stream to read the source code from, which must outlive the tokenizer.
+     */
+    explicit Tokenizer(std::istream &input)
+        : m_input(&input)
+    {
+    }
+
+    /// @brief Makes syntax errors throw a SyntaxError rather than exit, for callers that report them and go on.
+    void throw_errors()
+    {
+        m_throw_errors = true;
+    }
+
     /**
      * @brief Tokenizes the source code into a list of tokens.
      *
@@ -121,8 +193,84 @@ public:
     std::vector<Token> tokenize()
     {
         std::vector<Token> tokens;
+        tokenize([&](Token &&token)
+                 { tokens.push_back(std::move(token)); });
+        return tokens;
+    }
+
+    /**
+     * @brief Tokenizes the source code, handing every token to a sink as soon as it is complete.
+     *
+     * @tparam Sink Callable taking a `Token &&`.
+     * @param sink Receives the tokens in order.
+     */
+    template <typename Sink>
+    void tokenize(Sink &&sink)
+    {
+        while (std::optional<Token> token = next())
+        {
+            sink(std::move(token.value()));
+        }
+        m_index = 0;
+        m_line = 1;
+        m_header_depth.reset();
+        m_header_ended = false;
+    }
+
+    /**
+     * @brief Tokenizes the next token of the source code.
+     *
+     * `sum` is only a keyword right after the header of a 'parallel for', elsewhere it is an identifier.
+     *
+     * @return The token, or an empty optional at the end of the source code.
+     */
+    std::optional<Token> next()
+    {
+        std::optional<Token> token = scan();
+        if (!token.has_value())
+        {
+            return token;
+        }
+        if (m_header_ended && token->type == TokenType::ident && token->value == "sum")
+        {
+            token->type = TokenType::sum;
+            token->value.reset();
+        }
+        m_header_ended = false;
+
+        // The header is in the parentheses after `for`, which may nest.
+        if (token->type == TokenType::for_)
+        {
+            m_header_depth = 0;
+        }
+        else if (m_header_depth.has_value() && token->type == TokenType::open_paren)
+        {
+            m_header_depth.value()++;
+        }
+        else if (m_header_depth.has_value() && token->type == TokenType::close_paren)
+        {
+            if (m_header_depth.value() > 1)
+            {
+                m_header_depth.value()--;
+            }
+            else
+            {
+                m_header_ended = m_header_depth.value() == 1;
+                m_header_depth.reset();
+            }
+        }
+        return token;
+    }
+
+private:
+    /**
+     * @brief Tokenizes the next token of the source code, taking `sum` for an identifier.
+     *
+     * @return The token, or an empty optional at the end of the source code.
+     */
+    std::optional<Token> scan()
+    {
         std::string buff;
-        size_t line_count = 1;
         while (peek().has_value())
         {
             // Check if the current character is alphabetic
@@ -135,37 +283,75 @@ public:
                 }
                 if (buff == "exit")
                 {
-                    tokens.push_back({.type = TokenType::exit, .line = line_count});
-                    buff.clear();
+                    return Token{.type = TokenType::exit, .line = m_line};
                 }
                 else if (buff == "let")
                 {
-                    tokens.push_back({.type = TokenType::let, .line = line_count});
-                    buff.clear();
+                    return Token{.type = TokenType::let, .line = m_line};
                 }
                 else if (buff == "if")
                 {
-                    tokens.push_back({.type = TokenType::if_, .line = line_count});
-                    buff.clear();
+                    return Token{.type = TokenType::if_, .line = m_line};
                 }
                 else if (buff == "else")
                 {
-                    tokens.push_back({.type = TokenType::else_, .line = line_count});
-                    buff.clear();
+                    return Token{.type = TokenType::else_, .line = m_line};
                 }
                 else if (buff == "elif")
                 {
-                    tokens.push_back({.type = TokenType::elif_, .line = line_count});
-                    buff.clear();
+                    return Token{.type = TokenType::elif_, .line = m_line};
+                }
+                else if (buff == "print" && call_follows())
+                {
+                    return Token{.type = TokenType::print, .line = m_line};
+                }
+                else if (buff == "arg" && call_follows())
+                {
+                    return Token{.type = TokenType::arg, .line = m_line};
+                }
+                else if (buff == "read" && call_follows())
+                {
+                    return Token{.type = TokenType::read, .line = m_line};
+                }
+                else if (buff == "alloc" && call_follows())
+                {
+                    return Token{.type = TokenType::alloc, .line = m_line};
+                }
+                else if (buff == "reset" && call_follows())
+                {
+                    return Token{.type = TokenType::reset, .line = m_line};
+                }
+                else if (buff == "map" && call_follows())
+                {
+                    return Token{.type = TokenType::map, .line = m_line};
+                }
+                else if (buff == "size" && call_follows())
+                {
+                    return Token{.type = TokenType::size, .line = m_line};
+                }
+                else if (buff == "byte" && call_follows())
+                {
+                    return Token{.type = TokenType::byte, .line = m_line};
+                }
+                else if (buff == "word" && call_follows())
+                {
+                    return Token{.type = TokenType::word, .line = m_line};
+                }
+                else if (buff == "parallel")
+                {
+                    return Token{.type = TokenType::parallel, .line = m_line};
+                }
+                else if (buff == "for")
+                {
+                    return Token{.type = TokenType::for_, .line = m_line};
                 }
                 else
                 {
-                    tokens.push_back({
+                    return Token{
                         .type = TokenType::ident,
-                        .line = line_count,
+                        .line = m_line,
                         .value = buff,
-                    });
-                    buff.clear();
+                    };
                 }
             }
             // Check if the current character is a digit
@@ -176,19 +362,18 @@ public:
                 {
                     buff.push_back(consume());
                 }
-                tokens.push_back({.type = TokenType::int_lit, .line = line_count, .value = buff});
-                buff.clear();
+                return Token{.type = TokenType::int_lit, .line = m_line, .value = buff};
             }
             // Check comments
             else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/')
             {
                 consume();
                 consume();
+                // The newline ending the comment is left to count the line.
                 while (peek().has_value() && peek().value() != '\n')
                 {
                     consume();
                 }
-                line_count++;
             }
             else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '*')
             {
@@ -202,7 +387,7 @@ public:
                     }
                     if (peek().value() == '\n')
                     {
-                        line_count++;
+                        m_line++;
                     }
                     consume();
                 }
@@ -215,58 +400,73 @@ public:
             else if (peek().value() == '(')
             {
                 consume();
-                tokens.push_back({.type = TokenType::open_paren, .line = line_count});
+                return Token{.type = TokenType::open_paren, .line = m_line};
             }
             else if (peek().value() == ')')
             {
                 consume();
-                tokens.push_back({.type = TokenType::close_paren, .line = line_count});
+                return Token{.type = TokenType::close_paren, .line = m_line};
             }
             else if (peek().value() == ';')
             {
                 consume();
-                tokens.push_back({.type = TokenType::semi, .line = line_count});
+                return Token{.type = TokenType::semi, .line = m_line};
             }
             else if (peek().value() == '=')
             {
                 consume();
-                tokens.push_back({.type = TokenType::eq, .line = line_count});
+                return Token{.type = TokenType::eq, .line = m_line};
             }
             else if (peek().value() == '+')
             {
                 consume();
-                tokens.push_back({.type = TokenType::plus, .line = line_count});
+                return Token{.type = TokenType::plus, .line = m_line};
             }
             else if (peek().value() == '*')
             {
                 consume();
-                tokens.push_back({.type = TokenType::star, .line = line_count});
+                return Token{.type = TokenType::star, .line = m_line};
             }
             else if (peek().value() == '-')
             {
                 consume();
-                tokens.push_back({.type = TokenType::minus, .line = line_count});
+                return Token{.type = TokenType::minus, .line = m_line};
             }
             else if (peek().value() == '/')
             {
                 consume();
-                tokens.push_back({.type = TokenType::fslash, .line = line_count});
+                return Token{.type = TokenType::fslash, .line = m_line};
             }
             else if (peek().value() == '{')
             {
                 consume();
-                tokens.push_back({.type = TokenType::open_curly, .line = line_count});
+                return Token{.type = TokenType::open_curly, .line = m_line};
             }
             else if (peek().value() == '}')
             {
                 consume();
-                tokens.push_back({.type = TokenType::close_curly, .line = line_count});
+                return Token{.type = TokenType::close_curly, .line = m_line};
+            }
+            else if (peek().value() == '[')
+            {
+                consume();
+                return Token{.type = TokenType::open_bracket, .line = m_line};
+            }
+            else if (peek().value() == ']')
+            {
+                consume();
+                return Token{.type = TokenType::close_bracket, .line = m_line};
+            }
+            else if (peek().value() == ',')
+            {
+                consume();
+                return Token{.type = TokenType::comma, .line = m_line};
             }
             // Line Count
             else if (peek().value() == '\n')
             {
                 consume();
-                line_count++;
+                m_line++;
             }
             // Skip whitespace characters
             else if (std::isspace(peek().value()))
@@ -276,30 +476,71 @@ public:
             // Handle invalid tokens
             else
             {
-                std::cerr << "Invalid token encountered!" << std::endl;
-                exit(EXIT_FAILURE);
+                syntax_error("Invalid token encountered!", m_throw_errors);
             }
         }
-        m_index = 0;
-        return tokens;
+        return {};
+    }
+
+    /**
+     * @brief Checks whether the name just read is called. The names of the builtins are only keywords when called, so
+     * programs can still use them for variables.
+     *
+     * @return Whether the next character other than whitespace is `(`.
+     */
+    bool call_follows()
+    {
+        size_t offset = 0;
+        while (peek(offset).has_value() && std::isspace(peek(offset).value()))
+        {
+            offset++;
+        }
+        return peek(offset) == '(';
     }
 
-private:
     /**
      * @brief Peeks at the current position in the source code.
      *
      * @param offset The offset from the current position to peek at.
      * @return The character at the current position plus the offset, if valid; otherwise, an empty optional.
      */
-    std::optional<char> peek(const size_t offset = 0) const
+    std::optional<char> peek(const size_t offset = 0)
     {
-        if (m_index + offset >= m_src.length())
+        while (m_index + offset >= m_src.length())
         {
-            return {};
+            if (!refill())
+            {
+                return {};
+            }
         }
         return m_src.at(m_index + offset);
     }
 
+    /**
+     * @brief Reads more of the source code from the input stream, dropping the characters already consumed.
+     *
+     * @return Whether more characters were read.
+     */
+    bool refill()
+    {
+        if (m_input == nullptr)
+        {
+            return false;
+        }
+        m_src.erase(0, m_index);
+        m_index = 0;
+        const size_t size = m_src.size();
+        m_src.resize(size + read_size);
+        m_input->read(m_src.data() + size, read_size);
+        m_src.resize(size + static_cast<size_t>(m_input->gcount()));
+        if (m_src.size() == size)
+        {
+            m_input = nullptr;
+            return false;
+        }
+        return true;
+    }
+
     /**
      * @brief Consumes the current character in the source code and increments the index.
      *
@@ -307,6 +548,13 @@ private:
      */
     char consume() { return m_src[m_index++]; }
 
-    const std::string m_src; // The source code to tokenize.
-    size_t m_index = 0;      // The current index in the source code.
+    static constexpr size_t read_size = 64 * 1024; // Characters read from the input stream at once.
+
+    std::string m_src;                      // The source code to tokenize, or the window of it read so far.
+    std::istream *m_input = nullptr;        // Stream to read more source code from, or nullptr if there is none left.
+    size_t m_index = 0;                     // The current index in the source code.
+    size_t m_line = 1;                      // The current line in the source code.
+    bool m_throw_errors = false;            // Whether syntax errors are thrown rather than exit.
+    std::optional<size_t> m_header_depth{}; // Parentheses open in the header of a 'parallel for', if in one.
+    bool m_header_ended = false;            // Whether the last token ended the header of a 'parallel for'.
 };
\ No newline at end of file
@@ -0,0 +1,608 @@
+#pragma once
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "parser.hpp"
+
+/// @brief Walks the parse tree in source order, calling the hooks `Derived` defines for every node.
+///
+/// `Derived` inherits from `AstVisitor<Derived>` and shadows the hooks it needs; the others default to doing nothing.
+/// Hooks are looked up statically, so they are inlined into the traversal rather than dispatched at run time. Every
+/// node gets an `enter_*` hook before its children and a `leave_*` hook after them; an `enter_*` hook returning false
+/// skips the children, but the node is still left. Statements and expressions also get the `enter_stmt`/`enter_expr`
+/// hooks around the hooks of their kind. Like the other passes, the traversal keeps an explicit stack of nodes
+/// rather than recursing, so deeply nested programs do not overflow the call stack.
+///
+/// Hooks `Derived` keeps private are reached by declaring `friend class AstVisitor<Derived>`.
+template <typename Derived>
+class AstVisitor
+{
+public:
+    /// @brief Visits every statement of a program.
+    void traverse_program(NodeProg &prog)
+    {
+        for (NodeStmt *&stmt : prog.stmts)
+        {
+            traverse(StmtFrame{.slot = &stmt});
+        }
+    }
+
+    /**
+     * @brief Visits a statement and everything in it.
+     *
+     * @param stmt The statement.
+     * @return The statement, or the node a rewriter replaced it with.
+     */
+    NodeStmt *traverse_statement(NodeStmt *stmt)
+    {
+        traverse(StmtFrame{.slot = &stmt});
+        return stmt;
+    }
+
+    /**
+     * @brief Visits an expression and everything in it.
+     *
+     * @param expr The expression.
+     * @return The expression, or the node a rewriter replaced it with.
+     */
+    NodeExpr *traverse_expression(NodeExpr *expr)
+    {
+        traverse(ExprFrame{.slot = &expr});
+        return expr;
+    }
+
+protected:
+    static constexpr bool rewrites = false; // Whether the post-order hooks may replace the nodes, see AstRewriter.
+
+    // Statements ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+    bool enter_stmt(NodeStmt *) { return true; }
+    void leave_stmt(NodeStmt *) {}
+    bool enter_exit(NodeStmtExit *) { return true; }
+    void leave_exit(NodeStmtExit *) {}
+    bool enter_print(NodeStmtPrint *) { return true; }
+    void leave_print(NodeStmtPrint *) {}
+    bool enter_let(NodeStmtLet *) { return true; }
+    void leave_let(NodeStmtLet *) {}
+    bool enter_assign(NodeStmtAssign *) { return true; }
+    void leave_assign(NodeStmtAssign *) {}
+    bool enter_store(NodeStmtStore *) { return true; }
+    void leave_store(NodeStmtStore *) {}
+    bool enter_reset(NodeStmtReset *) { return true; }
+    void leave_reset(NodeStmtReset *) {}
+    bool enter_if(NodeStmtIf *) { return true; }
+    void leave_if(NodeStmtIf *) {}
+    bool enter_if_arm(NodeIfArm *) { return true; }
+    void leave_if_arm(NodeIfArm *) {}
+    bool enter_parallel(NodeStmtParallel *) { return true; }
+    void leave_parallel(NodeStmtParallel *) {}
+
+    /// @brief The body of a 'parallel for', once its bounds and its sum variable are visited.
+    bool enter_parallel_body(NodeStmtParallel *) { return true; }
+
+    /// @brief Scope statements, and the scopes of 'if' statements.
+    bool enter_scope(NodeScope *) { return true; }
+    void leave_scope(NodeScope *) {}
+
+    // Expressions ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+    bool enter_expr(NodeExpr *) { return true; }
+    void leave_expr(NodeExpr *) {}
+    bool enter_bin_expr(NodeBinExpr *) { return true; }
+    void leave_bin_expr(NodeBinExpr *) {}
+    bool enter_paren(NodeTermParen *) { return true; }
+    void leave_paren(NodeTermParen *) {}
+    bool enter_arg(NodeTermArg *) { return true; }
+    void leave_arg(NodeTermArg *) {}
+    bool enter_alloc(NodeTermAlloc *) { return true; }
+    void leave_alloc(NodeTermAlloc *) {}
+    bool enter_index(NodeTermIndex *) { return true; }
+    void leave_index(NodeTermIndex *) {}
+    bool enter_map(NodeTermMap *) { return true; }
+    void leave_map(NodeTermMap *) {}
+    bool enter_size(NodeTermSize *) { return true; }
+    void leave_size(NodeTermSize *) {}
+    bool enter_load(NodeTermLoad *) { return true; }
+    void leave_load(NodeTermLoad *) {}
+    void visit_read(NodeTermRead *) {}
+    void visit_int_lit(NodeTermIntLit *) {}
+
+    /// @brief Uses of variables, including the arrays of element reads and assignments, which are visited after
+    /// `enter_index`/`enter_store` and before the index, and the sum variable of a 'parallel for'.
+    void visit_ident(NodeTermIdent *) {}
+
+private:
+    // Frames point at the parent's pointer to the node, so a rewriter can replace it once the node is left.
+
+    /// @brief Visit a statement.
+    struct StmtFrame
+    {
+        NodeStmt **slot;
+    };
+
+    /// @brief Leave a statement once its children are visited.
+    struct StmtEndFrame
+    {
+        NodeStmt **slot;
+    };
+
+    /// @brief Visit an expression.
+    struct ExprFrame
+    {
+        NodeExpr **slot;
+    };
+
+    /// @brief Leave an expression once its children are visited.
+    struct ExprEndFrame
+    {
+        NodeExpr **slot;
+    };
+
+    /// @brief Visit a scope.
+    struct ScopeFrame
+    {
+        NodeScope *scope;
+    };
+
+    /// @brief Leave a scope once its statements are visited.
+    struct ScopeEndFrame
+    {
+        NodeScope *scope;
+    };
+
+    /// @brief Visit an arm of an 'if' statement.
+    struct IfArmFrame
+    {
+        NodeIfArm *arm;
+    };
+
+    /// @brief Leave an arm of an 'if' statement once its condition and scope are visited.
+    struct IfArmEndFrame
+    {
+        NodeIfArm *arm;
+    };
+
+    /// @brief Visit the sum variable and the body of a 'parallel for' once its bounds are visited.
+    struct ParallelBodyFrame
+    {
+        NodeStmtParallel *stmt;
+    };
+
+    using Frame = std::variant<StmtFrame, StmtEndFrame, ExprFrame, ExprEndFrame, ScopeFrame, ScopeEndFrame, IfArmFrame, IfArmEndFrame, ParallelBodyFrame>;
+
+    Derived &derived()
+    {
+        return static_cast<Derived &>(*this);
+    }
+
+    /// @brief Whether a hook of `Derived` shadows the default one, which is a member of a different class.
+    template <typename Hook, typename DefaultHook>
+    static constexpr bool shadows(Hook, DefaultHook)
+    {
+        return !std::is_same_v<Hook, DefaultHook>;
+    }
+
+    /// @brief Whether the nodes of a kind are left, which is only done if a hook is called then. Most passes only
+    /// need a few of the hooks, so most nodes are never revisited.
+    template <typename Node>
+    static constexpr bool leaves()
+    {
+        constexpr bool stmt = Derived::rewrites || shadows(&Derived::leave_stmt, &AstVisitor::leave_stmt);
+        constexpr bool expr = Derived::rewrites || shadows(&Derived::leave_expr, &AstVisitor::leave_expr);
+        if constexpr (std::is_same_v<Node, NodeStmtExit>)
+        {
+            return stmt || shadows(&Derived::leave_exit, &AstVisitor::leave_exit);
+        }
+        else if constexpr (std::is_same_v<Node, NodeStmtPrint>)
+        {
+            return stmt || shadows(&Derived::leave_print, &AstVisitor::leave_print);
+        }
+        else if constexpr (std::is_same_v<Node, NodeStmtLet>)
+        {
+            return stmt || shadows(&Derived::leave_let, &AstVisitor::leave_let);
+        }
+        else if constexpr (std::is_same_v<Node, NodeStmtAssign>)
+        {
+            return stmt || shadows(&Derived::leave_assign, &AstVisitor::leave_assign);
+        }
+        else if constexpr (std::is_same_v<Node, NodeStmtStore>)
+        {
+            return stmt || shadows(&Derived::leave_store, &AstVisitor::leave_store);
+        }
+        else if constexpr (std::is_same_v<Node, NodeStmtReset>)
+        {
+            return stmt || shadows(&Derived::leave_reset, &AstVisitor::leave_reset);
+        }
+        else if constexpr (std::is_same_v<Node, NodeStmtIf>)
+        {
+            return stmt || shadows(&Derived::leave_if, &AstVisitor::leave_if);
+        }
+        else if constexpr (std::is_same_v<Node, NodeStmtParallel>)
+        {
+            return stmt || shadows(&Derived::leave_parallel, &AstVisitor::leave_parallel);
+        }
+        else if constexpr (std::is_same_v<Node, NodeScope>)
+        {
+            return stmt;
+        }
+        else if constexpr (std::is_same_v<Node, NodeTerm>)
+        {
+            return expr || shadows(&Derived::leave_paren, &AstVisitor::leave_paren) ||
+                   shadows(&Derived::leave_arg, &AstVisitor::leave_arg) ||
+                   shadows(&Derived::leave_alloc, &AstVisitor::leave_alloc) ||
+                   shadows(&Derived::leave_index, &AstVisitor::leave_index) ||
+                   shadows(&Derived::leave_map, &AstVisitor::leave_map) ||
+                   shadows(&Derived::leave_size, &AstVisitor::leave_size) ||
+                   shadows(&Derived::leave_load, &AstVisitor::leave_load);
+        }
+        else
+        {
+            static_assert(std::is_same_v<Node, NodeBinExpr>);
+            return expr || shadows(&Derived::leave_bin_expr, &AstVisitor::leave_bin_expr);
+        }
+    }
+
+    /// @brief Visits the node of a frame and everything in it.
+    void traverse(const Frame &root)
+    {
+        // Traversals may be started from a hook, so the frames below the root are not ours to visit.
+        const size_t base = m_frames.size();
+        m_frames.push_back(root);
+        while (m_frames.size() != base)
+        {
+            const Frame frame = m_frames.back();
+            m_frames.pop_back();
+            std::visit([this](const auto &f) { step(f); }, frame);
+        }
+    }
+
+    void step(const StmtFrame &frame)
+    {
+        std::visit([this, &frame](auto *node) { step_stmt(frame.slot, node); }, (*frame.slot)->var);
+    }
+
+    template <typename Node>
+    void step_stmt(NodeStmt **slot, Node *node)
+    {
+        if constexpr (leaves<Node>())
+        {
+            m_frames.emplace_back(StmtEndFrame{.slot = slot});
+        }
+        if (derived().enter_stmt(*slot))
+        {
+            enter(node);
+        }
+    }
+
+    void step(const StmtEndFrame &frame)
+    {
+        NodeStmt *stmt = *frame.slot;
+        std::visit([this](auto *node) { leave(node); }, stmt->var);
+        derived().leave_stmt(stmt);
+        if constexpr (Derived::rewrites)
+        {
+            *frame.slot = derived().rewrite_stmt(stmt);
+        }
+    }
+
+    void step(const ExprFrame &frame)
+    {
+        std::visit([this, &frame](auto *node) { step_expr(frame.slot, node); }, (*frame.slot)->var);
+    }
+
+    template <typename Node>
+    void step_expr(NodeExpr **slot, Node *node)
+    {
+        if constexpr (leaves<Node>())
+        {
+            m_frames.emplace_back(ExprEndFrame{.slot = slot});
+        }
+        if (derived().enter_expr(*slot))
+        {
+            enter(node);
+        }
+    }
+
+    void step(const ExprEndFrame &frame)
+    {
+        NodeExpr *expr = *frame.slot;
+        std::visit([this](auto *node) { leave(node); }, expr->var);
+        derived().leave_expr(expr);
+        if constexpr (Derived::rewrites)
+        {
+            *frame.slot = derived().rewrite_expr(expr);
+        }
+    }
+
+    void step(const ScopeFrame &frame)
+    {
+        if constexpr (shadows(&Derived::leave_scope, &AstVisitor::leave_scope))
+        {
+            m_frames.emplace_back(ScopeEndFrame{.scope = frame.scope});
+        }
+        if (derived().enter_scope(frame.scope))
+        {
+            for (auto it = frame.scope->stmts.rbegin(); it != frame.scope->stmts.rend(); ++it)
+            {
+                m_frames.emplace_back(StmtFrame{.slot = &*it});
+            }
+        }
+    }
+
+    void step(const ScopeEndFrame &frame)
+    {
+        derived().leave_scope(frame.scope);
+    }
+
+    void step(const IfArmFrame &frame)
+    {
+        if constexpr (shadows(&Derived::leave_if_arm, &AstVisitor::leave_if_arm))
+        {
+            m_frames.emplace_back(IfArmEndFrame{.arm = frame.arm});
+        }
+        if (derived().enter_if_arm(frame.arm))
+        {
+            m_frames.emplace_back(ScopeFrame{.scope = frame.arm->scope});
+            m_frames.emplace_back(ExprFrame{.slot = &frame.arm->expr});
+        }
+    }
+
+    void step(const IfArmEndFrame &frame)
+    {
+        derived().leave_if_arm(frame.arm);
+    }
+
+    void step(const ParallelBodyFrame &frame)
+    {
+        if (frame.stmt->sum.has_value())
+        {
+            derived().visit_ident(&frame.stmt->sum.value());
+        }
+        if (derived().enter_parallel_body(frame.stmt))
+        {
+            m_frames.emplace_back(ScopeFrame{.scope = frame.stmt->scope});
+        }
+    }
+
+    // Statements ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+    void enter(NodeStmtExit *stmt_exit)
+    {
+        if (derived().enter_exit(stmt_exit))
+        {
+            m_frames.emplace_back(ExprFrame{.slot = &stmt_exit->expr});
+        }
+    }
+
+    void enter(NodeStmtPrint *stmt_print)
+    {
+        if (derived().enter_print(stmt_print))
+        {
+            m_frames.emplace_back(ExprFrame{.slot = &stmt_print->expr});
+        }
+    }
+
+    void enter(NodeStmtLet *stmt_let)
+    {
+        if (derived().enter_let(stmt_let))
+        {
+            m_frames.emplace_back(ExprFrame{.slot = &stmt_let->expr});
+        }
+    }
+
+    void enter(NodeStmtAssign *stmt_assign)
+    {
+        if (derived().enter_assign(stmt_assign))
+        {
+            m_frames.emplace_back(ExprFrame{.slot = &stmt_assign->expr});
+        }
+    }
+
+    void enter(NodeStmtStore *stmt_store)
+    {
+        if (derived().enter_store(stmt_store))
+        {
+            derived().visit_ident(&stmt_store->array);
+            m_frames.emplace_back(ExprFrame{.slot = &stmt_store->expr});
+            m_frames.emplace_back(ExprFrame{.slot = &stmt_store->index});
+        }
+    }
+
+    void enter(NodeStmtReset *stmt_reset)
+    {
+        if (derived().enter_reset(stmt_reset))
+        {
+            m_frames.emplace_back(ExprFrame{.slot = &stmt_reset->expr});
+        }
+    }
+
+    void enter(NodeScope *stmt_scope)
+    {
+        step(ScopeFrame{.scope = stmt_scope});
+    }
+
+    void enter(NodeStmtIf *stmt_if)
+    {
+        if (!derived().enter_if(stmt_if))
+        {
+            return;
+        }
+        if (stmt_if->else_scope.has_value())
+        {
+            m_frames.emplace_back(ScopeFrame{.scope = stmt_if->else_scope.value()});
+        }
+        for (auto it = stmt_if->arms.rbegin(); it != stmt_if->arms.rend(); ++it)
+        {
+            if constexpr (shadows(&Derived::enter_if_arm, &AstVisitor::enter_if_arm) ||
+                          shadows(&Derived::leave_if_arm, &AstVisitor::leave_if_arm))
+            {
+                m_frames.emplace_back(IfArmFrame{.arm = &*it});
+            }
+            else
+            {
+                m_frames.emplace_back(ScopeFrame{.scope = it->scope});
+                m_frames.emplace_back(ExprFrame{.slot = &it->expr});
+            }
+        }
+    }
+
+    void enter(NodeStmtParallel *stmt_parallel)
+    {
+        if (!derived().enter_parallel(stmt_parallel))
+        {
+            return;
+        }
+        m_frames.emplace_back(ParallelBodyFrame{.stmt = stmt_parallel});
+        if (stmt_parallel->chunk != nullptr)
+        {
+            m_frames.emplace_back(ExprFrame{.slot = &stmt_parallel->chunk});
+        }
+        m_frames.emplace_back(ExprFrame{.slot = &stmt_parallel->hi});
+        m_frames.emplace_back(ExprFrame{.slot = &stmt_parallel->lo});
+    }
+
+    void leave(NodeStmtExit *stmt_exit) { derived().leave_exit(stmt_exit); }
+    void leave(NodeStmtPrint *stmt_print) { derived().leave_print(stmt_print); }
+    void leave(NodeStmtLet *stmt_let) { derived().leave_let(stmt_let); }
+    void leave(NodeStmtAssign *stmt_assign) { derived().leave_assign(stmt_assign); }
+    void leave(NodeStmtStore *stmt_store) { derived().leave_store(stmt_store); }
+    void leave(NodeStmtReset *stmt_reset) { derived().leave_reset(stmt_reset); }
+    void leave(NodeScope *) {}
+    void leave(NodeStmtIf *stmt_if) { derived().leave_if(stmt_if); }
+    void leave(NodeStmtParallel *stmt_parallel) { derived().leave_parallel(stmt_parallel); }
+
+    // Expressions ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+    void enter(NodeTerm *term)
+    {
+        if (const auto int_lit = std::get_if<NodeTermIntLit *>(&term->var))
+        {
+            derived().visit_int_lit(*int_lit);
+        }
+        else if (const auto ident = std::get_if<NodeTermIdent *>(&term->var))
+        {
+            derived().visit_ident(*ident);
+        }
+        else if (const auto paren = std::get_if<NodeTermParen *>(&term->var))
+        {
+            if (derived().enter_paren(*paren))
+            {
+                m_frames.emplace_back(ExprFrame{.slot = &(*paren)->expr});
+            }
+        }
+        else if (const auto arg = std::get_if<NodeTermArg *>(&term->var))
+        {
+            if (derived().enter_arg(*arg))
+            {
+                m_frames.emplace_back(ExprFrame{.slot = &(*arg)->expr});
+            }
+        }
+        else if (const auto alloc = std::get_if<NodeTermAlloc *>(&term->var))
+        {
+            if (derived().enter_alloc(*alloc))
+            {
+                m_frames.emplace_back(ExprFrame{.slot = &(*alloc)->expr});
+            }
+        }
+        else if (const auto index = std::get_if<NodeTermIndex *>(&term->var))
+        {
+            if (derived().enter_index(*index))
+            {
+                derived().visit_ident(&(*index)->array);
+                m_frames.emplace_back(ExprFrame{.slot = &(*index)->index});
+            }
+        }
+        else if (const auto map = std::get_if<NodeTermMap *>(&term->var))
+        {
+            if (derived().enter_map(*map))
+            {
+                m_frames.emplace_back(ExprFrame{.slot = &(*map)->expr});
+            }
+        }
+        else if (const auto size = std::get_if<NodeTermSize *>(&term->var))
+        {
+            if (derived().enter_size(*size))
+            {
+                m_frames.emplace_back(ExprFrame{.slot = &(*size)->expr});
+            }
+        }
+        else if (const auto load = std::get_if<NodeTermLoad *>(&term->var))
+        {
+            if (derived().enter_load(*load))
+            {
+                m_frames.emplace_back(ExprFrame{.slot = &(*load)->index});
+                m_frames.emplace_back(ExprFrame{.slot = &(*load)->file});
+            }
+        }
+        else
+        {
+            derived().visit_read(std::get<NodeTermRead *>(term->var));
+        }
+    }
+
+    void enter(NodeBinExpr *bin_expr)
+    {
+        if (!derived().enter_bin_expr(bin_expr))
+        {
+            return;
+        }
+        const auto [lhs, rhs] = std::visit([](auto *bin) { return std::pair<NodeExpr **, NodeExpr **>(&bin->lhs, &bin->rhs); }, bin_expr->var);
+        m_frames.emplace_back(ExprFrame{.slot = rhs});
+        m_frames.emplace_back(ExprFrame{.slot = lhs});
+    }
+
+    void leave(NodeTerm *term)
+    {
+        if (const auto paren = std::get_if<NodeTermParen *>(&term->var))
+        {
+            derived().leave_paren(*paren);
+        }
+        else if (const auto arg = std::get_if<NodeTermArg *>(&term->var))
+        {
+            derived().leave_arg(*arg);
+        }
+        else if (const auto alloc = std::get_if<NodeTermAlloc *>(&term->var))
+        {
+            derived().leave_alloc(*alloc);
+        }
+        else if (const auto index = std::get_if<NodeTermIndex *>(&term->var))
+        {
+            derived().leave_index(*index);
+        }
+        else if (const auto map = std::get_if<NodeTermMap *>(&term->var))
+        {
+            derived().leave_map(*map);
+        }
+        else if (const auto size = std::get_if<NodeTermSize *>(&term->var))
+        {
+            derived().leave_size(*size);
+        }
+        else if (const auto load = std::get_if<NodeTermLoad *>(&term->var))
+        {
+            derived().leave_load(*load);
+        }
+    }
+
+    void leave(NodeBinExpr *bin_expr) { derived().leave_bin_expr(bin_expr); }
+
+    std::vector<Frame> m_frames{}; // Stack of the nodes left to visit and leave.
+};
+
+/// @brief An AstVisitor whose post-order hooks may replace the node they are called on.
+///
+/// After a statement or expression is left, `rewrite_stmt` or `rewrite_expr` is called with it and its parent is
+/// pointed at the node returned, so passes such as ConstantFolder can rebuild the tree bottom-up in a single
+/// traversal. The defaults return the node unchanged. Replacements are allocated by the pass, usually in the parser's
+/// arena.
+template <typename Derived>
+class AstRewriter : public AstVisitor<Derived>
+{
+    friend class AstVisitor<Derived>;
+
+protected:
+    static constexpr bool rewrites = true;
+
+    NodeStmt *rewrite_stmt(NodeStmt *stmt) { return stmt; }
+    NodeExpr *rewrite_expr(NodeExpr *expr) { return expr; }
+};
@@ -0,0 +1,665 @@
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "tokenization.hpp"
+#include "parser.hpp"
+#include "visitor.hpp"
+#include "resolution.hpp"
+#include "evaluation.hpp"
+#include "generation.hpp"
+#include "peephole.hpp"
+#include "encoding.hpp"
+#include "linking.hpp"
+
+/// @brief Returns every node of a statement to the pools of the allocator it was parsed in.
+class NodeReleaser : public AstVisitor<NodeReleaser>
+{
+public:
+    /**
+     * @brief Constructs the releaser for a given allocator.
+     *
+     * @param allocator The allocator the statements were parsed in.
+     */
+    explicit NodeReleaser(PoolAllocator &allocator)
+        : m_allocator(allocator)
+    {
+    }
+
+private:
+    friend class AstVisitor<NodeReleaser>;
+
+    // Nodes are freed once they are left, when the traversal no longer refers to anything in them.
+
+    void leave_stmt(NodeStmt *stmt)
+    {
+        if (const auto stmt_if = std::get_if<NodeStmtIf *>(&stmt->var))
+        {
+            m_allocator.free_array((*stmt_if)->arms.data(), (*stmt_if)->arms.size());
+        }
+
+        // Scopes are freed when they are left.
+        if (!std::holds_alternative<NodeScope *>(stmt->var))
+        {
+            std::visit([this](auto *node) { m_allocator.free(node); }, stmt->var);
+        }
+        m_allocator.free(stmt);
+    }
+
+    void leave_scope(NodeScope *scope)
+    {
+        m_allocator.free_array(scope->stmts.data(), scope->stmts.size());
+        m_allocator.free(scope);
+    }
+
+    void leave_expr(NodeExpr *expr)
+    {
+        if (const auto term = std::get_if<NodeTerm *>(&expr->var))
+        {
+            std::visit([this](auto *node) { m_allocator.free(node); }, (*term)->var);
+            m_allocator.free(*term);
+        }
+        else if (const auto bin_expr = std::get_if<NodeBinExpr *>(&expr->var))
+        {
+            std::visit([this](auto *node) { m_allocator.free(node); }, (*bin_expr)->var);
+            m_allocator.free(*bin_expr);
+        }
+        m_allocator.free(expr);
+    }
+
+    PoolAllocator &m_allocator; // The allocator the statements were parsed in.
+};
+
+/// @brief Moves the tokens of a statement to other lines, for a statement reused at another place in the source code.
+class LineShifter : public AstVisitor<LineShifter>
+{
+public:
+    /**
+     * @brief Constructs the shifter for a given number of lines.
+     *
+     * @param offset Lines to add, wrapping around so statements can also move up.
+     */
+    explicit LineShifter(const size_t offset)
+        : m_offset(offset)
+    {
+    }
+
+private:
+    friend class AstVisitor<LineShifter>;
+
+    bool enter_let(NodeStmtLet *stmt_let)
+    {
+        stmt_let->ident.line += m_offset;
+        return true;
+    }
+
+    bool enter_assign(NodeStmtAssign *stmt_assign)
+    {
+        stmt_assign->ident.line += m_offset;
+        return true;
+    }
+
+    bool enter_parallel(NodeStmtParallel *stmt_parallel)
+    {
+        stmt_parallel->ident.line += m_offset;
+        return true;
+    }
+
+    void visit_int_lit(NodeTermIntLit *term_int_lit)
+    {
+        term_int_lit->int_lit.line += m_offset;
+    }
+
+    void visit_ident(NodeTermIdent *term_ident)
+    {
+        term_ident->ident.line += m_offset;
+    }
+
+    const size_t m_offset; // Lines to add.
+};
+
+/// @brief Describes how far below the top of the stack the variables a top-level statement uses from before it are.
+///
+/// Besides its own tokens, that is all the code of the statement depends on, so a statement whose tokens and
+/// description did not change gets the same code wherever it is in the program.
+class EntryContext : public AstVisitor<EntryContext>
+{
+public:
+    /**
+     * @brief Describes a resolved top-level statement.
+     *
+     * @param stmt The statement.
+     * @param var_count Number of variables on the stack before the statement.
+     * @return Depth of every variable used from before the statement, in order.
+     */
+    std::vector<size_t> describe(NodeStmt *stmt, const size_t var_count)
+    {
+        m_var_count = var_count;
+        m_depths.clear();
+        traverse_statement(stmt);
+        return m_depths;
+    }
+
+private:
+    friend class AstVisitor<EntryContext>;
+
+    bool enter_assign(NodeStmtAssign *stmt_assign)
+    {
+        use(stmt_assign->slot);
+        return true;
+    }
+
+    void visit_ident(NodeTermIdent *term_ident)
+    {
+        use(term_ident->slot);
+    }
+
+    /// @brief Records the use of a variable, if it was declared before the statement.
+    void use(const size_t slot)
+    {
+        if (slot < m_var_count)
+        {
+            m_depths.push_back(m_var_count - slot);
+        }
+    }
+
+    size_t m_var_count = 0;         // Number of variables on the stack before the statement.
+    std::vector<size_t> m_depths{}; // Depth of every variable used from before the statement, in order.
+};
+
+/// @brief Class to compile a program again every time its file changes, reparsing only the statements edited.
+///
+/// The parse tree is kept between builds. Top-level statements whose tokens did not change keep their subtree, even
+/// if they moved, and only the others are parsed again. The subtrees they replace are returned to the parser's pools
+/// and reused by later reparses, so a long session does not grow with the number of edits. The code of every statement
+/// is kept with its subtree too, along with the EntryContext it was generated in, so only statements that were edited
+/// or whose variables moved are generated again; the rest is copied with its labels renumbered. Statements are
+/// generated one at a time for that, never in chunks on several threads. The executable is written directly, one
+/// padded chunk per statement, so a build that only changes some statements patches their chunks in place. Syntax and
+/// resolve errors are reported and the session goes on with the last build kept, until the next edit fixes them.
+class WatchSession
+{
+public:
+    /**
+     * @brief Constructs the session for a given hydrogen file.
+     *
+     * @param path Path of the hydrogen file.
+     * @param evaluate Whether to run the program at compile time.
+     * @param superopt_table Table of superoptimized sequences to consult, or nullptr to not use any.
+     * @param superopt_search Whether to search for sequences missing from the table and add them.
+     * @param dialect The assembler out.asm is printed for.
+     */
+    WatchSession(std::string path, const bool evaluate, SuperoptTable *superopt_table = nullptr, const bool superopt_search = false,
+                 const AsmDialect dialect = AsmDialect::nasm)
+        : m_path(std::move(path)),
+          m_evaluate(evaluate),
+          m_superopt_table(superopt_table),
+          m_superopt_search(superopt_search),
+          m_dialect(dialect)
+    {
+    }
+
+    /// @brief Builds the program every time its file is written to, until the file is removed.
+    void run()
+    {
+        std::filesystem::file_time_type built_time{};
+        while (true)
+        {
+            std::error_code ec;
+            const std::filesystem::file_time_type write_time = std::filesystem::last_write_time(m_path, ec);
+            if (ec)
+            {
+                return;
+            }
+            if (write_time != built_time)
+            {
+                built_time = write_time;
+                std::ifstream input(m_path);
+                std::stringstream contents;
+                contents << input.rdbuf();
+                const std::vector<std::string> errors = rebuild(contents.str());
+                for (const std::string &error : errors)
+                {
+                    std::cerr << error << std::endl;
+                }
+                if (errors.empty())
+                {
+                    std::cout << "[Watch] Built out.asm, reparsed " << m_reparsed << " and generated " << m_generated
+                              << " of " << m_stmts.size() << " statements, "
+                              << (m_patched.has_value() ? "patched " + std::to_string(m_patched.value()) + " chunks of out"
+                                                        : std::string("linked out"))
+                              << std::endl;
+                }
+            }
+            std::this_thread::sleep_for(poll_interval);
+        }
+    }
+
+    /**
+     * @brief Builds the program from the new source code, writing out.asm if there are no errors.
+     *
+     * @param src The source code.
+     * @return The errors found, empty if out.asm was written.
+     */
+    std::vector<std::string> rebuild(const std::string &src)
+    {
+        Tokenizer tokenizer(src);
+        tokenizer.throw_errors();
+        std::vector<Token> tokens;
+        try
+        {
+            tokens = tokenizer.tokenize();
+        }
+        catch (const SyntaxError &error)
+        {
+            return {error.message};
+        }
+
+        // Statements that appear several times are reused in order, so the first unchanged one is at the back.
+        std::unordered_map<std::string_view, std::vector<size_t>> previous;
+        for (size_t i = m_stmts.size(); i-- > 0;)
+        {
+            previous[m_stmts[i].key].push_back(i);
+        }
+
+        // Statements are matched before anything is parsed, so a syntax error leaves the last build as it is.
+        const std::vector<size_t> ends = split_statements(tokens);
+        std::vector<std::string> keys;
+        std::vector<std::optional<size_t>> reused;
+        size_t begin = 0;
+        for (const size_t end : ends)
+        {
+            keys.push_back(statement_key(tokens, begin, end));
+            const auto it = previous.find(keys.back());
+            if (it != previous.end() && !it->second.empty())
+            {
+                reused.emplace_back(it->second.back());
+                it->second.pop_back();
+            }
+            else
+            {
+                reused.emplace_back();
+            }
+            begin = end;
+        }
+        if (std::optional<std::string> error = check_syntax(tokens, ends, reused))
+        {
+            return {std::move(error.value())};
+        }
+
+        std::vector<Stmt> stmts;
+        m_reparsed = 0;
+        begin = 0;
+        for (size_t i = 0; i < ends.size(); i++)
+        {
+            const size_t end = ends[i];
+            Stmt stmt{.key = std::move(keys[i]), .line = tokens[begin].line, .node = nullptr};
+            if (reused[i].has_value())
+            {
+                Stmt &reused_stmt = m_stmts[reused[i].value()];
+                if (reused_stmt.line != stmt.line)
+                {
+                    LineShifter(stmt.line - reused_stmt.line).traverse_statement(reused_stmt.node);
+                }
+                // The subtree keeps its code, which is reused if its context did not change either.
+                std::string key = std::move(stmt.key);
+                stmt = std::move(reused_stmt);
+                stmt.key = std::move(key);
+                stmt.line = tokens[begin].line;
+                reused_stmt.node = nullptr;
+            }
+            else
+            {
+                stmt.node = m_parser.parse_top_level_stmt(std::vector<Token>(tokens.begin() + static_cast<std::ptrdiff_t>(begin),
+                                                                             tokens.begin() + static_cast<std::ptrdiff_t>(end)));
+                m_reparsed++;
+            }
+            stmts.push_back(std::move(stmt));
+            begin = end;
+        }
+
+        NodeReleaser releaser(m_parser.allocator());
+        for (const Stmt &stmt : m_stmts)
+        {
+            if (stmt.node != nullptr)
+            {
+                releaser.traverse_statement(stmt.node);
+            }
+        }
+        m_stmts = std::move(stmts);
+
+        NodeProg prog;
+        for (const Stmt &stmt : m_stmts)
+        {
+            prog.stmts.push_back(stmt.node);
+        }
+        return compile(std::move(prog));
+    }
+
+private:
+    static constexpr std::chrono::milliseconds poll_interval{100}; // Time between two checks of the file.
+    static constexpr size_t check_block_size = 64 * 1024;          // Arena block size of the parser checking syntax.
+
+    /// @brief A top-level statement of the last build.
+    struct Stmt
+    {
+        std::string key;                           // Tokens of the statement, see statement_key.
+        size_t line;                               // Line of the first token.
+        NodeStmt *node;                            // Parse tree of the statement.
+        std::vector<size_t> context{};             // EntryContext the code was generated in.
+        std::optional<Generator::StmtCode> code{}; // Code of the statement, if it was generated.
+        ObjectCode object{};                       // The code encoded on its own, for its chunk of the executable.
+        size_t code_id = 0;                        // Number of the code, different every time the statement is generated.
+    };
+
+    /**
+     * @brief Splits the tokens into top-level statements by matching braces, without parsing them.
+     *
+     * A statement ends at a `;` outside of braces, or at the `}` closing them unless an `elif` or `else` follows.
+     *
+     * @param tokens The tokens of the program.
+     * @return The index after the last token of every statement.
+     */
+    static std::vector<size_t> split_statements(const std::vector<Token> &tokens)
+    {
+        std::vector<size_t> ends;
+        size_t depth = 0;
+        for (size_t i = 0; i < tokens.size(); i++)
+        {
+            if (tokens[i].type == TokenType::open_curly)
+            {
+                depth++;
+                continue;
+            }
+            if (tokens[i].type == TokenType::close_curly && depth > 0)
+            {
+                depth--;
+                const bool continued = i + 1 < tokens.size() &&
+                                       (tokens[i + 1].type == TokenType::elif_ || tokens[i + 1].type == TokenType::else_);
+                if (depth == 0 && !continued)
+                {
+                    ends.push_back(i + 1);
+                }
+                continue;
+            }
+            if (tokens[i].type == TokenType::semi && depth == 0)
+            {
+                ends.push_back(i + 1);
+            }
+        }
+
+        // An unfinished statement is left to the parser to report.
+        if (ends.empty() ? !tokens.empty() : ends.back() != tokens.size())
+        {
+            ends.push_back(tokens.size());
+        }
+        return ends;
+    }
+
+    /**
+     * @brief Parses the statements that are not reused on their own, to find a syntax error before the session parses
+     * them into its parse tree.
+     *
+     * They are parsed by a parser of their own, whose nodes are dropped along with it, so a statement that does not
+     * parse leaves nothing behind in the pools of the session.
+     *
+     * @param tokens The tokens of the program.
+     * @param ends The index after the last token of every statement.
+     * @param reused The statement of the last build every statement reuses, if any.
+     * @return The first syntax error, if any.
+     */
+    static std::optional<std::string> check_syntax(const std::vector<Token> &tokens, const std::vector<size_t> &ends,
+                                                   const std::vector<std::optional<size_t>> &reused)
+    {
+        Parser parser(std::vector<Token>(), {}, check_block_size);
+        parser.throw_errors();
+        size_t begin = 0;
+        for (size_t i = 0; i < ends.size(); i++)
+        {
+            if (!reused[i].has_value())
+            {
+                try
+                {
+                    (void)parser.parse_top_level_stmt(std::vector<Token>(tokens.begin() + static_cast<std::ptrdiff_t>(begin),
+                                                                         tokens.begin() + static_cast<std::ptrdiff_t>(ends[i])));
+                }
+                catch (const SyntaxError &error)
+                {
+                    return error.message;
+                }
+            }
+            begin = ends[i];
+        }
+        return {};
+    }
+
+    /**
+     * @brief Describes a statement by its tokens and their lines relative to the first one, so a statement moved to
+     * other lines still matches its parse tree.
+     *
+     * @param tokens The tokens of the program.
+     * @param begin Index of the first token of the statement.
+     * @param end Index after the last token of the statement.
+     * @return The description.
+     */
+    static std::string statement_key(const std::vector<Token> &tokens, const size_t begin, const size_t end)
+    {
+        std::string key;
+        for (size_t i = begin; i < end; i++)
+        {
+            key.push_back(static_cast<char>(tokens[i].type));
+            key += std::to_string(tokens[i].line - tokens[begin].line);
+            if (tokens[i].value.has_value())
+            {
+                key.push_back(' ');
+                key += tokens[i].value.value();
+            }
+            key.push_back('\n');
+        }
+        return key;
+    }
+
+    /**
+     * @brief Runs the passes after parsing on the program and writes out.asm.
+     *
+     * @param prog The program.
+     * @return The errors found, empty if out.asm was written.
+     */
+    std::vector<std::string> compile(NodeProg prog)
+    {
+        m_generated = 0;
+        Resolver resolver(prog);
+        std::vector<std::string> errors = resolver.resolve_program();
+        if (!errors.empty())
+        {
+            return errors;
+        }
+
+        std::optional<uint64_t> exit_code;
+        if (m_evaluate)
+        {
+            Evaluator evaluator(prog);
+            exit_code = evaluator.evaluate_program();
+        }
+
+        Generator generator(std::move(prog), m_superopt_table, m_superopt_search);
+        const std::vector<MachineInstr> &instrs = exit_code.has_value() ? generator.generate_exit_program(exit_code.value())
+                                                                        : generate(generator);
+        PeepholeOptimizer peephole;
+        std::vector<MachineInstr> optimized = peephole.optimize(instrs);
+        generator.labels().remove_dead_labels(optimized);
+        Encoder encoder(generator.labels());
+        encoder.relax(optimized);
+
+        AsmPrinter printer(m_dialect);
+        std::fstream file("out.asm", std::ios::out);
+        file << printer.print_program(optimized);
+
+        if (exit_code.has_value())
+        {
+            // The evaluated program has no statements to chunk, so the next build links the executable again.
+            const ObjectCode object{.machine_code = encoder.encode(optimized)};
+            m_executable.link({&object});
+            m_linked_ids.reset();
+            m_patched.reset();
+        }
+        else
+        {
+            write_executable();
+        }
+        return {};
+    }
+
+    /**
+     * @brief Generates the program statement by statement, reusing the code of the statements whose context did not
+     * change.
+     *
+     * @param generator The generator of the program.
+     * @return The generated instructions.
+     */
+    const std::vector<MachineInstr> &generate(Generator &generator)
+    {
+        // The program mostly has the size of the cached code, which is copied rather than grown into.
+        size_t cached_count = 0;
+        for (const Stmt &stmt : m_stmts)
+        {
+            cached_count += stmt.code.has_value() ? stmt.code->instrs.size() : 0;
+        }
+        generator.reserve_instrs(m_prologue_count + cached_count + m_epilogue_count);
+
+        EntryContext context;
+        size_t instr_count = 0;
+        size_t var_count = 0;
+        for (Stmt &stmt : m_stmts)
+        {
+            std::vector<size_t> depths = context.describe(stmt.node, var_count);
+            if (stmt.code.has_value() && depths == stmt.context)
+            {
+                generator.append_statement_code(stmt.code.value());
+            }
+            else
+            {
+                stmt.context = std::move(depths);
+                stmt.code = generator.generate_statement_code(stmt.node);
+                stmt.object = encode_statement(stmt.code.value());
+                stmt.code_id = ++m_code_count;
+                m_generated++;
+            }
+            instr_count += stmt.code->instrs.size();
+            var_count += stmt.code->var_count;
+        }
+
+        // The start of the program and the exit and runtime after the statements only change with the routines of the
+        // runtime the statements call, they get the first and the last chunk. The runtime is numbered after the labels
+        // of the statements. Once they change, the chunks of the statements no longer fit around them and the
+        // executable is linked again.
+        const std::vector<MachineInstr> &instrs = generator.finish_program();
+        if (m_runtime_calls != generator.runtime_calls())
+        {
+            m_prologue_count = generator.prologue_count();
+            const auto prologue_end = instrs.begin() + static_cast<std::ptrdiff_t>(m_prologue_count);
+            const auto epilogue = prologue_end + static_cast<std::ptrdiff_t>(instr_count);
+            m_prologue = encode_statement({.instrs = std::vector(instrs.begin(), prologue_end), .label_count = 0, .var_count = 0, .calls = {}});
+            m_epilogue = encode_statement({.instrs = std::vector(epilogue, instrs.end()), .label_count = generator.labels().size(), .var_count = 0, .calls = {}});
+            m_epilogue_count = static_cast<size_t>(instrs.end() - epilogue);
+            m_runtime_calls = generator.runtime_calls();
+            m_linked_ids.reset();
+        }
+        return instrs;
+    }
+
+    /**
+     * @brief Runs the passes after codegen on the code of a single statement and encodes it.
+     *
+     * The code does not jump out of the statement, so it is encoded on its own and runs wherever its chunk is.
+     *
+     * @param code The code of the statement.
+     * @return The machine code, along with its calls into the runtime.
+     */
+    static ObjectCode encode_statement(const Generator::StmtCode &code)
+    {
+        PeepholeOptimizer peephole;
+        std::vector<MachineInstr> optimized = peephole.optimize(code.instrs);
+        LabelTable labels(code.label_count);
+        labels.remove_dead_labels(optimized);
+        Encoder encoder(labels);
+        encoder.relax(optimized);
+        ObjectCode object{.machine_code = encoder.encode(optimized), .relocations = encoder.relocations()};
+        for (size_t i = 0; i < runtime_symbol_count; i++)
+        {
+            object.symbols[i] = encoder.symbol_offset(static_cast<RuntimeSymbol>(i));
+        }
+        return object;
+    }
+
+    /**
+     * @brief Writes the executable, patching the chunks of the statements generated again if it was linked with as
+     * many statements and they still fit.
+     */
+    void write_executable()
+    {
+        if (m_linked_ids.has_value() && m_linked_ids->size() == m_stmts.size())
+        {
+            // The chunk of a statement follows the one of the start of the program.
+            std::vector<std::pair<size_t, const ObjectCode *>> changes;
+            bool fits = true;
+            for (size_t i = 0; i < m_stmts.size() && fits; i++)
+            {
+                if (m_stmts[i].code_id != m_linked_ids->at(i))
+                {
+                    fits = m_executable.fits(i + 1, m_stmts[i].object.machine_code.size());
+                    changes.emplace_back(i + 1, &m_stmts[i].object);
+                }
+            }
+            if (fits && m_executable.patch(changes))
+            {
+                for (size_t i = 0; i < m_stmts.size(); i++)
+                {
+                    m_linked_ids->at(i) = m_stmts[i].code_id;
+                }
+                m_patched = changes.size();
+                return;
+            }
+        }
+
+        std::vector<const ObjectCode *> chunks{&m_prologue};
+        m_linked_ids.emplace();
+        for (const Stmt &stmt : m_stmts)
+        {
+            chunks.push_back(&stmt.object);
+            m_linked_ids->push_back(stmt.code_id);
+        }
+        chunks.push_back(&m_epilogue);
+        m_executable.link(chunks);
+        m_patched.reset();
+    }
+
+    const std::string m_path;                          // Path of the hydrogen file.
+    const bool m_evaluate;                             // Whether to run the program at compile time.
+    SuperoptTable *const m_superopt_table;             // Table of superoptimized sequences, or nullptr.
+    const bool m_superopt_search;                      // Whether to search for sequences missing from the table.
+    const AsmDialect m_dialect;                        // The assembler out.asm is printed for.
+    Parser m_parser{std::vector<Token>()};             // Parser, keeps the parse tree and its pools between builds.
+    std::vector<Stmt> m_stmts{};                       // Top-level statements of the last build.
+    size_t m_reparsed = 0;                             // Number of statements parsed again in the last build.
+    size_t m_generated = 0;                            // Number of statements generated in it.
+    size_t m_code_count = 0;                           // Number of times a statement was generated in the session.
+    ObjectCode m_prologue{};                           // Code of the start of the program, before the statements.
+    ObjectCode m_epilogue{};                           // Code of the exit and the runtime after the statements.
+    size_t m_prologue_count = 0;                       // Number of instructions of the start of the program.
+    size_t m_epilogue_count = 0;                       // Number of instructions of the exit and the runtime.
+    // Routines of the runtime the first and the last chunk were generated for, nullopt before any.
+    std::optional<Generator::RuntimeCalls> m_runtime_calls{};
+    ChunkedExecutable m_executable{"out"};             // The executable, written by the session instead of nasm and ld.
+    std::optional<std::vector<size_t>> m_linked_ids{}; // Code in every statement chunk of out, or nullopt to link again.
+    std::optional<size_t> m_patched{};                 // Number of chunks patched in the last build, nullopt if linked.
+};
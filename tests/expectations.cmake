@@ -0,0 +1,69 @@
+# What a test program must do when it is run, shared by run_test.cmake, run_watch.cmake and run_error.cmake.
+#
+# A program must have an `// exit: <code>` line with the code it exits with, unless it must not compile. Then it has
+# `// error: <line>` lines instead, one for every line hydro must report, in order. It may also have:
+# - `// args: <arguments>`, the command-line arguments it is run with
+# - `// input: <file>`, a file next to it that is its stdin, which is empty otherwise
+# - `// output: <line>` lines, one for every line it must print, it must print nothing without them
+# - `// threads: <counts>`, the sizes of the thread pool of a 'parallel for' to run it with, set through
+#   HYDRO_THREADS, it is run once with the default size otherwise
+
+# Reads the expectations of PROGRAM into EXPECTED, EXPECTED_ERRORS, ARGS, INPUT, EXPECTED_OUTPUT and THREADS.
+macro(read_expectations)
+    file(STRINGS ${PROGRAM} COMMENTS REGEX "^// (exit|error|args|input|output|threads):")
+    set(EXPECTED "")
+    set(EXPECTED_ERRORS "")
+    set(ARGS "")
+    set(THREADS "")
+    set(INPUT /dev/null)
+    set(EXPECTED_OUTPUT "")
+    foreach(COMMENT IN LISTS COMMENTS)
+        if(COMMENT MATCHES "^// exit: ([0-9]+)$")
+            set(EXPECTED ${CMAKE_MATCH_1})
+        elseif(COMMENT MATCHES "^// error: (.+)$")
+            string(APPEND EXPECTED_ERRORS "${CMAKE_MATCH_1}\n")
+        elseif(COMMENT MATCHES "^// args: (.*)$")
+            separate_arguments(ARGS UNIX_COMMAND "${CMAKE_MATCH_1}")
+        elseif(COMMENT MATCHES "^// input: (.+)$")
+            get_filename_component(DIR ${PROGRAM} DIRECTORY)
+            set(INPUT ${DIR}/${CMAKE_MATCH_1})
+        elseif(COMMENT MATCHES "^// output: ?(.*)$")
+            string(APPEND EXPECTED_OUTPUT "${CMAKE_MATCH_1}\n")
+        elseif(COMMENT MATCHES "^// threads: (.*)$")
+            separate_arguments(THREADS UNIX_COMMAND "${CMAKE_MATCH_1}")
+        endif()
+    endforeach()
+    if(EXPECTED STREQUAL "" AND EXPECTED_ERRORS STREQUAL "")
+        message(FATAL_ERROR "${PROGRAM} has no `// exit: <code>` or `// error: <line>` line")
+    endif()
+endmacro()
+
+# Runs the executable compiled from PROGRAM in WORK_DIR, once for every size of THREADS, and sets ERROR_VAR to how it
+# failed its expectations, or to an empty string if it met them.
+function(check_run EXECUTABLE ERROR_VAR)
+    set(${ERROR_VAR} "" PARENT_SCOPE)
+    set(POOL_SIZES ${THREADS})
+    if(NOT POOL_SIZES)
+        set(POOL_SIZES default)
+    endif()
+    foreach(POOL_SIZE IN LISTS POOL_SIZES)
+        set(WITH "")
+        if(NOT POOL_SIZE STREQUAL "default")
+            set(ENV{HYDRO_THREADS} ${POOL_SIZE})
+            set(WITH " with HYDRO_THREADS=${POOL_SIZE}")
+        endif()
+        execute_process(COMMAND ${EXECUTABLE} ${ARGS}
+                        WORKING_DIRECTORY ${WORK_DIR}
+                        INPUT_FILE ${INPUT}
+                        RESULT_VARIABLE RESULT
+                        OUTPUT_VARIABLE OUTPUT)
+        unset(ENV{HYDRO_THREADS})
+        if(NOT RESULT EQUAL EXPECTED)
+            set(${ERROR_VAR} "${PROGRAM} exited with ${RESULT}${WITH}, expected ${EXPECTED}" PARENT_SCOPE)
+            return()
+        elseif(NOT OUTPUT STREQUAL EXPECTED_OUTPUT)
+            set(${ERROR_VAR} "${PROGRAM} printed${WITH}:\n${OUTPUT}expected:\n${EXPECTED_OUTPUT}" PARENT_SCOPE)
+            return()
+        endif()
+    endforeach()
+endfunction()
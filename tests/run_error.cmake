@@ -0,0 +1,23 @@
+# Compiles PROGRAM, which must not compile, with HYDRO and FLAGS in WORK_DIR, and checks that hydro fails and reports
+# exactly its `// error:` lines on stderr, see expectations.cmake.
+include(${CMAKE_CURRENT_LIST_DIR}/expectations.cmake)
+read_expectations()
+if(EXPECTED_ERRORS STREQUAL "")
+    message(FATAL_ERROR "${PROGRAM} has no `// error: <line>` line")
+endif()
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+separate_arguments(FLAGS UNIX_COMMAND "${FLAGS}")
+execute_process(COMMAND ${HYDRO} --assembler=as ${FLAGS} ${PROGRAM}
+                WORKING_DIRECTORY ${WORK_DIR}
+                RESULT_VARIABLE RESULT
+                OUTPUT_QUIET
+                ERROR_VARIABLE ERRORS)
+if(RESULT EQUAL 0)
+    message(FATAL_ERROR "${PROGRAM} compiled, expected it to fail with:\n${EXPECTED_ERRORS}")
+elseif(NOT ERRORS STREQUAL EXPECTED_ERRORS)
+    message(FATAL_ERROR "${PROGRAM} failed with:\n${ERRORS}expected:\n${EXPECTED_ERRORS}")
+elseif(EXISTS ${WORK_DIR}/out.asm)
+    message(FATAL_ERROR "${PROGRAM} failed but wrote out.asm")
+endif()
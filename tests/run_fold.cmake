@@ -0,0 +1,33 @@
+# Compiles PROGRAM with HYDRO and `--no-eval --fold` in WORK_DIR, runs it and checks it against its expectations, see
+# expectations.cmake. The comments the generator leaves in out.asm show what the folded tree was made of: it must have
+# IFS 'if' statements, no 'elif' arm, SCOPES scope statements, and the literal LITERAL.
+include(${CMAKE_CURRENT_LIST_DIR}/expectations.cmake)
+read_expectations()
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+execute_process(COMMAND ${HYDRO} --assembler=as --no-eval --fold ${PROGRAM}
+                WORKING_DIRECTORY ${WORK_DIR}
+                RESULT_VARIABLE RESULT
+                OUTPUT_VARIABLE OUTPUT
+                ERROR_VARIABLE OUTPUT)
+if(NOT RESULT EQUAL 0 OR NOT EXISTS ${WORK_DIR}/out)
+    message(FATAL_ERROR "${PROGRAM} did not compile:\n${OUTPUT}")
+endif()
+
+file(STRINGS ${WORK_DIR}/out.asm IF_LINES REGEX "^ *# if$")
+file(STRINGS ${WORK_DIR}/out.asm ELIF_LINES REGEX "^ *# elif$")
+file(STRINGS ${WORK_DIR}/out.asm SCOPE_LINES REGEX "^ *# scope$")
+file(STRINGS ${WORK_DIR}/out.asm LITERAL_LINES REGEX "\\$${LITERAL},")
+list(LENGTH IF_LINES IF_COUNT)
+list(LENGTH ELIF_LINES ELIF_COUNT)
+list(LENGTH SCOPE_LINES SCOPE_COUNT)
+if(NOT IF_COUNT EQUAL IFS OR NOT ELIF_COUNT EQUAL 0 OR NOT SCOPE_COUNT EQUAL SCOPES OR NOT LITERAL_LINES)
+    message(FATAL_ERROR "${PROGRAM} folded to ${IF_COUNT} 'if', ${ELIF_COUNT} 'elif' and ${SCOPE_COUNT} scopes, "
+                        "expected ${IFS} 'if', no 'elif' and ${SCOPES} scopes with the literal ${LITERAL}")
+endif()
+
+check_run(${WORK_DIR}/out ERROR)
+if(ERROR)
+    message(FATAL_ERROR "${ERROR}")
+endif()
@@ -0,0 +1,52 @@
+# Compiles PROGRAM with HYDRO and FLAGS in WORK_DIR, runs it and checks it against its expectations, see
+# expectations.cmake. With PREPARE_FLAGS it is first compiled with those, for modes that reuse what an earlier compile
+# left in WORK_DIR. With `-c` the object file is linked into an executable by CXX, with a `main` that calls it.
+include(${CMAKE_CURRENT_LIST_DIR}/expectations.cmake)
+read_expectations()
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+if(PREPARE_FLAGS)
+    separate_arguments(PREPARE_FLAGS UNIX_COMMAND "${PREPARE_FLAGS}")
+    execute_process(COMMAND ${HYDRO} --assembler=as ${PREPARE_FLAGS} ${PROGRAM}
+                    WORKING_DIRECTORY ${WORK_DIR}
+                    RESULT_VARIABLE RESULT
+                    OUTPUT_VARIABLE OUTPUT
+                    ERROR_VARIABLE OUTPUT)
+    if(NOT RESULT EQUAL 0)
+        message(FATAL_ERROR "${PROGRAM} did not compile with ${PREPARE_FLAGS}:\n${OUTPUT}")
+    endif()
+    file(REMOVE ${WORK_DIR}/out)
+endif()
+separate_arguments(FLAGS UNIX_COMMAND "${FLAGS}")
+execute_process(COMMAND ${HYDRO} --assembler=as ${FLAGS} ${PROGRAM}
+                WORKING_DIRECTORY ${WORK_DIR}
+                RESULT_VARIABLE RESULT
+                OUTPUT_VARIABLE OUTPUT
+                ERROR_VARIABLE OUTPUT)
+list(FIND FLAGS "-c" OBJECT)
+if(NOT OBJECT EQUAL -1)
+    if(NOT RESULT EQUAL 0 OR NOT EXISTS ${WORK_DIR}/out.o)
+        message(FATAL_ERROR "${PROGRAM} did not compile:\n${OUTPUT}")
+    endif()
+    # The function is named after the program and takes argc and argv like `main`.
+    get_filename_component(SYMBOL ${PROGRAM} NAME_WE)
+    string(MAKE_C_IDENTIFIER ${SYMBOL} SYMBOL)
+    file(WRITE ${WORK_DIR}/main.cpp
+         "#include <cstdint>\n"
+         "extern \"C\" uint64_t ${SYMBOL}(int argc, char **argv);\n"
+         "int main(int argc, char **argv) { return static_cast<int>(${SYMBOL}(argc, argv)); }\n")
+    execute_process(COMMAND ${CXX} -o out main.cpp out.o
+                    WORKING_DIRECTORY ${WORK_DIR}
+                    RESULT_VARIABLE RESULT
+                    OUTPUT_VARIABLE OUTPUT
+                    ERROR_VARIABLE OUTPUT)
+endif()
+if(NOT RESULT EQUAL 0 OR NOT EXISTS ${WORK_DIR}/out)
+    message(FATAL_ERROR "${PROGRAM} did not compile:\n${OUTPUT}")
+endif()
+
+check_run(${WORK_DIR}/out ERROR)
+if(ERROR)
+    message(FATAL_ERROR "${ERROR}")
+endif()
@@ -0,0 +1,87 @@
+# Watches a copy of PROGRAM with HYDRO and FLAGS in WORK_DIR, checks every build against the program's expectations,
+# see expectations.cmake, and edits the copy in between so the session has to rebuild it.
+#
+# hydro --watch only returns once the watched file is removed, so this script runs it next to a second instance of
+# itself with DRIVE set, which makes the edits and removes the file when done.
+include(${CMAKE_CURRENT_LIST_DIR}/expectations.cmake)
+read_expectations()
+set(WATCHED ${WORK_DIR}/watched.hy)
+set(LOG ${WORK_DIR}/watch.log)
+
+# Waits for the session to have built COUNT times, or removes the watched file and fails after a timeout.
+function(wait_for_builds COUNT)
+    foreach(TRY RANGE 400)
+        file(STRINGS ${LOG} BUILDS REGEX "^\\[Watch\\] Built")
+        list(LENGTH BUILDS BUILT)
+        if(BUILT GREATER_EQUAL COUNT)
+            return()
+        endif()
+        execute_process(COMMAND ${CMAKE_COMMAND} -E sleep 0.05)
+    endforeach()
+    file(REMOVE ${WATCHED})
+    message(FATAL_ERROR "${PROGRAM} was not built ${COUNT} times while watched")
+endfunction()
+
+# Runs the last build, or removes the watched file and fails if it does not meet the expectations.
+function(check_build)
+    check_run(${WORK_DIR}/out ERROR)
+    if(ERROR)
+        file(REMOVE ${WATCHED})
+        message(FATAL_ERROR "${ERROR}")
+    endif()
+endfunction()
+
+# Removes the watched file and fails if the line the session logged for its last build does not match REGEX.
+function(expect_last_build REGEX)
+    file(STRINGS ${LOG} BUILDS REGEX "^\\[Watch\\] Built")
+    list(GET BUILDS -1 BUILD)
+    if(NOT BUILD MATCHES "${REGEX}")
+        file(REMOVE ${WATCHED})
+        message(FATAL_ERROR "${PROGRAM} was rebuilt with `${BUILD}`, expected it to match `${REGEX}`")
+    endif()
+endfunction()
+
+# Replaces the watched file in one rename, so the session never reads it half written.
+function(edit_watched CONTENTS)
+    file(WRITE ${WATCHED}.tmp "${CONTENTS}")
+    file(RENAME ${WATCHED}.tmp ${WATCHED})
+endfunction()
+
+if(DRIVE)
+    file(READ ${PROGRAM} SOURCE)
+    wait_for_builds(1)
+    check_build()
+
+    # A statement in front of the program moves every variable to another stack slot.
+    edit_watched("let watchedit = 1;\n${SOURCE}")
+    wait_for_builds(2)
+    check_build()
+    # Only the new statement is parsed and generated, the code of the others is reused.
+    expect_last_build("reparsed 1 and generated 1 of")
+
+    # Changing only that statement leaves the rest of the program as it was, so its chunk is patched in place.
+    edit_watched("let watchedit = 2;\n${SOURCE}")
+    wait_for_builds(3)
+    check_build()
+    expect_last_build("reparsed 1 and generated 1 of .*, patched 1 chunks of out$")
+
+    file(REMOVE ${WATCHED})
+    return()
+endif()
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+file(COPY_FILE ${PROGRAM} ${WATCHED})
+file(TOUCH ${LOG})
+separate_arguments(FLAGS UNIX_COMMAND "${FLAGS}")
+execute_process(COMMAND ${CMAKE_COMMAND} -DDRIVE=ON -DPROGRAM=${PROGRAM} -DWORK_DIR=${WORK_DIR} -P ${CMAKE_CURRENT_LIST_FILE}
+                COMMAND ${HYDRO} --watch --assembler=as ${FLAGS} ${WATCHED}
+                WORKING_DIRECTORY ${WORK_DIR}
+                OUTPUT_FILE ${LOG}
+                RESULTS_VARIABLE RESULTS
+                ERROR_VARIABLE ERRORS
+                TIMEOUT 60)
+if(NOT RESULTS STREQUAL "0;0")
+    file(READ ${LOG} OUTPUT)
+    message(FATAL_ERROR "${PROGRAM} failed while watched:\n${OUTPUT}${ERRORS}")
+endif()
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Times how long every installed assembler takes to assemble hydro's output for the given programs, to pick the
+# fastest toolchain for `--assembler=`.
+#
+# Usage: bench_assemblers.sh <hydro> <input.hy>...
+
+if [ "$#" -lt 2 ]; then
+    echo "Try using : bench_assemblers.sh <hydro> <input.hy>..." >&2
+    exit 1
+fi
+hydro=$(realpath "$1")
+shift
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+for input in "$@"; do
+    input=$(realpath "$input")
+    for assembler in nasm yasm as; do
+        case $assembler in
+        nasm) command="nasm -felf64 out.asm" ;;
+        yasm) command="yasm -felf64 -o out.o out.asm" ;;
+        as) command="as -o out.o out.asm" ;;
+        esac
+        if ! command -v "$assembler" > /dev/null; then
+            echo "$(basename "$input") $assembler: not installed"
+            continue
+        fi
+
+        # Printing is timed apart from assembling, the compiler also runs the assembler itself.
+        (cd "$work" && "$hydro" --no-eval --assembler="$assembler" "$input" > /dev/null) || exit 1
+        size=$(wc -c < "$work/out.asm")
+        start=$(date +%s%N)
+        (cd "$work" && $command) || exit 1
+        end=$(date +%s%N)
+        echo "$(basename "$input") $assembler: $(( (end - start) / 1000000 )) ms for $size bytes of assembly"
+    done
+done
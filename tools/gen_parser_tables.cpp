@@ -0,0 +1,518 @@
+// Generates the parser's dispatch and precedence tables from grammar.txt, run by the build as a custom command.
+// grammer.md shows the same grammar in LaTeX, the build fails if it is not what grammar.txt renders to.
+//
+// Usage: gen_parser_tables <grammar.txt> <output.hpp> <grammer.md>
+//        gen_parser_tables --markdown <grammar.txt> <grammer.md>   rewrites the grammar of grammer.md
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/// @brief A symbol on the right-hand side of a production.
+struct Symbol
+{
+    std::string name; // Nonterminal or TokenType name.
+    char repeat;      // `*`, `?` or 0 for a symbol matched exactly once.
+    bool nullable;    // Whether the symbol has a `*` or `?` and may match nothing.
+};
+
+/// @brief One alternative of a nonterminal.
+struct Alternative
+{
+    std::optional<std::string> rule; // Name the parser dispatches to, if the alternative has one.
+    std::vector<Symbol> symbols;     // The right-hand side.
+    size_t line;                     // Line of the alternative in the grammar.
+};
+
+/// @brief A binary operator with its precedence.
+struct Operator
+{
+    std::string token; // TokenType name of the operator.
+    int prec;          // Precedence, higher binds tighter.
+};
+
+/// @brief The grammar read from the grammar file.
+struct Grammar
+{
+    std::vector<std::string> order{};                               // Nonterminals in the order they are defined.
+    std::map<std::string, std::vector<Alternative>> nonterminals{}; // Alternatives of every nonterminal.
+    std::vector<Operator> operators{};                              // Binary operators.
+};
+
+/**
+ * @brief Reports an error in the grammar and stops the build.
+ *
+ * @param path Path of the grammar file.
+ * @param line Line of the error.
+ * @param msg The error message.
+ */
+[[noreturn]] void fail(const std::string &path, const size_t line, const std::string &msg)
+{
+    std::cerr << path << ":" << line << ": " << msg << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+/// @brief Checks whether a symbol is a nonterminal, which are capitalized.
+bool is_nonterminal(const std::string &name)
+{
+    return std::isupper(static_cast<unsigned char>(name.front())) != 0;
+}
+
+/**
+ * @brief Reads the grammar file.
+ *
+ * @param path Path of the grammar file.
+ * @return The grammar.
+ */
+Grammar read_grammar(const std::string &path)
+{
+    std::ifstream input(path);
+    if (!input)
+    {
+        fail(path, 0, "cannot open grammar");
+    }
+    Grammar grammar;
+    std::string text;
+    for (size_t line = 1; std::getline(input, text); line++)
+    {
+        std::istringstream words(text.substr(0, text.find('#')));
+        std::string head;
+        if (!(words >> head))
+        {
+            continue;
+        }
+        if (head == "%left")
+        {
+            int prec = 0;
+            if (!(words >> prec))
+            {
+                fail(path, line, "expected a precedence after %left");
+            }
+            for (std::string token; words >> token;)
+            {
+                grammar.operators.push_back({.token = token, .prec = prec});
+            }
+            continue;
+        }
+
+        std::string arrow;
+        if (!(words >> arrow) || arrow != "->")
+        {
+            fail(path, line, "expected `->` after `" + head + "`");
+        }
+        Alternative alternative{.line = line};
+        const size_t dot = head.find('.');
+        const std::string name = head.substr(0, dot);
+        if (dot != std::string::npos)
+        {
+            alternative.rule = head.substr(dot + 1);
+        }
+        if (!is_nonterminal(name))
+        {
+            fail(path, line, "nonterminal `" + name + "` must be capitalized");
+        }
+        for (std::string word; words >> word;)
+        {
+            const bool nullable = word.back() == '*' || word.back() == '?';
+            alternative.symbols.push_back({.name = nullable ? word.substr(0, word.size() - 1) : word,
+                                           .repeat = nullable ? word.back() : '\0',
+                                           .nullable = nullable});
+        }
+        if (!grammar.nonterminals.contains(name))
+        {
+            grammar.order.push_back(name);
+        }
+        grammar.nonterminals[name].push_back(alternative);
+    }
+
+    for (const auto &[name, alternatives] : grammar.nonterminals)
+    {
+        for (const Alternative &alternative : alternatives)
+        {
+            for (const Symbol &symbol : alternative.symbols)
+            {
+                if (is_nonterminal(symbol.name) && !grammar.nonterminals.contains(symbol.name))
+                {
+                    fail(path, alternative.line, "undefined nonterminal `" + symbol.name + "`");
+                }
+            }
+        }
+    }
+    return grammar;
+}
+
+/// @brief FIRST sets and nullability of the nonterminals.
+struct FirstSets
+{
+    std::map<std::string, std::set<std::string>> first{}; // Tokens every nonterminal can start with.
+    std::set<std::string> nullable{};                     // Nonterminals that can match nothing.
+
+    /**
+     * @brief Computes the FIRST set of a sequence of symbols.
+     *
+     * @param symbols The sequence.
+     * @return The tokens the sequence can start with.
+     */
+    std::set<std::string> of(const std::vector<Symbol> &symbols) const
+    {
+        std::set<std::string> tokens;
+        for (const Symbol &symbol : symbols)
+        {
+            if (!is_nonterminal(symbol.name))
+            {
+                tokens.insert(symbol.name);
+                if (!symbol.nullable)
+                {
+                    return tokens;
+                }
+                continue;
+            }
+            const std::set<std::string> &sub = first.at(symbol.name);
+            tokens.insert(sub.begin(), sub.end());
+            if (!symbol.nullable && !nullable.contains(symbol.name))
+            {
+                return tokens;
+            }
+        }
+        return tokens;
+    }
+
+    /// @brief Checks whether a sequence of symbols can match nothing.
+    bool is_nullable(const std::vector<Symbol> &symbols) const
+    {
+        for (const Symbol &symbol : symbols)
+        {
+            if (!symbol.nullable && (!is_nonterminal(symbol.name) || !nullable.contains(symbol.name)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief Computes the FIRST sets of every nonterminal, iterating until nothing changes.
+ *
+ * @param grammar The grammar.
+ * @return The FIRST sets.
+ */
+FirstSets compute_first_sets(const Grammar &grammar)
+{
+    FirstSets sets;
+    for (const std::string &name : grammar.order)
+    {
+        sets.first[name] = {};
+    }
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (const auto &[name, alternatives] : grammar.nonterminals)
+        {
+            for (const Alternative &alternative : alternatives)
+            {
+                for (const std::string &token : sets.of(alternative.symbols))
+                {
+                    changed |= sets.first[name].insert(token).second;
+                }
+                if (sets.is_nullable(alternative.symbols))
+                {
+                    changed |= sets.nullable.insert(name).second;
+                }
+            }
+        }
+    }
+    return sets;
+}
+
+/// @brief Converts a nonterminal name to the snake case used for table names.
+std::string snake_case(const std::string &name)
+{
+    std::string result;
+    for (const char c : name)
+    {
+        if (std::isupper(static_cast<unsigned char>(c)) && !result.empty())
+        {
+            result.push_back('_');
+        }
+        result.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+    }
+    return result;
+}
+
+/**
+ * @brief Writes the dispatch table of a nonterminal whose alternatives are named.
+ *
+ * @param out The generated header.
+ * @param path Path of the grammar file, for errors.
+ * @param name The nonterminal.
+ * @param alternatives Its alternatives.
+ * @param sets The FIRST sets.
+ */
+void write_dispatch(std::ostream &out, const std::string &path, const std::string &name,
+                    const std::vector<Alternative> &alternatives, const FirstSets &sets)
+{
+    const std::string type = name + "Rule";
+    out << "/// @brief Alternatives of [" << name << "].\n";
+    out << "enum class " << type << " : uint8_t\n{\n    none,\n";
+    for (const Alternative &alternative : alternatives)
+    {
+        if (!alternative.rule.has_value())
+        {
+            fail(path, alternative.line, "every alternative of `" + name + "` needs a rule name");
+        }
+        out << "    " << alternative.rule.value() << ",\n";
+    }
+    out << "};\n\n";
+
+    // Every token may start at most one alternative, the grammar is LL(1) where the parser dispatches.
+    std::map<std::string, const Alternative *> owners;
+    out << "/// @brief Alternative of [" << name << "] to parse for every first token.\n";
+    out << "constexpr std::array<" << type << ", token_type_count> " << snake_case(name) << "_rules = []\n{\n";
+    out << "    std::array<" << type << ", token_type_count> rules{};\n";
+    for (const Alternative &alternative : alternatives)
+    {
+        if (sets.is_nullable(alternative.symbols))
+        {
+            fail(path, alternative.line, "`" + name + "." + alternative.rule.value() + "` can match nothing");
+        }
+        for (const std::string &token : sets.of(alternative.symbols))
+        {
+            const auto [it, inserted] = owners.emplace(token, &alternative);
+            if (!inserted)
+            {
+                fail(path, alternative.line, "FIRST sets of `" + name + "." + it->second->rule.value() + "` and `" + name + "." +
+                                                 alternative.rule.value() + "` overlap on `" + token + "`");
+            }
+            out << "    rules[static_cast<size_t>(TokenType::" << token << ")] = " << type << "::" << alternative.rule.value() << ";\n";
+        }
+    }
+    out << "    return rules;\n}();\n\n";
+}
+
+/**
+ * @brief Writes the precedence table of the binary operators.
+ *
+ * @param out The generated header.
+ * @param operators The binary operators.
+ */
+void write_precedence(std::ostream &out, const std::vector<Operator> &operators)
+{
+    out << "/// @brief Precedence of every binary operator token, higher binds tighter.\n";
+    out << "constexpr std::array<std::optional<int>, token_type_count> binary_precedence = []\n{\n";
+    out << "    std::array<std::optional<int>, token_type_count> precedence{};\n";
+    for (const Operator &op : operators)
+    {
+        out << "    precedence[static_cast<size_t>(TokenType::" << op.token << ")] = " << op.prec << ";\n";
+    }
+    out << "    return precedence;\n}();\n";
+}
+
+/// @brief Nonterminal the `%left` operators combine, shown in grammer.md as the operands of [BinExpr].
+const std::string binary_operand = "Expr";
+
+/**
+ * @brief Spells a symbol in LaTeX for grammer.md.
+ *
+ * @param symbol The symbol.
+ * @return Nonterminals in brackets, keywords and names as text and punctuation as itself.
+ */
+std::string latex(const Symbol &symbol)
+{
+    static const std::map<std::string, std::string> punctuation = {
+        {"open_paren", "("}, {"close_paren", ")"}, {"open_curly", "\\{"}, {"close_curly", "\\}"},
+        {"open_bracket", "["}, {"close_bracket", "]"}, {"semi", ";"}, {"eq", " = "},
+        {"comma", ", "}, {"plus", " + "}, {"minus", " - "}, {"star", " * "},
+        {"fslash", " / "},
+    };
+    std::string text;
+    if (is_nonterminal(symbol.name))
+    {
+        text = "[\\text{" + symbol.name + "}]";
+    }
+    else if (punctuation.contains(symbol.name))
+    {
+        text = punctuation.at(symbol.name);
+    }
+    else
+    {
+        // Keywords that are also C++ keywords have a trailing `_` in their TokenType name.
+        std::string word = symbol.name.back() == '_' ? symbol.name.substr(0, symbol.name.size() - 1) : symbol.name;
+        text = "\\text{";
+        for (const char c : word)
+        {
+            text += c == '_' ? "\\_" : std::string(1, c);
+        }
+        text += "}";
+    }
+    if (symbol.repeat != '\0')
+    {
+        text += "^";
+        text += symbol.repeat;
+    }
+    return text;
+}
+
+/// @brief Spells a sequence of symbols in LaTeX, with a space between words that would otherwise run together.
+std::string latex(const std::vector<Symbol> &symbols)
+{
+    std::string text;
+    bool word = false;
+    for (const Symbol &symbol : symbols)
+    {
+        const std::string spelled = latex(symbol);
+        const bool is_word = spelled.starts_with("\\text");
+        text += word && is_word ? "\\space" + spelled : spelled;
+        word = is_word && symbol.repeat == '\0';
+    }
+    return text;
+}
+
+/**
+ * @brief Renders the grammar as the LaTeX block of grammer.md.
+ *
+ * @param grammar The grammar.
+ * @return The lines from the opening to the closing `$$`.
+ */
+std::string render_markdown(const Grammar &grammar)
+{
+    // The rows of every production, the binary operators become [BinExpr] next to the operand.
+    std::vector<std::pair<std::string, std::vector<std::string>>> productions;
+    for (const std::string &name : grammar.order)
+    {
+        std::vector<std::string> rows;
+        for (const Alternative &alternative : grammar.nonterminals.at(name))
+        {
+            rows.push_back(latex(alternative.symbols));
+        }
+        if (name == binary_operand && !grammar.operators.empty())
+        {
+            rows.push_back("[\\text{BinExpr}]");
+            productions.emplace_back(name, rows);
+            std::vector<Operator> operators = grammar.operators;
+            std::stable_sort(operators.begin(), operators.end(), [](const Operator &a, const Operator &b)
+                             { return a.prec > b.prec; });
+            rows.clear();
+            for (const Operator &op : operators)
+            {
+                const Symbol operand{.name = binary_operand, .repeat = '\0', .nullable = false};
+                rows.push_back(latex(std::vector<Symbol>{operand, {.name = op.token, .repeat = '\0', .nullable = false}, operand}) +
+                               " & \\text{prec} = " + std::to_string(op.prec));
+            }
+            productions.emplace_back("BinExpr", rows);
+            continue;
+        }
+        productions.emplace_back(name, rows);
+    }
+
+    std::ostringstream out;
+    out << "$$\n\\begin{align}\n";
+    for (size_t i = 0; i < productions.size(); i++)
+    {
+        const auto &[name, rows] = productions[i];
+        const char *const end = i + 1 < productions.size() ? " \\\\\n" : "\n";
+        out << "    [\\text{" << name << "}] &\\to";
+        if (rows.size() == 1)
+        {
+            out << " " << rows.front() << end;
+            continue;
+        }
+        out << "\n    \\begin{cases}\n";
+        for (size_t j = 0; j < rows.size(); j++)
+        {
+            out << "        " << rows[j] << (j + 1 < rows.size() ? " \\\\\n" : "\n");
+        }
+        out << "    \\end{cases}" << end;
+    }
+    out << "\\end{align}\n$$\n";
+    return out.str();
+}
+
+/**
+ * @brief Reads a markdown file, split around its LaTeX block.
+ *
+ * @param path Path of the markdown file.
+ * @return The text before the block, the block from the opening to the closing `$$` line, and the text after it.
+ */
+std::array<std::string, 3> read_markdown(const std::string &path)
+{
+    std::ifstream input(path);
+    if (!input)
+    {
+        fail(path, 0, "cannot open markdown");
+    }
+    std::array<std::string, 3> parts;
+    size_t part = 0;
+    for (std::string text; std::getline(input, text);)
+    {
+        const bool fence = text == "$$" && part < 2;
+        parts[part] += text + "\n";
+        if (fence && part == 0)
+        {
+            parts[1] = parts[0].substr(parts[0].size() - 3);
+            parts[0].resize(parts[0].size() - 3);
+            part = 1;
+        }
+        else if (fence && part == 1)
+        {
+            part = 2;
+        }
+    }
+    if (part != 2)
+    {
+        fail(path, 0, "expected a grammar between two `$$` lines");
+    }
+    return parts;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 4 && std::string(argv[1]) == "--markdown")
+    {
+        // Rewriting the grammar of the markdown file, the text around it is kept.
+        const std::array<std::string, 3> parts = read_markdown(argv[3]);
+        std::ofstream output(argv[3]);
+        output << parts[0] << render_markdown(read_grammar(argv[2])) << parts[2];
+        return output ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (argc != 4)
+    {
+        std::cerr << "Try using : gen_parser_tables <grammar.txt> <output.hpp> <grammer.md>" << std::endl;
+        std::cerr << "       or : gen_parser_tables --markdown <grammar.txt> <grammer.md>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const Grammar grammar = read_grammar(argv[1]);
+
+    // grammer.md is checked rather than written, the build does not touch the source tree.
+    if (read_markdown(argv[3])[1] != render_markdown(grammar))
+    {
+        fail(argv[3], 0, "grammar differs from grammar.txt, regenerate it with `cmake --build <build> --target grammar_markdown`");
+    }
+    const FirstSets sets = compute_first_sets(grammar);
+
+    std::ostringstream out;
+    out << "// Generated from grammar.txt by tools/gen_parser_tables.cpp, do not edit.\n";
+    out << "#pragma once\n#include <array>\n#include <cstdint>\n#include <optional>\n#include \"tokenization.hpp\"\n\n";
+    for (const std::string &name : grammar.order)
+    {
+        const std::vector<Alternative> &alternatives = grammar.nonterminals.at(name);
+        if (alternatives.front().rule.has_value())
+        {
+            write_dispatch(out, argv[1], name, alternatives, sets);
+        }
+    }
+    write_precedence(out, grammar.operators);
+
+    std::ofstream output(argv[2]);
+    output << out.str();
+    return output ? EXIT_SUCCESS : EXIT_FAILURE;
+}